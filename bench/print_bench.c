@@ -0,0 +1,220 @@
+/**
+ * Print Benchmark - cost of emitting plain log messages
+ *
+ * Times apep_detect_caps() with the capability cache warm and with it
+ * invalidated before every call (the old probe-per-print behaviour), then
+ * the full apep_print_message() path to a stream, a message with typed
+ * fields as JSON, the same message suppressed by a rate limiter (plain
+ * and as a format whose arguments are never expanded), the
+ * caller-side cost of the same message through an async sink and of a
+ * deferred binary log record, then a text diagnostic over 16 KB lines
+ * through stdio and through the zero-copy writev path.
+ *
+ * Usage: apep_print_bench [messages] [output_path]
+ *        (defaults: 1000000, /dev/null)
+ *
+ * Run it under `strace -c -f` to count syscalls per message; with a warm
+ * cache only the write(2)s issued by stdio remain.
+ */
+
+#include "../include/apep/apep.h"
+#include "../include/apep/apep_binlog.h"
+#include "../include/apep/apep_fields.h"
+#include "../include/apep/apep_helpers.h"
+#include "../include/apep/apep_limit.h"
+#include "../include/apep/apep_sink.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, size_t n, double secs)
+{
+    printf("  %-28s %10.1f ns/op %12.0f ops/s\n", what, secs * 1e9 / (double)n, (double)n / secs);
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = (argc > 1) ? (size_t)strtoul(argv[1], NULL, 10) : 1000000;
+    const char *path = (argc > 2) ? argv[2] : "/dev/null";
+    if (n == 0)
+        n = 1000000;
+
+    FILE *out = fopen(path, "w");
+    if (!out)
+    {
+        perror(path);
+        return 1;
+    }
+
+    apep_options_t opt;
+    apep_options_default(&opt);
+    opt.out = out;
+
+    printf("apep print benchmark: %lu messages to %s\n", (unsigned long)n, path);
+
+    volatile int sink = 0;
+    double t0 = now_sec();
+    for (size_t i = 0; i < n; i++)
+    {
+        apep_caps_invalidate();
+        sink += apep_detect_caps(out, &opt).width;
+    }
+    report("detect_caps (probe each)", n, now_sec() - t0);
+
+    t0 = now_sec();
+    for (size_t i = 0; i < n; i++)
+        sink += apep_detect_caps(out, &opt).width;
+    report("detect_caps (cached)", n, now_sec() - t0);
+
+    t0 = now_sec();
+    for (size_t i = 0; i < n; i++)
+        apep_print_message(&opt, APEP_LVL_INFO, "BENCH", "request handled in 12 ms");
+    fflush(out);
+    report("print_message", n, now_sec() - t0);
+
+    /* Within a second only the milliseconds of the stamp change */
+    opt.timestamp = APEP_TIMESTAMP_LOCAL;
+    t0 = now_sec();
+    for (size_t i = 0; i < n; i++)
+        apep_print_message(&opt, APEP_LVL_INFO, "BENCH", "request handled in 12 ms");
+    fflush(out);
+    report("print_message (timestamp)", n, now_sec() - t0);
+    opt.timestamp = APEP_TIMESTAMP_NONE;
+
+    /* Typed fields serialized straight into the record */
+    opt.format = APEP_FORMAT_JSON;
+    t0 = now_sec();
+    for (size_t i = 0; i < n; i++)
+    {
+        apep_field_t fields[3] = {
+            apep_field_str("path", "/index.html"),
+            apep_field_uint("status", 200),
+            apep_field_double("ms", 12.5)};
+        apep_print_fields(&opt, APEP_LVL_INFO, "BENCH", "request handled", fields, 3);
+    }
+    fflush(out);
+    report("print_fields (json)", n, now_sec() - t0);
+    opt.format = APEP_FORMAT_PRETTY;
+
+    t0 = now_sec();
+    for (size_t i = 0; i < n; i++)
+        apep_print_json_diagnostic(out, APEP_SEV_ERROR, "E0001", "unexpected token", "src/main.c", 12, 5, 3, NULL, 0);
+    fflush(out);
+    report("json_diagnostic (indented)", n, now_sec() - t0);
+
+    t0 = now_sec();
+    for (size_t i = 0; i < n; i++)
+        apep_print_json_diagnostic_format(out, APEP_FORMAT_JSON, APEP_SEV_ERROR, "E0001", "unexpected token",
+                                          "src/main.c", 12, 5, 3, NULL, 0);
+    fflush(out);
+    report("json_diagnostic (ndjson)", n, now_sec() - t0);
+
+    /* Every repeat after the first is rejected by the limiter's hash probe */
+    apep_limiter_t *limiter = apep_limiter_create(0);
+    if (limiter)
+    {
+        apep_limiter_set_level(limiter, APEP_LVL_INFO, 1, 1);
+        opt.limiter = limiter;
+
+        t0 = now_sec();
+        for (size_t i = 0; i < n; i++)
+            apep_print_message(&opt, APEP_LVL_INFO, "BENCH", "request handled in 12 ms");
+        report("print_message (limited)", n, now_sec() - t0);
+
+        t0 = now_sec();
+        for (size_t i = 0; i < n; i++)
+            apep_print_message_fmt(&opt, APEP_LVL_INFO, "BENCH", "request %s handled in %.1f ms", "/index.html", 12.5);
+        report("print_message_fmt (limited)", n, now_sec() - t0);
+
+        opt.limiter = NULL;
+        apep_limiter_destroy(limiter);
+    }
+
+    /* Caller side only: the writer thread drains to out in the background */
+    apep_sink_t *file_sink = apep_sink_file_create(out, 0);
+    apep_sink_t *async_sink = file_sink ? apep_sink_async_create(file_sink, NULL) : NULL;
+    apep_router_t *router = apep_router_create();
+    if (async_sink && router)
+    {
+        apep_router_add(router, APEP_ROUTE_ALL, async_sink);
+        opt.router = router;
+
+        t0 = now_sec();
+        for (size_t i = 0; i < n; i++)
+            apep_print_message(&opt, APEP_LVL_INFO, "BENCH", "request handled in 12 ms");
+        report("print_message (async)", n, now_sec() - t0);
+
+        apep_sink_flush(async_sink);
+        opt.router = NULL;
+    }
+    apep_router_destroy(router);
+
+    /* Caller side only: records are written unformatted to a temp file */
+    FILE *bin = tmpfile();
+    apep_binlog_config_t bl;
+    apep_binlog_config_default(&bl);
+    bl.ring_size = 16u << 20;
+    bl.flush_interval = 5;
+    bl.file = bin;
+    if (bin && apep_binlog_start(&bl) == 0)
+    {
+        t0 = now_sec();
+        for (size_t i = 0; i < n; i++)
+            APEP_BINLOG(APEP_LVL_INFO, "BENCH", "request %lu handled in %d ms", (unsigned long)i, 12);
+        report("binlog record", n, now_sec() - t0);
+
+        apep_binlog_stop();
+        if (apep_binlog_dropped())
+            printf("  (%llu binlog records dropped)\n", apep_binlog_dropped());
+    }
+    if (bin)
+        fclose(bin);
+    apep_sink_destroy(async_sink);
+    apep_sink_destroy(file_sink);
+
+    /* Five 16 KB lines around the error */
+    size_t line_len = 16 * 1024;
+    char *text = (char *)malloc(5 * (line_len + 1) + 1);
+    if (text)
+    {
+        for (int l = 0; l < 5; l++)
+        {
+            memset(text + l * (line_len + 1), 'a' + l, line_len);
+            text[l * (line_len + 1) + line_len] = '\n';
+        }
+        text[5 * (line_len + 1)] = '\0';
+
+        apep_text_source_t src = apep_text_source_from_string_indexed("long.txt", text);
+        apep_loc_t loc = {3, 100};
+        size_t diags = n / 100 ? n / 100 : 1;
+
+        t0 = now_sec();
+        for (size_t i = 0; i < diags; i++)
+            apep_print_text_diagnostic(&opt, APEP_SEV_ERROR, "E1", "long line", &src, loc, 4, NULL, 0);
+        fflush(out);
+        report("text diag 16K lines (stdio)", diags, now_sec() - t0);
+
+        opt.zero_copy = 1;
+        t0 = now_sec();
+        for (size_t i = 0; i < diags; i++)
+            apep_print_text_diagnostic(&opt, APEP_SEV_ERROR, "E1", "long line", &src, loc, 4, NULL, 0);
+        report("text diag 16K lines (writev)", diags, now_sec() - t0);
+        opt.zero_copy = 0;
+
+        apep_text_source_destroy(&src);
+        free(text);
+    }
+
+    (void)sink;
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,250 @@
+/**
+ * Scan Benchmark - byte-at-a-time walking vs the vectorized scan kernels
+ *
+ * Measures newline counting (what text sources do to reach a line),
+ * quote/backslash/colon search (what the .loc parser does) and JSON string
+ * escaping of multi-KB payloads, for the old per-character loop and every
+ * kernel the CPU supports.
+ *
+ * Usage: apep_scan_bench [size_in_MB]   (default 256)
+ */
+
+#include "../src/apep_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* The pre-kernel approach: walk to line N one character at a time */
+static const char *naive_nth_line(const char *text, size_t line_no)
+{
+    size_t current = 1;
+    const char *p = text;
+    const char *line_start = p;
+    while (*p && current < line_no)
+    {
+        if (*p == '\n')
+        {
+            current++;
+            line_start = p + 1;
+        }
+        p++;
+    }
+    return line_start;
+}
+
+static const char *naive_find_any(const char *p, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (p[i] == '"' || p[i] == '\\' || p[i] == ':')
+            return p + i;
+    }
+    return NULL;
+}
+
+/* The pre-kernel JSON escaper: test every byte, copy the runs between */
+static void naive_json_escape(apep_rbuf_t *out, const char *s, size_t n)
+{
+    const char *run = s;
+    const char *end = s + n;
+    for (const char *p = s; p < end; p++)
+    {
+        unsigned char c = (unsigned char)*p;
+        if (c >= 32 && c != '"' && c != '\\')
+            continue;
+
+        apep_rbuf_append(out, run, (size_t)(p - run));
+        run = p + 1;
+        switch (c)
+        {
+        case '"':
+            apep_rbuf_puts(out, "\\\"");
+            break;
+        case '\\':
+            apep_rbuf_puts(out, "\\\\");
+            break;
+        case '\n':
+            apep_rbuf_puts(out, "\\n");
+            break;
+        default:
+            apep_rbuf_puts(out, "\\u");
+            apep_rbuf_hex(out, c, 4, 0);
+            break;
+        }
+    }
+    apep_rbuf_append(out, run, (size_t)(end - run));
+}
+
+/* SQL-ish payload: printable text with one quote and one newline in about
+   every `every` bytes */
+static void fill_payload(char *p, size_t n, int every)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        int r = rand() % every;
+        p[i] = r == 0 ? '\n' : r == 1 ? '"' : (char)(' ' + 1 + rand() % 94);
+        if (p[i] == '\\')
+            p[i] = 'x';
+    }
+}
+
+/* Escape the payload over and over into a reused buffer */
+static double time_escape(void (*escape)(apep_rbuf_t *, const char *, size_t), apep_rbuf_t *out,
+                          const char *payload, size_t len, size_t reps)
+{
+    double t0 = now_sec();
+    for (size_t r = 0; r < reps; r++)
+    {
+        apep_rbuf_reset(out);
+        escape(out, payload, len);
+    }
+    return now_sec() - t0;
+}
+
+static void report(const char *what, const char *impl, size_t bytes, double secs)
+{
+    printf("  %-22s %-9s %8.2f GB/s\n", what, impl, (double)bytes / secs / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+    size_t mb = (argc > 1) ? (size_t)strtoul(argv[1], NULL, 10) : 256;
+    if (mb == 0)
+        mb = 256;
+    size_t size = mb * 1024 * 1024;
+
+    char *text = (char *)malloc(size + 1);
+    if (!text)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    /* Log-like lines of varying length with no quotes/colons */
+    srand(42);
+    size_t lines = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (rand() % 48 == 0)
+        {
+            text[i] = '\n';
+            lines++;
+        }
+        else
+        {
+            text[i] = (char)('a' + rand() % 26);
+        }
+    }
+    text[size] = '\0';
+
+    /* Put the only ':' at the very end so the search covers everything */
+    text[size - 2] = ':';
+
+    printf("Input: %lu MB, %lu lines\n\n", (unsigned long)mb, (unsigned long)lines);
+
+    double t0 = now_sec();
+    const char *naive = naive_nth_line(text, lines);
+    report("newline walk (line N)", "bytewise", size, now_sec() - t0);
+
+    t0 = now_sec();
+    const char *naive_hit = naive_find_any(text, size);
+    report("quote/colon search", "bytewise", size, now_sec() - t0);
+
+    static const apep_scan_isa_t isas[] = {APEP_SCAN_ISA_PORTABLE, APEP_SCAN_ISA_SSE2, APEP_SCAN_ISA_AVX2};
+    const char *last_name = "";
+    for (size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); i++)
+    {
+        const char *name = apep_scan_select(isas[i]);
+        if (strcmp(name, last_name) == 0)
+            continue; /* CPU lacks this ISA */
+        last_name = name;
+
+        t0 = now_sec();
+        const char *nl = apep_scan_nth(text, size, '\n', lines - 1, NULL);
+        report("newline walk (line N)", name, size, now_sec() - t0);
+        if (!nl || nl + 1 != naive)
+            printf("  !! %s newline result mismatch\n", name);
+
+        t0 = now_sec();
+        const char *hit = apep_scan_any(text, size, "\"\\:");
+        report("quote/colon search", name, size, now_sec() - t0);
+        if (hit != naive_hit)
+            printf("  !! %s search result mismatch\n", name);
+    }
+    apep_scan_select(APEP_SCAN_ISA_BEST);
+
+    /* JSON escaping of 4 KB payloads (stack dumps, SQL) */
+    enum
+    {
+        PAYLOAD = 4096
+    };
+    static const struct
+    {
+        const char *what;
+        int every;
+    } densities[] = {{"json escape (2% esc)", 100}, {"json escape (0.2% esc)", 1000}};
+
+    static char payload[PAYLOAD];
+    size_t reps = size / PAYLOAD;
+    apep_rbuf_t escaped;
+    apep_rbuf_t expected;
+    apep_rbuf_init(&escaped, NULL, 0);
+    apep_rbuf_init(&expected, NULL, 0);
+
+    for (size_t d = 0; d < sizeof(densities) / sizeof(densities[0]); d++)
+    {
+        fill_payload(payload, PAYLOAD, densities[d].every);
+        apep_rbuf_reset(&expected);
+        naive_json_escape(&expected, payload, PAYLOAD);
+
+        printf("\n");
+        report(densities[d].what, "bytewise", reps * PAYLOAD,
+               time_escape(naive_json_escape, &escaped, payload, PAYLOAD, reps));
+
+        last_name = "";
+        for (size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); i++)
+        {
+            const char *name = apep_scan_select(isas[i]);
+            if (strcmp(name, last_name) == 0)
+                continue;
+            last_name = name;
+
+            report(densities[d].what, name, reps * PAYLOAD,
+                   time_escape(apep_json_escape, &escaped, payload, PAYLOAD, reps));
+            if (apep_rbuf_size(&escaped) != apep_rbuf_size(&expected) ||
+                memcmp(apep_rbuf_cstr(&escaped), apep_rbuf_cstr(&expected), apep_rbuf_size(&expected)) != 0)
+                printf("  !! %s escape result mismatch\n", name);
+        }
+        apep_scan_select(APEP_SCAN_ISA_BEST);
+    }
+    apep_rbuf_free(&escaped);
+    apep_rbuf_free(&expected);
+    printf("\n");
+
+    /* End to end through the public API */
+    t0 = now_sec();
+    apep_text_source_t src = apep_text_source_from_string_indexed("bench", text);
+    int count = apep_text_source_line_count(&src);
+    report("full line index", "best", size, now_sec() - t0);
+    apep_text_source_destroy(&src);
+
+    src = apep_text_source_from_string_indexed("bench", text);
+    apep_text_source_set_index_stride(&src, 1024);
+    t0 = now_sec();
+    apep_text_source_line_count(&src);
+    report("sparse index (K=1024)", "best", size, now_sec() - t0);
+    apep_text_source_destroy(&src);
+
+    printf("\n(%d lines indexed)\n", count);
+    free(text);
+    return 0;
+}
@@ -2,6 +2,8 @@
  * Logger Wrapper Example - How to use APEP as a universal logger backend
  *
  * This demonstrates building a Serilog-like logging system on top of APEP.
+ * For named loggers with inherited levels out of the box, see
+ * apep/apep_logger.h.
  */
 
 #include <apep/apep_helpers.h>
@@ -1,6 +1,7 @@
 #ifndef APEP_H
 #define APEP_H
 
+#include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -64,12 +65,33 @@ extern "C"
         APEP_STYLE_FULL = 1
     } apep_style_t;
 
+    /* How message records (apep_print_message() and friends, fields from
+    apep/apep_fields.h) are serialized. Diagnostics render as text. */
+    typedef enum apep_output_format
+    {
+        APEP_FORMAT_PRETTY = 0, /* Information[tag]: message key=value */
+        APEP_FORMAT_JSON = 1,   /* {"level":"info","tag":"tag","msg":"message","key":value} */
+        APEP_FORMAT_LOGFMT = 2  /* level=info tag=tag msg="message" key=value */
+    } apep_output_format_t;
+
+    /* Timestamp written at the start of message records. Wall-clock
+    modes read the coarse real-time clock (millisecond digits move in
+    scheduler ticks, 1-4 ms on Linux). */
+    typedef enum apep_timestamp_mode
+    {
+        APEP_TIMESTAMP_NONE = 0,
+        APEP_TIMESTAMP_UTC = 1,      /* 2026-01-19T09:15:00.123Z */
+        APEP_TIMESTAMP_LOCAL = 2,    /* 2026-01-19T10:15:00.123+01:00 */
+        APEP_TIMESTAMP_MONOTONIC = 3 /* 12.345: seconds since the first timestamp */
+    } apep_timestamp_mode_t;
+
     typedef struct apep_caps
     {
-        int is_tty;  /* 1 if output is a terminal */
-        int color;   /* 1 if colors enabled */
-        int unicode; /* 1 if unicode line art allowed */
-        int width;   /* terminal width, fallback 80 */
+        int is_tty;      /* 1 if output is a terminal */
+        int color;       /* 1 if colors enabled */
+        int unicode;     /* 1 if unicode line art allowed */
+        int width;       /* terminal width, fallback 80 */
+        int color_depth; /* 4 (16 colors), 8 (256) or 24 (truecolor) bits */
     } apep_caps_t;
 
     typedef struct apep_options
@@ -86,14 +108,56 @@ extern "C"
         /* Hard overrides (useful for demos / CLI flags). */
         int force_no_color; /* if 1, disable color regardless of TTY/CI/NO_COLOR */
         int force_ascii;    /* if 1, force ASCII-only (no unicode arrows etc.) */
+
+        /* If 1, diagnostics bypass stdio: out is flushed and the rendered
+        output goes to its fd with one writev(2). Source lines from the
+        built-in text sources are referenced in place, never copied. */
+        int zero_copy;
+
+        /* If set, output goes to the sinks routed for each record's level
+        or severity instead of out (see apep/apep_sink.h). */
+        const struct apep_router *router;
+
+        /* If set, apep_print_message() and apep_print_message_fmt() drop
+        repeats over the limiter's rates (see apep/apep_limit.h). */
+        struct apep_limiter *limiter;
+
+        /* Message record format (default pretty). Sinks routed with
+        apep_router_add_format() use their own. */
+        apep_output_format_t format;
+
+        /* Message record timestamp (default none). */
+        apep_timestamp_mode_t timestamp;
     } apep_options_t;
 
     /* Fill defaults (safe, portable) */
     void apep_options_default(apep_options_t *opt);
 
-    /* Detect capabilities for current output stream. */
+    /* The current time as message records show it for mode, NUL-terminated
+    ("" for none; 32 bytes always suffice). Returns its length. */
+    size_t apep_format_timestamp(char *buf, size_t size, apep_timestamp_mode_t mode);
+
+    /* Detect capabilities for current output stream.
+    Terminal facts (TTY state, width) are cached per file descriptor (any
+    below 65536) and the environment is read once, so after the first call
+    detection costs no syscalls. Cached facts change only through the calls
+    below. */
     apep_caps_t apep_detect_caps(FILE *out, const apep_options_t *opt);
 
+    /* Forget cached TTY state and width for every stream (call after
+    redirecting or reopening one). Async-signal-safe, so it may be called
+    from the application's own SIGWINCH handler. */
+    void apep_caps_invalidate(void);
+
+    /* Re-read NO_COLOR, CI, TERM, COLORTERM, APEP_ASCII and the locale
+    variables on the next detection. */
+    void apep_caps_refresh_env(void);
+
+    /* Install a SIGWINCH handler (chaining any previous one) that calls
+    apep_caps_invalidate() when the terminal is resized.
+    Returns 0 on success, -1 where unsupported (e.g. Windows). */
+    int apep_caps_watch_resize(void);
+
     /* ----------------------------
     Diagnostics model
     ---------------------------- */
@@ -154,6 +218,161 @@ extern "C"
     /* Helper: create text source from a single in-memory UTF-8 string. */
     apep_text_source_t apep_text_source_from_string(const char *name, const char *text);
 
+    /* Helper: create an indexed text source over an in-memory UTF-8 string.
+    Line start offsets are recorded lazily on first use and kept for the
+    lifetime of the source, so every diagnostic sharing it gets O(1) line
+    lookups. The text is not copied and must outlive the source.
+    Not thread-safe: share between threads only under external locking.
+    Release with apep_text_source_destroy(). */
+    apep_text_source_t apep_text_source_from_string_indexed(const char *name, const char *text);
+
+    /* Helper: create an indexed text source backed by a read-only memory
+    mapping of a file. Lines are returned as pointers straight into the
+    mapping (zero copy) and indexed lazily, so only the pages scanned up to
+    the requested lines are ever touched. The name is set to a copy of path.
+    Returns 0 on success, -1 on error (errno is set). Release with
+    apep_text_source_destroy(), which unmaps the file. */
+    int apep_text_source_from_file(apep_text_source_t *src, const char *path);
+
+    /* Release resources held by an indexed source (no-op for plain sources). */
+    void apep_text_source_destroy(apep_text_source_t *src);
+
+    /* Byte offset of the first character of a line (indexed sources only).
+    Returns 1 on success, 0 if the line does not exist. */
+    int apep_text_source_line_offset(const apep_text_source_t *src, int line_no_1based, size_t *offset);
+
+    /* Map a byte offset to a 1-based line/column (column counted in bytes).
+    Returns 1 on success, 0 if the offset is past the end of the source or
+    the line or column exceeds INT_MAX. */
+    int apep_text_source_offset_to_loc(const apep_text_source_t *src, size_t offset, apep_loc_t *loc);
+
+    /* Total number of lines (indexes the whole source), saturated at
+    INT_MAX, or -1 if not indexed. */
+    int apep_text_source_line_count(const apep_text_source_t *src);
+
+    /* Select the indexing mode of an indexed source.
+    stride 1 (default) records every line start (8 bytes per line).
+    stride K > 1 records only every Kth line as a checkpoint, so memory is
+    bounded to 1/K of the full index and a lookup rescans at most K-1 lines
+    from the nearest checkpoint. Changing the stride discards the current
+    index. Returns 0 on success, -1 if src is not indexed or stride <= 0. */
+    int apep_text_source_set_index_stride(apep_text_source_t *src, int stride);
+
+    /* ----------------------------
+    Shared source cache
+    ---------------------------- */
+
+    /* Registry of indexed sources keyed by path (files) or content id
+    (strings). Every diagnostic that opens the same key shares one mapping
+    and one line index, so after the first lookup no rescanning happens.
+    Least recently used entries are evicted on open once the resident
+    bytes (source bytes plus index) exceed byte_budget (0 = unlimited).
+    Sources handed out stay valid after eviction until destroyed.
+    Not thread-safe. */
+    typedef struct apep_source_cache apep_source_cache_t;
+
+    apep_source_cache_t *apep_source_cache_create(size_t byte_budget);
+    void apep_source_cache_destroy(apep_source_cache_t *cache);
+
+    /* Drop every cached entry (handed-out sources stay valid). */
+    void apep_source_cache_clear(apep_source_cache_t *cache);
+
+    /* Open (or reuse) a memory-mapped file source keyed by path.
+    Returns 0 on success, -1 on error (errno is set).
+    Release with apep_text_source_destroy(). */
+    int apep_source_cache_open_file(apep_source_cache_t *cache, const char *path, apep_text_source_t *src);
+
+    /* Open (or reuse) an indexed string source keyed by key, which is also
+    used as the source name. text is not copied and must stay valid while
+    cached. Returns 0 on success, -1 on error. */
+    int apep_source_cache_open_string(apep_source_cache_t *cache, const char *key, const char *text, apep_text_source_t *src);
+
+    /* Forget one entry, e.g. after the file changed on disk. */
+    void apep_source_cache_invalidate(apep_source_cache_t *cache, const char *key);
+
+    /* Number of cached entries and their resident bytes. */
+    void apep_source_cache_stats(const apep_source_cache_t *cache, size_t *entries, size_t *bytes);
+
+    /* ----------------------------
+    Render buffer
+    ---------------------------- */
+
+    /* Growable byte builder used by every printer to compose a whole
+    diagnostic in memory before a single write. It can start on caller
+    storage (e.g. a stack array) and moves to the heap only when that is
+    outgrown. Allocation failure is sticky: further appends are dropped
+    and failed is set, so output is truncated rather than corrupted.
+    The contents are not NUL-terminated; use apep_rbuf_cstr() for that.
+    With ref_mode set, apep_rbuf_ref() records external fragments instead
+    of copying them; they are stitched in at write time (one writev on an
+    fd), so the referenced memory must stay valid until then. */
+    typedef struct apep_rbuf
+    {
+        char *data;
+        size_t len; /* owned bytes, excluding referenced fragments */
+        size_t cap;
+        int heap;   /* data is owned by the buffer */
+        int failed; /* an allocation failed */
+
+        int ref_mode;               /* if 1, apep_rbuf_ref() does not copy */
+        struct apep_rbuf_ref *refs; /* referenced fragments, in order */
+        size_t ref_count;
+        size_t ref_cap;
+        size_t ref_bytes; /* total length of referenced fragments */
+    } apep_rbuf_t;
+
+    /* storage may be NULL (heap only). Release with apep_rbuf_free(). */
+    void apep_rbuf_init(apep_rbuf_t *rb, char *storage, size_t storage_size);
+    void apep_rbuf_free(apep_rbuf_t *rb);
+
+    /* Empty the buffer (keeps its memory) and clear the failure flag. */
+    void apep_rbuf_reset(apep_rbuf_t *rb);
+
+    /* Make room for extra more bytes. Returns 0 on success, -1 on failure. */
+    int apep_rbuf_reserve(apep_rbuf_t *rb, size_t extra);
+
+    void apep_rbuf_append(apep_rbuf_t *rb, const char *s, size_t n);
+    void apep_rbuf_puts(apep_rbuf_t *rb, const char *s);
+    void apep_rbuf_putc(apep_rbuf_t *rb, char c);
+    void apep_rbuf_repeat(apep_rbuf_t *rb, char c, size_t n);
+
+    /* Append n bytes at s by reference when rb->ref_mode is set and the
+    fragment is long enough to be worth it; otherwise copy. */
+    void apep_rbuf_ref(apep_rbuf_t *rb, const char *s, size_t n);
+
+    /* Total output size, owned bytes plus referenced fragments. */
+    size_t apep_rbuf_size(const apep_rbuf_t *rb);
+
+    /* Append s padded with spaces to |width| columns (bytes): width > 0
+    right-aligns, width < 0 left-aligns, like printf's %*s. */
+    void apep_rbuf_pad(apep_rbuf_t *rb, const char *s, size_t n, int width);
+
+    /* Decimal integers, space padded like apep_rbuf_pad(). */
+    void apep_rbuf_int(apep_rbuf_t *rb, long long v, int width);
+    void apep_rbuf_uint(apep_rbuf_t *rb, unsigned long long v, int width);
+
+    /* Hexadecimal, zero padded to at least min_digits (no 0x prefix). */
+    void apep_rbuf_hex(apep_rbuf_t *rb, unsigned long long v, int min_digits, int upper);
+
+    /* printf-style append. Returns bytes appended, or -1 on error. */
+    int apep_rbuf_printf(apep_rbuf_t *rb, const char *fmt, ...);
+    int apep_rbuf_vprintf(apep_rbuf_t *rb, const char *fmt, va_list args);
+
+    /* NUL-terminated view of the contents (valid until the next append).
+    Referenced fragments are copied in first. */
+    const char *apep_rbuf_cstr(apep_rbuf_t *rb);
+
+    /* The output in order: apep_rbuf_pieces() pieces, owned bytes and
+    referenced fragments alternating. *p receives piece i, its length is
+    returned (possibly 0). */
+    size_t apep_rbuf_pieces(const apep_rbuf_t *rb);
+    size_t apep_rbuf_piece(const apep_rbuf_t *rb, size_t i, const char **p);
+
+    /* Emit the contents with a single write (writev(2) when the buffer
+    holds references). Returns 0 on success, -1 on error. */
+    int apep_rbuf_write(const apep_rbuf_t *rb, FILE *out);
+    int apep_rbuf_write_fd(const apep_rbuf_t *rb, int fd);
+
     /* ----------------------------
     Pretty printers
     ---------------------------- */
@@ -188,6 +407,41 @@ extern "C"
         const apep_note_t *notes,
         size_t notes_count);
 
+    /* Render variants: append exactly what the matching print function
+    would write to opt->out (colors and line art follow that stream's
+    capabilities) to rb instead of writing it. */
+    void apep_render_message(
+        apep_rbuf_t *rb,
+        const apep_options_t *opt,
+        apep_level_t lvl,
+        const char *tag,
+        const char *message);
+
+    void apep_render_text_diagnostic(
+        apep_rbuf_t *rb,
+        const apep_options_t *opt,
+        apep_severity_t sev,
+        const char *code,
+        const char *message,
+        const apep_text_source_t *src,
+        apep_loc_t loc,
+        int span_len_cols,
+        const apep_note_t *notes,
+        size_t notes_count);
+
+    void apep_render_hex_diagnostic(
+        apep_rbuf_t *rb,
+        const apep_options_t *opt,
+        apep_severity_t sev,
+        const char *code,
+        const char *message,
+        const char *blob_name,
+        const uint8_t *data,
+        size_t data_size,
+        apep_span_t span,
+        const apep_note_t *notes,
+        size_t notes_count);
+
     /* ----------------------------
     Utility (public, minimal)
     ---------------------------- */
@@ -201,6 +455,13 @@ extern "C"
     /* Exception handling is in separate header */
     /* Include apep/apep_exception.h for exception support */
 
+    /* Output sinks and per-level routing: include apep/apep_sink.h */
+    /* Rate limiting and duplicate suppression: include apep/apep_limit.h */
+    /* Named hierarchical loggers: include apep/apep_logger.h */
+    /* Deferred binary logging: include apep/apep_binlog.h */
+    /* Structured key-value fields: include apep/apep_fields.h */
+    /* Streaming JSON writer: include apep/apep_json.h */
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,112 @@
+/**
+ * @file apep_binlog.h
+ * @brief Deferred binary logging: record raw arguments, format later
+ *
+ * For the hottest trace points even printf-style formatting is too slow.
+ * APEP_BINLOG() registers its call site (format string, level, tag) once;
+ * after that a call only copies a site id, a timestamp and the raw
+ * argument bytes into a ring buffer owned by the calling thread. A
+ * background thread drains every thread's ring, either formatting the
+ * records and printing them like apep_print_message_fmt(), or writing
+ * them unformatted to a binary file that tools/apep_decode (or
+ * apep_binlog_replay()) turns into text later.
+ *
+ *     apep_binlog_config_t cfg;
+ *     apep_binlog_config_default(&cfg);
+ *     cfg.file = fopen("trace.bin", "wb");   // or leave NULL to print live
+ *     apep_binlog_start(&cfg);
+ *     APEP_BINLOG(APEP_LVL_TRACE, "NET", "rx %zu bytes from %s", n, peer);
+ *     apep_binlog_stop();
+ *
+ * The format must be a string literal. %s arguments are copied (the
+ * pointer need not outlive the call); %n and wide characters/strings are
+ * not supported, and such sites are formatted immediately instead. When a
+ * thread's ring is full the record is dropped and counted rather than
+ * blocking. Binary files use the writer's byte order and type sizes.
+ */
+
+#ifndef APEP_BINLOG_H
+#define APEP_BINLOG_H
+
+#include "apep.h"
+#include "apep_helpers.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* One per call site, defined by APEP_BINLOG(). */
+    typedef struct apep_binlog_site
+    {
+        apep_level_t level;
+        const char *tag;
+        const char *file;
+        int line;
+        const char *fmt;
+        volatile unsigned id;       /* assigned on first use, 0 before */
+        const unsigned char *kinds; /* argument kinds parsed from fmt */
+    } apep_binlog_site_t;
+
+    typedef struct apep_binlog_config
+    {
+        size_t ring_size;        /* bytes per thread, rounded up to a power of two (default 64 KB) */
+        unsigned flush_interval; /* ms between background drains (default 50) */
+
+        /* If file is set, records are written to it in binary form;
+        otherwise they are formatted and printed with opt (NULL = the
+        global options). Neither is owned. */
+        FILE *file;
+        const apep_options_t *opt;
+    } apep_binlog_config_t;
+
+    void apep_binlog_config_default(apep_binlog_config_t *cfg);
+
+    /* Start the background thread. cfg may be NULL (defaults). Before
+    start and after stop, APEP_BINLOG() formats and prints immediately.
+    Returns 0, or -1 if already running or on failure. */
+    int apep_binlog_start(const apep_binlog_config_t *cfg);
+
+    /* Drain every ring now, on the calling thread. */
+    void apep_binlog_flush(void);
+
+    /* Drain and stop the background thread. */
+    void apep_binlog_stop(void);
+
+    /* Records dropped because a ring was full, plus records a thread
+    finished writing only after apep_binlog_stop() had drained. */
+    unsigned long long apep_binlog_dropped(void);
+
+    /* Record one call; use APEP_BINLOG() rather than calling this. */
+    void apep_binlog_write(apep_binlog_site_t *site, const char *fmt, ...)
+#if defined(__GNUC__) || defined(__clang__)
+        __attribute__((format(printf, 2, 3)))
+#endif
+        ;
+
+/* Replay flags */
+#define APEP_BINLOG_REPLAY_TIME 1u /* prefix each message with seconds since start */
+
+    /* Format every record of a binary log read from in and print it with
+    opt (NULL = the global options). Returns the number of messages, or
+    -1 if in is not a binary log from a compatible writer. */
+    long apep_binlog_replay(FILE *in, const apep_options_t *opt, unsigned flags);
+
+#define APEP_BINLOG_FIRST_(...) APEP_BINLOG_FIRST2_(__VA_ARGS__, 0)
+#define APEP_BINLOG_FIRST2_(first, ...) first
+
+/* APEP_BINLOG(level, tag, format, args...) - level filtered like APEP_LOG() */
+#define APEP_BINLOG(lvl, tag, ...)                                                    \
+    do                                                                                \
+    {                                                                                 \
+        static apep_binlog_site_t apep_binlog_site_ = {                               \
+            (lvl), (tag), __FILE__, __LINE__, APEP_BINLOG_FIRST_(__VA_ARGS__), 0, 0}; \
+        if (APEP_LOG_ENABLED(lvl))                                                    \
+            apep_binlog_write(&apep_binlog_site_, __VA_ARGS__);                       \
+    } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEP_BINLOG_H */
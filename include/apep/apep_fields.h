@@ -0,0 +1,173 @@
+/**
+ * @file apep_fields.h
+ * @brief Structured log messages with typed key-value fields
+ *
+ * apep_print_fields() takes a message plus typed fields and serializes
+ * them straight into the record in each destination's format
+ * (apep_output_format_t): appended as key=value to the pretty line, as
+ * logfmt pairs, or as members of one compact JSON object. Values are never
+ * formatted into an intermediate string, so the same call gives readable
+ * terminal output and machine-parseable sink output.
+ *
+ *     APEP_LOG_FIELDS(APEP_LVL_INFO, "HTTP", "request handled",
+ *                     apep_field_str("path", path),
+ *                     apep_field_uint("status", 200),
+ *                     apep_field_double("ms", 12.5));
+ *
+ *     pretty: Information[HTTP]: request handled path=/index status=200 ms=12.5
+ *     logfmt: level=info tag=HTTP msg="request handled" path=/index status=200 ms=12.5
+ *     json:   {"level":"info","tag":"HTTP","msg":"request handled","path":"/index","status":200,"ms":12.5}
+ */
+
+#ifndef APEP_FIELDS_H
+#define APEP_FIELDS_H
+
+#include "apep.h"
+#include "apep_helpers.h"
+
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef enum apep_field_type
+    {
+        APEP_FIELD_INT = 0,
+        APEP_FIELD_UINT,
+        APEP_FIELD_DOUBLE,
+        APEP_FIELD_STR, /* len bytes, need not be NUL-terminated; NULL is null */
+        APEP_FIELD_BOOL,
+        APEP_FIELD_HEX /* len bytes, written as lowercase hex digits */
+    } apep_field_type_t;
+
+    typedef struct apep_field
+    {
+        const char *key;
+        apep_field_type_t type;
+        size_t len; /* STR and HEX */
+        union
+        {
+            long long i;
+            unsigned long long u;
+            double d;
+            const char *s;
+            const void *bytes;
+            int b;
+        } v;
+    } apep_field_t;
+
+    /* Print message with fields at lvl. Level filtering and the limiter
+    (keyed on message) apply as for apep_print_message(). Neither the
+    fields nor the data they point to are retained. */
+    void apep_print_fields(
+        const apep_options_t *opt,
+        apep_level_t lvl,
+        const char *tag,
+        const char *message,
+        const apep_field_t *fields,
+        size_t count);
+
+    /* Append message and fields as one record in format to out, with the
+    capabilities of opt->out (for tests and custom sinks). */
+    void apep_render_fields(
+        apep_rbuf_t *out,
+        const apep_options_t *opt,
+        apep_output_format_t format,
+        apep_level_t lvl,
+        const char *tag,
+        const char *message,
+        const apep_field_t *fields,
+        size_t count);
+
+#if defined(_MSC_VER) && !defined(__cplusplus)
+#define APEP_FIELD_INLINE static __inline
+#else
+#define APEP_FIELD_INLINE static inline
+#endif
+
+    /* Field constructors. Keys and string data are referenced, not copied. */
+    APEP_FIELD_INLINE apep_field_t apep_field_int(const char *key, long long v)
+    {
+        apep_field_t f;
+        f.key = key;
+        f.type = APEP_FIELD_INT;
+        f.len = 0;
+        f.v.i = v;
+        return f;
+    }
+
+    APEP_FIELD_INLINE apep_field_t apep_field_uint(const char *key, unsigned long long v)
+    {
+        apep_field_t f;
+        f.key = key;
+        f.type = APEP_FIELD_UINT;
+        f.len = 0;
+        f.v.u = v;
+        return f;
+    }
+
+    APEP_FIELD_INLINE apep_field_t apep_field_double(const char *key, double v)
+    {
+        apep_field_t f;
+        f.key = key;
+        f.type = APEP_FIELD_DOUBLE;
+        f.len = 0;
+        f.v.d = v;
+        return f;
+    }
+
+    APEP_FIELD_INLINE apep_field_t apep_field_strn(const char *key, const char *s, size_t len)
+    {
+        apep_field_t f;
+        f.key = key;
+        f.type = APEP_FIELD_STR;
+        f.len = s ? len : 0;
+        f.v.s = s;
+        return f;
+    }
+
+    APEP_FIELD_INLINE apep_field_t apep_field_str(const char *key, const char *s)
+    {
+        return apep_field_strn(key, s, s ? strlen(s) : 0);
+    }
+
+    APEP_FIELD_INLINE apep_field_t apep_field_bool(const char *key, int v)
+    {
+        apep_field_t f;
+        f.key = key;
+        f.type = APEP_FIELD_BOOL;
+        f.len = 0;
+        f.v.b = v != 0;
+        return f;
+    }
+
+    APEP_FIELD_INLINE apep_field_t apep_field_hex(const char *key, const void *bytes, size_t len)
+    {
+        apep_field_t f;
+        f.key = key;
+        f.type = APEP_FIELD_HEX;
+        f.len = bytes ? len : 0;
+        f.v.bytes = bytes;
+        return f;
+    }
+
+/* APEP_LOG_FIELDS(level, tag, message, fields...) - level filtered like
+   APEP_LOG(); the fields are not evaluated when the level is disabled. */
+#define APEP_LOG_FIELDS(lvl, tag, msg, ...)                                                        \
+    do                                                                                             \
+    {                                                                                              \
+        if (APEP_LOG_ENABLED(lvl))                                                                 \
+        {                                                                                          \
+            const apep_field_t apep_fields_[] = {__VA_ARGS__};                                     \
+            apep_print_fields(NULL, (lvl), (tag), (msg), apep_fields_,                             \
+                              sizeof(apep_fields_) / sizeof(apep_fields_[0]));                     \
+        }                                                                                          \
+    } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEP_FIELDS_H */
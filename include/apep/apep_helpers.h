@@ -12,24 +12,38 @@ extern "C"
     Convenience macros for quick usage
     ---------------------------- */
 
-/* Quick logging macros - use global defaults */
-#define APEP_LOG_TRACE(tag, msg) \
-    apep_print_message(NULL, APEP_LVL_TRACE, tag, msg)
+/* Levels below APEP_MIN_LOG_LEVEL are compiled out of the macros below:
+   build with e.g. -DAPEP_MIN_LOG_LEVEL=APEP_LVL_INFO (or the number, TRACE
+   is 0) and trace/debug call sites fold to nothing, arguments included. */
+#ifndef APEP_MIN_LOG_LEVEL
+#define APEP_MIN_LOG_LEVEL APEP_LVL_TRACE
+#endif
 
-#define APEP_LOG_DEBUG(tag, msg) \
-    apep_print_message(NULL, APEP_LVL_DEBUG, tag, msg)
+/* Runtime threshold, checked before any argument is evaluated. Levels that
+   pass the compile-time filter cost one load and one branch when below it. */
+#if defined(__GNUC__) || defined(__clang__)
+#define APEP_MIN_LEVEL_NOW() __atomic_load_n(&apep_min_level_current, __ATOMIC_RELAXED)
+#else
+#define APEP_MIN_LEVEL_NOW() apep_min_level_current
+#endif
 
-#define APEP_LOG_INFO(tag, msg) \
-    apep_print_message(NULL, APEP_LVL_INFO, tag, msg)
+#define APEP_LOG_ENABLED(lvl) \
+    ((int)(lvl) >= (int)(APEP_MIN_LOG_LEVEL) && (int)(lvl) >= APEP_MIN_LEVEL_NOW())
 
-#define APEP_LOG_WARN(tag, msg) \
-    apep_print_message(NULL, APEP_LVL_WARN, tag, msg)
+/* Quick logging macros - use global defaults */
+#define APEP_LOG(lvl, tag, msg) \
+    (APEP_LOG_ENABLED(lvl) ? apep_print_message(NULL, lvl, tag, msg) : (void)0)
 
-#define APEP_LOG_ERROR(tag, msg) \
-    apep_print_message(NULL, APEP_LVL_ERROR, tag, msg)
+/* printf-style; nothing is formatted for disabled levels */
+#define APEP_LOGF(lvl, tag, ...) \
+    (APEP_LOG_ENABLED(lvl) ? apep_print_message_fmt(NULL, lvl, tag, __VA_ARGS__) : (void)0)
 
-#define APEP_LOG_CRITICAL(tag, msg) \
-    apep_print_message(NULL, APEP_LVL_CRITICAL, tag, msg)
+#define APEP_LOG_TRACE(tag, msg) APEP_LOG(APEP_LVL_TRACE, tag, msg)
+#define APEP_LOG_DEBUG(tag, msg) APEP_LOG(APEP_LVL_DEBUG, tag, msg)
+#define APEP_LOG_INFO(tag, msg) APEP_LOG(APEP_LVL_INFO, tag, msg)
+#define APEP_LOG_WARN(tag, msg) APEP_LOG(APEP_LVL_WARN, tag, msg)
+#define APEP_LOG_ERROR(tag, msg) APEP_LOG(APEP_LVL_ERROR, tag, msg)
+#define APEP_LOG_CRITICAL(tag, msg) APEP_LOG(APEP_LVL_CRITICAL, tag, msg)
 
 /* Conditional debug logging (compiled out in release builds) */
 #ifndef NDEBUG
@@ -73,6 +87,9 @@ extern "C"
 
     /* ----------------------------
     Formatted message variants
+    The text is formatted straight into the record being printed, at any
+    length. Records larger than the stack buffer grow into a per-thread
+    scratch area that is kept, so repeated long messages do not allocate.
     ---------------------------- */
 
     void apep_print_message_fmt(
@@ -100,12 +117,24 @@ extern "C"
     Global options management
     ---------------------------- */
 
-    /* Set global default options (used when opt=NULL in other calls) */
+    /* Set global default options (used when opt=NULL in other calls).
+    Safe to call while other threads print: the options are copied into a
+    new immutable snapshot that replaces the current one atomically.
+    Replaced snapshots are freed once no acquire/release section that
+    could still see them is open. */
     void apep_set_global_options(const apep_options_t *opt);
 
-    /* Get current global options (returns defaults if not set) */
+    /* Get current global options (returns defaults if not set). The
+    returned pointer stays valid for the life of the process; it keeps
+    showing the options current at the call, not later set/reset. */
     const apep_options_t *apep_get_global_options(void);
 
+    /* Pin the current snapshot until the matching release. Sections may
+    nest; keep them short, since snapshots replaced meanwhile are
+    reclaimed only when the last open section closes. */
+    const apep_options_t *apep_global_options_acquire(void);
+    void apep_global_options_release(void);
+
     /* Reset global options to library defaults */
     void apep_reset_global_options(void);
 
@@ -113,11 +142,7 @@ extern "C"
     JSON Output
     ---------------------------- */
 
-    typedef enum apep_output_format
-    {
-        APEP_FORMAT_PRETTY = 0, /* Standard pretty output */
-        APEP_FORMAT_JSON = 1    /* JSON structured output */
-    } apep_output_format_t;
+    /* apep_output_format_t is declared in apep.h (apep_options_t.format) */
 
     /* Print diagnostic in JSON format */
     void apep_print_json_diagnostic(
@@ -132,6 +157,22 @@ extern "C"
         const apep_note_t *notes,
         size_t notes_count);
 
+    /* apep_print_json_diagnostic() in format. APEP_FORMAT_JSON writes one
+    compact object per line (NDJSON) with untranslated severities and no
+    whitespace or colors; other formats write the indented form above. */
+    void apep_print_json_diagnostic_format(
+        FILE *out,
+        apep_output_format_t format,
+        apep_severity_t sev,
+        const char *code,
+        const char *message,
+        const char *file,
+        int line,
+        int col,
+        int span_len,
+        const apep_note_t *notes,
+        size_t notes_count);
+
     /* ----------------------------
     Severity Filtering
     ---------------------------- */
@@ -145,6 +186,15 @@ extern "C"
     /* Check if severity passes filter */
     int apep_severity_passes_filter(apep_severity_t sev);
 
+    /* Messages below this level are dropped by apep_print_message(),
+    apep_print_message_fmt() (before formatting) and the APEP_LOG macros
+    (before evaluating their arguments). Default APEP_LVL_TRACE: all pass. */
+    void apep_set_min_level(apep_level_t min_lvl);
+    apep_level_t apep_get_min_level(void);
+
+    /* Read by APEP_LOG_ENABLED(); set it with apep_set_min_level(). */
+    extern volatile int apep_min_level_current;
+
     /* ----------------------------
     Diagnostic Buffering/Batching
     ---------------------------- */
@@ -164,7 +214,10 @@ extern "C"
         int line,
         int col);
 
-    /* Flush buffer (print all diagnostics, optionally sorted) */
+    /* Flush buffer (print all diagnostics as JSON, optionally sorted;
+    one compact line each when opt->format is APEP_FORMAT_JSON). With
+    opt->router each diagnostic goes to the sinks routed for its severity,
+    in each sink's format. */
     void apep_buffer_flush(
         apep_diagnostic_buffer_t *buf,
         const apep_options_t *opt,
@@ -179,6 +232,17 @@ extern "C"
     /* Get diagnostic count in buffer */
     size_t apep_buffer_count(const apep_diagnostic_buffer_t *buf);
 
+    /* Write the buffered diagnostics to out as one SARIF 2.1.0 log: a run
+    for tool_name (NULL: "apep") whose rules are the distinct codes, whose
+    artifacts are the distinct files, and whose results are grouped by file
+    in line/column order. Streamed in blocks; the buffer keeps its
+    diagnostics and order. Returns 0 on success, -1 on a write error. */
+    int apep_buffer_write_sarif(
+        apep_diagnostic_buffer_t *buf,
+        FILE *out,
+        const char *tool_name,
+        const char *tool_version);
+
     /* ----------------------------
     Color Schemes
     ---------------------------- */
@@ -216,7 +280,14 @@ extern "C"
     Stack Trace / Debug Context
     ---------------------------- */
 
+    /* Each thread has its own shadow stack. It grows in chunks of
+    APEP_MAX_STACK_DEPTH frames up to APEP_STACK_MAX_FRAMES; deeper pushes
+    (or pushes when memory runs out) are counted and reported instead of
+    recorded. Frames keep the given pointers, so pass static strings
+    (__func__, __FILE__). Define APEP_NO_TRACE to compile the macros below
+    out entirely. */
 #define APEP_MAX_STACK_DEPTH 32
+#define APEP_STACK_MAX_FRAMES 65536
 
     typedef struct apep_stack_frame
     {
@@ -237,17 +308,45 @@ extern "C"
     /* Clear stack trace */
     void apep_stack_clear(void);
 
+    /* Current thread's depth, and pushes that were not recorded. */
+    size_t apep_stack_depth(void);
+    size_t apep_stack_overflow(void);
+
+    /* Cleanup handler behind APEP_TRACE_SCOPE (pops one frame). */
+    void apep_stack_scope_end(int *scope);
+
+#define APEP_TRACE_CAT_(a, b) a##b
+#define APEP_TRACE_CAT(a, b) APEP_TRACE_CAT_(a, b)
+
+#if defined(APEP_NO_TRACE)
+#define APEP_TRACE_SCOPE() ((void)0)
+#define APEP_TRACE() ((void)0)
+#define APEP_TRACE_BEGIN() ((void)0)
+#define APEP_TRACE_END() ((void)0)
+#else
+#if defined(__GNUC__) || defined(__clang__)
+    /* Push a frame that is popped when the enclosing block exits (C and C++) */
+#define APEP_TRACE_SCOPE()                                                        \
+    __attribute__((cleanup(apep_stack_scope_end), unused)) int APEP_TRACE_CAT(    \
+        apep_trace_scope_, __LINE__) = (apep_stack_push(__func__, __FILE__, __LINE__), 0)
+#endif
+
+#if defined(__cplusplus)
     /* RAII-style macro for automatic stack tracking */
-#define APEP_TRACE()                                         \
-    apep_stack_push(__func__, __FILE__, __LINE__);           \
-    struct apep_trace_guard_##__LINE__                       \
-    {                                                        \
-        ~apep_trace_guard_##__LINE__() { apep_stack_pop(); } \
-    } apep_trace_guard_instance_##__LINE__
+#define APEP_TRACE()                                                            \
+    apep_stack_push(__func__, __FILE__, __LINE__);                              \
+    struct APEP_TRACE_CAT(apep_trace_guard_, __LINE__)                          \
+    {                                                                           \
+        ~APEP_TRACE_CAT(apep_trace_guard_, __LINE__)() { apep_stack_pop(); }    \
+    } APEP_TRACE_CAT(apep_trace_guard_instance_, __LINE__)
+#elif defined(APEP_TRACE_SCOPE)
+#define APEP_TRACE() APEP_TRACE_SCOPE()
+#endif
 
     /* C-compatible version (manual cleanup required) */
 #define APEP_TRACE_BEGIN() apep_stack_push(__func__, __FILE__, __LINE__)
 #define APEP_TRACE_END() apep_stack_pop()
+#endif
 
     /* ----------------------------
     Suggestions / Diff
@@ -0,0 +1,102 @@
+/**
+ * @file apep_json.h
+ * @brief Streaming JSON writer
+ *
+ * apep_json_writer_t encodes a JSON document straight into a render buffer
+ * (or a buffer it delivers to a sink as one record). It places commas,
+ * colons and, with APEP_JSON_PRETTY, newlines and indentation itself, and
+ * escapes strings with the library's vectorized escaper. JSON diagnostics
+ * and JSON message records are written with it.
+ *
+ *     apep_json_writer_t w;
+ *     apep_json_writer_init(&w, &rb, 0, NULL);
+ *     apep_json_begin_object(&w);
+ *     apep_json_key(&w, "path");
+ *     apep_json_string(&w, "/index.html");
+ *     apep_json_key(&w, "status");
+ *     apep_json_int(&w, 200);
+ *     apep_json_end_object(&w);
+ *     apep_json_writer_end(&w);   ->  {"path":"/index.html","status":200}\n
+ *
+ * Calls that would make the document invalid (a value where a key is
+ * expected, closing the wrong container, nesting deeper than
+ * APEP_JSON_MAX_DEPTH) write nothing and mark the writer failed;
+ * apep_json_writer_end() reports it.
+ */
+
+#ifndef APEP_JSON_H
+#define APEP_JSON_H
+
+#include "apep.h"
+#include "apep_sink.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define APEP_JSON_PRETTY 1u /* one member per line, two-space indent */
+
+#define APEP_JSON_MAX_DEPTH 32
+#define APEP_JSON_WRITER_STACK 512 /* sink documents up to this size are not allocated */
+
+    typedef struct apep_json_writer
+    {
+        apep_rbuf_t *out;
+        apep_sink_t *sink;
+        apep_caps_t caps;
+        unsigned flags;
+        int depth;
+        int after_key;
+        int failed;
+        unsigned long long members; /* bit d: container at depth d has members */
+        unsigned long long arrays;  /* bit d: container at depth d is an array */
+        apep_rbuf_t own;            /* sink mode */
+        char storage[APEP_JSON_WRITER_STACK];
+    } apep_json_writer_t;
+
+    /* Write documents to out. flags: APEP_JSON_PRETTY or 0 (compact).
+    Syntax colors follow caps (caps->color, caps->color_depth); NULL writes
+    no escapes. */
+    void apep_json_writer_init(apep_json_writer_t *w, apep_rbuf_t *out, unsigned flags, const apep_caps_t *caps);
+
+    /* Buffer each document and deliver it to sink as one record from
+    apep_json_writer_end(). Release with apep_json_writer_free(). */
+    void apep_json_writer_init_sink(apep_json_writer_t *w, apep_sink_t *sink, unsigned flags, const apep_caps_t *caps);
+
+    /* Finish the document with a newline (delivering it in sink mode) and
+    make the writer ready for the next one. Returns 0 if the document was
+    complete and valid and was delivered, -1 otherwise. */
+    int apep_json_writer_end(apep_json_writer_t *w);
+
+    /* Release the sink-mode buffer (no-op otherwise). */
+    void apep_json_writer_free(apep_json_writer_t *w);
+
+    void apep_json_begin_object(apep_json_writer_t *w);
+    void apep_json_end_object(apep_json_writer_t *w);
+    void apep_json_begin_array(apep_json_writer_t *w);
+    void apep_json_end_array(apep_json_writer_t *w);
+
+    /* Member name; the next call writes its value. */
+    void apep_json_key(apep_json_writer_t *w, const char *key);
+
+    /* Values. NULL strings are written as null, non-finite doubles as null. */
+    void apep_json_string(apep_json_writer_t *w, const char *s);
+    void apep_json_stringn(apep_json_writer_t *w, const char *s, size_t n);
+    void apep_json_int(apep_json_writer_t *w, long long v);
+    void apep_json_uint(apep_json_writer_t *w, unsigned long long v);
+    void apep_json_double(apep_json_writer_t *w, double v);
+    void apep_json_bool(apep_json_writer_t *w, int v);
+    void apep_json_null(apep_json_writer_t *w);
+
+    /* n bytes as a string of lowercase hex digits. */
+    void apep_json_hex(apep_json_writer_t *w, const void *bytes, size_t n);
+
+    /* A value already encoded as JSON, written as is (colored as a number). */
+    void apep_json_raw(apep_json_writer_t *w, const char *json, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEP_JSON_H */
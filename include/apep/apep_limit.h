@@ -0,0 +1,84 @@
+/**
+ * @file apep_limit.h
+ * @brief Rate limiting and duplicate suppression for log messages
+ *
+ * A limiter tracks every distinct (level, tag, message template) that
+ * apep_print_message() and apep_print_message_fmt() emit and lets each
+ * one through at a configured rate. Repeats over the rate are counted
+ * instead of printed; the next instance that gets through carries a
+ * "(repeated N times in T s)" note, and apep_limiter_flush() reports the
+ * rest. Set apep_options_t.limiter to enable it.
+ *
+ * The check for an already-seen message is one lock-free hash probe and
+ * one compare-and-swap on the message's bucket state. Levels and tags
+ * without a rate are not hashed at all. apep_print_message_fmt() asks on
+ * the format string before formatting, so suppressed repeats never
+ * expand their arguments.
+ */
+
+#ifndef APEP_LIMIT_H
+#define APEP_LIMIT_H
+
+#include "apep.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Most tags with their own rate */
+#define APEP_LIMITER_MAX_TAGS 16
+
+/* Bytes of a message kept for apep_limiter_flush() */
+#define APEP_LIMITER_TEXT_MAX 95
+
+    typedef struct apep_limiter apep_limiter_t;
+
+    /* Track up to about `slots` distinct messages (rounded up to a power of
+    two, 0 = 1024). Messages that find no free slot are never limited.
+    Returns NULL on failure. */
+    apep_limiter_t *apep_limiter_create(size_t slots);
+    void apep_limiter_destroy(apep_limiter_t *lim);
+
+    /* Allow each distinct message at this level per_second times on
+    average, with bursts of up to `burst` back to back (0 means 1).
+    per_second <= 0 removes the limit. Time is read at clock-tick
+    resolution (a few ms on Linux), so give rates above a few hundred per
+    second a burst of at least one tick's worth. Returns 0, or -1 on bad
+    arguments. */
+    int apep_limiter_set_level(apep_limiter_t *lim, apep_level_t lvl, double per_second, unsigned burst);
+
+    /* Same for every message with this tag; overrides the level's rate.
+    Returns -1 if APEP_LIMITER_MAX_TAGS tags already have rates. */
+    int apep_limiter_set_tag(apep_limiter_t *lim, const char *tag, double per_second, unsigned burst);
+
+    /* Rates are resolved when a message is first seen: configure before
+    printing, or call apep_limiter_reset() (not concurrently with
+    printing) to forget every tracked message. */
+    void apep_limiter_reset(apep_limiter_t *lim);
+
+    /* Returns 1 if the message may be printed now, 0 if it is suppressed
+    (and counted). If it may be printed and earlier repeats were
+    suppressed, *repeated and *seconds (either may be NULL) receive their
+    count and the time since the first of them, and the count restarts. */
+    int apep_limiter_check(
+        apep_limiter_t *lim,
+        apep_level_t lvl,
+        const char *tag,
+        const char *key, /* message template; identifies the message */
+        unsigned long long *repeated,
+        double *seconds);
+
+    /* Print a "(repeated N times in T s)" summary for every message with
+    suppressed repeats not yet reported, using the text of its first
+    instance (truncated to APEP_LIMITER_TEXT_MAX bytes). */
+    void apep_limiter_flush(apep_limiter_t *lim, const apep_options_t *opt);
+
+    /* Repeats suppressed since creation. */
+    unsigned long long apep_limiter_suppressed(const apep_limiter_t *lim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEP_LIMIT_H */
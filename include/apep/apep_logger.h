@@ -0,0 +1,99 @@
+/**
+ * @file apep_logger.h
+ * @brief Named hierarchical loggers
+ *
+ * Loggers are named with dotted paths ("db.pool.conn") and form a tree
+ * under the root logger (""). A logger without its own level inherits
+ * its parent's. Each logger caches its effective level; changing any
+ * level bumps a generation counter that invalidates every cache, so the
+ * check for a disabled level is one load and one compare.
+ *
+ *     apep_logger_t *conn = apep_logger_get("db.pool.conn");
+ *     apep_logger_set_level(apep_logger_get("db"), APEP_LVL_DEBUG);
+ *     APEP_LOGGER_DEBUG(conn, "opened %s", dsn);   // Debug[db.pool.conn]: opened ...
+ */
+
+#ifndef APEP_LOGGER_H
+#define APEP_LOGGER_H
+
+#include "apep.h"
+#include "apep_helpers.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct apep_logger apep_logger_t;
+
+    /* Every logger starts with this header; APEP_LOGGER_ENABLED() reads
+    it inline. cached_level is the effective level, or -1 while stale
+    (which sends the check to the slow path). */
+    typedef struct apep_logger_head
+    {
+        volatile int cached_level;
+    } apep_logger_head_t;
+
+/* Level that disables a logger completely */
+#define APEP_LOGGER_OFF ((apep_level_t)(APEP_LVL_CRITICAL + 1))
+
+    /* The logger for name, created with its ancestors on first use. NULL
+    or "" is the root. Loggers live until apep_logger_shutdown(); look one
+    up once and keep the pointer. Returns NULL on allocation failure. */
+    apep_logger_t *apep_logger_get(const char *name);
+    apep_logger_t *apep_logger_root(void);
+
+    const char *apep_logger_name(const apep_logger_t *lg);
+
+    /* Set the logger's own level (APEP_LOGGER_OFF silences it). The root
+    starts at APEP_LVL_INFO; other loggers inherit until set. */
+    void apep_logger_set_level(apep_logger_t *lg, apep_level_t lvl);
+
+    /* Inherit the parent's level again (ignored for the root). */
+    void apep_logger_unset_level(apep_logger_t *lg);
+
+    apep_level_t apep_logger_effective_level(apep_logger_t *lg);
+
+    /* Options used to print; inherited like levels. NULL (the default)
+    means the global options. opt must stay valid while in use. */
+    void apep_logger_set_options(apep_logger_t *lg, const apep_options_t *opt);
+
+    /* 1 if lvl passes the logger's effective level and the global runtime
+    threshold. Refreshes a stale cache. */
+    int apep_logger_enabled(apep_logger_t *lg, apep_level_t lvl);
+
+    /* Print a formatted message tagged with the logger's name if lvl is
+    enabled. The format string keys the rate limiter, if any. */
+    void apep_logger_log(apep_logger_t *lg, apep_level_t lvl, const char *fmt, ...)
+#if defined(__GNUC__) || defined(__clang__)
+        __attribute__((format(printf, 3, 4)))
+#endif
+        ;
+
+    void apep_logger_vlog(apep_logger_t *lg, apep_level_t lvl, const char *fmt, va_list args);
+
+    /* Free every logger. None may be used afterwards. */
+    void apep_logger_shutdown(void);
+
+/* Inline level check; arguments of disabled calls are not evaluated. A
+   stale cache passes the compare and is refreshed by the last term. */
+#define APEP_LOGGER_ENABLED(lg, lvl)                                    \
+    ((int)(lvl) >= (int)(APEP_MIN_LOG_LEVEL) &&                         \
+     (int)(lvl) >= ((const apep_logger_head_t *)(lg))->cached_level &&  \
+     (((const apep_logger_head_t *)(lg))->cached_level >= 0 || apep_logger_enabled(lg, lvl)))
+
+#define APEP_LOGGER_LOG(lg, lvl, ...) \
+    (APEP_LOGGER_ENABLED(lg, lvl) ? apep_logger_log(lg, lvl, __VA_ARGS__) : (void)0)
+
+#define APEP_LOGGER_TRACE(lg, ...) APEP_LOGGER_LOG(lg, APEP_LVL_TRACE, __VA_ARGS__)
+#define APEP_LOGGER_DEBUG(lg, ...) APEP_LOGGER_LOG(lg, APEP_LVL_DEBUG, __VA_ARGS__)
+#define APEP_LOGGER_INFO(lg, ...) APEP_LOGGER_LOG(lg, APEP_LVL_INFO, __VA_ARGS__)
+#define APEP_LOGGER_WARN(lg, ...) APEP_LOGGER_LOG(lg, APEP_LVL_WARN, __VA_ARGS__)
+#define APEP_LOGGER_ERROR(lg, ...) APEP_LOGGER_LOG(lg, APEP_LVL_ERROR, __VA_ARGS__)
+#define APEP_LOGGER_CRITICAL(lg, ...) APEP_LOGGER_LOG(lg, APEP_LVL_CRITICAL, __VA_ARGS__)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEP_LOGGER_H */
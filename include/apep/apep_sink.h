@@ -0,0 +1,191 @@
+/**
+ * @file apep_sink.h
+ * @brief Output sinks and per-level routing
+ *
+ * A sink receives complete rendered records (one diagnostic or message
+ * at a time). Built-in sinks write to a FILE, a raw file descriptor, a
+ * growing memory buffer, a fixed-size ring of recent records or a user
+ * callback; custom sinks implement apep_sink_vtable_t.
+ *
+ * A router maps every log level and diagnostic severity to the sinks that
+ * should receive it. Set apep_options_t.router and printers send their
+ * output through it instead of apep_options_t.out, rendering colors and
+ * line art for each destination's own capabilities.
+ */
+
+#ifndef APEP_SINK_H
+#define APEP_SINK_H
+
+#include "apep.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* ----------------------------
+    Sink interface
+    ---------------------------- */
+
+    typedef struct apep_sink apep_sink_t;
+
+    typedef struct apep_sink_vtable
+    {
+        /* Deliver one complete record. The record may hold referenced
+        fragments; walk it with apep_rbuf_pieces()/apep_rbuf_piece().
+        Return 0 on success, -1 on error. May be called concurrently. */
+        int (*write)(apep_sink_t *sink, const apep_rbuf_t *record);
+
+        /* Push buffered output to its destination. May be NULL. */
+        int (*flush)(apep_sink_t *sink);
+
+        /* Release the sink (including the apep_sink_t). May be NULL. */
+        void (*destroy)(apep_sink_t *sink);
+    } apep_sink_vtable_t;
+
+    /* Custom sinks embed this as their first member. */
+    struct apep_sink
+    {
+        const apep_sink_vtable_t *vt;
+        int fd; /* descriptor whose terminal capabilities apply, -1 if none */
+    };
+
+    /* Write data as one record. Returns 0 on success, -1 on error. */
+    int apep_sink_write(apep_sink_t *sink, const char *data, size_t len);
+    int apep_sink_write_rbuf(apep_sink_t *sink, const apep_rbuf_t *record);
+
+    int apep_sink_flush(apep_sink_t *sink);
+    void apep_sink_destroy(apep_sink_t *sink);
+
+    /* ----------------------------
+    Built-in sinks
+    Each returns NULL on failure. Records are never interleaved with
+    records from other threads writing to the same sink.
+    ---------------------------- */
+
+    /* Locked stdio writes to out. If close_on_destroy, out is fclose()d. */
+    apep_sink_t *apep_sink_file_create(FILE *out, int close_on_destroy);
+
+    /* Unbuffered writev(2) per record, referenced source lines included
+    without copying. If close_on_destroy, fd is close()d. */
+    apep_sink_t *apep_sink_fd_create(int fd, int close_on_destroy);
+
+    /* Appends every record to a growing buffer. */
+    apep_sink_t *apep_sink_memory_create(void);
+
+    /* Contents of a memory sink (NUL-terminated, valid until the next
+    write or clear). len may be NULL. */
+    const char *apep_sink_memory_data(apep_sink_t *sink, size_t *len);
+    void apep_sink_memory_clear(apep_sink_t *sink);
+
+    /* Keeps the most recent records within capacity bytes, dropping the
+    oldest whole records to make room. Records larger than the ring are
+    dropped. Useful as an always-on crash buffer. */
+    apep_sink_t *apep_sink_ring_create(size_t capacity);
+
+    /* Append the retained records, oldest first, to out. Returns how many
+    records were copied. */
+    size_t apep_sink_ring_copy(apep_sink_t *sink, apep_rbuf_t *out);
+
+    /* Records evicted or rejected since creation. */
+    unsigned long long apep_sink_ring_dropped(apep_sink_t *sink);
+
+    /* Calls fn(user, data, len) once per record with the record's bytes
+    contiguous. Return 0 from fn on success. fn must be thread safe if
+    several threads print. */
+    typedef int (*apep_sink_callback_fn)(void *user, const char *data, size_t len);
+
+    apep_sink_t *apep_sink_callback_create(apep_sink_callback_fn fn, void *user);
+
+    /* ----------------------------
+    Asynchronous sink
+    Wraps another sink: the printing thread copies each rendered record
+    into a preallocated queue slot and returns; a background thread writes
+    the records to the wrapped sink in order. Route through it to keep a
+    slow destination (a pipe, a network log) off the caller's thread.
+    ---------------------------- */
+
+    typedef enum apep_overflow_policy
+    {
+        APEP_OVERFLOW_BLOCK = 0,   /* wait for a free slot */
+        APEP_OVERFLOW_DROP_NEWEST, /* discard the record being written */
+        APEP_OVERFLOW_DROP_OLDEST, /* discard the oldest queued record */
+        APEP_OVERFLOW_SAMPLE       /* keep 1 in sample_every records (waiting for it), drop the rest */
+    } apep_overflow_policy_t;
+
+    typedef struct apep_async_config
+    {
+        size_t capacity;  /* queue slots, rounded up to a power of two (default 1024) */
+        size_t slot_size; /* bytes stored in place; longer records are heap copied (default 512) */
+        apep_overflow_policy_t overflow;
+        unsigned sample_every; /* for APEP_OVERFLOW_SAMPLE (default 16) */
+    } apep_async_config_t;
+
+    void apep_async_config_default(apep_async_config_t *cfg);
+
+    /* Start the writer thread. cfg may be NULL (defaults). The target is
+    not owned: destroy it after the async sink. Returns NULL on failure.
+    apep_sink_flush() returns once every record queued before the call has
+    been written (or discarded by the overflow policy) and the target
+    flushed. apep_sink_destroy() drains the
+    queue and joins the thread. After fork() the child starts with an
+    empty queue (the parent still writes what was pending) and a new
+    writer thread. */
+    apep_sink_t *apep_sink_async_create(apep_sink_t *target, const apep_async_config_t *cfg);
+
+    /* Records discarded by the overflow policy since creation. */
+    unsigned long long apep_sink_async_dropped(apep_sink_t *sink);
+
+    /* ----------------------------
+    Routing
+    A route mask selects log levels (apep_print_message and friends) and
+    diagnostic severities (text, hex, multi-span, suggestion and exception
+    output). Records without either (stack traces, timers) travel as
+    APEP_LVL_DEBUG; failed assertions and apep_error_simple() as
+    APEP_SEV_ERROR. apep_buffer_flush() routes each diagnostic by its
+    severity. Streams handed to an API directly (JSON printers, SARIF
+    export, progress bars) are not routed.
+    ---------------------------- */
+
+#define APEP_ROUTE_LEVEL(lvl) (1u << (unsigned)(lvl))
+#define APEP_ROUTE_SEVERITY(sev) (1u << (8u + (unsigned)(sev)))
+#define APEP_ROUTE_ALL_LEVELS 0x00FFu
+#define APEP_ROUTE_ALL_SEVERITIES 0xFF00u
+#define APEP_ROUTE_ALL 0xFFFFu
+
+/* lvl and every level above it */
+#define APEP_ROUTE_LEVELS_FROM(lvl) (APEP_ROUTE_ALL_LEVELS & ~(APEP_ROUTE_LEVEL(lvl) - 1u))
+
+/* Most sinks one level or severity can be routed to */
+#define APEP_ROUTER_MAX_SINKS 8
+
+    typedef struct apep_router apep_router_t;
+
+    apep_router_t *apep_router_create(void);
+
+    /* Does not destroy the sinks. */
+    void apep_router_destroy(apep_router_t *router);
+
+    /* Send every level/severity in mask to sink as well. Routes are
+    resolved into a per-key table here, so printing does no lookup work.
+    Configure before printing starts; routes are not changed atomically.
+    Returns 0 on success, -1 if a key already has APEP_ROUTER_MAX_SINKS. */
+    int apep_router_add(apep_router_t *router, unsigned mask, apep_sink_t *sink);
+
+    /* apep_router_add() with message records for sink serialized in
+    format instead of apep_options_t.format (e.g. JSON to a file while
+    the terminal gets pretty lines). Adding a routed sink again changes
+    its format. Returns -1 on a bad format or a full key. */
+    int apep_router_add_format(apep_router_t *router, unsigned mask, apep_sink_t *sink, apep_output_format_t format);
+
+    /* Remove every route (the table becomes empty; nothing is printed). */
+    void apep_router_clear(apep_router_t *router);
+
+    /* Flush every distinct sink the router knows about. */
+    int apep_router_flush(apep_router_t *router);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APEP_SINK_H */
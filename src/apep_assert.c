@@ -5,38 +5,71 @@
 #include <stdlib.h>
 #include <stdarg.h>
 
-void apep_assert_failed(
+/* Header shared by both entry points; the message line is appended by the caller */
+static void apep_render_assert_header(
+    apep_rbuf_t *out,
+    const apep_caps_t *caps,
     const char *expr,
-    const char *msg,
     const char *file,
     int line,
     const char *func)
 {
-    apep_options_t opt;
-    apep_options_default(&opt);
-    apep_caps_t caps = apep_detect_caps(stderr, &opt);
+    apep_rbuf_putc(out, '\n');
+    apep_color_begin(out, caps, APEP_CR_SEV_ERROR);
+    apep_rbuf_puts(out, "Assertion failed");
+    apep_color_end(out, caps);
+    apep_rbuf_puts(out, ": ");
+    apep_rbuf_puts(out, expr);
+    apep_rbuf_putc(out, '\n');
 
-    fprintf(stderr, "\n");
-    apep_color_begin(stderr, &caps, APEP_CR_SEV_ERROR);
-    fprintf(stderr, "Assertion failed");
-    apep_color_end(stderr, &caps);
-    fprintf(stderr, ": %s\n", expr);
+    apep_rbuf_puts(out, "  -> ");
+    apep_rbuf_puts(out, file);
+    apep_rbuf_putc(out, ':');
+    apep_rbuf_int(out, line, 0);
+    apep_rbuf_puts(out, " in ");
+    apep_rbuf_puts(out, func);
+    apep_rbuf_puts(out, "()\n");
+}
 
-    fprintf(stderr, "  -> %s:%d in %s()\n", file, line, func);
+static void apep_render_assert_message_label(apep_rbuf_t *out, const apep_caps_t *caps)
+{
+    apep_rbuf_puts(out, "  = ");
+    apep_color_begin(out, caps, APEP_CR_LABEL);
+    apep_rbuf_puts(out, "message");
+    apep_color_end(out, caps);
+    apep_rbuf_puts(out, ": ");
+}
 
-    if (msg && msg[0])
+static void apep_render_assert_trailer(apep_rbuf_t *out)
+{
+    /* Print stack trace if available */
+    apep_rbuf_putc(out, '\n');
+    apep_stack_render(out);
+    apep_rbuf_putc(out, '\n');
+}
+
+void apep_assert_failed(
+    const char *expr,
+    const char *msg,
+    const char *file,
+    int line,
+    const char *func)
+{
+    apep_emit_t em;
+    for (apep_emit_begin(&em, apep_global_options_acquire(), APEP_ROUTE_KEY_SEVERITY(APEP_SEV_ERROR), 0); apep_emit_next(&em);)
     {
-        fprintf(stderr, "  = ");
-        apep_color_begin(stderr, &caps, APEP_CR_LABEL);
-        fprintf(stderr, "message");
-        apep_color_end(stderr, &caps);
-        fprintf(stderr, ": %s\n", msg);
-    }
+        apep_render_assert_header(&em.rb, &em.caps, expr, file, line, func);
 
-    /* Print stack trace if available */
-    fprintf(stderr, "\n");
-    apep_stack_print(&opt);
-    fprintf(stderr, "\n");
+        if (msg && msg[0])
+        {
+            apep_render_assert_message_label(&em.rb, &em.caps);
+            apep_rbuf_puts(&em.rb, msg);
+            apep_rbuf_putc(&em.rb, '\n');
+        }
+
+        apep_render_assert_trailer(&em.rb);
+    }
+    apep_global_options_release();
 }
 
 void apep_assert_failed_fmt(
@@ -47,36 +80,25 @@ void apep_assert_failed_fmt(
     const char *fmt,
     ...)
 {
-    apep_options_t opt;
-    apep_options_default(&opt);
-    apep_caps_t caps = apep_detect_caps(stderr, &opt);
-
-    fprintf(stderr, "\n");
-    apep_color_begin(stderr, &caps, APEP_CR_SEV_ERROR);
-    fprintf(stderr, "Assertion failed");
-    apep_color_end(stderr, &caps);
-    fprintf(stderr, ": %s\n", expr);
+    apep_emit_t em;
+    for (apep_emit_begin(&em, apep_global_options_acquire(), APEP_ROUTE_KEY_SEVERITY(APEP_SEV_ERROR), 0); apep_emit_next(&em);)
+    {
+        apep_render_assert_header(&em.rb, &em.caps, expr, file, line, func);
 
-    fprintf(stderr, "  -> %s:%d in %s()\n", file, line, func);
+        if (fmt && fmt[0])
+        {
+            apep_render_assert_message_label(&em.rb, &em.caps);
 
-    if (fmt && fmt[0])
-    {
-        fprintf(stderr, "  = ");
-        apep_color_begin(stderr, &caps, APEP_CR_LABEL);
-        fprintf(stderr, "message");
-        apep_color_end(stderr, &caps);
-        fprintf(stderr, ": ");
+            /* Each rendering consumes its own copy of the arguments */
+            va_list args;
+            va_start(args, fmt);
+            apep_rbuf_vprintf(&em.rb, fmt, args);
+            va_end(args);
 
-        va_list args;
-        va_start(args, fmt);
-        vfprintf(stderr, fmt, args);
-        va_end(args);
+            apep_rbuf_putc(&em.rb, '\n');
+        }
 
-        fprintf(stderr, "\n");
+        apep_render_assert_trailer(&em.rb);
     }
-
-    /* Print stack trace if available */
-    fprintf(stderr, "\n");
-    apep_stack_print(&opt);
-    fprintf(stderr, "\n");
+    apep_global_options_release();
 }
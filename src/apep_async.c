@@ -0,0 +1,679 @@
+#include "../include/apep/apep_sink.h"
+#include "apep_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+/* ----------------------------
+Threading shim
+---------------------------- */
+
+#if defined(_WIN32)
+typedef CRITICAL_SECTION apep_mutex_t;
+typedef CONDITION_VARIABLE apep_cond_t;
+typedef HANDLE apep_thread_t;
+
+#define apep_mutex_init(m) InitializeCriticalSection(m)
+#define apep_mutex_destroy(m) DeleteCriticalSection(m)
+#define apep_mutex_lock(m) EnterCriticalSection(m)
+#define apep_mutex_unlock(m) LeaveCriticalSection(m)
+#define apep_cond_init(c) InitializeConditionVariable(c)
+#define apep_cond_destroy(c) ((void)(c))
+#define apep_cond_signal(c) WakeConditionVariable(c)
+#define apep_cond_broadcast(c) WakeAllConditionVariable(c)
+#define apep_cond_wait_ms(c, m, ms) ((void)SleepConditionVariableCS((c), (m), (DWORD)(ms)))
+#define apep_async_yield() SwitchToThread()
+#else
+typedef pthread_mutex_t apep_mutex_t;
+typedef pthread_cond_t apep_cond_t;
+typedef pthread_t apep_thread_t;
+
+#define apep_mutex_init(m) pthread_mutex_init((m), NULL)
+#define apep_mutex_destroy(m) pthread_mutex_destroy(m)
+#define apep_mutex_lock(m) pthread_mutex_lock(m)
+#define apep_mutex_unlock(m) pthread_mutex_unlock(m)
+#define apep_cond_init(c) pthread_cond_init((c), NULL)
+#define apep_cond_destroy(c) pthread_cond_destroy(c)
+#define apep_cond_signal(c) pthread_cond_signal(c)
+#define apep_cond_broadcast(c) pthread_cond_broadcast(c)
+#define apep_async_yield() sched_yield()
+
+static void apep_cond_wait_ms(apep_cond_t *c, apep_mutex_t *m, long ms)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(c, m, &ts);
+}
+#endif
+
+/* The writer re-checks the queue at least this often even if a wakeup is
+   missed, and flush waiters poll at the same period. */
+#define APEP_ASYNC_IDLE_MS 100
+
+/* Times the writer polls an empty queue before sleeping. While it is
+   awake producers never pay for a wakeup. */
+#define APEP_ASYNC_SPIN 256
+
+/* ----------------------------
+Bounded MPMC queue (D. Vyukov)
+Each slot carries a sequence number: pos when free for the producer
+that claims pos, pos + 1 once published. Producers claim with one CAS on
+tail; the writer (and producers evicting under DROP_OLDEST) claim with one
+CAS on head. Record bytes live in the slot itself.
+---------------------------- */
+
+typedef struct apep_async_slot
+{
+    volatile unsigned long long seq;
+    size_t len;
+    char *heap; /* record did not fit in place */
+    /* slot_size bytes follow */
+} apep_async_slot_t;
+
+typedef struct apep_async_sink
+{
+    apep_sink_t base;
+    apep_sink_t *target;
+    apep_async_config_t cfg;
+
+    unsigned char *slots;
+    size_t stride;
+    unsigned long long mask;
+
+    /* Hot counters on separate cache lines */
+    char pad0[64];
+    volatile unsigned long long tail; /* next position to enqueue */
+    char pad1[64];
+    volatile unsigned long long head; /* next position to dequeue */
+    char pad2[64];
+    volatile unsigned long long written; /* writer has finished every position below */
+    volatile unsigned long long dropped; /* records discarded */
+    volatile unsigned long long sample_tick;
+    volatile long writer_sleeping;
+    volatile long flushers; /* threads inside apep_sink_flush() */
+    char pad3[64];
+
+    apep_mutex_t lock;
+    apep_mutex_t target_lock; /* held around every call into target */
+    apep_cond_t work; /* writer waits for records */
+    apep_cond_t idle; /* flushers wait for the writer to catch up */
+    apep_thread_t thread;
+    volatile long running; /* writer thread exists in this process */
+    volatile long stopping;
+
+    struct apep_async_sink *next; /* fork registry */
+} apep_async_sink_t;
+
+static apep_async_slot_t *apep_async_slot(apep_async_sink_t *as, unsigned long long pos)
+{
+    return (apep_async_slot_t *)(as->slots + (size_t)(pos & as->mask) * as->stride);
+}
+
+static char *apep_async_slot_data(apep_async_slot_t *slot)
+{
+    return (char *)(slot + 1);
+}
+
+static void apep_async_reset_queue(apep_async_sink_t *as)
+{
+    for (unsigned long long i = 0; i <= as->mask; i++)
+    {
+        apep_async_slot_t *slot = apep_async_slot(as, i);
+        slot->seq = i;
+        slot->len = 0;
+        slot->heap = NULL;
+    }
+    as->tail = 0;
+    as->head = 0;
+    as->written = 0;
+}
+
+/* Claim the oldest published slot. Returns NULL if the queue is empty;
+   *pos_out is then the head position, below which everything is claimed. */
+static apep_async_slot_t *apep_async_claim_head(apep_async_sink_t *as, unsigned long long *pos_out)
+{
+    unsigned long long pos = APEP_LOAD_ACQUIRE(&as->head);
+    for (;;)
+    {
+        apep_async_slot_t *slot = apep_async_slot(as, pos);
+        unsigned long long seq = APEP_LOAD_ACQUIRE(&slot->seq);
+        long long dif = (long long)(seq - (pos + 1));
+
+        if (dif == 0)
+        {
+            if (APEP_CAS64(&as->head, &pos, pos + 1))
+            {
+                *pos_out = pos;
+                return slot;
+            }
+        }
+        else if (dif < 0)
+        {
+            *pos_out = pos;
+            return NULL;
+        }
+        else
+        {
+            pos = APEP_LOAD_ACQUIRE(&as->head);
+        }
+    }
+}
+
+/* Hand a claimed head slot back to producers */
+static void apep_async_release_head(apep_async_sink_t *as, apep_async_slot_t *slot, unsigned long long pos)
+{
+    free(slot->heap);
+    slot->heap = NULL;
+    APEP_STORE_RELEASE(&slot->seq, pos + as->mask + 1);
+}
+
+/* Copy the record into a free slot. Returns 0, or -1 if the queue is full. */
+static int apep_async_try_enqueue(apep_async_sink_t *as, const apep_rbuf_t *record, int *oom)
+{
+    unsigned long long pos = APEP_LOAD_ACQUIRE(&as->tail);
+    apep_async_slot_t *slot;
+
+    for (;;)
+    {
+        slot = apep_async_slot(as, pos);
+        unsigned long long seq = APEP_LOAD_ACQUIRE(&slot->seq);
+        long long dif = (long long)(seq - pos);
+
+        if (dif == 0)
+        {
+            if (APEP_CAS64(&as->tail, &pos, pos + 1))
+                break;
+        }
+        else if (dif < 0)
+        {
+            return -1;
+        }
+        else
+        {
+            pos = APEP_LOAD_ACQUIRE(&as->tail);
+        }
+    }
+
+    size_t len = apep_rbuf_size(record);
+    char *dst = apep_async_slot_data(slot);
+    if (len > as->cfg.slot_size)
+    {
+        /* The slot is claimed either way; an empty record keeps order */
+        dst = (char *)malloc(len);
+        if (!dst)
+        {
+            *oom = 1;
+            len = 0;
+        }
+        slot->heap = dst;
+    }
+
+    size_t at = 0;
+    size_t pieces = apep_rbuf_pieces(record);
+    for (size_t i = 0; i < pieces && len; i++)
+    {
+        const char *p;
+        size_t n = apep_rbuf_piece(record, i, &p);
+        if (n)
+            memcpy(dst + at, p, n);
+        at += n;
+    }
+    slot->len = len;
+
+    APEP_STORE_RELEASE(&slot->seq, pos + 1);
+    return 0;
+}
+
+static void apep_async_wake(apep_async_sink_t *as)
+{
+    /* Pairs with the fence in the writer before it re-checks the queue */
+    APEP_FENCE();
+    if (APEP_LOAD_ACQUIRE(&as->writer_sleeping))
+    {
+        apep_mutex_lock(&as->lock);
+        apep_cond_signal(&as->work);
+        apep_mutex_unlock(&as->lock);
+    }
+}
+
+/* ----------------------------
+Writer thread
+---------------------------- */
+
+static int apep_async_target_write(apep_async_sink_t *as, const char *data, size_t len)
+{
+    apep_mutex_lock(&as->target_lock);
+    int rc = apep_sink_write(as->target, data, len);
+    apep_mutex_unlock(&as->target_lock);
+    return rc;
+}
+
+static int apep_async_target_flush(apep_async_sink_t *as)
+{
+    apep_mutex_lock(&as->target_lock);
+    int rc = apep_sink_flush(as->target);
+    apep_mutex_unlock(&as->target_lock);
+    return rc;
+}
+
+static int apep_async_queue_empty(apep_async_sink_t *as)
+{
+    unsigned long long pos = APEP_LOAD_ACQUIRE(&as->head);
+    apep_async_slot_t *slot = apep_async_slot(as, pos);
+    return APEP_LOAD_ACQUIRE(&slot->seq) != pos + 1;
+}
+
+/* Write everything queued. Returns how many records were written. Only
+   the writer advances `written`: positions it skipped were evicted by
+   DROP_OLDEST producers and need no waiting for. */
+static size_t apep_async_drain(apep_async_sink_t *as)
+{
+    size_t count = 0;
+    unsigned long long pos;
+    apep_async_slot_t *slot;
+
+    while ((slot = apep_async_claim_head(as, &pos)) != NULL)
+    {
+        APEP_STORE_RELEASE(&as->written, pos);
+        const char *data = slot->heap ? slot->heap : apep_async_slot_data(slot);
+        if (slot->len)
+            apep_async_target_write(as, data, slot->len);
+        apep_async_release_head(as, slot, pos);
+        APEP_STORE_RELEASE(&as->written, pos + 1);
+        count++;
+    }
+    APEP_STORE_RELEASE(&as->written, pos);
+    return count;
+}
+
+static void apep_async_run(apep_async_sink_t *as)
+{
+    int dirty = 0; /* written since the target was last flushed */
+
+    for (;;)
+    {
+        if (apep_async_drain(as))
+            dirty = 1;
+
+        if (APEP_LOAD_ACQUIRE(&as->flushers))
+        {
+            apep_mutex_lock(&as->lock);
+            apep_cond_broadcast(&as->idle);
+            apep_mutex_unlock(&as->lock);
+        }
+
+        for (int spin = 0; spin < APEP_ASYNC_SPIN && apep_async_queue_empty(as); spin++)
+        {
+            if (APEP_LOAD_ACQUIRE(&as->stopping))
+                break;
+            apep_async_yield();
+        }
+        if (!apep_async_queue_empty(as))
+            continue;
+
+        /* Going idle: push out what was written */
+        if (dirty)
+        {
+            apep_async_target_flush(as);
+            dirty = 0;
+        }
+
+        apep_mutex_lock(&as->lock);
+        if (APEP_LOAD_ACQUIRE(&as->stopping) && apep_async_queue_empty(as))
+        {
+            apep_mutex_unlock(&as->lock);
+            break;
+        }
+
+        APEP_STORE_RELEASE(&as->writer_sleeping, 1L);
+        APEP_FENCE();
+        if (apep_async_queue_empty(as) && !APEP_LOAD_ACQUIRE(&as->stopping))
+            apep_cond_wait_ms(&as->work, &as->lock, APEP_ASYNC_IDLE_MS);
+        APEP_STORE_RELEASE(&as->writer_sleeping, 0L);
+        apep_mutex_unlock(&as->lock);
+    }
+}
+
+#if defined(_WIN32)
+static unsigned __stdcall apep_async_thread(void *arg)
+{
+    apep_async_run((apep_async_sink_t *)arg);
+    return 0;
+}
+
+static int apep_async_spawn(apep_async_sink_t *as)
+{
+    uintptr_t h = _beginthreadex(NULL, 0, apep_async_thread, as, 0, NULL);
+    if (!h)
+        return -1;
+    as->thread = (HANDLE)h;
+    return 0;
+}
+
+static void apep_async_join(apep_async_sink_t *as)
+{
+    WaitForSingleObject(as->thread, INFINITE);
+    CloseHandle(as->thread);
+}
+#else
+static void *apep_async_thread(void *arg)
+{
+    apep_async_run((apep_async_sink_t *)arg);
+    return NULL;
+}
+
+static int apep_async_spawn(apep_async_sink_t *as)
+{
+    return pthread_create(&as->thread, NULL, apep_async_thread, as) == 0 ? 0 : -1;
+}
+
+static void apep_async_join(apep_async_sink_t *as)
+{
+    pthread_join(as->thread, NULL);
+}
+#endif
+
+/* Start the writer if this process does not have one (i.e. after fork) */
+static int apep_async_ensure_writer(apep_async_sink_t *as)
+{
+    if (APEP_LOAD_ACQUIRE(&as->running))
+        return 0;
+
+    int rc = 0;
+    apep_mutex_lock(&as->lock);
+    if (!as->running)
+    {
+        rc = apep_async_spawn(as);
+        if (rc == 0)
+            APEP_STORE_RELEASE(&as->running, 1L);
+    }
+    apep_mutex_unlock(&as->lock);
+    return rc;
+}
+
+/* ----------------------------
+Fork safety
+Every async sink is registered. Around fork() their locks are held so
+the child gets them in a consistent state. Holding target_lock also
+waits for the writer to leave the target, so no lock inside the target
+(fd sink spin lock, stdio lock) is inherited held. The child then drops
+the records it inherited (the parent owns them) and starts without a
+writer.
+---------------------------- */
+
+#if !defined(_WIN32)
+static pthread_mutex_t g_async_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static apep_async_sink_t *g_async_registry = NULL;
+static pthread_once_t g_async_atfork_once = PTHREAD_ONCE_INIT;
+
+static void apep_async_prefork(void)
+{
+    pthread_mutex_lock(&g_async_registry_lock);
+    for (apep_async_sink_t *as = g_async_registry; as; as = as->next)
+    {
+        apep_mutex_lock(&as->lock);
+        apep_mutex_lock(&as->target_lock);
+    }
+}
+
+static void apep_async_postfork_parent(void)
+{
+    for (apep_async_sink_t *as = g_async_registry; as; as = as->next)
+    {
+        apep_mutex_unlock(&as->target_lock);
+        apep_mutex_unlock(&as->lock);
+    }
+    pthread_mutex_unlock(&g_async_registry_lock);
+}
+
+static void apep_async_postfork_child(void)
+{
+    /* This thread is the only one left and holds every lock */
+    for (apep_async_sink_t *as = g_async_registry; as; as = as->next)
+    {
+        for (unsigned long long i = 0; i <= as->mask; i++)
+            free(apep_async_slot(as, i)->heap);
+        apep_async_reset_queue(as);
+
+        apep_cond_init(&as->work);
+        apep_cond_init(&as->idle);
+        as->running = 0;
+        as->writer_sleeping = 0;
+        as->flushers = 0;
+        apep_mutex_unlock(&as->target_lock);
+        apep_mutex_unlock(&as->lock);
+    }
+    pthread_mutex_unlock(&g_async_registry_lock);
+}
+
+static void apep_async_register_atfork(void)
+{
+    pthread_atfork(apep_async_prefork, apep_async_postfork_parent, apep_async_postfork_child);
+}
+
+static void apep_async_register(apep_async_sink_t *as)
+{
+    pthread_once(&g_async_atfork_once, apep_async_register_atfork);
+    pthread_mutex_lock(&g_async_registry_lock);
+    as->next = g_async_registry;
+    g_async_registry = as;
+    pthread_mutex_unlock(&g_async_registry_lock);
+}
+
+static void apep_async_unregister(apep_async_sink_t *as)
+{
+    pthread_mutex_lock(&g_async_registry_lock);
+    apep_async_sink_t **link = &g_async_registry;
+    while (*link && *link != as)
+        link = &(*link)->next;
+    if (*link)
+        *link = as->next;
+    pthread_mutex_unlock(&g_async_registry_lock);
+}
+#else
+#define apep_async_register(as) ((void)(as))
+#define apep_async_unregister(as) ((void)(as))
+#endif
+
+/* ----------------------------
+Sink interface
+---------------------------- */
+
+static int apep_async_write(apep_sink_t *sink, const apep_rbuf_t *record)
+{
+    apep_async_sink_t *as = (apep_async_sink_t *)sink;
+    int oom = 0;
+
+    if (apep_async_ensure_writer(as) != 0)
+    {
+        /* Degrade to synchronous */
+        apep_mutex_lock(&as->target_lock);
+        int rc = apep_sink_write_rbuf(as->target, record);
+        apep_mutex_unlock(&as->target_lock);
+        return rc;
+    }
+
+    int keep = 0; /* SAMPLE: this record was picked to wait for a slot */
+    while (apep_async_try_enqueue(as, record, &oom) != 0)
+    {
+        apep_overflow_policy_t policy = as->cfg.overflow;
+
+        if (policy == APEP_OVERFLOW_SAMPLE)
+        {
+            if (!keep)
+                keep = APEP_FETCH_ADD64(&as->sample_tick, 1) % as->cfg.sample_every == 0;
+            policy = keep ? APEP_OVERFLOW_BLOCK : APEP_OVERFLOW_DROP_NEWEST;
+        }
+
+        if (policy == APEP_OVERFLOW_DROP_NEWEST)
+        {
+            APEP_FETCH_ADD64(&as->dropped, 1);
+            apep_async_wake(as);
+            return 0;
+        }
+
+        if (policy == APEP_OVERFLOW_DROP_OLDEST)
+        {
+            unsigned long long pos;
+            apep_async_slot_t *slot = apep_async_claim_head(as, &pos);
+            if (slot)
+            {
+                apep_async_release_head(as, slot, pos);
+                APEP_FETCH_ADD64(&as->dropped, 1);
+            }
+            continue;
+        }
+
+        /* Block: let the writer make room */
+        apep_async_wake(as);
+        apep_async_yield();
+    }
+
+    apep_async_wake(as);
+    return oom ? -1 : 0;
+}
+
+static int apep_async_flush(apep_sink_t *sink)
+{
+    apep_async_sink_t *as = (apep_async_sink_t *)sink;
+    unsigned long long target = APEP_LOAD_ACQUIRE(&as->tail);
+
+    if (apep_async_ensure_writer(as) != 0)
+        return apep_async_target_flush(as);
+
+    apep_mutex_lock(&as->lock);
+    APEP_STORE_RELEASE(&as->flushers, as->flushers + 1); /* changed only under lock */
+    while (APEP_LOAD_ACQUIRE(&as->written) < target)
+    {
+        apep_cond_signal(&as->work);
+        apep_cond_wait_ms(&as->idle, &as->lock, APEP_ASYNC_IDLE_MS);
+    }
+    APEP_STORE_RELEASE(&as->flushers, as->flushers - 1);
+    apep_mutex_unlock(&as->lock);
+
+    return apep_async_target_flush(as);
+}
+
+static void apep_async_destroy(apep_sink_t *sink)
+{
+    apep_async_sink_t *as = (apep_async_sink_t *)sink;
+
+    apep_async_unregister(as);
+
+    if (APEP_LOAD_ACQUIRE(&as->running))
+    {
+        apep_mutex_lock(&as->lock);
+        APEP_STORE_RELEASE(&as->stopping, 1L);
+        apep_cond_signal(&as->work);
+        apep_mutex_unlock(&as->lock);
+        apep_async_join(as);
+    }
+
+    /* Anything left (no writer was ever started here) */
+    apep_async_drain(as);
+    apep_async_target_flush(as);
+
+    apep_cond_destroy(&as->idle);
+    apep_cond_destroy(&as->work);
+    apep_mutex_destroy(&as->target_lock);
+    apep_mutex_destroy(&as->lock);
+    free(as->slots);
+    free(as);
+}
+
+static const apep_sink_vtable_t apep_async_sink_vt = {
+    apep_async_write, apep_async_flush, apep_async_destroy};
+
+void apep_async_config_default(apep_async_config_t *cfg)
+{
+    if (!cfg)
+        return;
+    cfg->capacity = 1024;
+    cfg->slot_size = 512;
+    cfg->overflow = APEP_OVERFLOW_BLOCK;
+    cfg->sample_every = 16;
+}
+
+apep_sink_t *apep_sink_async_create(apep_sink_t *target, const apep_async_config_t *cfg_in)
+{
+    if (!target)
+        return NULL;
+
+    apep_async_config_t cfg;
+    apep_async_config_default(&cfg);
+    if (cfg_in)
+    {
+        cfg = *cfg_in;
+        if (cfg.capacity < 2)
+            cfg.capacity = 2;
+        if (cfg.sample_every == 0)
+            cfg.sample_every = 1;
+    }
+
+    size_t capacity = 2;
+    while (capacity < cfg.capacity)
+        capacity *= 2;
+    cfg.capacity = capacity;
+
+    apep_async_sink_t *as = (apep_async_sink_t *)calloc(1, sizeof(*as));
+    if (!as)
+        return NULL;
+
+    /* Keep every slot header aligned for its 64-bit sequence */
+    as->stride = (sizeof(apep_async_slot_t) + cfg.slot_size + 7) & ~(size_t)7;
+    as->slots = (unsigned char *)malloc(capacity * as->stride);
+    if (!as->slots)
+    {
+        free(as);
+        return NULL;
+    }
+
+    as->base.vt = &apep_async_sink_vt;
+    as->base.fd = target->fd;
+    as->target = target;
+    as->cfg = cfg;
+    as->mask = (unsigned long long)capacity - 1;
+    apep_async_reset_queue(as);
+
+    apep_mutex_init(&as->lock);
+    apep_mutex_init(&as->target_lock);
+    apep_cond_init(&as->work);
+    apep_cond_init(&as->idle);
+
+    if (apep_async_ensure_writer(as) != 0)
+    {
+        apep_cond_destroy(&as->idle);
+        apep_cond_destroy(&as->work);
+        apep_mutex_destroy(&as->target_lock);
+        apep_mutex_destroy(&as->lock);
+        free(as->slots);
+        free(as);
+        return NULL;
+    }
+
+    apep_async_register(as);
+    return &as->base;
+}
+
+unsigned long long apep_sink_async_dropped(apep_sink_t *sink)
+{
+    if (!sink || sink->vt != &apep_async_sink_vt)
+        return 0;
+    return APEP_LOAD_ACQUIRE(&((apep_async_sink_t *)sink)->dropped);
+}
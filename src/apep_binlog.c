@@ -0,0 +1,1380 @@
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* nanosleep, clock_gettime */
+#endif
+
+#include "../include/apep/apep_binlog.h"
+#include "apep_internal.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define APEP_BINLOG_TICKS() __builtin_ia32_rdtsc()
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define APEP_BINLOG_TICKS() __rdtsc()
+#else
+#define APEP_BINLOG_TICKS() apep_binlog_clock_ns()
+#endif
+
+/* ----------------------------
+Record layout
+A ring holds records of a 16-byte header followed by the argument bytes,
+each padded to 16 bytes. A header with id 0 pads the rest of the ring so
+no record wraps. Arguments are stored as the promoted C type of their
+conversion; strings as a 32-bit length (APEP_BINLOG_NULL_STR for NULL)
+and the bytes with their terminator.
+---------------------------- */
+
+typedef struct apep_binlog_rec
+{
+    uint32_t id;
+    uint32_t len; /* argument bytes */
+    uint64_t ticks;
+} apep_binlog_rec_t;
+
+#define APEP_BINLOG_ALIGN 16
+#define APEP_BINLOG_STRIDE(len) (((sizeof(apep_binlog_rec_t) + (len)) + APEP_BINLOG_ALIGN - 1) & ~(size_t)(APEP_BINLOG_ALIGN - 1))
+#define APEP_BINLOG_NULL_STR 0xFFFFFFFFu
+
+/* Site ids are indexes into chunks that never move */
+#define APEP_BINLOG_SITE_CHUNK 256
+#define APEP_BINLOG_SITE_CHUNKS 256
+#define APEP_BINLOG_UNSUPPORTED 0xFFFFFFFFu
+
+/* Argument kinds */
+#define APEP_BK_INT 'i'
+#define APEP_BK_LONG 'l'
+#define APEP_BK_LLONG 'L'
+#define APEP_BK_SIZE 'z'
+#define APEP_BK_INTMAX 'j'
+#define APEP_BK_PTRDIFF 't'
+#define APEP_BK_DOUBLE 'd'
+#define APEP_BK_LDOUBLE 'D'
+#define APEP_BK_PTR 'p'
+#define APEP_BK_STR 's'
+
+/* File format: magic, type sizes, byte order mark, start time; then
+   records tagged 'S' (site), 'M' (message) or 'D' (dropped total). */
+static const char apep_binlog_magic[8] = {'A', 'P', 'E', 'P', 'B', 'L', '0', '1'};
+#define APEP_BINLOG_BOM 0x01020304u
+#define APEP_BINLOG_SIZES 10
+
+typedef struct apep_binlog_ring
+{
+    volatile unsigned long long tail; /* written by the owning thread */
+    unsigned long long head_seen;     /* owner's last look at head */
+    char pad0[64 - 2 * sizeof(unsigned long long)];
+    volatile unsigned long long head; /* written by the drainer */
+    char pad1[64 - sizeof(unsigned long long)];
+    size_t mask;
+    volatile long abandoned; /* owning thread exited */
+    struct apep_binlog_ring *next;
+    unsigned char *data;
+} apep_binlog_ring_t;
+
+static volatile long g_bl_lock;       /* ring list; never held across I/O */
+static volatile long g_bl_drain_lock; /* one drain at a time, config and drain state */
+static volatile long g_bl_site_lock;  /* site registration */
+static apep_binlog_site_t **g_bl_sites[APEP_BINLOG_SITE_CHUNKS];
+static volatile unsigned g_bl_site_count;
+
+static apep_binlog_ring_t *g_bl_rings;
+static int g_bl_draining; /* rings are being read outside g_bl_lock */
+static volatile long g_bl_running;
+static volatile long g_bl_stopping;
+static int g_bl_drain_open; /* g_bl_cfg may be drained to; set under both locks */
+static apep_binlog_config_t g_bl_cfg;
+static unsigned g_bl_sites_written;
+static volatile unsigned long long g_bl_dropped;
+static unsigned long long g_bl_dropped_reported;
+
+/* ticks -> ns since start; start as real time for message timestamps */
+static unsigned long long g_bl_tick0;
+static double g_bl_ns_per_tick = 1.0;
+static long long g_bl_real0_ms;
+
+static APEP_THREAD_LOCAL apep_binlog_ring_t *t_bl_ring;
+
+static unsigned long long apep_binlog_clock_ns(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (unsigned long long)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+#endif
+}
+
+static void apep_binlog_sleep_ms(unsigned ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ms / 1000);
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+/* ----------------------------
+Conversion specs
+---------------------------- */
+
+/* Widest field width or precision a record is formatted with; on replay
+   they come from the file, so a corrupt log cannot ask for a huge field */
+#define APEP_BINLOG_MAX_FIELD 4096
+
+typedef struct apep_binlog_spec
+{
+    char text[32]; /* "%...c", NUL-terminated */
+    int stars;     /* '*' width/precision arguments (ints) */
+    int prec_star; /* the last star is the precision */
+    int wide;      /* a written width or precision exceeds APEP_BINLOG_MAX_FIELD */
+    char kind;     /* 0 for "%%", '?' if unsupported */
+} apep_binlog_spec_t;
+
+/* Skip the digits at p, flagging sp->wide if their value is too large */
+static const char *apep_binlog_skip_field(const char *p, apep_binlog_spec_t *sp)
+{
+    long v = 0;
+    for (; *p >= '0' && *p <= '9'; p++)
+    {
+        if (v <= APEP_BINLOG_MAX_FIELD)
+            v = v * 10 + (*p - '0');
+    }
+    if (v > APEP_BINLOG_MAX_FIELD)
+        sp->wide = 1;
+    return p;
+}
+
+/* Parse the conversion starting at fmt ('%'); returns its length */
+static size_t apep_binlog_parse_spec(const char *fmt, apep_binlog_spec_t *sp)
+{
+    const char *p = fmt + 1;
+    sp->stars = 0;
+    sp->prec_star = 0;
+    sp->wide = 0;
+    sp->kind = '?';
+
+    if (*p == '%')
+    {
+        sp->kind = 0;
+        return 2;
+    }
+
+    while (*p && strchr("-+ #0'", *p))
+        p++;
+    if (*p == '*')
+    {
+        sp->stars++;
+        p++;
+    }
+    else
+    {
+        p = apep_binlog_skip_field(p, sp);
+    }
+    if (*p == '.')
+    {
+        p++;
+        if (*p == '*')
+        {
+            sp->stars++;
+            sp->prec_star = 1;
+            p++;
+        }
+        else
+        {
+            p = apep_binlog_skip_field(p, sp);
+        }
+    }
+
+    char length = 0; /* 'H' hh, 'h', 'l', 'q' ll, 'L', 'z', 'j', 't' */
+    if (p[0] == 'h' && p[1] == 'h')
+        length = 'H', p += 2;
+    else if (p[0] == 'l' && p[1] == 'l')
+        length = 'q', p += 2;
+    else if (*p && strchr("hlLqzjt", *p))
+        length = *p == 'q' ? 'q' : *p, p++;
+
+    char conv = *p;
+    if (!conv)
+        return (size_t)(p - fmt);
+    p++;
+
+    switch (conv)
+    {
+    case 'd':
+    case 'i':
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'c':
+        if (conv == 'c' && length == 'l')
+            break; /* wint_t */
+        switch (length)
+        {
+        case 'l':
+            sp->kind = APEP_BK_LONG;
+            break;
+        case 'q':
+            sp->kind = APEP_BK_LLONG;
+            break;
+        case 'z':
+            sp->kind = APEP_BK_SIZE;
+            break;
+        case 'j':
+            sp->kind = APEP_BK_INTMAX;
+            break;
+        case 't':
+            sp->kind = APEP_BK_PTRDIFF;
+            break;
+        case 'L':
+            break;
+        default:
+            sp->kind = APEP_BK_INT; /* hh, h and none promote to int */
+            break;
+        }
+        break;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        sp->kind = length == 'L' ? APEP_BK_LDOUBLE : (length == 0 || length == 'l') ? APEP_BK_DOUBLE : '?';
+        break;
+    case 's':
+        if (length == 0)
+            sp->kind = APEP_BK_STR;
+        break;
+    case 'p':
+        if (length == 0)
+            sp->kind = APEP_BK_PTR;
+        break;
+    default:
+        break; /* %n, %ls, %C, %S, unknown */
+    }
+
+    size_t n = (size_t)(p - fmt);
+    if (n >= sizeof(sp->text))
+    {
+        sp->kind = '?';
+        return n;
+    }
+    memcpy(sp->text, fmt, n);
+    sp->text[n] = '\0';
+    return n;
+}
+
+/* Argument kinds of fmt in order, or NULL if fmt cannot be deferred */
+static unsigned char *apep_binlog_parse_kinds(const char *fmt)
+{
+    unsigned char *kinds = (unsigned char *)malloc(strlen(fmt) + 1);
+    if (!kinds)
+        return NULL;
+
+    size_t k = 0;
+    for (const char *p = fmt; *p;)
+    {
+        if (*p != '%')
+        {
+            p++;
+            continue;
+        }
+
+        apep_binlog_spec_t sp;
+        p += apep_binlog_parse_spec(p, &sp);
+        if (sp.kind == '?')
+        {
+            free(kinds);
+            return NULL;
+        }
+        if (sp.kind == 0)
+            continue;
+        for (int s = 0; s < sp.stars; s++)
+            kinds[k++] = APEP_BK_INT;
+        kinds[k++] = (unsigned char)sp.kind;
+    }
+    kinds[k] = '\0';
+    return kinds;
+}
+
+/* ----------------------------
+Sites
+---------------------------- */
+
+static unsigned apep_binlog_register(apep_binlog_site_t *site)
+{
+    apep_spin_lock(&g_bl_site_lock);
+
+    unsigned id = site->id;
+    if (id == 0)
+    {
+        unsigned char *kinds = site->fmt ? apep_binlog_parse_kinds(site->fmt) : NULL;
+        unsigned n = g_bl_site_count;
+        apep_binlog_site_t **chunk = kinds && n < APEP_BINLOG_SITE_CHUNK * APEP_BINLOG_SITE_CHUNKS
+                                         ? g_bl_sites[n / APEP_BINLOG_SITE_CHUNK]
+                                         : NULL;
+        if (kinds && !chunk && n < APEP_BINLOG_SITE_CHUNK * APEP_BINLOG_SITE_CHUNKS)
+        {
+            chunk = (apep_binlog_site_t **)calloc(APEP_BINLOG_SITE_CHUNK, sizeof(*chunk));
+            g_bl_sites[n / APEP_BINLOG_SITE_CHUNK] = chunk;
+        }
+
+        if (chunk)
+        {
+            chunk[n % APEP_BINLOG_SITE_CHUNK] = site;
+            site->kinds = kinds;
+            id = n + 1;
+            APEP_STORE_RELEASE(&g_bl_site_count, n + 1);
+        }
+        else
+        {
+            free(kinds);
+            id = APEP_BINLOG_UNSUPPORTED;
+        }
+        APEP_STORE_RELEASE(&site->id, id);
+    }
+
+    apep_spin_unlock(&g_bl_site_lock);
+    return id;
+}
+
+static const apep_binlog_site_t *apep_binlog_site(unsigned id)
+{
+    if (id == 0 || id > APEP_LOAD_ACQUIRE(&g_bl_site_count))
+        return NULL;
+    id--;
+    return g_bl_sites[id / APEP_BINLOG_SITE_CHUNK][id % APEP_BINLOG_SITE_CHUNK];
+}
+
+/* ----------------------------
+Per-thread rings
+---------------------------- */
+
+static void apep_binlog_ring_free(apep_binlog_ring_t *ring)
+{
+    free(ring->data);
+    free(ring);
+}
+
+/* Caller holds g_bl_lock */
+static void apep_binlog_ring_unlink(apep_binlog_ring_t *ring)
+{
+    for (apep_binlog_ring_t **link = &g_bl_rings; *link; link = &(*link)->next)
+    {
+        if (*link == ring)
+        {
+            *link = ring->next;
+            return;
+        }
+    }
+}
+
+static void apep_binlog_ring_discard(apep_binlog_ring_t *ring);
+
+/* Owning thread exited: free the ring now, or let the drainer free it
+   once its records are out */
+static void apep_binlog_ring_release(apep_binlog_ring_t *ring)
+{
+    apep_spin_lock(&g_bl_lock);
+    if (APEP_LOAD_ACQUIRE(&g_bl_running) || g_bl_draining || g_bl_drain_open)
+    {
+        APEP_STORE_RELEASE(&ring->abandoned, 1L);
+        ring = NULL;
+    }
+    else
+    {
+        apep_binlog_ring_discard(ring);
+        apep_binlog_ring_unlink(ring);
+    }
+    apep_spin_unlock(&g_bl_lock);
+
+    if (ring)
+        apep_binlog_ring_free(ring);
+}
+
+#if defined(_WIN32)
+static DWORD g_bl_fls = FLS_OUT_OF_INDEXES;
+static INIT_ONCE g_bl_fls_once = INIT_ONCE_STATIC_INIT;
+
+static void WINAPI apep_binlog_thread_exit(void *p)
+{
+    if (p)
+        apep_binlog_ring_release((apep_binlog_ring_t *)p);
+}
+
+static BOOL CALLBACK apep_binlog_fls_init(PINIT_ONCE once, PVOID param, PVOID *ctx)
+{
+    (void)once;
+    (void)param;
+    (void)ctx;
+    g_bl_fls = FlsAlloc(apep_binlog_thread_exit);
+    return TRUE;
+}
+
+static void apep_binlog_watch_thread(apep_binlog_ring_t *ring)
+{
+    InitOnceExecuteOnce(&g_bl_fls_once, apep_binlog_fls_init, NULL, NULL);
+    if (g_bl_fls != FLS_OUT_OF_INDEXES)
+        FlsSetValue(g_bl_fls, ring);
+}
+#else
+static pthread_key_t g_bl_key;
+static pthread_once_t g_bl_key_once = PTHREAD_ONCE_INIT;
+
+static void apep_binlog_thread_exit(void *p)
+{
+    apep_binlog_ring_release((apep_binlog_ring_t *)p);
+}
+
+static void apep_binlog_key_init(void)
+{
+    pthread_key_create(&g_bl_key, apep_binlog_thread_exit);
+}
+
+static void apep_binlog_watch_thread(apep_binlog_ring_t *ring)
+{
+    pthread_once(&g_bl_key_once, apep_binlog_key_init);
+    pthread_setspecific(g_bl_key, ring);
+}
+#endif
+
+static apep_binlog_ring_t *apep_binlog_attach(void)
+{
+    size_t cap = 4096;
+    while (cap < g_bl_cfg.ring_size)
+        cap <<= 1;
+
+    apep_binlog_ring_t *ring = (apep_binlog_ring_t *)calloc(1, sizeof(*ring));
+    if (!ring)
+        return NULL;
+    ring->data = (unsigned char *)malloc(cap);
+    if (!ring->data)
+    {
+        free(ring);
+        return NULL;
+    }
+    ring->mask = cap - 1;
+    memset(ring->data, 0, cap); /* fault the pages in now, not while recording */
+
+    apep_spin_lock(&g_bl_lock);
+    ring->next = g_bl_rings;
+    g_bl_rings = ring;
+    apep_spin_unlock(&g_bl_lock);
+
+    apep_binlog_watch_thread(ring);
+    t_bl_ring = ring;
+    return ring;
+}
+
+/* ----------------------------
+Recording
+---------------------------- */
+
+static size_t apep_binlog_args_size(const unsigned char *kinds, va_list args)
+{
+    size_t size = 0;
+    for (const unsigned char *k = kinds; *k; k++)
+    {
+        switch (*k)
+        {
+        case APEP_BK_INT:
+            (void)va_arg(args, int);
+            size += sizeof(int);
+            break;
+        case APEP_BK_LONG:
+            (void)va_arg(args, long);
+            size += sizeof(long);
+            break;
+        case APEP_BK_LLONG:
+            (void)va_arg(args, long long);
+            size += sizeof(long long);
+            break;
+        case APEP_BK_SIZE:
+            (void)va_arg(args, size_t);
+            size += sizeof(size_t);
+            break;
+        case APEP_BK_INTMAX:
+            (void)va_arg(args, intmax_t);
+            size += sizeof(intmax_t);
+            break;
+        case APEP_BK_PTRDIFF:
+            (void)va_arg(args, ptrdiff_t);
+            size += sizeof(ptrdiff_t);
+            break;
+        case APEP_BK_DOUBLE:
+            (void)va_arg(args, double);
+            size += sizeof(double);
+            break;
+        case APEP_BK_LDOUBLE:
+            (void)va_arg(args, long double);
+            size += sizeof(long double);
+            break;
+        case APEP_BK_PTR:
+            (void)va_arg(args, void *);
+            size += sizeof(void *);
+            break;
+        case APEP_BK_STR:
+        {
+            const char *s = va_arg(args, const char *);
+            size += sizeof(uint32_t) + (s ? strlen(s) + 1 : 0);
+            break;
+        }
+        }
+    }
+    return size;
+}
+
+#define APEP_BINLOG_PUT(T)             \
+    do                                 \
+    {                                  \
+        T v_ = va_arg(args, T);        \
+        memcpy(dst, &v_, sizeof(v_));  \
+        dst += sizeof(v_);             \
+    } while (0)
+
+static void apep_binlog_args_copy(unsigned char *dst, const unsigned char *kinds, va_list args)
+{
+    for (const unsigned char *k = kinds; *k; k++)
+    {
+        switch (*k)
+        {
+        case APEP_BK_INT:
+            APEP_BINLOG_PUT(int);
+            break;
+        case APEP_BK_LONG:
+            APEP_BINLOG_PUT(long);
+            break;
+        case APEP_BK_LLONG:
+            APEP_BINLOG_PUT(long long);
+            break;
+        case APEP_BK_SIZE:
+            APEP_BINLOG_PUT(size_t);
+            break;
+        case APEP_BK_INTMAX:
+            APEP_BINLOG_PUT(intmax_t);
+            break;
+        case APEP_BK_PTRDIFF:
+            APEP_BINLOG_PUT(ptrdiff_t);
+            break;
+        case APEP_BK_DOUBLE:
+            APEP_BINLOG_PUT(double);
+            break;
+        case APEP_BK_LDOUBLE:
+            APEP_BINLOG_PUT(long double);
+            break;
+        case APEP_BK_PTR:
+            APEP_BINLOG_PUT(void *);
+            break;
+        case APEP_BK_STR:
+        {
+            const char *s = va_arg(args, const char *);
+            uint32_t n = s ? (uint32_t)strlen(s) : APEP_BINLOG_NULL_STR;
+            memcpy(dst, &n, sizeof(n));
+            dst += sizeof(n);
+            if (s)
+            {
+                memcpy(dst, s, (size_t)n + 1);
+                dst += (size_t)n + 1;
+            }
+            break;
+        }
+        }
+    }
+}
+
+void apep_binlog_write(apep_binlog_site_t *site, const char *fmt, ...)
+{
+    unsigned id = APEP_LOAD_ACQUIRE(&site->id);
+    if (id == 0)
+        id = apep_binlog_register(site);
+
+    apep_binlog_ring_t *ring = t_bl_ring;
+    int running = (int)APEP_LOAD_ACQUIRE(&g_bl_running);
+    if (id == APEP_BINLOG_UNSUPPORTED || !running || (!ring && !(ring = apep_binlog_attach())))
+    {
+        va_list args;
+        va_start(args, fmt);
+        apep_print_message_vfmt(running && !g_bl_cfg.file ? g_bl_cfg.opt : NULL, site->level, site->tag, fmt, args);
+        va_end(args);
+        return;
+    }
+
+    unsigned long long ticks = APEP_BINLOG_TICKS();
+
+    va_list args;
+    va_start(args, fmt);
+    size_t len = apep_binlog_args_size(site->kinds, args);
+    va_end(args);
+
+    /* Reserve a contiguous stride, padding to the end of the ring if the
+       record would wrap */
+    size_t cap = ring->mask + 1;
+    size_t stride = APEP_BINLOG_STRIDE(len);
+    unsigned long long tail = ring->tail;
+    size_t off = (size_t)(tail & ring->mask);
+    size_t pad = stride > cap - off ? cap - off : 0;
+
+    /* The drainer's head is only read again when the last value seen
+       leaves too little room, so the common case touches no shared line */
+    if (tail + pad + stride - ring->head_seen > cap)
+    {
+        ring->head_seen = APEP_LOAD_ACQUIRE(&ring->head);
+        if (stride > cap / 2 || tail + pad + stride - ring->head_seen > cap)
+        {
+            APEP_FETCH_ADD64(&g_bl_dropped, 1);
+            return;
+        }
+    }
+
+    if (pad)
+    {
+        apep_binlog_rec_t filler = {0, 0, 0};
+        memcpy(ring->data + off, &filler, sizeof(filler));
+        tail += pad;
+        off = 0;
+    }
+
+    apep_binlog_rec_t rec;
+    rec.id = id;
+    rec.len = (uint32_t)len;
+    rec.ticks = ticks;
+    memcpy(ring->data + off, &rec, sizeof(rec));
+
+    va_start(args, fmt);
+    apep_binlog_args_copy(ring->data + off + sizeof(rec), site->kinds, args);
+    va_end(args);
+
+    APEP_STORE_RELEASE(&ring->tail, tail + stride);
+}
+
+/* ----------------------------
+Formatting recorded arguments
+---------------------------- */
+
+typedef struct apep_binlog_reader
+{
+    const unsigned char *p;
+    const unsigned char *end;
+} apep_binlog_reader_t;
+
+static int apep_binlog_take(apep_binlog_reader_t *r, void *out, size_t n)
+{
+    if ((size_t)(r->end - r->p) < n)
+        return -1;
+    memcpy(out, r->p, n);
+    r->p += n;
+    return 0;
+}
+
+#define APEP_BINLOG_EMIT(T)                                              \
+    do                                                                   \
+    {                                                                    \
+        T v_;                                                            \
+        if (apep_binlog_take(r, &v_, sizeof(v_)) != 0)                   \
+            return -1;                                                   \
+        if (sp->stars == 0)                                              \
+            apep_rbuf_printf(out, sp->text, v_);                         \
+        else if (sp->stars == 1)                                         \
+            apep_rbuf_printf(out, sp->text, star[0], v_);                \
+        else                                                             \
+            apep_rbuf_printf(out, sp->text, star[0], star[1], v_);       \
+    } while (0)
+
+static int apep_binlog_format_one(apep_rbuf_t *out, const apep_binlog_spec_t *sp, apep_binlog_reader_t *r)
+{
+    int star[2] = {0, 0};
+    for (int s = 0; s < sp->stars; s++)
+    {
+        if (apep_binlog_take(r, &star[s], sizeof(int)) != 0)
+            return -1;
+        /* Negative widths left-justify; negative precisions are rejected */
+        int is_prec = sp->prec_star && s == sp->stars - 1;
+        if (star[s] > APEP_BINLOG_MAX_FIELD || star[s] < (is_prec ? 0 : -APEP_BINLOG_MAX_FIELD))
+            return -1;
+    }
+    if (sp->wide)
+        return -1;
+
+    switch (sp->kind)
+    {
+    case APEP_BK_INT:
+        APEP_BINLOG_EMIT(int);
+        break;
+    case APEP_BK_LONG:
+        APEP_BINLOG_EMIT(long);
+        break;
+    case APEP_BK_LLONG:
+        APEP_BINLOG_EMIT(long long);
+        break;
+    case APEP_BK_SIZE:
+        APEP_BINLOG_EMIT(size_t);
+        break;
+    case APEP_BK_INTMAX:
+        APEP_BINLOG_EMIT(intmax_t);
+        break;
+    case APEP_BK_PTRDIFF:
+        APEP_BINLOG_EMIT(ptrdiff_t);
+        break;
+    case APEP_BK_DOUBLE:
+        APEP_BINLOG_EMIT(double);
+        break;
+    case APEP_BK_LDOUBLE:
+        APEP_BINLOG_EMIT(long double);
+        break;
+    case APEP_BK_PTR:
+        APEP_BINLOG_EMIT(void *);
+        break;
+    case APEP_BK_STR:
+    {
+        uint32_t n;
+        if (apep_binlog_take(r, &n, sizeof(n)) != 0)
+            return -1;
+        const char *s = NULL;
+        if (n != APEP_BINLOG_NULL_STR)
+        {
+            if ((size_t)(r->end - r->p) <= n || r->p[n] != '\0')
+                return -1;
+            s = (const char *)r->p;
+            r->p += (size_t)n + 1;
+        }
+        if (sp->stars == 0)
+            apep_rbuf_printf(out, sp->text, s);
+        else if (sp->stars == 1)
+            apep_rbuf_printf(out, sp->text, star[0], s);
+        else
+            apep_rbuf_printf(out, sp->text, star[0], star[1], s);
+        break;
+    }
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+/* Append fmt formatted with the recorded arguments; -1 if they run out or
+   a width or precision is out of range */
+static int apep_binlog_format(apep_rbuf_t *out, const char *fmt, const unsigned char *args, size_t len)
+{
+    apep_binlog_reader_t r = {args, args + len};
+
+    const char *lit = fmt;
+    for (const char *p = fmt; *p;)
+    {
+        if (*p != '%')
+        {
+            p++;
+            continue;
+        }
+
+        apep_rbuf_append(out, lit, (size_t)(p - lit));
+
+        apep_binlog_spec_t sp;
+        p += apep_binlog_parse_spec(p, &sp);
+        lit = p;
+        if (sp.kind == 0)
+            apep_rbuf_putc(out, '%');
+        else if (apep_binlog_format_one(out, &sp, &r) != 0)
+            return -1;
+    }
+    apep_rbuf_puts(out, lit);
+    return 0;
+}
+
+static void apep_binlog_print(
+    const apep_options_t *opt,
+    apep_level_t lvl,
+    const char *tag,
+    const char *fmt,
+    const unsigned char *args,
+    size_t len,
+    const char *prefix,
+    long long real_ms)
+{
+    char stack[APEP_RBUF_STACK];
+    apep_rbuf_t text;
+    apep_rbuf_init(&text, stack, sizeof(stack));
+
+    if (prefix)
+        apep_rbuf_puts(&text, prefix);
+    if (apep_binlog_format(&text, fmt, args, len) != 0)
+        apep_rbuf_puts(&text, " <invalid arguments>");
+    apep_print_message_at(opt, lvl, tag, fmt, apep_rbuf_cstr(&text), real_ms);
+
+    apep_rbuf_free(&text);
+}
+
+static void apep_binlog_report_dropped(const apep_options_t *opt, unsigned long long dropped)
+{
+    char msg[96];
+    snprintf(msg, sizeof(msg), "%llu binary log records dropped (ring full)", dropped);
+    apep_print_message(opt, APEP_LVL_WARN, "binlog", msg);
+}
+
+/* ----------------------------
+Binary file output
+---------------------------- */
+
+/* Records are staged in a render buffer and written in blocks */
+#define APEP_BINLOG_WRITE_BLOCK (64 * 1024)
+
+static void apep_binlog_put(apep_rbuf_t *out, const void *p, size_t n)
+{
+    apep_rbuf_append(out, (const char *)p, n);
+}
+
+static void apep_binlog_put_str(apep_rbuf_t *out, const char *s)
+{
+    uint32_t n = s ? (uint32_t)strlen(s) : 0;
+    apep_binlog_put(out, &n, sizeof(n));
+    apep_binlog_put(out, s, n);
+}
+
+static void apep_binlog_write_header(FILE *f)
+{
+    unsigned char sizes[APEP_BINLOG_SIZES] = {
+        (unsigned char)sizeof(int), (unsigned char)sizeof(long), (unsigned char)sizeof(long long),
+        (unsigned char)sizeof(size_t), (unsigned char)sizeof(ptrdiff_t), (unsigned char)sizeof(intmax_t),
+        (unsigned char)sizeof(void *), (unsigned char)sizeof(double), (unsigned char)sizeof(long double), 0};
+    uint32_t bom = APEP_BINLOG_BOM;
+    int64_t real0 = g_bl_real0_ms;
+
+    fwrite(apep_binlog_magic, 1, sizeof(apep_binlog_magic), f);
+    fwrite(sizes, 1, sizeof(sizes), f);
+    fwrite(&bom, sizeof(bom), 1, f);
+    fwrite(&real0, sizeof(real0), 1, f);
+}
+
+/* Caller holds g_bl_drain_lock */
+static void apep_binlog_write_sites(apep_rbuf_t *out)
+{
+    unsigned count = APEP_LOAD_ACQUIRE(&g_bl_site_count);
+    for (; g_bl_sites_written < count; g_bl_sites_written++)
+    {
+        const apep_binlog_site_t *site = apep_binlog_site(g_bl_sites_written + 1);
+        uint32_t id = g_bl_sites_written + 1;
+        uint32_t level = (uint32_t)site->level;
+        uint32_t line = (uint32_t)site->line;
+
+        apep_rbuf_putc(out, 'S');
+        apep_binlog_put(out, &id, sizeof(id));
+        apep_binlog_put(out, &level, sizeof(level));
+        apep_binlog_put(out, &line, sizeof(line));
+        apep_binlog_put_str(out, site->tag);
+        apep_binlog_put_str(out, site->file);
+        apep_binlog_put_str(out, site->fmt);
+    }
+}
+
+/* ----------------------------
+Draining
+Every ring is read up to the tail seen at the start and the records are
+merged by timestamp, so output from different threads is in time order
+within each drain. Drains are serialized by g_bl_drain_lock; g_bl_lock
+is taken only to snapshot the cursors and to free emptied rings, so a
+thread attaching or exiting never waits for the drain's I/O.
+---------------------------- */
+
+typedef struct apep_binlog_cursor
+{
+    apep_binlog_ring_t *ring;
+    unsigned long long pos;
+    unsigned long long end;
+} apep_binlog_cursor_t;
+
+/* Skip padding; returns the record at c->pos or NULL when drained */
+static const apep_binlog_rec_t *apep_binlog_peek(apep_binlog_cursor_t *c)
+{
+    while (c->pos < c->end)
+    {
+        size_t cap = c->ring->mask + 1;
+        size_t off = (size_t)(c->pos & c->ring->mask);
+        const apep_binlog_rec_t *rec = (const apep_binlog_rec_t *)(const void *)(c->ring->data + off);
+        if (rec->id != 0)
+            return rec;
+        c->pos += cap - off;
+    }
+    return NULL;
+}
+
+/* Caller holds g_bl_lock and no drain is open. Records still in the ring
+   were written by a producer that saw running just before a stop and
+   finished after its final drain; they are counted as dropped. */
+static void apep_binlog_ring_discard(apep_binlog_ring_t *ring)
+{
+    apep_binlog_cursor_t c;
+    c.ring = ring;
+    c.pos = ring->head;
+    c.end = APEP_LOAD_ACQUIRE(&ring->tail);
+
+    unsigned long long n = 0;
+    const apep_binlog_rec_t *rec;
+    while ((rec = apep_binlog_peek(&c)) != NULL)
+    {
+        c.pos += APEP_BINLOG_STRIDE(rec->len);
+        n++;
+    }
+    if (n)
+        APEP_FETCH_ADD64(&g_bl_dropped, n);
+    APEP_STORE_RELEASE(&ring->head, c.pos);
+}
+
+/* Caller holds g_bl_drain_lock and no drain is open */
+static void apep_binlog_discard_late(void)
+{
+    apep_spin_lock(&g_bl_lock);
+    for (apep_binlog_ring_t *ring = g_bl_rings; ring; ring = ring->next)
+        apep_binlog_ring_discard(ring);
+    apep_spin_unlock(&g_bl_lock);
+}
+
+static unsigned long long apep_binlog_ns(unsigned long long ticks)
+{
+    return ticks > g_bl_tick0 ? (unsigned long long)((double)(ticks - g_bl_tick0) * g_bl_ns_per_tick) : 0;
+}
+
+/* Caller holds g_bl_drain_lock. Rings in the snapshot stay allocated
+   until g_bl_draining is cleared: exiting threads only mark theirs. */
+static void apep_binlog_drain_locked(void)
+{
+    apep_spin_lock(&g_bl_lock);
+    size_t n = 0;
+    for (apep_binlog_ring_t *ring = g_bl_rings; ring; ring = ring->next)
+        n++;
+
+    apep_binlog_cursor_t local[16];
+    apep_binlog_cursor_t *cur = n <= 16 ? local : (apep_binlog_cursor_t *)malloc(n * sizeof(*cur));
+    if (!cur)
+    {
+        apep_spin_unlock(&g_bl_lock);
+        return;
+    }
+
+    size_t i = 0;
+    for (apep_binlog_ring_t *ring = g_bl_rings; ring; ring = ring->next, i++)
+    {
+        cur[i].ring = ring;
+        cur[i].pos = ring->head;
+        cur[i].end = APEP_LOAD_ACQUIRE(&ring->tail);
+    }
+    g_bl_draining = 1;
+    apep_spin_unlock(&g_bl_lock);
+
+    FILE *f = g_bl_cfg.file;
+    const apep_options_t *opt = g_bl_cfg.opt;
+    int global = !f && !opt;
+    if (global)
+        opt = apep_global_options_acquire();
+
+    char stack[APEP_RBUF_STACK];
+    apep_rbuf_t out;
+    apep_rbuf_init(&out, stack, sizeof(stack));
+    if (f)
+        apep_binlog_write_sites(&out);
+
+    for (;;)
+    {
+        apep_binlog_cursor_t *next = NULL;
+        const apep_binlog_rec_t *rec = NULL;
+        for (i = 0; i < n; i++)
+        {
+            const apep_binlog_rec_t *r = apep_binlog_peek(&cur[i]);
+            if (r && (!rec || r->ticks < rec->ticks))
+            {
+                rec = r;
+                next = &cur[i];
+            }
+        }
+        if (!rec)
+            break;
+
+        const unsigned char *args = (const unsigned char *)(rec + 1);
+        const apep_binlog_site_t *site = apep_binlog_site(rec->id);
+        if (site && f)
+        {
+            uint32_t id = rec->id;
+            uint64_t ns = apep_binlog_ns(rec->ticks);
+            uint32_t len = rec->len;
+            apep_rbuf_putc(&out, 'M');
+            apep_binlog_put(&out, &id, sizeof(id));
+            apep_binlog_put(&out, &ns, sizeof(ns));
+            apep_binlog_put(&out, &len, sizeof(len));
+            apep_binlog_put(&out, args, len);
+            if (apep_rbuf_size(&out) >= APEP_BINLOG_WRITE_BLOCK)
+            {
+                apep_rbuf_write(&out, f);
+                apep_rbuf_reset(&out);
+            }
+        }
+        else if (site)
+        {
+            long long ms = g_bl_real0_ms + (long long)(apep_binlog_ns(rec->ticks) / 1000000ull);
+            apep_binlog_print(opt, site->level, site->tag, site->fmt, args, rec->len, NULL, ms);
+        }
+        next->pos += APEP_BINLOG_STRIDE(rec->len);
+    }
+
+    for (i = 0; i < n; i++)
+        APEP_STORE_RELEASE(&cur[i].ring->head, cur[i].pos);
+
+    unsigned long long dropped = APEP_LOAD_ACQUIRE(&g_bl_dropped);
+    if (dropped != g_bl_dropped_reported)
+    {
+        if (f)
+        {
+            uint64_t total = dropped;
+            apep_rbuf_putc(&out, 'D');
+            apep_binlog_put(&out, &total, sizeof(total));
+        }
+        else
+        {
+            apep_binlog_report_dropped(opt, dropped - g_bl_dropped_reported);
+        }
+        g_bl_dropped_reported = dropped;
+    }
+
+    if (f)
+    {
+        apep_rbuf_write(&out, f);
+        fflush(f);
+    }
+    apep_rbuf_free(&out);
+    if (global)
+        apep_global_options_release();
+    if (cur != local)
+        free(cur);
+
+    /* Rings of exited threads go once empty */
+    apep_spin_lock(&g_bl_lock);
+    g_bl_draining = 0;
+    apep_binlog_ring_t **link = &g_bl_rings;
+    while (*link)
+    {
+        apep_binlog_ring_t *ring = *link;
+        if (APEP_LOAD_ACQUIRE(&ring->abandoned) && ring->head == APEP_LOAD_ACQUIRE(&ring->tail))
+        {
+            *link = ring->next;
+            apep_binlog_ring_free(ring);
+        }
+        else
+        {
+            link = &ring->next;
+        }
+    }
+    apep_spin_unlock(&g_bl_lock);
+}
+
+void apep_binlog_flush(void)
+{
+    if (!APEP_LOAD_ACQUIRE(&g_bl_running))
+        return;
+
+    apep_spin_lock(&g_bl_drain_lock);
+    if (g_bl_drain_open)
+        apep_binlog_drain_locked();
+    apep_spin_unlock(&g_bl_drain_lock);
+}
+
+/* ----------------------------
+Background thread
+---------------------------- */
+
+#if defined(_WIN32)
+static HANDLE g_bl_thread;
+
+static unsigned __stdcall apep_binlog_thread(void *arg)
+#else
+static pthread_t g_bl_thread;
+
+static void *apep_binlog_thread(void *arg)
+#endif
+{
+    (void)arg;
+    while (!APEP_LOAD_ACQUIRE(&g_bl_stopping))
+    {
+        apep_binlog_sleep_ms(g_bl_cfg.flush_interval);
+        apep_binlog_flush();
+    }
+    return 0;
+}
+
+void apep_binlog_config_default(apep_binlog_config_t *cfg)
+{
+    if (!cfg)
+        return;
+    cfg->ring_size = 64 * 1024;
+    cfg->flush_interval = 50;
+    cfg->file = NULL;
+    cfg->opt = NULL;
+}
+
+int apep_binlog_start(const apep_binlog_config_t *cfg)
+{
+    apep_spin_lock(&g_bl_drain_lock);
+    if (APEP_LOAD_ACQUIRE(&g_bl_running))
+    {
+        apep_spin_unlock(&g_bl_drain_lock);
+        return -1;
+    }
+
+    if (cfg)
+        g_bl_cfg = *cfg;
+    else
+        apep_binlog_config_default(&g_bl_cfg);
+    if (g_bl_cfg.flush_interval == 0)
+        g_bl_cfg.flush_interval = 1;
+
+    /* Timestamps are ticks since start; calibrate the tick rate briefly */
+    unsigned long long ns0 = apep_binlog_clock_ns();
+    g_bl_tick0 = APEP_BINLOG_TICKS();
+    unsigned long long ns1;
+    while ((ns1 = apep_binlog_clock_ns()) - ns0 < 2000000ull)
+        ;
+    unsigned long long tick1 = APEP_BINLOG_TICKS();
+    g_bl_ns_per_tick = tick1 > g_bl_tick0 ? (double)(ns1 - ns0) / (double)(tick1 - g_bl_tick0) : 1.0;
+    g_bl_real0_ms = apep_clock_real_ms() - (long long)((ns1 - ns0) / 1000000ull);
+
+    g_bl_sites_written = 0;
+    if (g_bl_cfg.file)
+        apep_binlog_write_header(g_bl_cfg.file);
+
+    /* Records written after the last stop's final drain are counted as
+       dropped, not silently discarded */
+    apep_binlog_discard_late();
+    g_bl_dropped_reported = APEP_LOAD_ACQUIRE(&g_bl_dropped);
+
+    g_bl_stopping = 0;
+    int ok;
+#if defined(_WIN32)
+    g_bl_thread = (HANDLE)_beginthreadex(NULL, 0, apep_binlog_thread, NULL, 0, NULL);
+    ok = g_bl_thread != NULL;
+#else
+    ok = pthread_create(&g_bl_thread, NULL, apep_binlog_thread, NULL) == 0;
+#endif
+    if (ok)
+    {
+        apep_spin_lock(&g_bl_lock);
+        g_bl_drain_open = 1;
+        APEP_STORE_RELEASE(&g_bl_running, 1L);
+        apep_spin_unlock(&g_bl_lock);
+    }
+    apep_spin_unlock(&g_bl_drain_lock);
+    return ok ? 0 : -1;
+}
+
+void apep_binlog_stop(void)
+{
+    if (!APEP_LOAD_ACQUIRE(&g_bl_running))
+        return;
+
+    APEP_STORE_RELEASE(&g_bl_stopping, 1L);
+#if defined(_WIN32)
+    WaitForSingleObject(g_bl_thread, INFINITE);
+    CloseHandle(g_bl_thread);
+#else
+    pthread_join(g_bl_thread, NULL);
+#endif
+
+    /* Refuse new records before the final drain. A producer that saw
+       running just before this may still finish its record afterwards;
+       apep_binlog_discard_late() counts those as dropped. */
+    APEP_STORE_RELEASE(&g_bl_running, 0L);
+
+    apep_spin_lock(&g_bl_drain_lock);
+    if (g_bl_drain_open)
+        apep_binlog_drain_locked();
+    apep_spin_lock(&g_bl_lock);
+    g_bl_drain_open = 0;
+    apep_spin_unlock(&g_bl_lock);
+    apep_spin_unlock(&g_bl_drain_lock);
+}
+
+unsigned long long apep_binlog_dropped(void)
+{
+    if (!APEP_LOAD_ACQUIRE(&g_bl_running))
+    {
+        apep_spin_lock(&g_bl_drain_lock);
+        if (!g_bl_drain_open)
+            apep_binlog_discard_late();
+        apep_spin_unlock(&g_bl_drain_lock);
+    }
+    return APEP_LOAD_ACQUIRE(&g_bl_dropped);
+}
+
+/* ----------------------------
+Replay
+---------------------------- */
+
+typedef struct apep_binlog_replay_site
+{
+    apep_level_t level;
+    char *tag;
+    char *fmt;
+} apep_binlog_replay_site_t;
+
+static int apep_binlog_get_str(FILE *in, char **out)
+{
+    uint32_t n;
+    if (fread(&n, sizeof(n), 1, in) != 1)
+        return -1;
+    char *s = (char *)malloc((size_t)n + 1);
+    if (!s)
+        return -1;
+    if (n && fread(s, 1, n, in) != n)
+    {
+        free(s);
+        return -1;
+    }
+    s[n] = '\0';
+    *out = s;
+    return 0;
+}
+
+long apep_binlog_replay(FILE *in, const apep_options_t *opt, unsigned flags)
+{
+    if (!in)
+        return -1;
+
+    char magic[sizeof(apep_binlog_magic)];
+    unsigned char sizes[APEP_BINLOG_SIZES];
+    uint32_t bom;
+    int64_t real0;
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+        memcmp(magic, apep_binlog_magic, sizeof(magic)) != 0 ||
+        fread(sizes, 1, sizeof(sizes), in) != sizeof(sizes) ||
+        fread(&bom, sizeof(bom), 1, in) != 1 || bom != APEP_BINLOG_BOM ||
+        fread(&real0, sizeof(real0), 1, in) != 1)
+        return -1;
+
+    unsigned char here[APEP_BINLOG_SIZES] = {
+        (unsigned char)sizeof(int), (unsigned char)sizeof(long), (unsigned char)sizeof(long long),
+        (unsigned char)sizeof(size_t), (unsigned char)sizeof(ptrdiff_t), (unsigned char)sizeof(intmax_t),
+        (unsigned char)sizeof(void *), (unsigned char)sizeof(double), (unsigned char)sizeof(long double), 0};
+    if (memcmp(sizes, here, sizeof(here)) != 0)
+        return -1;
+
+    const apep_options_t *o = opt ? opt : apep_global_options_acquire();
+
+    apep_binlog_replay_site_t *sites = NULL;
+    size_t site_cap = 0;
+    unsigned char *args = NULL;
+    size_t args_cap = 0;
+    unsigned long long dropped = 0;
+    long messages = 0;
+
+    int kind;
+    while ((kind = fgetc(in)) != EOF)
+    {
+        if (kind == 'S')
+        {
+            uint32_t id, level, line;
+            char *tag = NULL, *file = NULL, *fmt = NULL;
+            if (fread(&id, sizeof(id), 1, in) != 1 || fread(&level, sizeof(level), 1, in) != 1 ||
+                fread(&line, sizeof(line), 1, in) != 1 || apep_binlog_get_str(in, &tag) != 0 ||
+                apep_binlog_get_str(in, &file) != 0 || apep_binlog_get_str(in, &fmt) != 0 || id == 0)
+            {
+                free(tag);
+                free(file);
+                free(fmt);
+                break;
+            }
+            free(file);
+
+            if (id > site_cap)
+            {
+                size_t cap = site_cap ? site_cap : 64;
+                while (cap < id)
+                    cap *= 2;
+                apep_binlog_replay_site_t *grown = (apep_binlog_replay_site_t *)realloc(sites, cap * sizeof(*sites));
+                if (!grown)
+                {
+                    free(tag);
+                    free(fmt);
+                    break;
+                }
+                memset(grown + site_cap, 0, (cap - site_cap) * sizeof(*grown));
+                sites = grown;
+                site_cap = cap;
+            }
+            free(sites[id - 1].tag);
+            free(sites[id - 1].fmt);
+            sites[id - 1].level = (apep_level_t)level;
+            sites[id - 1].tag = tag;
+            sites[id - 1].fmt = fmt;
+        }
+        else if (kind == 'M')
+        {
+            uint32_t id, len;
+            uint64_t ns;
+            if (fread(&id, sizeof(id), 1, in) != 1 || fread(&ns, sizeof(ns), 1, in) != 1 ||
+                fread(&len, sizeof(len), 1, in) != 1)
+                break;
+            if (len > args_cap)
+            {
+                unsigned char *grown = (unsigned char *)realloc(args, len);
+                if (!grown)
+                    break;
+                args = grown;
+                args_cap = len;
+            }
+            if (len && fread(args, 1, len, in) != len)
+                break;
+            if (id == 0 || id > site_cap || !sites[id - 1].fmt)
+                continue;
+
+            char prefix[40];
+            if (flags & APEP_BINLOG_REPLAY_TIME)
+                snprintf(prefix, sizeof(prefix), "[%12.6f] ", (double)ns / 1e9);
+            apep_binlog_print(o, sites[id - 1].level, sites[id - 1].tag, sites[id - 1].fmt, args, len,
+                              (flags & APEP_BINLOG_REPLAY_TIME) ? prefix : NULL,
+                              (long long)real0 + (long long)(ns / 1000000ull));
+            messages++;
+        }
+        else if (kind == 'D')
+        {
+            uint64_t total;
+            if (fread(&total, sizeof(total), 1, in) != 1)
+                break;
+            if (total > dropped)
+                apep_binlog_report_dropped(o, total - dropped);
+            dropped = total;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < site_cap; i++)
+    {
+        free(sites[i].tag);
+        free(sites[i].fmt);
+    }
+    free(sites);
+    free(args);
+    if (!opt)
+        apep_global_options_release();
+    return messages;
+}
@@ -1,10 +1,15 @@
 #include "../include/apep/apep.h"
 #include "../include/apep/apep_helpers.h"
+#include "../include/apep/apep_json.h"
+#include "apep_internal.h"
 #include <stdlib.h>
 #include <string.h>
 
 #define MAX_BUFFERED_DIAGS 1024
 
+/* Compact flushes write in blocks of about this size */
+#define APEP_BUFFER_WRITE_BLOCK (64 * 1024)
+
 typedef struct buffered_diag
 {
     apep_severity_t sev;
@@ -13,6 +18,8 @@ typedef struct buffered_diag
     char *file;
     int line;
     int col;
+    size_t seq;  /* insertion order */
+    size_t rule; /* SARIF rule index while exporting */
 } buffered_diag_t;
 
 struct apep_diagnostic_buffer
@@ -75,7 +82,8 @@ void apep_buffer_add(
         buf->capacity = new_cap;
     }
 
-    buffered_diag_t *d = &buf->diags[buf->count++];
+    buffered_diag_t *d = &buf->diags[buf->count];
+    d->seq = buf->count++;
     d->sev = sev;
     d->code = str_dup(code);
     d->message = str_dup(message);
@@ -118,11 +126,57 @@ void apep_buffer_flush(
         qsort(buf->diags, buf->count, sizeof(buffered_diag_t), compare_diags);
     }
 
+    /* Routed: each diagnostic goes to the sinks of its severity, in each
+       sink's format */
+    if (opt && opt->router)
+    {
+        for (size_t i = 0; i < buf->count; i++)
+        {
+            const buffered_diag_t *d = &buf->diags[i];
+            apep_emit_t em;
+            for (apep_emit_begin(&em, opt, APEP_ROUTE_KEY_SEVERITY(d->sev), 0); apep_emit_next(&em);)
+                apep_render_json_diagnostic(&em.rb, &em.caps, em.format, d->sev, d->code, d->message, d->file,
+                                            d->line, d->col, 1, NULL, 0);
+        }
+        apep_buffer_clear(buf);
+        return;
+    }
+
+    /* Hold the stream for the whole batch so it is not interleaved */
+    FILE *out = (opt && opt->out) ? opt->out : stderr;
+
+    /* NDJSON: the whole batch renders into one buffer, written in blocks */
+    if (opt && opt->format == APEP_FORMAT_JSON)
+    {
+        char storage[APEP_RBUF_STACK];
+        apep_rbuf_t rb;
+        apep_rbuf_init(&rb, storage, sizeof(storage));
+
+        APEP_LOCK_STREAM(out);
+        for (size_t i = 0; i < buf->count; i++)
+        {
+            const buffered_diag_t *d = &buf->diags[i];
+            apep_render_json_diagnostic_compact(&rb, d->sev, d->code, d->message, d->file, d->line, d->col, 1, NULL, 0);
+            if (apep_rbuf_size(&rb) >= APEP_BUFFER_WRITE_BLOCK || i + 1 == buf->count)
+            {
+                apep_rbuf_write(&rb, out);
+                apep_rbuf_reset(&rb);
+            }
+        }
+        APEP_UNLOCK_STREAM(out);
+
+        apep_rbuf_free(&rb);
+        apep_buffer_clear(buf);
+        return;
+    }
+
+    APEP_LOCK_STREAM(out);
+
     for (size_t i = 0; i < buf->count; i++)
     {
         buffered_diag_t *d = &buf->diags[i];
         apep_print_json_diagnostic(
-            opt ? opt->out : stderr,
+            out,
             d->sev,
             d->code,
             d->message,
@@ -134,9 +188,287 @@ void apep_buffer_flush(
             0);
     }
 
+    APEP_UNLOCK_STREAM(out);
     apep_buffer_clear(buf);
 }
 
+/* ----------------------------
+SARIF export
+The buffer is sorted in place, by code for the rules and by location for
+the artifacts and results, and put back in insertion order afterwards;
+the document streams out in write blocks with no memory beyond the buffer.
+---------------------------- */
+
+#define APEP_SARIF_SCHEMA "https://json.schemastore.org/sarif-2.1.0.json"
+#define APEP_SARIF_NO_RULE ((size_t)-1)
+
+/* NULL sorts first */
+static int apep_sarif_strcmp(const char *a, const char *b)
+{
+    if (!a || !b)
+        return (a != NULL) - (b != NULL);
+    return strcmp(a, b);
+}
+
+static int apep_sarif_seqcmp(const buffered_diag_t *a, const buffered_diag_t *b)
+{
+    return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+static int compare_by_code(const void *a, const void *b)
+{
+    const buffered_diag_t *da = a;
+    const buffered_diag_t *db = b;
+    int cmp = apep_sarif_strcmp(da->code, db->code);
+    return cmp ? cmp : apep_sarif_seqcmp(da, db);
+}
+
+static int compare_by_location(const void *a, const void *b)
+{
+    const buffered_diag_t *da = a;
+    const buffered_diag_t *db = b;
+    int cmp = apep_sarif_strcmp(da->file, db->file);
+    if (cmp != 0)
+        return cmp;
+    if (da->line != db->line)
+        return (da->line > db->line) - (da->line < db->line);
+    if (da->col != db->col)
+        return (da->col > db->col) - (da->col < db->col);
+    return apep_sarif_seqcmp(da, db);
+}
+
+static int compare_by_seq(const void *a, const void *b)
+{
+    return apep_sarif_seqcmp(a, b);
+}
+
+static const char *apep_sarif_level(apep_severity_t sev)
+{
+    switch (sev)
+    {
+    case APEP_SEV_ERROR:
+        return "error";
+    case APEP_SEV_WARN:
+        return "warning";
+    case APEP_SEV_NOTE:
+    default:
+        return "note";
+    }
+}
+
+/* Paths become URI references: '\\' is written as '/', absolute paths get
+   a file: scheme, bytes that may not appear in a URI path are %-encoded */
+static void apep_sarif_write_uri(apep_json_writer_t *w, const char *file)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    char storage[256];
+    apep_rbuf_t rb;
+    apep_rbuf_init(&rb, storage, sizeof(storage));
+
+    const unsigned char *p = (const unsigned char *)file;
+    int drive = ((p[0] | 0x20) >= 'a' && (p[0] | 0x20) <= 'z') && p[1] == ':' && (p[2] == '/' || p[2] == '\\');
+    if (drive)
+        apep_rbuf_puts(&rb, "file:///");
+    else if (p[0] == '/')
+        apep_rbuf_puts(&rb, "file://");
+
+    for (; *p; p++)
+    {
+        unsigned char c = *p;
+        if (c == '\\')
+            apep_rbuf_putc(&rb, '/');
+        else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                 strchr("-._~/!$&'()*+,;=:@", c))
+            apep_rbuf_putc(&rb, (char)c);
+        else
+        {
+            char esc[3] = {'%', digits[c >> 4], digits[c & 15]};
+            apep_rbuf_append(&rb, esc, 3);
+        }
+    }
+    apep_json_stringn(w, apep_rbuf_cstr(&rb), apep_rbuf_size(&rb));
+    apep_rbuf_free(&rb);
+}
+
+/* Write out a full block; 0 or -1 */
+static int apep_sarif_drain(apep_rbuf_t *rb, FILE *out)
+{
+    if (apep_rbuf_size(rb) < APEP_BUFFER_WRITE_BLOCK)
+        return 0;
+    int rc = apep_rbuf_write(rb, out);
+    apep_rbuf_reset(rb);
+    return rc;
+}
+
+static void apep_sarif_write_result(apep_json_writer_t *w, const buffered_diag_t *d, long long artifact)
+{
+    apep_json_begin_object(w);
+    if (d->code)
+    {
+        apep_json_key(w, "ruleId");
+        apep_json_string(w, d->code);
+        apep_json_key(w, "ruleIndex");
+        apep_json_uint(w, d->rule);
+    }
+    apep_json_key(w, "level");
+    apep_json_string(w, apep_sarif_level(d->sev));
+    apep_json_key(w, "message");
+    apep_json_begin_object(w);
+    apep_json_key(w, "text");
+    apep_json_string(w, d->message ? d->message : "");
+    apep_json_end_object(w);
+
+    if (d->file)
+    {
+        apep_json_key(w, "locations");
+        apep_json_begin_array(w);
+        apep_json_begin_object(w);
+        apep_json_key(w, "physicalLocation");
+        apep_json_begin_object(w);
+        apep_json_key(w, "artifactLocation");
+        apep_json_begin_object(w);
+        apep_json_key(w, "uri");
+        apep_sarif_write_uri(w, d->file);
+        apep_json_key(w, "index");
+        apep_json_int(w, artifact);
+        apep_json_end_object(w);
+        if (d->line > 0)
+        {
+            apep_json_key(w, "region");
+            apep_json_begin_object(w);
+            apep_json_key(w, "startLine");
+            apep_json_int(w, d->line);
+            if (d->col > 0)
+            {
+                apep_json_key(w, "startColumn");
+                apep_json_int(w, d->col);
+            }
+            apep_json_end_object(w);
+        }
+        apep_json_end_object(w);
+        apep_json_end_object(w);
+        apep_json_end_array(w);
+    }
+    apep_json_end_object(w);
+}
+
+int apep_buffer_write_sarif(
+    apep_diagnostic_buffer_t *buf,
+    FILE *out,
+    const char *tool_name,
+    const char *tool_version)
+{
+    if (!buf || !out)
+        return -1;
+
+    char storage[APEP_RBUF_STACK];
+    apep_rbuf_t rb;
+    apep_rbuf_init(&rb, storage, sizeof(storage));
+    apep_json_writer_t w;
+    apep_json_writer_init(&w, &rb, 0, NULL);
+    int rc = 0;
+
+    /* Held for the whole document so it is not interleaved */
+    APEP_LOCK_STREAM(out);
+    apep_json_begin_object(&w);
+    apep_json_key(&w, "$schema");
+    apep_json_string(&w, APEP_SARIF_SCHEMA);
+    apep_json_key(&w, "version");
+    apep_json_string(&w, "2.1.0");
+    apep_json_key(&w, "runs");
+    apep_json_begin_array(&w);
+    apep_json_begin_object(&w);
+
+    /* One rule per distinct code, in code order */
+    apep_json_key(&w, "tool");
+    apep_json_begin_object(&w);
+    apep_json_key(&w, "driver");
+    apep_json_begin_object(&w);
+    apep_json_key(&w, "name");
+    apep_json_string(&w, (tool_name && tool_name[0]) ? tool_name : "apep");
+    if (tool_version)
+    {
+        apep_json_key(&w, "version");
+        apep_json_string(&w, tool_version);
+    }
+    apep_json_key(&w, "rules");
+    apep_json_begin_array(&w);
+    if (buf->count > 1)
+        qsort(buf->diags, buf->count, sizeof(buffered_diag_t), compare_by_code);
+    size_t rules = 0;
+    for (size_t i = 0; i < buf->count; i++)
+    {
+        buffered_diag_t *d = &buf->diags[i];
+        if (!d->code)
+        {
+            d->rule = APEP_SARIF_NO_RULE;
+            continue;
+        }
+        if (i == 0 || apep_sarif_strcmp(d->code, buf->diags[i - 1].code) != 0)
+        {
+            apep_json_begin_object(&w);
+            apep_json_key(&w, "id");
+            apep_json_string(&w, d->code);
+            apep_json_end_object(&w);
+            rules++;
+            if (apep_sarif_drain(&rb, out) != 0)
+                rc = -1;
+        }
+        d->rule = rules - 1;
+    }
+    apep_json_end_array(&w);
+    apep_json_end_object(&w);
+    apep_json_end_object(&w);
+
+    /* One artifact per distinct file; results follow in the same order */
+    if (buf->count > 1)
+        qsort(buf->diags, buf->count, sizeof(buffered_diag_t), compare_by_location);
+    apep_json_key(&w, "artifacts");
+    apep_json_begin_array(&w);
+    for (size_t i = 0; i < buf->count; i++)
+    {
+        const buffered_diag_t *d = &buf->diags[i];
+        if (!d->file || (i > 0 && apep_sarif_strcmp(d->file, buf->diags[i - 1].file) == 0))
+            continue;
+        apep_json_begin_object(&w);
+        apep_json_key(&w, "location");
+        apep_json_begin_object(&w);
+        apep_json_key(&w, "uri");
+        apep_sarif_write_uri(&w, d->file);
+        apep_json_end_object(&w);
+        apep_json_end_object(&w);
+        if (apep_sarif_drain(&rb, out) != 0)
+            rc = -1;
+    }
+    apep_json_end_array(&w);
+
+    apep_json_key(&w, "results");
+    apep_json_begin_array(&w);
+    long long artifact = -1;
+    for (size_t i = 0; i < buf->count; i++)
+    {
+        const buffered_diag_t *d = &buf->diags[i];
+        if (d->file && (i == 0 || apep_sarif_strcmp(d->file, buf->diags[i - 1].file) != 0))
+            artifact++;
+        apep_sarif_write_result(&w, d, artifact);
+        if (apep_sarif_drain(&rb, out) != 0)
+            rc = -1;
+    }
+    apep_json_end_array(&w);
+    apep_json_end_object(&w);
+    apep_json_end_array(&w);
+    apep_json_end_object(&w);
+
+    if (apep_json_writer_end(&w) != 0 || apep_rbuf_write(&rb, out) != 0)
+        rc = -1;
+    APEP_UNLOCK_STREAM(out);
+
+    if (buf->count > 1)
+        qsort(buf->diags, buf->count, sizeof(buffered_diag_t), compare_by_seq);
+    apep_rbuf_free(&rb);
+    return rc;
+}
+
 void apep_buffer_clear(apep_diagnostic_buffer_t *buf)
 {
     if (!buf)
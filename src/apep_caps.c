@@ -12,7 +12,9 @@
 #endif
 
 #include "../include/apep/apep.h"
+#include "apep_internal.h"
 
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -48,19 +50,16 @@ static int apep_str_contains_utf8(const char *s)
     return (strstr(s, "UTF-8") || strstr(s, "utf8") || strstr(s, "UTF8"));
 }
 
-static int apep_detect_is_tty(FILE *out)
+static int apep_detect_is_tty(int fd)
 {
-    if (!out)
-        return 0;
-    int fd = APEP_FILENO(out);
     if (fd < 0)
         return 0;
     return APEP_ISATTY(fd) ? 1 : 0;
 }
 
-static int apep_detect_width(FILE *out, int fallback)
+static int apep_detect_width(int fd, int fallback)
 {
-    (void)out;
+    (void)fd;
 
 #if defined(_WIN32)
     HANDLE h = GetStdHandle(STD_ERROR_HANDLE);
@@ -74,7 +73,6 @@ static int apep_detect_width(FILE *out, int fallback)
     int w = (int)(info.srWindow.Right - info.srWindow.Left + 1);
     return (w > 0) ? w : fallback;
 #else
-    int fd = out ? APEP_FILENO(out) : -1;
     if (fd < 0)
         return fallback;
 
@@ -114,6 +112,26 @@ static int apep_detect_color_auto(int is_tty)
     return 1;
 }
 
+/* Color depth the terminal advertises: 24 (truecolor), 8 (256) or 4 (16) */
+static int apep_detect_color_depth(void)
+{
+    const char *colorterm = getenv("COLORTERM");
+    if (colorterm && (strstr(colorterm, "truecolor") || strstr(colorterm, "24bit")))
+        return 24;
+
+#if defined(_WIN32)
+    /* Windows Terminal supports 24-bit color */
+    if (apep_env_is_set("WT_SESSION"))
+        return 24;
+#endif
+
+    const char *term = getenv("TERM");
+    if (term && strstr(term, "256"))
+        return 8;
+
+    return 4;
+}
+
 static int apep_detect_unicode_auto(int is_tty)
 {
     if (!is_tty)
@@ -135,30 +153,189 @@ static int apep_detect_unicode_auto(int is_tty)
     return 0;
 }
 
+/* ----------------------------
+Capability cache
+Terminal facts are cached per fd and environment facts process wide.
+The fd table is direct-mapped in pages of APEP_CAPS_PAGE_FDS entries,
+allocated the first time a descriptor in their range is probed and kept
+for the life of the process, so servers whose sockets and log files sit
+at high descriptors are cached too. Entries carry the generation they
+were probed in; bumping the generation invalidates them all without
+touching the table.
+---------------------------- */
+
+#define APEP_CAPS_PAGE_FDS 64
+#define APEP_CAPS_PAGES 1024 /* descriptors below 65536 are cached */
+
+typedef struct apep_fd_caps
+{
+    volatile unsigned stamp; /* generation + 1 when filled, 0 = empty */
+    volatile int is_tty;
+    volatile int width; /* probed width, before override/clamping */
+} apep_fd_caps_t;
+
+typedef struct apep_env_caps
+{
+    volatile unsigned stamp;
+    volatile int no_color;
+    volatile int ci;
+    volatile int tty_color;   /* color heuristic result for a TTY */
+    volatile int tty_unicode; /* unicode heuristic result for a TTY */
+    volatile int color_depth;
+} apep_env_caps_t;
+
+static apep_fd_caps_t g_fd_caps_first[APEP_CAPS_PAGE_FDS]; /* stdio and friends */
+static apep_fd_caps_t *volatile g_fd_caps_pages[APEP_CAPS_PAGES];
+static volatile long g_fd_caps_lock;
+static apep_env_caps_t g_env_caps;
+static volatile sig_atomic_t g_caps_generation = 0;
+static volatile unsigned g_env_generation = 0;
+
+void apep_caps_invalidate(void)
+{
+    g_caps_generation = g_caps_generation + 1;
+}
+
+void apep_caps_refresh_env(void)
+{
+    APEP_STORE_RELEASE(&g_env_generation, APEP_LOAD_ACQUIRE(&g_env_generation) + 1);
+}
+
+/* Cache entry for fd, or NULL if fd is out of range or its page could
+   not be allocated */
+static apep_fd_caps_t *apep_caps_fd_entry(int fd)
+{
+    if (fd < 0 || fd >= APEP_CAPS_PAGE_FDS * APEP_CAPS_PAGES)
+        return NULL;
+    if (fd < APEP_CAPS_PAGE_FDS)
+        return &g_fd_caps_first[fd];
+
+    size_t page = (size_t)fd / APEP_CAPS_PAGE_FDS;
+    apep_fd_caps_t *entries = APEP_LOAD_ACQUIRE(&g_fd_caps_pages[page]);
+    if (!entries)
+    {
+        apep_spin_lock(&g_fd_caps_lock);
+        entries = g_fd_caps_pages[page];
+        if (!entries)
+        {
+            entries = (apep_fd_caps_t *)calloc(APEP_CAPS_PAGE_FDS, sizeof(*entries));
+            if (entries)
+                APEP_STORE_RELEASE(&g_fd_caps_pages[page], entries);
+        }
+        apep_spin_unlock(&g_fd_caps_lock);
+        if (!entries)
+            return NULL;
+    }
+    return &entries[(size_t)fd % APEP_CAPS_PAGE_FDS];
+}
+
+static void apep_caps_probe_fd(int fd, int *is_tty, int *width)
+{
+    apep_fd_caps_t *e = apep_caps_fd_entry(fd);
+    if (!e)
+    {
+        *is_tty = apep_detect_is_tty(fd);
+        *width = apep_detect_width(fd, 80);
+        return;
+    }
+
+    unsigned stamp = (unsigned)g_caps_generation + 1u;
+    if (APEP_LOAD_ACQUIRE(&e->stamp) != stamp)
+    {
+        e->is_tty = apep_detect_is_tty(fd);
+        e->width = apep_detect_width(fd, 80);
+        APEP_STORE_RELEASE(&e->stamp, stamp);
+    }
+
+    *is_tty = e->is_tty;
+    *width = e->width;
+}
+
+static const apep_env_caps_t *apep_caps_env(void)
+{
+    unsigned stamp = APEP_LOAD_ACQUIRE(&g_env_generation) + 1u;
+    if (APEP_LOAD_ACQUIRE(&g_env_caps.stamp) != stamp)
+    {
+        g_env_caps.no_color = apep_env_is_set("NO_COLOR");
+        g_env_caps.ci = apep_env_is_set("CI");
+        g_env_caps.tty_color = apep_detect_color_auto(1);
+        g_env_caps.tty_unicode = apep_detect_unicode_auto(1);
+        g_env_caps.color_depth = apep_detect_color_depth();
+        APEP_STORE_RELEASE(&g_env_caps.stamp, stamp);
+    }
+    return &g_env_caps;
+}
+
+#if !defined(_WIN32) && defined(SIGWINCH)
+static struct sigaction g_prev_winch;
+static volatile sig_atomic_t g_winch_installed = 0;
+
+static void apep_caps_on_winch(int sig, siginfo_t *info, void *ctx)
+{
+    apep_caps_invalidate();
+
+    if (g_prev_winch.sa_flags & SA_SIGINFO)
+    {
+        if (g_prev_winch.sa_sigaction)
+            g_prev_winch.sa_sigaction(sig, info, ctx);
+    }
+    else if (g_prev_winch.sa_handler != SIG_DFL && g_prev_winch.sa_handler != SIG_IGN)
+    {
+        g_prev_winch.sa_handler(sig);
+    }
+}
+
+int apep_caps_watch_resize(void)
+{
+    if (g_winch_installed)
+        return 0;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = apep_caps_on_winch;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+
+    if (sigaction(SIGWINCH, &sa, &g_prev_winch) != 0)
+        return -1;
+
+    g_winch_installed = 1;
+    return 0;
+}
+#else
+int apep_caps_watch_resize(void)
+{
+    return -1;
+}
+#endif
+
 apep_caps_t apep_detect_caps(FILE *out, const apep_options_t *opt)
+{
+    return apep_detect_caps_fd(out ? APEP_FILENO(out) : -1, opt);
+}
+
+apep_caps_t apep_detect_caps_fd(int fd, const apep_options_t *opt)
 {
     apep_caps_t caps;
-    caps.is_tty = apep_detect_is_tty(out);
+    const apep_env_caps_t *env = apep_caps_env();
 
     int width = 80;
+    apep_caps_probe_fd(fd, &caps.is_tty, &width);
     if (opt && opt->width_override > 0)
     {
         width = opt->width_override;
     }
-    else
-    {
-        width = apep_detect_width(out, 80);
-    }
     if (width < 20)
         width = 20; /* keep layouts sane */
     caps.width = width;
+    caps.color_depth = env->color_depth;
 
     /* Color */
     if (opt && opt->force_no_color)
     {
         caps.color = 0;
     }
-    else if (apep_env_is_set("NO_COLOR"))
+    else if (env->no_color)
     {
         caps.color = 0;
     }
@@ -178,13 +355,13 @@ apep_caps_t apep_detect_caps(FILE *out, const apep_options_t *opt)
         else
         {
             /* AUTO */
-            if (apep_env_is_set("CI"))
+            if (env->ci)
             {
                 caps.color = 0;
             }
             else
             {
-                caps.color = apep_detect_color_auto(caps.is_tty);
+                caps.color = caps.is_tty ? env->tty_color : 0;
             }
         }
     }
@@ -196,7 +373,7 @@ apep_caps_t apep_detect_caps(FILE *out, const apep_options_t *opt)
     else if (um == APEP_UNICODE_ON)
         caps.unicode = caps.is_tty ? 1 : 0;
     else
-        caps.unicode = apep_detect_unicode_auto(caps.is_tty);
+        caps.unicode = caps.is_tty ? env->tty_unicode : 0;
 
     if (opt && opt->force_ascii)
     {
@@ -1,74 +1,308 @@
 #include "apep_internal.h"
 
-static void apep_write(FILE *out, const char *s)
+#include <string.h>
+
+/* ----------------------------
+SGR downsampling
+Scheme escapes may use 16-color, 256-color (38;5;n) or truecolor
+(38;2;r;g;b) parameters. They are rewritten once for the terminal's depth.
+---------------------------- */
+
+/* xterm's default RGB values for the 16 basic colors */
+static const unsigned char apep_basic_rgb[16][3] = {
+    {0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0},
+    {0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+    {127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0},
+    {92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255}};
+
+static const int apep_cube_levels[6] = {0, 95, 135, 175, 215, 255};
+
+static void apep_xterm_to_rgb(int idx, int rgb[3])
+{
+    if (idx < 16)
+    {
+        for (int i = 0; i < 3; i++)
+            rgb[i] = apep_basic_rgb[idx][i];
+    }
+    else if (idx < 232)
+    {
+        idx -= 16;
+        rgb[0] = apep_cube_levels[idx / 36];
+        rgb[1] = apep_cube_levels[(idx / 6) % 6];
+        rgb[2] = apep_cube_levels[idx % 6];
+    }
+    else
+    {
+        rgb[0] = rgb[1] = rgb[2] = 8 + 10 * (idx - 232);
+    }
+}
+
+static int apep_rgb_dist(const int a[3], int r, int g, int b)
+{
+    int dr = a[0] - r, dg = a[1] - g, db = a[2] - b;
+    return dr * dr + dg * dg + db * db;
+}
+
+static int apep_rgb_to_basic(const int rgb[3])
+{
+    int best = 0, best_d = -1;
+    for (int i = 0; i < 16; i++)
+    {
+        int d = apep_rgb_dist(rgb, apep_basic_rgb[i][0], apep_basic_rgb[i][1], apep_basic_rgb[i][2]);
+        if (best_d < 0 || d < best_d)
+        {
+            best = i;
+            best_d = d;
+        }
+    }
+    return best;
+}
+
+static int apep_nearest_level(int v)
+{
+    int best = 0;
+    for (int i = 1; i < 6; i++)
+    {
+        int d = v - apep_cube_levels[i], bd = v - apep_cube_levels[best];
+        if (d * d < bd * bd)
+            best = i;
+    }
+    return best;
+}
+
+static int apep_rgb_to_xterm(const int rgb[3])
+{
+    int r = apep_nearest_level(rgb[0]);
+    int g = apep_nearest_level(rgb[1]);
+    int b = apep_nearest_level(rgb[2]);
+    int cube = 16 + 36 * r + 6 * g + b;
+    int cube_d = apep_rgb_dist(rgb, apep_cube_levels[r], apep_cube_levels[g], apep_cube_levels[b]);
+
+    int avg = (rgb[0] + rgb[1] + rgb[2]) / 3;
+    int gray = avg < 8 ? 0 : (avg - 8) / 10;
+    if (gray > 23)
+        gray = 23;
+    int gv = 8 + 10 * gray;
+    int gray_d = apep_rgb_dist(rgb, gv, gv, gv);
+
+    return gray_d < cube_d ? 232 + gray : cube;
+}
+
+typedef struct apep_sgr_out
+{
+    unsigned char *buf;
+    size_t len;
+    int params;
+} apep_sgr_out_t;
+
+static void apep_sgr_param(apep_sgr_out_t *o, int v)
 {
-    if (!out || !s)
+    char tmp[8];
+    int n = 0;
+    do
+    {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v && n < (int)sizeof(tmp));
+
+    /* Leave room for the final 'm' */
+    if (o->len + (size_t)n + 2 >= APEP_PALETTE_SEQ_MAX)
         return;
-    fputs(s, out);
+    if (o->params++)
+        o->buf[o->len++] = ';';
+    while (n)
+        o->buf[o->len++] = (unsigned char)tmp[--n];
 }
 
-void apep_color_begin(FILE *out, const apep_caps_t *caps, apep_color_role_t role)
+/* Emit an extended color (from 38/48 parameters) at the target depth */
+static void apep_sgr_color(apep_sgr_out_t *o, int bg, int is_rgb, const int rgb[3], int idx, int depth)
 {
-    if (!out || !caps || !caps->color)
+    int base = bg ? 48 : 38;
+
+    if (depth >= 24 && is_rgb)
+    {
+        apep_sgr_param(o, base);
+        apep_sgr_param(o, 2);
+        for (int i = 0; i < 3; i++)
+            apep_sgr_param(o, rgb[i]);
+        return;
+    }
+
+    if (depth >= 8)
+    {
+        apep_sgr_param(o, base);
+        apep_sgr_param(o, 5);
+        apep_sgr_param(o, is_rgb ? apep_rgb_to_xterm(rgb) : idx);
+        return;
+    }
+
+    int c[3] = {rgb[0], rgb[1], rgb[2]};
+    if (!is_rgb)
+        apep_xterm_to_rgb(idx, c);
+    int basic = apep_rgb_to_basic(c);
+    apep_sgr_param(o, (basic < 8 ? (bg ? 40 : 30) : (bg ? 100 : 90)) + (basic & 7));
+}
+
+static int apep_clamp_byte(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+/* Rewrite one escape string into a single SGR sequence for depth.
+   Strings that are not plain SGR sequences are copied verbatim. */
+static void apep_palette_resolve(unsigned char *slot, const char *code, int depth)
+{
+    apep_sgr_out_t o = {slot + 1, 0, 0};
+    int params[APEP_PALETTE_SEQ_MAX];
+    int count = 0;
+    const char *p = code;
+
+    slot[0] = 0;
+    if (!code || !code[0])
         return;
 
-    /* ANSI SGR sequences. Keep it minimal and readable. */
-    switch (role)
+    /* Collect the parameters of every ESC [ ... m sequence */
+    while (*p)
+    {
+        if (p[0] != '\x1b' || p[1] != '[')
+            goto verbatim;
+        p += 2;
+        for (;;)
+        {
+            int v = 0, digits = 0;
+            while (*p >= '0' && *p <= '9')
+            {
+                if (v < 100000)
+                    v = v * 10 + (*p - '0');
+                p++;
+                digits++;
+            }
+            if (count < APEP_PALETTE_SEQ_MAX)
+                params[count++] = digits ? v : 0;
+            if (*p == ';')
+            {
+                p++;
+                continue;
+            }
+            if (*p == 'm')
+            {
+                p++;
+                break;
+            }
+            goto verbatim;
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        int v = params[i];
+        if ((v == 38 || v == 48) && i + 2 < count && params[i + 1] == 5)
+        {
+            int zero[3] = {0, 0, 0};
+            apep_sgr_color(&o, v == 48, 0, zero, params[i + 2] & 0xFF, depth);
+            i += 2;
+        }
+        else if ((v == 38 || v == 48) && i + 4 < count && params[i + 1] == 2)
+        {
+            int rgb[3] = {apep_clamp_byte(params[i + 2]), apep_clamp_byte(params[i + 3]), apep_clamp_byte(params[i + 4])};
+            apep_sgr_color(&o, v == 48, 1, rgb, 0, depth);
+            i += 4;
+        }
+        else
+        {
+            apep_sgr_param(&o, v);
+        }
+    }
+
+    /* ESC [ params m */
+    memmove(slot + 3, slot + 1, o.len);
+    slot[1] = '\x1b';
+    slot[2] = '[';
+    slot[3 + o.len] = 'm';
+    slot[0] = (unsigned char)(o.len + 3);
+    return;
+
+verbatim:
+{
+    size_t n = strlen(code);
+    if (n > APEP_PALETTE_SEQ_MAX - 1)
+        n = 0; /* too long to be a color; drop it rather than truncate */
+    memcpy(slot + 1, code, n);
+    slot[0] = (unsigned char)n;
+}
+}
+
+/* ----------------------------
+Palette cache
+One palette per depth, rebuilt under a lock when the scheme generation
+changes. A sequence count is odd while a rebuild writes; readers copy a
+role out and retry if a rebuild overlapped the copy, so they never see a
+mix of two schemes.
+---------------------------- */
+
+typedef struct apep_palette_slot
+{
+    volatile unsigned seq;   /* odd while pal is being written */
+    volatile unsigned stamp; /* scheme generation + 1 of pal, 0 = never built */
+    volatile long lock;      /* serializes rebuilds */
+    apep_palette_t pal;
+} apep_palette_slot_t;
+
+static apep_palette_slot_t g_palettes[3]; /* depth 4, 8, 24 */
+
+static apep_palette_slot_t *apep_palette_slot(int color_depth)
+{
+    apep_palette_slot_t *slot = &g_palettes[color_depth >= 24 ? 2 : (color_depth >= 8 ? 1 : 0)];
+    unsigned stamp = apep_scheme_generation() + 1u;
+    if (APEP_LOAD_ACQUIRE(&slot->stamp) == stamp)
+        return slot;
+
+    apep_spin_lock(&slot->lock);
+    if (slot->stamp != stamp)
+    {
+        /* Resolve aside so the odd window is one copy long */
+        apep_palette_t fresh;
+        for (int role = 0; role < APEP_CR_COUNT; role++)
+            apep_palette_resolve(fresh.seq[role], apep_get_color_for_role((apep_color_role_t)role), color_depth);
+
+        APEP_STORE_RELEASE(&slot->seq, slot->seq + 1u);
+        APEP_FENCE();
+        memcpy(&slot->pal, &fresh, sizeof(fresh));
+        APEP_STORE_RELEASE(&slot->seq, slot->seq + 1u);
+        APEP_STORE_RELEASE(&slot->stamp, stamp);
+    }
+    apep_spin_unlock(&slot->lock);
+    return slot;
+}
+
+void apep_palette_copy(int color_depth, apep_color_role_t role, unsigned char *seq)
+{
+    apep_palette_slot_t *slot = apep_palette_slot(color_depth);
+    for (;;)
     {
-    case APEP_CR_SEV_ERROR:
-        apep_write(out, "\x1b[1;31m");
-        break; /* bold red */
-    case APEP_CR_SEV_WARN:
-        apep_write(out, "\x1b[33m");
-        break; /* yellow */
-    case APEP_CR_SEV_NOTE:
-        apep_write(out, "\x1b[34m");
-        break; /* blue */
-    case APEP_CR_LABEL:
-        apep_write(out, "\x1b[1m");
-        break; /* bold */
-    case APEP_CR_DIM:
-        apep_write(out, "\x1b[2m");
-        break; /* dim */
-
-    /* Log levels: conservative palette */
-    case APEP_CR_LVL_TRACE:
-        apep_write(out, "\x1b[2m");
-        break; /* dim */
-    case APEP_CR_LVL_DEBUG:
-        apep_write(out, "\x1b[36m");
-        break; /* cyan */
-    case APEP_CR_LVL_INFO:
-        apep_write(out, "\x1b[32m");
-        break; /* green */
-    case APEP_CR_LVL_WARN:
-        apep_write(out, "\x1b[33m");
-        break; /* yellow */
-    case APEP_CR_LVL_ERROR:
-        apep_write(out, "\x1b[31m");
-        break; /* red */
-    case APEP_CR_LVL_CRITICAL:
-        apep_write(out, "\x1b[1;31m");
-        break; /* bold red */
-
-    /* Highlighting */
-    case APEP_CR_HIGHLIGHT:
-        apep_write(out, "\x1b[1;33;41m");
-        break; /* bold yellow on red background */
-    case APEP_CR_CARET:
-        apep_write(out, "\x1b[1;31m");
-        break; /* bold red for ^ */
-
-    case APEP_CR_RESET:
-    default:
-        apep_write(out, "\x1b[0m");
-        break;
+        unsigned before = APEP_LOAD_ACQUIRE(&slot->seq);
+        if (before & 1u)
+            continue;
+        memcpy(seq, slot->pal.seq[role], APEP_PALETTE_SEQ_MAX);
+        APEP_FENCE_ACQUIRE();
+        if (APEP_LOAD_ACQUIRE(&slot->seq) == before)
+            return;
     }
 }
 
-void apep_color_end(FILE *out, const apep_caps_t *caps)
+void apep_color_begin(apep_rbuf_t *out, const apep_caps_t *caps, apep_color_role_t role)
+{
+    if (!out || !caps || !caps->color || role < 0 || role >= APEP_CR_COUNT)
+        return;
+
+    unsigned char seq[APEP_PALETTE_SEQ_MAX];
+    apep_palette_copy(caps->color_depth, role, seq);
+    apep_rbuf_append(out, (const char *)seq + 1, seq[0]);
+}
+
+void apep_color_end(apep_rbuf_t *out, const apep_caps_t *caps)
 {
     if (!out || !caps || !caps->color)
         return;
-    apep_write(out, "\x1b[0m");
+    apep_rbuf_append(out, "\x1b[0m", 4);
 }
@@ -35,43 +35,6 @@ typedef struct
     char **symbols;
 } apep_stack_trace_t;
 
-static void apep_fputs_utf8(FILE *out, const char *s)
-{
-    if (!s || !out)
-        return;
-
-#ifdef _WIN32
-    HANDLE h = NULL;
-    if (out == stdout)
-        h = GetStdHandle(STD_OUTPUT_HANDLE);
-    else if (out == stderr)
-        h = GetStdHandle(STD_ERROR_HANDLE);
-
-    if (h && h != INVALID_HANDLE_VALUE)
-    {
-        DWORD mode = 0;
-        if (GetConsoleMode(h, &mode))
-        {
-            int wlen = MultiByteToWideChar(CP_UTF8, 0, s, -1, NULL, 0);
-            if (wlen > 0)
-            {
-                WCHAR *wbuf = (WCHAR *)malloc(sizeof(WCHAR) * (size_t)wlen);
-                if (wbuf)
-                {
-                    MultiByteToWideChar(CP_UTF8, 0, s, -1, wbuf, wlen);
-                    DWORD written = 0;
-                    WriteConsoleW(h, wbuf, (DWORD)(wlen - 1), &written, NULL);
-                    free(wbuf);
-                    return;
-                }
-            }
-        }
-    }
-#endif
-
-    fputs(s, out);
-}
-
 apep_exception_t *apep_exception_create(const char *type, const char *format, ...)
 {
     apep_exception_t *ex = (apep_exception_t *)calloc(1, sizeof(apep_exception_t));
@@ -159,7 +122,7 @@ void apep_exception_capture_stack(apep_exception_t *ex)
     ex->stack_trace = stack;
 }
 
-static void print_stack_trace(FILE *out, const apep_stack_trace_t *stack, int indent)
+static void render_stack_trace(apep_rbuf_t *out, const apep_stack_trace_t *stack, int indent)
 {
     if (!stack || stack->frame_count <= 0)
         return;
@@ -185,12 +148,12 @@ static void print_stack_trace(FILE *out, const apep_stack_trace_t *stack, int in
 
             if (SymFromAddr(process, address, 0, symbol))
             {
-                fprintf(out, "%s  #%d: %s at 0x%llx\n",
+                apep_rbuf_printf(out, "%s  #%d: %s at 0x%llx\n",
                         indent_str, i, symbol->Name, (unsigned long long)symbol->Address);
             }
             else
             {
-                fprintf(out, "%s  #%d: <unknown> at 0x%p\n",
+                apep_rbuf_printf(out, "%s  #%d: <unknown> at 0x%p\n",
                         indent_str, i, stack->frames[i]);
             }
         }
@@ -202,7 +165,7 @@ static void print_stack_trace(FILE *out, const apep_stack_trace_t *stack, int in
     // MinGW: Simple address dump
     for (int i = 0; i < stack->frame_count; i++)
     {
-        fprintf(out, "%s  #%d: 0x%p\n",
+        apep_rbuf_printf(out, "%s  #%d: 0x%p\n",
                 indent_str, i, stack->frames[i]);
     }
 #else
@@ -213,50 +176,46 @@ static void print_stack_trace(FILE *out, const apep_stack_trace_t *stack, int in
         {
             // Parse symbol: "binary(function+offset) [address]"
             const char *sym = stack->symbols[i];
-            fprintf(out, "%s  #%d: %s\n", indent_str, i, sym);
+            apep_rbuf_puts(out, indent_str);
+            apep_rbuf_puts(out, "  #");
+            apep_rbuf_int(out, i, 0);
+            apep_rbuf_puts(out, ": ");
+            apep_rbuf_puts(out, sym);
+            apep_rbuf_putc(out, '\n');
         }
     }
 #endif
 }
 
-void apep_exception_print(const apep_options_t *opt, const apep_exception_t *ex)
+static void render_exception(apep_rbuf_t *out, const apep_caps_t *caps, const apep_exception_t *ex)
 {
-    if (!ex)
-        return;
-
-    FILE *out = stdout;
-
-    // Check if colors are supported
-    apep_options_t default_opt = {0};
-    if (!opt)
-    {
-        apep_options_default(&default_opt);
-        opt = &default_opt;
-    }
-
-    apep_caps_t caps = apep_detect_caps(out, opt);
-
     // Exception type and message
-    const char *error_color = caps.color ? "\033[1;31m" : "";
-    const char *reset = caps.color ? "\033[0m" : "";
-    const char *bold = caps.color ? "\033[1m" : "";
-
-    fprintf(out, "%s%s%s: %s\n",
-            error_color, ex->type, reset, ex->message);
+    apep_color_begin(out, caps, APEP_CR_SEV_ERROR);
+    apep_rbuf_puts(out, ex->type);
+    apep_color_end(out, caps);
+    apep_rbuf_puts(out, ": ");
+    apep_rbuf_puts(out, ex->message);
+    apep_rbuf_putc(out, '\n');
 
     // Source location
     if (ex->source_file)
     {
-        fprintf(out, "  at %s%s:%d%s\n",
-                bold, ex->source_file, ex->source_line, reset);
+        apep_rbuf_puts(out, "  at ");
+        apep_color_begin(out, caps, APEP_CR_LABEL);
+        apep_rbuf_puts(out, ex->source_file);
+        apep_rbuf_putc(out, ':');
+        apep_rbuf_int(out, ex->source_line, 0);
+        apep_color_end(out, caps);
+        apep_rbuf_putc(out, '\n');
     }
 
     // Error code
     if (ex->error_code != 0)
     {
-        fputs("  ", out);
-        apep_fputs_utf8(out, _("Error Code:"));
-        fprintf(out, " %d", ex->error_code);
+        apep_rbuf_puts(out, "  ");
+        apep_rbuf_puts(out, _("Error Code:"));
+        apep_rbuf_putc(out, ' ');
+        apep_rbuf_int(out, ex->error_code, 0);
 
         // Try to get errno description
 #ifdef _WIN32
@@ -265,35 +224,39 @@ void apep_exception_print(const apep_options_t *opt, const apep_exception_t *ex)
             char err_buf[256];
             if (strerror_s(err_buf, sizeof(err_buf), ex->error_code) == 0)
             {
-                fprintf(out, " (%s)", err_buf);
+                apep_rbuf_puts(out, " (");
+                apep_rbuf_puts(out, err_buf);
+                apep_rbuf_putc(out, ')');
             }
         }
 #else
         if (ex->error_code > 0)
         {
-            fprintf(out, " (%s)", strerror(ex->error_code));
+            apep_rbuf_puts(out, " (");
+            apep_rbuf_puts(out, strerror(ex->error_code));
+            apep_rbuf_putc(out, ')');
         }
 #endif
-        fprintf(out, "\n");
+        apep_rbuf_putc(out, '\n');
     }
 
     // Stack trace
     if (ex->stack_trace)
     {
-        fputs("  ", out);
-        apep_fputs_utf8(out, _("Stack Trace:"));
-        fputc('\n', out);
-        print_stack_trace(out, (const apep_stack_trace_t *)ex->stack_trace, 4);
+        apep_rbuf_puts(out, "  ");
+        apep_rbuf_puts(out, _("Stack Trace:"));
+        apep_rbuf_putc(out, '\n');
+        render_stack_trace(out, (const apep_stack_trace_t *)ex->stack_trace, 4);
     }
 }
 
-void apep_exception_print_chain(const apep_options_t *opt, const apep_exception_t *ex, int max_depth)
+void apep_exception_print(const apep_options_t *opt, const apep_exception_t *ex)
 {
-    if (!ex)
-        return;
-
-    FILE *out = stdout;
+    apep_exception_print_chain(opt, ex, 1);
+}
 
+static void render_chain(apep_rbuf_t *out, const apep_caps_t *caps, const apep_exception_t *ex, int max_depth)
+{
     int depth = 0;
     const apep_exception_t *current = ex;
 
@@ -304,18 +267,29 @@ void apep_exception_print_chain(const apep_options_t *opt, const apep_exception_
 
         if (depth > 0)
         {
-            fputc('\n', out);
-            apep_fputs_utf8(out, _("Caused by:"));
-            fputc('\n', out);
+            apep_rbuf_putc(out, '\n');
+            apep_rbuf_puts(out, _("Caused by:"));
+            apep_rbuf_putc(out, '\n');
         }
 
-        apep_exception_print(opt, current);
+        render_exception(out, caps, current);
 
         current = current->inner;
         depth++;
     }
 }
 
+void apep_exception_print_chain(const apep_options_t *opt, const apep_exception_t *ex, int max_depth)
+{
+    if (!ex)
+        return;
+
+    // The whole chain is composed first and written once, to opt->out
+    apep_emit_t em;
+    for (apep_emit_begin(&em, opt, APEP_ROUTE_KEY_SEVERITY(APEP_SEV_ERROR), 0); apep_emit_next(&em);)
+        render_chain(&em.rb, &em.caps, ex, max_depth);
+}
+
 void apep_exception_destroy(apep_exception_t *ex)
 {
     if (!ex)
@@ -0,0 +1,362 @@
+#include "../include/apep/apep_fields.h"
+#include "../include/apep/apep_json.h"
+#include "../include/apep/apep_limit.h"
+#include "apep_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Canonical level names for machine formats (never translated) */
+static const char *apep_field_level_key(apep_level_t lvl)
+{
+    switch (lvl)
+    {
+    case APEP_LVL_TRACE:
+        return "trace";
+    case APEP_LVL_DEBUG:
+        return "debug";
+    case APEP_LVL_WARN:
+        return "warn";
+    case APEP_LVL_ERROR:
+        return "error";
+    case APEP_LVL_CRITICAL:
+        return "critical";
+    case APEP_LVL_INFO:
+    default:
+        return "info";
+    }
+}
+
+/* ----------------------------
+Scalars
+---------------------------- */
+
+/* NaN and infinities are not numbers in JSON; in text they are spelled out */
+static void apep_field_put_double(apep_rbuf_t *out, double v)
+{
+    if (v != v || v - v != 0)
+        apep_rbuf_puts(out, v != v ? "NaN" : (v > 0 ? "+Inf" : "-Inf"));
+    else
+        apep_render_double(out, v);
+}
+
+static void apep_field_put_hex(apep_rbuf_t *out, const unsigned char *p, size_t n)
+{
+    static const char digits[] = "0123456789abcdef";
+    if (n == 0 || apep_rbuf_reserve(out, n * 2) != 0)
+        return;
+    for (size_t i = 0; i < n; i++)
+    {
+        char pair[2] = {digits[p[i] >> 4], digits[p[i] & 15]};
+        apep_rbuf_append(out, pair, 2);
+    }
+}
+
+/* ----------------------------
+logfmt / pretty text
+Values are bare unless empty or holding a space, '=', '"' or a control
+byte; then they are quoted with JSON escapes.
+---------------------------- */
+
+static int apep_field_needs_quotes(const char *s, size_t n)
+{
+    if (n == 0)
+        return 1;
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned char c = (unsigned char)s[i];
+        if (c <= ' ' || c == '=' || c == '"' || c == 0x7F)
+            return 1;
+    }
+    return 0;
+}
+
+static void apep_field_put_text(apep_rbuf_t *out, const char *s, size_t n)
+{
+    if (!apep_field_needs_quotes(s, n))
+    {
+        apep_rbuf_append(out, s, n);
+        return;
+    }
+    apep_rbuf_putc(out, '"');
+    apep_json_escape(out, s, n);
+    apep_rbuf_putc(out, '"');
+}
+
+/* logfmt keys cannot be quoted: bytes that would end one become '_' */
+static void apep_field_put_key(apep_rbuf_t *out, const char *key)
+{
+    const char *k = (key && key[0]) ? key : "_";
+    const char *run = k;
+    const char *p = k;
+    for (; *p; p++)
+    {
+        unsigned char c = (unsigned char)*p;
+        if (c > ' ' && c != '=' && c != '"' && c != 0x7F)
+            continue;
+        apep_rbuf_append(out, run, (size_t)(p - run));
+        apep_rbuf_putc(out, '_');
+        run = p + 1;
+    }
+    apep_rbuf_append(out, run, (size_t)(p - run));
+}
+
+static void apep_field_put_value(apep_rbuf_t *out, const apep_field_t *f)
+{
+    switch (f->type)
+    {
+    case APEP_FIELD_INT:
+        apep_rbuf_int(out, f->v.i, 0);
+        break;
+    case APEP_FIELD_UINT:
+        apep_rbuf_uint(out, f->v.u, 0);
+        break;
+    case APEP_FIELD_DOUBLE:
+        apep_field_put_double(out, f->v.d);
+        break;
+    case APEP_FIELD_BOOL:
+        apep_rbuf_puts(out, f->v.b ? "true" : "false");
+        break;
+    case APEP_FIELD_HEX:
+        if (f->len == 0)
+            apep_rbuf_puts(out, "\"\"");
+        else
+            apep_field_put_hex(out, (const unsigned char *)f->v.bytes, f->len);
+        break;
+    case APEP_FIELD_STR:
+    default:
+        apep_field_put_text(out, f->v.s ? f->v.s : "", f->len);
+        break;
+    }
+}
+
+static void apep_field_write_json(apep_json_writer_t *w, const apep_field_t *f)
+{
+    switch (f->type)
+    {
+    case APEP_FIELD_INT:
+        apep_json_int(w, f->v.i);
+        break;
+    case APEP_FIELD_UINT:
+        apep_json_uint(w, f->v.u);
+        break;
+    case APEP_FIELD_DOUBLE:
+        apep_json_double(w, f->v.d);
+        break;
+    case APEP_FIELD_BOOL:
+        apep_json_bool(w, f->v.b);
+        break;
+    case APEP_FIELD_HEX:
+        apep_json_hex(w, f->v.bytes, f->len);
+        break;
+    case APEP_FIELD_STR:
+    default:
+        apep_json_stringn(w, f->v.s, f->len);
+        break;
+    }
+}
+
+/* ----------------------------
+Records
+---------------------------- */
+
+static void apep_render_record_pretty(
+    apep_rbuf_t *out,
+    const apep_caps_t *caps,
+    const apep_stamp_t *stamp,
+    apep_level_t lvl,
+    const char *tag,
+    const char *message,
+    const apep_field_t *fields,
+    size_t count)
+{
+    apep_render_message_head(out, caps, stamp, lvl, tag);
+    apep_rbuf_puts(out, message ? message : "");
+    for (size_t i = 0; i < count; i++)
+    {
+        apep_rbuf_putc(out, ' ');
+        apep_color_begin(out, caps, APEP_CR_LABEL);
+        apep_field_put_key(out, fields[i].key);
+        apep_color_end(out, caps);
+        apep_rbuf_putc(out, '=');
+        apep_field_put_value(out, &fields[i]);
+    }
+    apep_rbuf_putc(out, '\n');
+}
+
+static void apep_render_record_logfmt(
+    apep_rbuf_t *out,
+    const apep_stamp_t *stamp,
+    apep_level_t lvl,
+    const char *tag,
+    const char *message,
+    const apep_field_t *fields,
+    size_t count)
+{
+    if (stamp)
+    {
+        apep_rbuf_puts(out, "ts=");
+        apep_rbuf_append(out, stamp->text, stamp->len);
+        apep_rbuf_putc(out, ' ');
+    }
+    apep_rbuf_puts(out, "level=");
+    apep_rbuf_puts(out, apep_field_level_key(lvl));
+    if (tag && tag[0])
+    {
+        apep_rbuf_puts(out, " tag=");
+        apep_field_put_text(out, tag, strlen(tag));
+    }
+    apep_rbuf_puts(out, " msg=");
+    apep_field_put_text(out, message ? message : "", message ? strlen(message) : 0);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        apep_rbuf_putc(out, ' ');
+        apep_field_put_key(out, fields[i].key);
+        apep_rbuf_putc(out, '=');
+        apep_field_put_value(out, &fields[i]);
+    }
+    apep_rbuf_putc(out, '\n');
+}
+
+static void apep_render_record_json(
+    apep_rbuf_t *out,
+    const apep_stamp_t *stamp,
+    apep_level_t lvl,
+    const char *tag,
+    const char *message,
+    const apep_field_t *fields,
+    size_t count)
+{
+    apep_json_writer_t w;
+    apep_json_writer_init(&w, out, 0, NULL);
+    apep_json_begin_object(&w);
+    if (stamp)
+    {
+        /* Monotonic offsets are numbers, wall-clock times strings */
+        apep_json_key(&w, "ts");
+        if (stamp->mode == APEP_TIMESTAMP_MONOTONIC)
+            apep_json_raw(&w, stamp->text, stamp->len);
+        else
+            apep_json_stringn(&w, stamp->text, stamp->len);
+    }
+    apep_json_key(&w, "level");
+    apep_json_string(&w, apep_field_level_key(lvl));
+    if (tag && tag[0])
+    {
+        apep_json_key(&w, "tag");
+        apep_json_string(&w, tag);
+    }
+    apep_json_key(&w, "msg");
+    apep_json_string(&w, message ? message : "");
+
+    for (size_t i = 0; i < count; i++)
+    {
+        apep_json_key(&w, fields[i].key);
+        apep_field_write_json(&w, &fields[i]);
+    }
+    apep_json_end_object(&w);
+    apep_json_writer_end(&w);
+}
+
+void apep_render_record(
+    apep_rbuf_t *out,
+    const apep_caps_t *caps,
+    apep_output_format_t format,
+    const apep_stamp_t *stamp,
+    apep_level_t lvl,
+    const char *tag,
+    const char *message,
+    const struct apep_field *fields,
+    size_t count)
+{
+    if (!fields)
+        count = 0;
+
+    switch (format)
+    {
+    case APEP_FORMAT_LOGFMT:
+        apep_render_record_logfmt(out, stamp, lvl, tag, message, fields, count);
+        break;
+    case APEP_FORMAT_JSON:
+        apep_render_record_json(out, stamp, lvl, tag, message, fields, count);
+        break;
+    case APEP_FORMAT_PRETTY:
+    default:
+        apep_render_record_pretty(out, caps, stamp, lvl, tag, message, fields, count);
+        break;
+    }
+}
+
+void apep_render_fields(
+    apep_rbuf_t *out,
+    const apep_options_t *opt,
+    apep_output_format_t format,
+    apep_level_t lvl,
+    const char *tag,
+    const char *message,
+    const apep_field_t *fields,
+    size_t count)
+{
+    if (!out)
+        return;
+    apep_caps_t caps = apep_detect_caps((opt && opt->out) ? opt->out : stderr, opt);
+    apep_stamp_t st;
+    const apep_stamp_t *stamp = apep_stamp_now(&st, opt);
+    apep_render_record(out, &caps, format, stamp, lvl, tag, message, fields, count);
+}
+
+/* ----------------------------
+Printing
+---------------------------- */
+
+/* Fields before a "repeated" count is appended without allocating */
+#define APEP_FIELDS_STACK 16
+
+void apep_print_fields(
+    const apep_options_t *opt,
+    apep_level_t lvl,
+    const char *tag,
+    const char *message,
+    const apep_field_t *fields,
+    size_t count)
+{
+    if ((int)lvl < APEP_MIN_LEVEL_NOW())
+        return;
+    if (!fields)
+        count = 0;
+
+    unsigned long long repeated = 0;
+    double seconds = 0.0;
+    if (opt && opt->limiter &&
+        !apep_limiter_admit(opt->limiter, lvl, tag, message, message, &repeated, &seconds))
+        return;
+
+    /* Suppressed repeats travel as two more fields */
+    apep_field_t local[APEP_FIELDS_STACK + 2];
+    apep_field_t *all = NULL;
+    if (repeated)
+    {
+        all = count <= APEP_FIELDS_STACK ? local : (apep_field_t *)malloc((count + 2) * sizeof(*all));
+        if (all)
+        {
+            if (count)
+                memcpy(all, fields, count * sizeof(*all));
+            all[count] = apep_field_uint("repeated", repeated);
+            all[count + 1] = apep_field_double("repeated_secs", seconds);
+            fields = all;
+            count += 2;
+        }
+    }
+
+    apep_stamp_t st;
+    const apep_stamp_t *stamp = apep_stamp_now(&st, opt);
+
+    apep_emit_t em;
+    for (apep_emit_begin(&em, opt, APEP_ROUTE_KEY_LEVEL(lvl), 0); apep_emit_next(&em);)
+        apep_render_record(&em.rb, &em.caps, em.format, stamp, lvl, tag, message, fields, count);
+
+    if (all && all != local)
+        free(all);
+}
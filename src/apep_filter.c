@@ -18,3 +18,19 @@ int apep_severity_passes_filter(apep_severity_t sev)
     /* Lower numeric values = higher severity (ERROR=0, WARN=1, NOTE=2) */
     return sev <= global_min_severity;
 }
+
+volatile int apep_min_level_current = APEP_LVL_TRACE;
+
+void apep_set_min_level(apep_level_t min_lvl)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(&apep_min_level_current, (int)min_lvl, __ATOMIC_RELAXED);
+#else
+    apep_min_level_current = (int)min_lvl;
+#endif
+}
+
+apep_level_t apep_get_min_level(void)
+{
+    return (apep_level_t)APEP_MIN_LEVEL_NOW();
+}
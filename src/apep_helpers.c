@@ -1,67 +1,269 @@
 #include "../include/apep/apep_helpers.h"
 #include "../include/apep/apep_i18n.h"
+#include "apep_internal.h"
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /* ----------------------------
 Global options management
+The options live in immutable heap snapshots. Readers load the current
+snapshot pointer; writers publish a new one and retire the old. A retired
+snapshot is freed once no reader section (apep_global_options_acquire/
+release) is open, which guarantees nobody can still be using it: any
+section opened afterwards loads a newer pointer. The writer that retires
+it or the reader that closes the last section does the freeing. Sections
+count into one of several padded slots per thread so readers on different
+cores do not share a cache line.
+
+apep_get_global_options() hands out an unpinned pointer that callers may
+keep indefinitely, so a snapshot it returned is marked and never freed;
+it stays on g_kept_options instead.
 ---------------------------- */
 
-static apep_options_t g_global_options;
-static int g_global_options_set = 0;
+#define APEP_OPTS_READER_SLOTS 16
+
+typedef struct apep_opts_snapshot
+{
+    apep_options_t opt; /* first: snapshots are handed out as apep_options_t */
+    struct apep_opts_snapshot *next_retired;
+    volatile long kept; /* returned by apep_get_global_options() */
+} apep_opts_snapshot_t;
+
+typedef struct apep_opts_reader_slot
+{
+    volatile unsigned long long active;
+    char pad[64 - sizeof(unsigned long long)];
+} apep_opts_reader_slot_t;
+
+static apep_opts_snapshot_t *volatile g_global_options;
+static apep_opts_snapshot_t *volatile g_retired_options;
+static apep_opts_snapshot_t *g_kept_options;
+static volatile long g_global_options_lock;
+static apep_opts_reader_slot_t g_opts_readers[APEP_OPTS_READER_SLOTS];
+static volatile unsigned long long g_opts_next_slot;
+static APEP_THREAD_LOCAL apep_opts_reader_slot_t *t_opts_slot;
+
+/* Used only if a snapshot cannot be allocated */
+static APEP_THREAD_LOCAL apep_options_t t_fallback_options;
+
+static int apep_opts_readers_idle(void)
+{
+    for (size_t i = 0; i < APEP_OPTS_READER_SLOTS; i++)
+    {
+        if (APEP_LOAD_ACQUIRE(&g_opts_readers[i].active))
+            return 0;
+    }
+    return 1;
+}
+
+/* Caller holds g_global_options_lock. Frees the retired snapshots if no
+   section is open; kept ones move to g_kept_options. */
+static void apep_reclaim_global_options(void)
+{
+    if (!g_retired_options || !apep_opts_readers_idle())
+        return;
+
+    apep_opts_snapshot_t *snap = g_retired_options;
+    APEP_STORE_RELEASE(&g_retired_options, NULL);
+    while (snap)
+    {
+        apep_opts_snapshot_t *next = snap->next_retired;
+        /* A getter that loaded snap has closed its section, so its mark
+           is visible here */
+        if (APEP_LOAD_ACQUIRE(&snap->kept))
+        {
+            snap->next_retired = g_kept_options;
+            g_kept_options = snap;
+        }
+        else
+        {
+            free(snap);
+        }
+        snap = next;
+    }
+}
+
+/* Caller holds g_global_options_lock. Returns 0, or -1 if opt could not
+   be copied (the current snapshot stays). */
+static int apep_publish_global_options(const apep_options_t *opt)
+{
+    apep_opts_snapshot_t *snap = (apep_opts_snapshot_t *)malloc(sizeof(*snap));
+    if (!snap)
+        return -1;
+    snap->opt = *opt;
+    snap->next_retired = NULL;
+    snap->kept = 0;
+
+    apep_opts_snapshot_t *old = g_global_options;
+    APEP_STORE_RELEASE(&g_global_options, snap);
+    APEP_FENCE();
+
+    if (old)
+    {
+        old->next_retired = g_retired_options;
+        APEP_STORE_RELEASE(&g_retired_options, old);
+        /* Pairs with the fence in release: either this writer sees the
+           last reader's slot drop or that reader sees old */
+        APEP_FENCE();
+    }
+
+    /* Readers that open a section from here on see snap */
+    apep_reclaim_global_options();
+    return 0;
+}
 
 void apep_set_global_options(const apep_options_t *opt)
 {
     if (opt)
     {
-        g_global_options = *opt;
-        g_global_options_set = 1;
+        apep_spin_lock(&g_global_options_lock);
+        apep_publish_global_options(opt);
+        apep_spin_unlock(&g_global_options_lock);
     }
 }
 
+/* Current snapshot, publishing the defaults on first use. NULL only if
+   no snapshot could be allocated. */
+static apep_opts_snapshot_t *apep_load_global_options(void)
+{
+    apep_opts_snapshot_t *snap = APEP_LOAD_ACQUIRE(&g_global_options);
+    if (snap)
+        return snap;
+
+    apep_spin_lock(&g_global_options_lock);
+    if (!g_global_options)
+    {
+        apep_options_t defaults;
+        apep_options_default(&defaults);
+        apep_publish_global_options(&defaults);
+    }
+    snap = g_global_options;
+    apep_spin_unlock(&g_global_options_lock);
+    return snap;
+}
+
+static apep_opts_reader_slot_t *apep_opts_enter(void)
+{
+    apep_opts_reader_slot_t *slot = t_opts_slot;
+    if (!slot)
+    {
+        unsigned long long n = APEP_FETCH_ADD64(&g_opts_next_slot, 1);
+        slot = &g_opts_readers[n % APEP_OPTS_READER_SLOTS];
+        t_opts_slot = slot;
+    }
+
+    /* Announce the section before loading the pointer */
+    APEP_FETCH_ADD64(&slot->active, 1);
+    APEP_FENCE();
+    return slot;
+}
+
 const apep_options_t *apep_get_global_options(void)
 {
-    if (!g_global_options_set)
+    /* Mark inside a section so a writer cannot free snap between the
+       load and the mark */
+    apep_opts_enter();
+    apep_opts_snapshot_t *snap = apep_load_global_options();
+    if (snap && !APEP_LOAD_ACQUIRE(&snap->kept))
+        APEP_STORE_RELEASE(&snap->kept, 1);
+    apep_global_options_release();
+
+    if (!snap)
     {
-        apep_options_default(&g_global_options);
-        g_global_options_set = 1;
+        apep_options_default(&t_fallback_options);
+        return &t_fallback_options;
+    }
+    return &snap->opt;
+}
+
+const apep_options_t *apep_global_options_acquire(void)
+{
+    apep_opts_enter();
+    apep_opts_snapshot_t *snap = apep_load_global_options();
+    if (!snap)
+    {
+        apep_options_default(&t_fallback_options);
+        return &t_fallback_options;
+    }
+    return &snap->opt;
+}
+
+void apep_global_options_release(void)
+{
+    apep_opts_reader_slot_t *slot = t_opts_slot;
+    if (!slot)
+        return;
+
+    if (APEP_FETCH_ADD64(&slot->active, (unsigned long long)-1) != 1)
+        return;
+
+    /* The last reader out frees what writers retired meanwhile */
+    APEP_FENCE();
+    if (APEP_LOAD_ACQUIRE(&g_retired_options))
+    {
+        apep_spin_lock(&g_global_options_lock);
+        apep_reclaim_global_options();
+        apep_spin_unlock(&g_global_options_lock);
     }
-    return &g_global_options;
 }
 
 void apep_reset_global_options(void)
 {
-    apep_options_default(&g_global_options);
-    g_global_options_set = 1;
+    apep_options_t defaults;
+    apep_options_default(&defaults);
+    apep_set_global_options(&defaults);
 }
 
 /* ----------------------------
 Helper functions
 ---------------------------- */
 
+/* "error[code]: " */
+static void apep_render_error_head(apep_rbuf_t *out, const char *code)
+{
+    apep_rbuf_puts(out, _("error"));
+    if (code && code[0])
+    {
+        apep_rbuf_putc(out, '[');
+        apep_rbuf_puts(out, code);
+        apep_rbuf_putc(out, ']');
+    }
+    apep_rbuf_puts(out, ": ");
+}
+
+static void apep_render_error_hint(apep_rbuf_t *out, const char *hint)
+{
+    if (hint && hint[0])
+    {
+        apep_rbuf_puts(out, "  = ");
+        apep_rbuf_puts(out, _("hint"));
+        apep_rbuf_puts(out, ": ");
+        apep_rbuf_puts(out, hint);
+        apep_rbuf_putc(out, '\n');
+    }
+}
+
 void apep_error_simple(
     const apep_options_t *opt,
     const char *code,
     const char *message,
     const char *hint)
 {
-    const apep_options_t *o = opt ? opt : apep_get_global_options();
-    FILE *out = o->out ? o->out : stderr;
+    const apep_options_t *o = opt ? opt : apep_global_options_acquire();
 
-    /* Print error header */
-    fprintf(out, "%s", _("error"));
-    if (code && code[0])
+    apep_emit_t em;
+    for (apep_emit_begin(&em, o, APEP_ROUTE_KEY_SEVERITY(APEP_SEV_ERROR), 0); apep_emit_next(&em);)
     {
-        fprintf(out, "[%s]", code);
+        apep_render_error_head(&em.rb, code);
+        apep_rbuf_puts(&em.rb, message ? message : _("unknown error"));
+        apep_rbuf_putc(&em.rb, '\n');
+        apep_render_error_hint(&em.rb, hint);
     }
-    fprintf(out, ": %s\n", message ? message : _("unknown error"));
 
-    /* Print hint if provided */
-    if (hint && hint[0])
-    {
-        fprintf(out, "  = %s: %s\n", _("hint"), hint);
-    }
+    if (!opt)
+        apep_global_options_release();
 }
 
 void apep_error_file(
@@ -70,7 +272,6 @@ void apep_error_file(
     const char *operation,
     const char *reason)
 {
-    const apep_options_t *o = opt ? opt : apep_get_global_options();
     char msg[512];
 
     const char *fname = filename ? filename : _("<unknown>");
@@ -82,7 +283,7 @@ void apep_error_file(
     snprintf(msg, sizeof(msg), "%s %s '%s': %s",
              op_localized, _("error"), fname, rsn_localized);
 
-    apep_error_simple(o, "E_FILE", msg, NULL);
+    apep_error_simple(opt, "E_FILE", msg, NULL);
 }
 
 void apep_error_assert(
@@ -91,7 +292,6 @@ void apep_error_assert(
     const char *file,
     int line)
 {
-    const apep_options_t *o = opt ? opt : apep_get_global_options();
     char msg[512];
 
     snprintf(msg, sizeof(msg), _("assertion failed: %s"), expr ? expr : "");
@@ -99,7 +299,7 @@ void apep_error_assert(
     char hint[256];
     snprintf(hint, sizeof(hint), _("at %s:%d"), file ? file : _("<unknown>"), line);
 
-    apep_error_simple(o, "E_ASSERT", msg, hint);
+    apep_error_simple(opt, "E_ASSERT", msg, hint);
 }
 
 void apep_error_unknown_identifier(
@@ -109,7 +309,7 @@ void apep_error_unknown_identifier(
     const apep_text_source_t *src,
     apep_loc_t loc)
 {
-    const apep_options_t *o = opt ? opt : apep_get_global_options();
+    const apep_options_t *o = opt ? opt : apep_global_options_acquire();
 
     char msg[256];
     snprintf(msg, sizeof(msg), _("unknown identifier '%s'"), unknown ? unknown : "");
@@ -138,6 +338,9 @@ void apep_error_unknown_identifier(
             o, APEP_SEV_ERROR, "E_UNKNOWN",
             msg, src, loc, 0, NULL, 0);
     }
+
+    if (!opt)
+        apep_global_options_release();
 }
 
 /* ----------------------------
@@ -151,14 +354,10 @@ void apep_print_message_fmt(
     const char *fmt,
     ...)
 {
-    char buffer[1024];
     va_list args;
-
     va_start(args, fmt);
-    vsnprintf(buffer, sizeof(buffer), fmt, args);
+    apep_print_message_vfmt(opt, lvl, tag, fmt, args);
     va_end(args);
-
-    apep_print_message(opt, lvl, tag, buffer);
 }
 
 void apep_error_simple_fmt(
@@ -167,12 +366,22 @@ void apep_error_simple_fmt(
     const char *fmt,
     ...)
 {
-    char buffer[1024];
-    va_list args;
+    const apep_options_t *o = opt ? opt : apep_global_options_acquire();
 
-    va_start(args, fmt);
-    vsnprintf(buffer, sizeof(buffer), fmt, args);
-    va_end(args);
+    apep_emit_t em;
+    for (apep_emit_begin(&em, o, APEP_ROUTE_KEY_SEVERITY(APEP_SEV_ERROR), 0); apep_emit_next(&em);)
+    {
+        apep_render_error_head(&em.rb, code);
+
+        /* Formatted straight into the record, once per rendering */
+        va_list args;
+        va_start(args, fmt);
+        apep_rbuf_vprintf(&em.rb, fmt ? fmt : "", args);
+        va_end(args);
+
+        apep_rbuf_putc(&em.rb, '\n');
+    }
 
-    apep_error_simple(opt, code, buffer, NULL);
+    if (!opt)
+        apep_global_options_release();
 }
@@ -5,13 +5,17 @@
 #include <ctype.h>
 #include <string.h>
 
-static void apep_print_notes(FILE *out, const apep_note_t *notes, size_t notes_count)
+static void apep_render_notes(apep_rbuf_t *out, const apep_note_t *notes, size_t notes_count)
 {
     for (size_t i = 0; i < notes_count; i++)
     {
         const char *k = (notes[i].kind && notes[i].kind[0]) ? notes[i].kind : _("note");
         const char *m = notes[i].message ? notes[i].message : "";
-        fprintf(out, "  = %s: %s\n", k, m);
+        apep_rbuf_puts(out, "  = ");
+        apep_rbuf_puts(out, k);
+        apep_rbuf_puts(out, ": ");
+        apep_rbuf_puts(out, m);
+        apep_rbuf_putc(out, '\n');
     }
 }
 
@@ -21,8 +25,8 @@ static int apep_should_show_ascii(int width)
     return (width >= 90) ? 1 : 0;
 }
 
-static void apep_print_hex_line(
-    FILE *out,
+static void apep_render_hex_line(
+    apep_rbuf_t *out,
     const apep_caps_t *caps,
     const uint8_t *data,
     size_t data_size,
@@ -32,7 +36,8 @@ static void apep_print_hex_line(
     int show_ascii)
 {
     /* Offset */
-    fprintf(out, "%08lx: ", (unsigned long)line_off);
+    apep_rbuf_hex(out, line_off, 8, 0);
+    apep_rbuf_puts(out, ": ");
 
     /* Hex bytes (with span highlighting using colors or markers) */
     for (int i = 0; i < bpl; i++)
@@ -50,7 +55,7 @@ static void apep_print_hex_line(
 
         /* add extra space between two blocks */
         if (i == 8)
-            fputc(' ', out);
+            apep_rbuf_putc(out, ' ');
 
         if (idx < data_size)
         {
@@ -60,37 +65,38 @@ static void apep_print_hex_line(
                 if (caps && caps->color)
                 {
                     apep_color_begin(out, caps, APEP_CR_HIGHLIGHT);
-                    fprintf(out, "%02X", (unsigned)data[idx]);
+                    apep_rbuf_hex(out, data[idx], 2, 1);
                     apep_color_end(out, caps);
-                    fputc(' ', out);
+                    apep_rbuf_putc(out, ' ');
                 }
                 else
                 {
                     /* Fallback to markers for non-color terminals */
-                    fputc('*', out);
-                    fprintf(out, "%02X", (unsigned)data[idx]);
+                    apep_rbuf_putc(out, '*');
+                    apep_rbuf_hex(out, data[idx], 2, 1);
                 }
             }
             else
             {
-                fprintf(out, "%02X ", (unsigned)data[idx]);
+                apep_rbuf_hex(out, data[idx], 2, 1);
+                apep_rbuf_putc(out, ' ');
             }
         }
         else
         {
             /* Past end: keep columns aligned */
-            fputs("   ", out);
+            apep_rbuf_repeat(out, ' ', 3);
         }
     }
 
     if (!show_ascii)
     {
-        fputc('\n', out);
+        apep_rbuf_putc(out, '\n');
         return;
     }
 
     /* ASCII preview */
-    fputs(" |", out);
+    apep_rbuf_puts(out, " |");
     for (int i = 0; i < bpl; i++)
     {
         size_t idx = line_off + (size_t)i;
@@ -115,19 +121,21 @@ static void apep_print_hex_line(
         if (in_range && caps && caps->color)
         {
             apep_color_begin(out, caps, APEP_CR_HIGHLIGHT);
-            fputc(c, out);
+            apep_rbuf_putc(out, c);
             apep_color_end(out, caps);
         }
         else
         {
-            fputc(c, out);
+            apep_rbuf_putc(out, c);
         }
     }
-    fputs("|\n", out);
+    apep_rbuf_puts(out, "|\n");
 }
 
-void apep_print_hex_diagnostic(
-    const apep_options_t *opt_in,
+static void apep_render_hex(
+    apep_rbuf_t *out,
+    const apep_options_t *opt,
+    const apep_caps_t *caps,
     apep_severity_t sev,
     const char *code,
     const char *message,
@@ -138,58 +146,48 @@ void apep_print_hex_diagnostic(
     const apep_note_t *notes,
     size_t notes_count)
 {
-    apep_options_t def;
-    const apep_options_t *opt = opt_in;
-    if (!opt)
-    {
-        apep_options_default(&def);
-        opt = &def;
-    }
-
-    FILE *out = opt->out ? opt->out : stderr;
-
-    apep_caps_t caps = apep_detect_caps(out, opt);
-
-    const char *arrow = caps.unicode ? "→" : "->";
+    const char *arrow = caps->unicode ? "→" : "->";
 
     /* Header */
     apep_color_role_t role =
         (sev == APEP_SEV_ERROR) ? APEP_CR_SEV_ERROR : (sev == APEP_SEV_WARN) ? APEP_CR_SEV_WARN
                                                                              : APEP_CR_SEV_NOTE;
 
-    apep_color_begin(out, &caps, role);
-    fputs(apep_severity_name(sev), out);
-    apep_color_end(out, &caps);
+    apep_color_begin(out, caps, role);
+    apep_rbuf_puts(out, apep_severity_name(sev));
+    apep_color_end(out, caps);
 
     if (code && code[0])
     {
-        fputc('[', out);
-        apep_color_begin(out, &caps, APEP_CR_LABEL);
-        fputs(code, out);
-        apep_color_end(out, &caps);
-        fputc(']', out);
+        apep_rbuf_putc(out, '[');
+        apep_color_begin(out, caps, APEP_CR_LABEL);
+        apep_rbuf_puts(out, code);
+        apep_color_end(out, caps);
+        apep_rbuf_putc(out, ']');
     }
 
-    fputs(": ", out);
-    fputs(message ? message : "", out);
-    fputc('\n', out);
-
-    apep_color_begin(out, &caps, APEP_CR_DIM);
-    {
-        char span_msg[128];
-        snprintf(span_msg, sizeof(span_msg), _("span %lu bytes"), (unsigned long)span.length);
-        fprintf(out, "  %s %s:+0x%lx (%s)\n",
-                arrow,
-                (blob_name && blob_name[0]) ? blob_name : _("<blob>"),
-                (unsigned long)span.offset,
-                span_msg);
-    }
-    apep_color_end(out, &caps);
+    apep_rbuf_puts(out, ": ");
+    apep_rbuf_puts(out, message ? message : "");
+    apep_rbuf_putc(out, '\n');
+
+    apep_color_begin(out, caps, APEP_CR_DIM);
+    apep_rbuf_puts(out, "  ");
+    apep_rbuf_puts(out, arrow);
+    apep_rbuf_putc(out, ' ');
+    apep_rbuf_puts(out, (blob_name && blob_name[0]) ? blob_name : _("<blob>"));
+    apep_rbuf_puts(out, ":+0x");
+    apep_rbuf_hex(out, span.offset, 0, 0);
+    apep_rbuf_puts(out, " (");
+    apep_rbuf_printf(out, _("span %lu bytes"), (unsigned long)span.length);
+    apep_rbuf_puts(out, ")\n");
+    apep_color_end(out, caps);
 
     if (!data || data_size == 0)
     {
-        fprintf(out, "  (%s)\n", _("no binary data available"));
-        apep_print_notes(out, notes, notes_count);
+        apep_rbuf_puts(out, "  (");
+        apep_rbuf_puts(out, _("no binary data available"));
+        apep_rbuf_puts(out, ")\n");
+        apep_render_notes(out, notes, notes_count);
         return;
     }
 
@@ -244,20 +242,68 @@ void apep_print_hex_diagnostic(
         aligned_end = data_size;
     win_end = aligned_end;
 
-    int show_ascii = apep_should_show_ascii(caps.width);
+    int show_ascii = apep_should_show_ascii(caps->width);
 
-    {
-        char window_msg[256];
-        snprintf(window_msg, sizeof(window_msg), _("binary size: %lu bytes, window: 0x%lx..0x%lx"),
-                 (unsigned long)data_size, (unsigned long)win_start, (unsigned long)win_end);
-        fprintf(out, "  (%s)\n", window_msg);
-    }
+    apep_rbuf_puts(out, "  (");
+    apep_rbuf_printf(out, _("binary size: %lu bytes, window: 0x%lx..0x%lx"),
+                     (unsigned long)data_size, (unsigned long)win_start, (unsigned long)win_end);
+    apep_rbuf_puts(out, ")\n");
 
     /* Print hexdump lines */
     for (size_t off = win_start; off < win_end; off += (size_t)bpl)
     {
-        apep_print_hex_line(out, &caps, data, data_size, off, bpl, span, show_ascii);
+        apep_render_hex_line(out, caps, data, data_size, off, bpl, span, show_ascii);
+    }
+
+    apep_render_notes(out, notes, notes_count);
+}
+
+void apep_render_hex_diagnostic(
+    apep_rbuf_t *out,
+    const apep_options_t *opt_in,
+    apep_severity_t sev,
+    const char *code,
+    const char *message,
+    const char *blob_name,
+    const uint8_t *data,
+    size_t data_size,
+    apep_span_t span,
+    const apep_note_t *notes,
+    size_t notes_count)
+{
+    apep_options_t def;
+    const apep_options_t *opt = opt_in;
+    if (!opt)
+    {
+        apep_options_default(&def);
+        opt = &def;
+    }
+
+    apep_caps_t caps = apep_detect_caps(opt->out ? opt->out : stderr, opt);
+    apep_render_hex(out, opt, &caps, sev, code, message, blob_name, data, data_size, span, notes, notes_count);
+}
+
+void apep_print_hex_diagnostic(
+    const apep_options_t *opt_in,
+    apep_severity_t sev,
+    const char *code,
+    const char *message,
+    const char *blob_name,
+    const uint8_t *data,
+    size_t data_size,
+    apep_span_t span,
+    const apep_note_t *notes,
+    size_t notes_count)
+{
+    apep_options_t def;
+    const apep_options_t *opt = opt_in;
+    if (!opt)
+    {
+        apep_options_default(&def);
+        opt = &def;
     }
 
-    apep_print_notes(out, notes, notes_count);
+    apep_emit_t em;
+    for (apep_emit_begin(&em, opt, APEP_ROUTE_KEY_SEVERITY(sev), 0); apep_emit_next(&em);)
+        apep_render_hex(&em.rb, opt, &em.caps, sev, code, message, blob_name, data, data_size, span, notes, notes_count);
 }
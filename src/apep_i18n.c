@@ -1,4 +1,5 @@
 #include "../include/apep/apep_i18n.h"
+#include "apep_internal.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -162,30 +163,33 @@ static char *trim_whitespace(char *str)
 static char *find_unquoted_colon(char *s)
 {
     int in_quotes = 0;
-    int escaped = 0;
+    char *end = s + strlen(s);
+    char *p = s;
 
-    for (char *p = s; *p; p++)
+    /* Only quotes, backslashes and colons matter; skip everything else in bulk */
+    while ((p = (char *)apep_scan_any(p, (size_t)(end - p), "\"\\:")) != NULL)
     {
-        if (escaped)
+        if (*p == '\\')
         {
-            escaped = 0;
-            continue;
-        }
-
-        if (in_quotes && *p == '\\')
-        {
-            escaped = 1;
+            /* Escapes only apply inside quotes; stop before stepping
+               past the terminator */
+            size_t step = in_quotes ? 2 : 1;
+            if ((size_t)(end - p) <= step)
+                break;
+            p += step;
             continue;
         }
 
         if (*p == '"')
         {
             in_quotes = !in_quotes;
+            p++;
             continue;
         }
 
-        if (!in_quotes && *p == ':')
+        if (!in_quotes)
             return p;
+        p++;
     }
 
     return NULL;
@@ -352,26 +356,24 @@ static int parse_quoted_token(const char *p, const char **end, char **out)
     if (!p || *p != '"')
         return -1;
 
-    int escaped = 0;
     const char *start = p + 1;
+    const char *end_of_input = start + strlen(start);
     const char *q = start;
-    for (; *q; q++)
+    while ((q = apep_scan_any(q, (size_t)(end_of_input - q), "\"\\")) != NULL)
     {
-        if (escaped)
-        {
-            escaped = 0;
-            continue;
-        }
-        if (*q == '\\')
-        {
-            escaped = 1;
-            continue;
-        }
         if (*q == '"')
             break;
+        /* Backslash: skip the escaped character, unless the input ends
+           first (no closing quote) */
+        if (end_of_input - q <= 2)
+        {
+            q = NULL;
+            break;
+        }
+        q += 2;
     }
 
-    if (*q != '"')
+    if (!q)
         return -1;
 
     size_t len = (size_t)(q - start);
@@ -474,20 +476,58 @@ static int i18n_load_locale_file(const char *filepath)
     SetConsoleOutputCP(CP_UTF8);
 #endif
 
-    char line[2048];
-    int line_num = 0;
+    /* Slurp the file and split it into lines with the vectorized scanner */
+    size_t cap = 4096;
+    size_t len = 0;
+    char *text = (char *)malloc(cap);
+    if (!text)
+    {
+        fclose(f);
+        return -1;
+    }
 
-    while (fgets(line, sizeof(line), f))
+    for (;;)
     {
+        if (len + 1 >= cap)
+        {
+            char *grown = (char *)realloc(text, cap * 2);
+            if (!grown)
+            {
+                free(text);
+                fclose(f);
+                return -1;
+            }
+            text = grown;
+            cap *= 2;
+        }
+        size_t got = fread(text + len, 1, cap - len - 1, f);
+        if (got == 0)
+            break;
+        len += got;
+    }
+    fclose(f);
+    text[len] = '\0';
+
+    int line_num = 0;
+    char *line = text;
+    char *end = text + len;
+    while (line < end)
+    {
+        char *nl = (char *)apep_scan_byte(line, (size_t)(end - line), '\n');
+        char *line_end = nl ? nl : end;
+        *line_end = '\0';
+
         line_num++;
         int result = i18n_parse_line(line);
         if (result < 0)
         {
             fprintf(stderr, "Warning: invalid format in %s at line %d\n", filepath, line_num);
         }
+
+        line = line_end + 1;
     }
 
-    fclose(f);
+    free(text);
     return 0;
 }
 
@@ -2,6 +2,7 @@
 #define APEP_INTERNAL_H
 
 #include "../include/apep/apep.h"
+#include "../include/apep/apep_sink.h"
 
 typedef enum apep_color_role
 {
@@ -22,14 +23,393 @@ typedef enum apep_color_role
 
     /* Highlighting roles */
     APEP_CR_HIGHLIGHT, /* For highlighted spans in hex/text */
-    APEP_CR_CARET      /* For caret/pointer symbols */
+    APEP_CR_CARET,     /* For caret/pointer symbols */
+
+    /* JSON syntax roles (scheme independent) */
+    APEP_CR_JSON_KEY,
+    APEP_CR_JSON_STRING,
+    APEP_CR_JSON_NUMBER,
+    APEP_CR_JSON_PUNCT,
+
+    APEP_CR_COUNT
 } apep_color_role_t;
 
 /* Begin/end a colored segment. If caps->color == 0, these do nothing. */
-void apep_color_begin(FILE *out, const apep_caps_t *caps, apep_color_role_t role);
-void apep_color_end(FILE *out, const apep_caps_t *caps);
+void apep_color_begin(apep_rbuf_t *out, const apep_caps_t *caps, apep_color_role_t role);
+void apep_color_end(apep_rbuf_t *out, const apep_caps_t *caps);
+
+/* Built-in sources whose get_line pointers stay valid for the life of the
+   source, so rendered lines may reference them (apep_util.c/apep_source.c). */
+int apep_text_source_is_plain_string(const apep_text_source_t *src);
+int apep_text_source_is_stable(const apep_text_source_t *src);
+
+/* Write a rendered diagnostic to the stream selected by opt, honoring
+   opt->zero_copy (apep_rbuf.c). */
+int apep_rbuf_emit(const apep_rbuf_t *rb, const apep_options_t *opt);
+
+/* Stack storage each printer starts its render buffer on; larger output
+   spills to the heap. */
+#define APEP_RBUF_STACK 2048
+
+/* apep_rbuf_init() on the calling thread's scratch area when it is free
+   and larger than storage; release with apep_rbuf_free_scratch(), which
+   keeps a larger heap block the buffer grew into for the next buffer
+   (apep_rbuf.c). */
+void apep_rbuf_init_scratch(apep_rbuf_t *rb, char *storage, size_t storage_size);
+void apep_rbuf_free_scratch(apep_rbuf_t *rb);
+
+/* apep_detect_caps() for a raw descriptor; fd < 0 means not a terminal. */
+apep_caps_t apep_detect_caps_fd(int fd, const apep_options_t *opt);
+
+/* ----------------------------
+Emission (apep_sink.c)
+A printer renders a record once per distinct set of capabilities and
+message format among its destinations and each rendering goes to the
+destinations sharing it:
+
+    apep_emit_t em;
+    for (apep_emit_begin(&em, opt, key, by_ref); apep_emit_next(&em);)
+        render(&em.rb, &em.caps, ...);
+
+Without opt->router the only destination is opt->out (honoring
+opt->zero_copy). by_ref allows em.rb to reference source lines. Message
+printers serialize in em.format; other records ignore it.
+---------------------------- */
+
+#define APEP_ROUTE_KEY_LEVEL(lvl) ((int)(lvl))
+#define APEP_ROUTE_KEY_SEVERITY(sev) (8 + (int)(sev))
+#define APEP_ROUTE_KEYS 16
+
+typedef struct apep_emit
+{
+    const apep_options_t *opt;
+    apep_sink_t *const *sinks; /* routed destinations, NULL when unrouted */
+    unsigned pending;          /* sinks (bit per index) not yet written */
+    unsigned current;          /* sinks the current rendering is for */
+    int by_ref;
+    int state; /* 0 = not started, 1 = rendering, 2 = done */
+    apep_caps_t caps;
+    apep_output_format_t format; /* message format of the current rendering */
+    const signed char *formats;  /* per-sink formats (-1 = opt->format) */
+    apep_rbuf_t rb;
+    char storage[APEP_RBUF_STACK];
+} apep_emit_t;
+
+void apep_emit_begin(apep_emit_t *em, const apep_options_t *opt, int route_key, int by_ref);
+
+/* Deliver the previous rendering, if any, and prepare the next one.
+   Returns 0 (and releases em) once every destination has been written. */
+int apep_emit_next(apep_emit_t *em);
+
+/* apep_render_text_diagnostic() for known capabilities; opt is not NULL
+   (apep_text.c). */
+void apep_render_text_caps(
+    apep_rbuf_t *out,
+    const apep_options_t *opt,
+    const apep_caps_t *caps,
+    apep_severity_t sev,
+    const char *code,
+    const char *message,
+    const apep_text_source_t *src,
+    apep_loc_t loc,
+    int span_len_cols,
+    const apep_note_t *notes,
+    size_t notes_count);
+
+/* ----------------------------
+Timestamps (apep_time.c)
+A printer takes one stamp per record, before rendering it for each
+destination.
+---------------------------- */
+
+#define APEP_STAMP_MAX 32
+
+typedef struct apep_stamp
+{
+    apep_timestamp_mode_t mode;
+    size_t len;
+    char text[APEP_STAMP_MAX];
+} apep_stamp_t;
+
+/* Stamp for opt->timestamp at the current time; NULL when off. */
+const apep_stamp_t *apep_stamp_now(apep_stamp_t *st, const apep_options_t *opt);
+
+/* Stamp for mode at real_ms (ms since the epoch); NULL for none. */
+const apep_stamp_t *apep_stamp_at(apep_stamp_t *st, apep_timestamp_mode_t mode, long long real_ms);
+
+/* Coarse real-time clock, ms since the epoch. */
+long long apep_clock_real_ms(void);
+
+/* One diagnostic as a single-line JSON object (apep_json.c). */
+void apep_render_json_diagnostic_compact(
+    apep_rbuf_t *out,
+    apep_severity_t sev,
+    const char *code,
+    const char *message,
+    const char *file,
+    int line,
+    int col,
+    int span_len,
+    const apep_note_t *notes,
+    size_t notes_count);
+
+/* One diagnostic in format: compact for APEP_FORMAT_JSON, otherwise the
+   indented form with translated severity, colored per caps (apep_json.c). */
+void apep_render_json_diagnostic(
+    apep_rbuf_t *out,
+    const apep_caps_t *caps,
+    apep_output_format_t format,
+    apep_severity_t sev,
+    const char *code,
+    const char *message,
+    const char *file,
+    int line,
+    int col,
+    int span_len,
+    const apep_note_t *notes,
+    size_t notes_count);
+
+/* "[stamp ]level[tag]: "; stamp may be NULL (apep_text.c). */
+void apep_render_message_head(
+    apep_rbuf_t *out,
+    const apep_caps_t *caps,
+    const apep_stamp_t *stamp,
+    apep_level_t lvl,
+    const char *tag);
+
+/* One message record with optional fields in format; pretty records use
+   caps (apep_fields.c). */
+struct apep_field;
+void apep_render_record(
+    apep_rbuf_t *out,
+    const apep_caps_t *caps,
+    apep_output_format_t format,
+    const apep_stamp_t *stamp,
+    apep_level_t lvl,
+    const char *tag,
+    const char *message,
+    const struct apep_field *fields,
+    size_t count);
+
+/* The JSON string escape of s[0..n), without quotes (apep_json.c). */
+void apep_json_escape(apep_rbuf_t *out, const char *s, size_t n);
+
+/* A decimal of a finite v that reads back as v, '.' whatever the
+   locale (apep_json.c). */
+void apep_render_double(apep_rbuf_t *out, double v);
+
+/* apep_print_message() with the limiter keyed on key (the format string
+   for the _fmt variant) rather than the formatted text (apep_text.c). */
+void apep_print_message_keyed(
+    const apep_options_t *opt,
+    apep_level_t lvl,
+    const char *tag,
+    const char *key,
+    const char *message);
+
+/* apep_print_message_keyed() for a record made at real_ms (ms since the
+   epoch) rather than now, e.g. one drained from a deferred log. */
+void apep_print_message_at(
+    const apep_options_t *opt,
+    apep_level_t lvl,
+    const char *tag,
+    const char *key,
+    const char *message,
+    long long real_ms);
+
+/* apep_print_message_fmt() formatting straight into the record; fmt also
+   keys the limiter (apep_text.c). */
+void apep_print_message_vfmt(
+    const apep_options_t *opt,
+    apep_level_t lvl,
+    const char *tag,
+    const char *fmt,
+    va_list args);
+
+/* Print message with a "(repeated N times in T s)" note, bypassing the
+   limiter (apep_text.c). */
+void apep_emit_message_repeated(
+    const apep_options_t *opt,
+    apep_level_t lvl,
+    const char *tag,
+    const char *message,
+    unsigned long long repeated,
+    double seconds);
+
+/* apep_limiter_check() that records message as the text for
+   apep_limiter_flush() (apep_limit.c). */
+int apep_limiter_admit(
+    struct apep_limiter *lim,
+    apep_level_t lvl,
+    const char *tag,
+    const char *key,
+    const char *message,
+    unsigned long long *repeated,
+    double *seconds);
+
+/* apep_limiter_admit() keyed on fmt that formats the text only if this
+   call is the first to see the message (apep_limit.c). */
+int apep_limiter_admit_vfmt(
+    struct apep_limiter *lim,
+    apep_level_t lvl,
+    const char *tag,
+    const char *fmt,
+    va_list args,
+    unsigned long long *repeated,
+    double *seconds);
+
+/* Append the current APEP_TRACE stack (apep_stack.c). */
+void apep_stack_render(apep_rbuf_t *out);
 
 /* Get color code for role based on current color scheme */
 const char *apep_get_color_for_role(apep_color_role_t role);
 
+/* Changes whenever the active scheme or custom colors change. */
+unsigned apep_scheme_generation(void);
+
+/* Resolved palette: one SGR sequence per role, already downsampled to a
+   color depth. seq[role][0] holds the length, the bytes follow. Built on
+   first use and rebuilt only after a scheme change (apep_color.c). */
+#define APEP_PALETTE_SEQ_MAX 48
+
+typedef struct apep_palette
+{
+    unsigned char seq[APEP_CR_COUNT][APEP_PALETTE_SEQ_MAX];
+} apep_palette_t;
+
+/* Copy role's sequence (length byte first) for color_depth into seq, which
+   holds APEP_PALETTE_SEQ_MAX bytes; consistent even across a concurrent
+   scheme change. */
+void apep_palette_copy(int color_depth, apep_color_role_t role, unsigned char *seq);
+
+/* ----------------------------
+Atomics
+GCC/Clang builtins; elsewhere plain accesses to volatile objects, which
+MSVC gives acquire/release semantics on x86/x64.
+---------------------------- */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define APEP_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define APEP_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define APEP_LOAD_ACQUIRE(p) (*(p))
+#define APEP_STORE_RELEASE(p, v) (*(p) = (v))
+#endif
+
+#if defined(_MSC_VER)
+#define APEP_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__)
+#define APEP_THREAD_LOCAL __thread
+#else
+#define APEP_THREAD_LOCAL _Thread_local
+#endif
+
+/* Read-modify-write on volatile unsigned long long counters */
+#if defined(__GNUC__) || defined(__clang__)
+#define APEP_FETCH_ADD64(p, v) __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+/* Stores v and returns the previous value */
+#define APEP_EXCHANGE64(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+/* Weak CAS: *expected is updated on failure */
+#define APEP_CAS64(p, expected, desired) \
+    __atomic_compare_exchange_n((p), (expected), (desired), 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)
+#define APEP_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+/* Orders earlier loads before later ones (seqlock readers) */
+#define APEP_FENCE_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#else
+#include <intrin.h>
+#define APEP_FETCH_ADD64(p, v) \
+    ((unsigned long long)_InterlockedExchangeAdd64((volatile __int64 *)(p), (__int64)(v)))
+#define APEP_EXCHANGE64(p, v) \
+    ((unsigned long long)_InterlockedExchange64((volatile __int64 *)(p), (__int64)(v)))
+static __inline int apep_cas64(volatile unsigned long long *p, unsigned long long *expected, unsigned long long desired)
+{
+    unsigned long long seen = (unsigned long long)_InterlockedCompareExchange64(
+        (volatile __int64 *)p, (__int64)desired, (__int64)*expected);
+    if (seen == *expected)
+        return 1;
+    *expected = seen;
+    return 0;
+}
+#define APEP_CAS64(p, expected, desired) apep_cas64((p), (expected), (desired))
+/* Interlocked operations are full barriers */
+static __inline void apep_fence(void)
+{
+    volatile long word = 0;
+    _InterlockedExchange(&word, 0);
+}
+#define APEP_FENCE() apep_fence()
+#define APEP_FENCE_ACQUIRE() apep_fence()
+#endif
+
+/* Yielding spin lock for short critical sections; zero-initialized is
+   unlocked (apep_sink.c). */
+void apep_spin_lock(volatile long *l);
+void apep_spin_unlock(volatile long *l);
+
+/* ----------------------------
+Stream locking
+A diagnostic is written inside one lock scope with the unlocked stdio
+variants, so concurrent printers never interleave and pay one lock
+round-trip per diagnostic. The locks are recursive; holding one across
+several diagnostics (e.g. a buffer flush) keeps the batch together.
+---------------------------- */
+
+#if defined(_MSC_VER)
+#define APEP_LOCK_STREAM(f) _lock_file(f)
+#define APEP_UNLOCK_STREAM(f) _unlock_file(f)
+#define APEP_FWRITE_UNLOCKED(p, n, f) _fwrite_nolock((p), 1, (n), (f))
+#elif defined(_WIN32)
+/* MinGW: fwrite takes the CRT lock itself */
+#define APEP_LOCK_STREAM(f) ((void)(f))
+#define APEP_UNLOCK_STREAM(f) ((void)(f))
+#define APEP_FWRITE_UNLOCKED(p, n, f) fwrite((p), 1, (n), (f))
+#elif defined(__GLIBC__)
+#define APEP_LOCK_STREAM(f) flockfile(f)
+#define APEP_UNLOCK_STREAM(f) funlockfile(f)
+#define APEP_FWRITE_UNLOCKED(p, n, f) fwrite_unlocked((p), 1, (n), (f))
+#else
+/* POSIX without fwrite_unlocked: fwrite re-enters the held lock cheaply */
+#define APEP_LOCK_STREAM(f) flockfile(f)
+#define APEP_UNLOCK_STREAM(f) funlockfile(f)
+#define APEP_FWRITE_UNLOCKED(p, n, f) fwrite((p), 1, (n), (f))
+#endif
+
+/* ----------------------------
+Byte scanning kernels (apep_scan.c)
+SSE2/AVX2 paths are selected at runtime, with a portable SWAR fallback.
+None of them read outside [p, p+n).
+---------------------------- */
+
+#define APEP_SCAN_MAX_SET 4
+
+typedef enum apep_scan_isa
+{
+    APEP_SCAN_ISA_BEST = 0,
+    APEP_SCAN_ISA_PORTABLE,
+    APEP_SCAN_ISA_SSE2,
+    APEP_SCAN_ISA_AVX2
+} apep_scan_isa_t;
+
+/* First occurrence of c in [p, p+n), or NULL. */
+const char *apep_scan_byte(const char *p, size_t n, char c);
+
+/* First byte in [p, p+n) that matches any of the (up to 4) bytes in set. */
+const char *apep_scan_any(const char *p, size_t n, const char *set);
+
+/* k-th (1-based) occurrence of c in [p, p+n), or NULL if there are fewer.
+   *found receives the number of occurrences seen (k on success). */
+const char *apep_scan_nth(const char *p, size_t n, char c, size_t k, size_t *found);
+
+/* Store base+offset of up to max occurrences of c in [p, p+n) into out, in
+   order. Returns how many were stored; the scan stops early once max is hit. */
+size_t apep_scan_collect(const char *p, size_t n, char c, size_t *out, size_t max, size_t base);
+
+/* First byte in [p, p+n) a JSON string must escape ('"', '\\' or a
+   control byte below 0x20), or NULL. */
+const char *apep_scan_json(const char *p, size_t n);
+
+/* Force a kernel (falls back if the CPU lacks it); returns the name in use.
+   Intended for benchmarks and diagnostics. */
+const char *apep_scan_select(apep_scan_isa_t isa);
+
 #endif
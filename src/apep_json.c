@@ -1,84 +1,644 @@
+#include "../include/apep/apep_json.h"
 #include "../include/apep/apep.h"
 #include "../include/apep/apep_helpers.h"
 #include "apep_internal.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #ifdef _WIN32
-#include <io.h>
 #include <windows.h>
-#define isatty _isatty
-/* fileno is already defined in MinGW's stdio.h */
-#ifndef fileno
-#define fileno _fileno
-#endif
 /* Define this constant if not available in older Windows headers */
 #ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
 #define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
 #endif
-#else
-#include <unistd.h>
 #endif
 
-/* Color codes for JSON syntax highlighting */
-#define JSON_KEY_COLOR "\x1b[36m"       /* cyan for keys */
-#define JSON_STRING_COLOR "\x1b[32m"    /* green for strings */
-#define JSON_NUMBER_COLOR "\x1b[33m"    /* yellow for numbers */
-#define JSON_BRACKET_COLOR "\x1b[1;37m" /* bold white for brackets */
-#define JSON_RESET "\x1b[0m"
-
-/* Escape JSON string */
-static void json_escape_string(FILE *out, const char *str, int use_colors)
+/* Clean runs are found by the scan kernels and copied whole; only the
+   bytes they stop at are escaped one by one */
+void apep_json_escape(apep_rbuf_t *out, const char *s, size_t n)
 {
-    if (!str)
+    const char *end = s + n;
+    const char *p = s;
+    if (n > APEP_RBUF_STACK)
+        apep_rbuf_reserve(out, n); /* payloads grow the buffer once */
+    while (p < end)
     {
-        if (use_colors)
-            fputs(JSON_NUMBER_COLOR, out);
-        fputs("null", out);
-        if (use_colors)
-            fputs(JSON_RESET, out);
-        return;
+        const char *hit = apep_scan_json(p, (size_t)(end - p));
+        if (!hit)
+        {
+            apep_rbuf_append(out, p, (size_t)(end - p));
+            return;
+        }
+        apep_rbuf_append(out, p, (size_t)(hit - p));
+
+        /* Escapes tend to cluster (CRLF, runs of tabs) */
+        do
+        {
+            unsigned char c = (unsigned char)*hit++;
+            switch (c)
+            {
+            case '"':
+                apep_rbuf_puts(out, "\\\"");
+                break;
+            case '\\':
+                apep_rbuf_puts(out, "\\\\");
+                break;
+            case '\n':
+                apep_rbuf_puts(out, "\\n");
+                break;
+            case '\r':
+                apep_rbuf_puts(out, "\\r");
+                break;
+            case '\t':
+                apep_rbuf_puts(out, "\\t");
+                break;
+            default:
+                apep_rbuf_puts(out, "\\u");
+                apep_rbuf_hex(out, c, 4, 0);
+                break;
+            }
+        } while (hit < end && ((unsigned char)*hit < 32 || *hit == '"' || *hit == '\\'));
+        p = hit;
     }
+}
 
-    if (use_colors)
-        fputs(JSON_STRING_COLOR, out);
+/* ----------------------------
+Numbers
+---------------------------- */
 
-    fputc('"', out);
-    for (const char *p = str; *p; p++)
+void apep_render_double(apep_rbuf_t *out, double v)
+{
+    /* Most logged values (latencies, ratios) have a few decimals: print
+       them with integer arithmetic when m / 10^k reads back exactly */
+    static const double p10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6};
+    static const unsigned long long u10[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+    double a = v < 0 ? -v : v;
+    if (a < 9e9)
     {
-        switch (*p)
+        for (int k = 0; k < 7; k++)
         {
-        case '"':
-            fputs("\\\"", out);
-            break;
-        case '\\':
-            fputs("\\\\", out);
-            break;
-        case '\n':
-            fputs("\\n", out);
-            break;
-        case '\r':
-            fputs("\\r", out);
-            break;
-        case '\t':
-            fputs("\\t", out);
-            break;
-        default:
-            if ((unsigned char)*p < 32)
-            {
-                fprintf(out, "\\u%04x", (unsigned char)*p);
-            }
-            else
+            unsigned long long m = (unsigned long long)(a * p10[k] + 0.5);
+            if ((double)m / p10[k] != a)
+                continue;
+
+            if (v < 0)
+                apep_rbuf_putc(out, '-');
+            apep_rbuf_uint(out, m / u10[k], 0);
+            if (k)
             {
-                fputc(*p, out);
+                char frac[8];
+                unsigned long long f = m % u10[k];
+                frac[0] = '.';
+                for (int i = k; i > 0; i--, f /= 10)
+                    frac[i] = (char)('0' + f % 10);
+                apep_rbuf_append(out, frac, (size_t)k + 1);
             }
-            break;
+            return;
         }
     }
-    fputc('"', out);
 
-    if (use_colors)
-        fputs(JSON_RESET, out);
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%.15g", v);
+    if (strtod(buf, NULL) != v)
+        n = snprintf(buf, sizeof(buf), "%.17g", v);
+    if (n < 0 || (size_t)n >= sizeof(buf))
+        return;
+
+    /* '.' whatever the locale */
+    for (int i = 0; i < n; i++)
+    {
+        if (buf[i] == ',')
+            buf[i] = '.';
+    }
+    apep_rbuf_append(out, buf, (size_t)n);
+}
+
+/* ----------------------------
+Writer
+Bit d of members/arrays describes the container at depth d; bit 0 stands
+for the top level, which holds a single value. Uncolored tokens are
+staged with the separator before them, so a compact member with a short
+clean key and value costs two appends.
+---------------------------- */
+
+#define APEP_JSON_BIT(d) (1ull << (d))
+#define APEP_JSON_FAIL ((size_t)-1)
+
+/* Separator (at most ",\n" and 64 spaces), a short string, quotes, ": " */
+#define APEP_JSON_STAGE 160
+#define APEP_JSON_INLINE 64
+
+static void apep_json_writer_reset(apep_json_writer_t *w)
+{
+    w->depth = 0;
+    w->after_key = 0;
+    w->failed = 0;
+    w->members = 0;
+    w->arrays = 0;
+}
+
+void apep_json_writer_init(apep_json_writer_t *w, apep_rbuf_t *out, unsigned flags, const apep_caps_t *caps)
+{
+    if (!w)
+        return;
+    w->out = out;
+    w->sink = NULL;
+    w->flags = flags;
+    memset(&w->caps, 0, sizeof(w->caps));
+    if (caps)
+        w->caps = *caps;
+    apep_json_writer_reset(w);
+    if (!out)
+        w->failed = 1;
+}
+
+void apep_json_writer_init_sink(apep_json_writer_t *w, apep_sink_t *sink, unsigned flags, const apep_caps_t *caps)
+{
+    if (!w)
+        return;
+    apep_rbuf_init(&w->own, w->storage, sizeof(w->storage));
+    apep_json_writer_init(w, &w->own, flags, caps);
+    w->sink = sink;
+    if (!sink)
+        w->failed = 1;
+}
+
+int apep_json_writer_end(apep_json_writer_t *w)
+{
+    if (!w || !w->out)
+        return -1;
+
+    int ok = !w->failed && w->depth == 0 && !w->after_key && (w->members & 1);
+    if (w->members & 1)
+        apep_rbuf_putc(w->out, '\n');
+    if (w->sink)
+    {
+        if (ok && apep_sink_write_rbuf(w->sink, w->out) != 0)
+            ok = 0;
+        apep_rbuf_reset(w->out);
+    }
+    apep_json_writer_reset(w);
+    return ok ? 0 : -1;
+}
+
+void apep_json_writer_free(apep_json_writer_t *w)
+{
+    if (w && w->sink)
+    {
+        apep_rbuf_free(&w->own);
+        w->out = NULL;
+    }
+}
+
+/* Comma and, when pretty, line break and indent before a member; staged
+   into buf, returns the length */
+static size_t apep_json_member_sep(apep_json_writer_t *w, char *buf)
+{
+    unsigned long long bit = APEP_JSON_BIT(w->depth);
+    size_t n = 0;
+    if (w->members & bit)
+        buf[n++] = ',';
+    w->members |= bit;
+    if (w->flags & APEP_JSON_PRETTY)
+    {
+        buf[n++] = '\n';
+        memset(buf + n, ' ', (size_t)w->depth * 2);
+        n += (size_t)w->depth * 2;
+    }
+    return n;
+}
+
+/* Whatever precedes a value, staged into buf; APEP_JSON_FAIL if a value
+   is out of place here */
+static size_t apep_json_value_begin(apep_json_writer_t *w, char *buf)
+{
+    if (w->failed)
+        return APEP_JSON_FAIL;
+    if (w->after_key)
+    {
+        w->after_key = 0;
+        return 0;
+    }
+    if (w->depth == 0)
+    {
+        if (w->members & 1)
+            return w->failed = 1, APEP_JSON_FAIL;
+        w->members |= 1;
+        return 0;
+    }
+    if (!(w->arrays & APEP_JSON_BIT(w->depth)))
+        return w->failed = 1, APEP_JSON_FAIL; /* object member without a key */
+    return apep_json_member_sep(w, buf);
+}
+
+/* The staged bytes, then text in role's color */
+static void apep_json_token(apep_json_writer_t *w, char *buf, size_t n, const char *text, size_t len, apep_color_role_t role)
+{
+    if (!w->caps.color && n + len <= APEP_JSON_STAGE)
+    {
+        memcpy(buf + n, text, len);
+        apep_rbuf_append(w->out, buf, n + len);
+        return;
+    }
+    apep_rbuf_append(w->out, buf, n);
+    if (w->caps.color)
+        apep_color_begin(w->out, &w->caps, role);
+    apep_rbuf_append(w->out, text, len);
+    if (w->caps.color)
+        apep_color_end(w->out, &w->caps);
+}
+
+/* The staged bytes, then s quoted and escaped in role's color; short clean
+   strings go out with them in one append */
+static void apep_json_quoted(apep_json_writer_t *w, char *buf, size_t n, const char *s, size_t len, apep_color_role_t role)
+{
+    if (!w->caps.color && len <= APEP_JSON_INLINE && !apep_scan_json(s, len))
+    {
+        buf[n++] = '"';
+        memcpy(buf + n, s, len);
+        n += len;
+        buf[n++] = '"';
+        apep_rbuf_append(w->out, buf, n);
+        return;
+    }
+    apep_rbuf_append(w->out, buf, n);
+    if (w->caps.color)
+        apep_color_begin(w->out, &w->caps, role);
+    apep_rbuf_putc(w->out, '"');
+    apep_json_escape(w->out, s, len);
+    apep_rbuf_putc(w->out, '"');
+    if (w->caps.color)
+        apep_color_end(w->out, &w->caps);
+}
+
+static void apep_json_begin(apep_json_writer_t *w, char open, int array)
+{
+    char buf[APEP_JSON_STAGE];
+    size_t n = apep_json_value_begin(w, buf);
+    if (n == APEP_JSON_FAIL)
+        return;
+    if (w->depth >= APEP_JSON_MAX_DEPTH)
+    {
+        w->failed = 1;
+        return;
+    }
+
+    w->depth++;
+    unsigned long long bit = APEP_JSON_BIT(w->depth);
+    w->members &= ~bit;
+    if (array)
+        w->arrays |= bit;
+    else
+        w->arrays &= ~bit;
+    apep_json_token(w, buf, n, &open, 1, APEP_CR_JSON_PUNCT);
+}
+
+static void apep_json_end(apep_json_writer_t *w, char close, int array)
+{
+    if (w->failed)
+        return;
+    unsigned long long bit = APEP_JSON_BIT(w->depth);
+    if (w->depth == 0 || w->after_key || !(w->arrays & bit) != !array)
+    {
+        w->failed = 1;
+        return;
+    }
+
+    char buf[APEP_JSON_STAGE];
+    size_t n = 0;
+    if ((w->flags & APEP_JSON_PRETTY) && (w->members & bit))
+    {
+        buf[n++] = '\n';
+        memset(buf + n, ' ', (size_t)(w->depth - 1) * 2);
+        n += (size_t)(w->depth - 1) * 2;
+    }
+    apep_json_token(w, buf, n, &close, 1, APEP_CR_JSON_PUNCT);
+    w->depth--;
+}
+
+void apep_json_begin_object(apep_json_writer_t *w)
+{
+    if (w)
+        apep_json_begin(w, '{', 0);
+}
+
+void apep_json_end_object(apep_json_writer_t *w)
+{
+    if (w)
+        apep_json_end(w, '}', 0);
+}
+
+void apep_json_begin_array(apep_json_writer_t *w)
+{
+    if (w)
+        apep_json_begin(w, '[', 1);
+}
+
+void apep_json_end_array(apep_json_writer_t *w)
+{
+    if (w)
+        apep_json_end(w, ']', 1);
+}
+
+void apep_json_key(apep_json_writer_t *w, const char *key)
+{
+    if (!w || w->failed)
+        return;
+    if (w->depth == 0 || w->after_key || (w->arrays & APEP_JSON_BIT(w->depth)))
+    {
+        w->failed = 1;
+        return;
+    }
+
+    char buf[APEP_JSON_STAGE];
+    size_t n = apep_json_member_sep(w, buf);
+    apep_json_quoted(w, buf, n, key ? key : "", key ? strlen(key) : 0, APEP_CR_JSON_KEY);
+    if (w->flags & APEP_JSON_PRETTY)
+        apep_rbuf_append(w->out, ": ", 2);
+    else
+        apep_rbuf_putc(w->out, ':');
+    w->after_key = 1;
+}
+
+/* A scalar in the number color: numbers, true/false/null, raw values */
+static void apep_json_scalar(apep_json_writer_t *w, const char *text, size_t len)
+{
+    if (!w)
+        return;
+    char buf[APEP_JSON_STAGE];
+    size_t n = apep_json_value_begin(w, buf);
+    if (n != APEP_JSON_FAIL)
+        apep_json_token(w, buf, n, text, len, APEP_CR_JSON_NUMBER);
+}
+
+void apep_json_stringn(apep_json_writer_t *w, const char *s, size_t len)
+{
+    if (!s)
+    {
+        apep_json_null(w);
+        return;
+    }
+    if (!w)
+        return;
+    char buf[APEP_JSON_STAGE];
+    size_t n = apep_json_value_begin(w, buf);
+    if (n != APEP_JSON_FAIL)
+        apep_json_quoted(w, buf, n, s, len, APEP_CR_JSON_STRING);
+}
+
+void apep_json_string(apep_json_writer_t *w, const char *s)
+{
+    apep_json_stringn(w, s, s ? strlen(s) : 0);
+}
+
+/* Decimal digits of u ending at end; returns the count */
+static size_t apep_json_digits(char *end, unsigned long long u)
+{
+    size_t n = 0;
+    do
+    {
+        *--end = (char)('0' + u % 10);
+        u /= 10;
+        n++;
+    } while (u);
+    return n;
+}
+
+void apep_json_int(apep_json_writer_t *w, long long v)
+{
+    char digits[24];
+    unsigned long long u = v < 0 ? 0ull - (unsigned long long)v : (unsigned long long)v;
+    size_t n = apep_json_digits(digits + sizeof(digits), u);
+    if (v < 0)
+        digits[sizeof(digits) - ++n] = '-';
+    apep_json_scalar(w, digits + sizeof(digits) - n, n);
+}
+
+void apep_json_uint(apep_json_writer_t *w, unsigned long long v)
+{
+    char digits[24];
+    size_t n = apep_json_digits(digits + sizeof(digits), v);
+    apep_json_scalar(w, digits + sizeof(digits) - n, n);
+}
+
+void apep_json_double(apep_json_writer_t *w, double v)
+{
+    if (v != v || v - v != 0)
+    {
+        apep_json_null(w);
+        return;
+    }
+    if (!w)
+        return;
+    char buf[APEP_JSON_STAGE];
+    size_t n = apep_json_value_begin(w, buf);
+    if (n == APEP_JSON_FAIL)
+        return;
+    apep_rbuf_append(w->out, buf, n);
+    if (w->caps.color)
+        apep_color_begin(w->out, &w->caps, APEP_CR_JSON_NUMBER);
+    apep_render_double(w->out, v);
+    if (w->caps.color)
+        apep_color_end(w->out, &w->caps);
+}
+
+void apep_json_bool(apep_json_writer_t *w, int v)
+{
+    if (v)
+        apep_json_scalar(w, "true", 4);
+    else
+        apep_json_scalar(w, "false", 5);
+}
+
+void apep_json_null(apep_json_writer_t *w)
+{
+    apep_json_scalar(w, "null", 4);
+}
+
+void apep_json_raw(apep_json_writer_t *w, const char *json, size_t n)
+{
+    if (!json)
+    {
+        apep_json_null(w);
+        return;
+    }
+    apep_json_scalar(w, json, n);
+}
+
+void apep_json_hex(apep_json_writer_t *w, const void *bytes, size_t len)
+{
+    static const char digits[] = "0123456789abcdef";
+    if (!w)
+        return;
+    char buf[APEP_JSON_STAGE];
+    size_t n = apep_json_value_begin(w, buf);
+    if (n == APEP_JSON_FAIL)
+        return;
+
+    const unsigned char *p = (const unsigned char *)bytes;
+    if (!p)
+        len = 0;
+    apep_rbuf_append(w->out, buf, n);
+    if (w->caps.color)
+        apep_color_begin(w->out, &w->caps, APEP_CR_JSON_STRING);
+    apep_rbuf_putc(w->out, '"');
+    if (len && apep_rbuf_reserve(w->out, len * 2) == 0)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            char pair[2] = {digits[p[i] >> 4], digits[p[i] & 15]};
+            apep_rbuf_append(w->out, pair, 2);
+        }
+    }
+    apep_rbuf_putc(w->out, '"');
+    if (w->caps.color)
+        apep_color_end(w->out, &w->caps);
+}
+
+/* ----------------------------
+Diagnostics
+The indented form is the human one (translated severities, colors on a
+terminal); the compact one is one line per diagnostic for log shippers,
+with canonical severities.
+---------------------------- */
+
+static const char *apep_json_severity_key(apep_severity_t sev)
+{
+    switch (sev)
+    {
+    case APEP_SEV_ERROR:
+        return "error";
+    case APEP_SEV_WARN:
+        return "warning";
+    case APEP_SEV_NOTE:
+    default:
+        return "note";
+    }
+}
+
+static void apep_json_write_diagnostic(
+    apep_json_writer_t *w,
+    const char *severity,
+    const char *code,
+    const char *message,
+    const char *file,
+    int line,
+    int col,
+    int span_len,
+    const apep_note_t *notes,
+    size_t notes_count)
+{
+    apep_json_begin_object(w);
+    apep_json_key(w, "severity");
+    apep_json_string(w, severity);
+    apep_json_key(w, "code");
+    apep_json_string(w, code);
+    apep_json_key(w, "message");
+    apep_json_string(w, message);
+
+    apep_json_key(w, "location");
+    apep_json_begin_object(w);
+    apep_json_key(w, "file");
+    apep_json_string(w, file);
+    apep_json_key(w, "line");
+    apep_json_int(w, line);
+    apep_json_key(w, "column");
+    apep_json_int(w, col);
+    apep_json_key(w, "span_length");
+    apep_json_int(w, span_len);
+    apep_json_end_object(w);
+
+    if (notes && notes_count > 0)
+    {
+        apep_json_key(w, "notes");
+        apep_json_begin_array(w);
+        for (size_t i = 0; i < notes_count; i++)
+        {
+            apep_json_begin_object(w);
+            apep_json_key(w, "kind");
+            apep_json_string(w, notes[i].kind);
+            apep_json_key(w, "message");
+            apep_json_string(w, notes[i].message);
+            apep_json_end_object(w);
+        }
+        apep_json_end_array(w);
+    }
+    apep_json_end_object(w);
+    apep_json_writer_end(w);
+}
+
+void apep_render_json_diagnostic_compact(
+    apep_rbuf_t *out,
+    apep_severity_t sev,
+    const char *code,
+    const char *message,
+    const char *file,
+    int line,
+    int col,
+    int span_len,
+    const apep_note_t *notes,
+    size_t notes_count)
+{
+    apep_json_writer_t w;
+    apep_json_writer_init(&w, out, 0, NULL);
+    apep_json_write_diagnostic(&w, apep_json_severity_key(sev), code, message, file, line, col, span_len,
+                               notes, notes_count);
+}
+
+void apep_render_json_diagnostic(
+    apep_rbuf_t *out,
+    const apep_caps_t *caps,
+    apep_output_format_t format,
+    apep_severity_t sev,
+    const char *code,
+    const char *message,
+    const char *file,
+    int line,
+    int col,
+    int span_len,
+    const apep_note_t *notes,
+    size_t notes_count)
+{
+    if (format == APEP_FORMAT_JSON)
+    {
+        apep_render_json_diagnostic_compact(out, sev, code, message, file, line, col, span_len, notes, notes_count);
+        return;
+    }
+
+    apep_json_writer_t w;
+    apep_json_writer_init(&w, out, APEP_JSON_PRETTY, caps);
+    apep_json_write_diagnostic(&w, apep_severity_name(sev), code, message, file, line, col, span_len, notes, notes_count);
+}
+
+void apep_print_json_diagnostic_format(
+    FILE *out,
+    apep_output_format_t format,
+    apep_severity_t sev,
+    const char *code,
+    const char *message,
+    const char *file,
+    int line,
+    int col,
+    int span_len,
+    const apep_note_t *notes,
+    size_t notes_count)
+{
+    if (format != APEP_FORMAT_JSON)
+    {
+        apep_print_json_diagnostic(out, sev, code, message, file, line, col, span_len, notes, notes_count);
+        return;
+    }
+    if (!out)
+        out = stderr;
+
+    char storage[APEP_RBUF_STACK];
+    apep_rbuf_t rb;
+    apep_rbuf_init(&rb, storage, sizeof(storage));
+
+    apep_render_json_diagnostic_compact(&rb, sev, code, message, file, line, col, span_len, notes, notes_count);
+    apep_rbuf_write(&rb, out);
+    apep_rbuf_free(&rb);
 }
 
 void apep_print_json_diagnostic(
@@ -96,12 +656,13 @@ void apep_print_json_diagnostic(
     if (!out)
         out = stderr;
 
-    /* Detect if we should use colors (TTY check) */
-    int use_colors = isatty(fileno(out));
+    /* Syntax colors whenever the stream is a TTY */
+    apep_caps_t caps = apep_detect_caps(out, NULL);
+    caps.color = caps.is_tty;
 
 #ifdef _WIN32
     /* Windows terminal color support */
-    if (use_colors)
+    if (caps.color)
     {
         HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
         DWORD mode;
@@ -113,186 +674,12 @@ void apep_print_json_diagnostic(
     }
 #endif
 
-    /* Opening brace */
-    if (use_colors)
-        fputs(JSON_BRACKET_COLOR, out);
-    fputs("{\n", out);
-    if (use_colors)
-        fputs(JSON_RESET, out);
-
-    /* Severity */
-    fputs("  ", out);
-    if (use_colors)
-        fputs(JSON_KEY_COLOR, out);
-    fputs("\"severity\"", out);
-    if (use_colors)
-        fputs(JSON_RESET, out);
-    fputs(": ", out);
-    json_escape_string(out, apep_severity_name(sev), use_colors);
-    fputs(",\n", out);
-
-    /* Code */
-    fputs("  ", out);
-    if (use_colors)
-        fputs(JSON_KEY_COLOR, out);
-    fputs("\"code\"", out);
-    if (use_colors)
-        fputs(JSON_RESET, out);
-    fputs(": ", out);
-    json_escape_string(out, code, use_colors);
-    fputs(",\n", out);
-
-    /* Message */
-    fputs("  ", out);
-    if (use_colors)
-        fputs(JSON_KEY_COLOR, out);
-    fputs("\"message\"", out);
-    if (use_colors)
-        fputs(JSON_RESET, out);
-    fputs(": ", out);
-    json_escape_string(out, message, use_colors);
-    fputs(",\n", out);
-
-    /* Location */
-    fputs("  ", out);
-    if (use_colors)
-        fputs(JSON_KEY_COLOR, out);
-    fputs("\"location\"", out);
-    if (use_colors)
-        fputs(JSON_RESET, out);
-    fputs(": ", out);
-    if (use_colors)
-        fputs(JSON_BRACKET_COLOR, out);
-    fputs("{\n", out);
-    if (use_colors)
-        fputs(JSON_RESET, out);
-
-    fputs("    ", out);
-    if (use_colors)
-        fputs(JSON_KEY_COLOR, out);
-    fputs("\"file\"", out);
-    if (use_colors)
-        fputs(JSON_RESET, out);
-    fputs(": ", out);
-    json_escape_string(out, file, use_colors);
-    fputs(",\n", out);
-
-    fputs("    ", out);
-    if (use_colors)
-        fputs(JSON_KEY_COLOR, out);
-    fputs("\"line\"", out);
-    if (use_colors)
-        fputs(JSON_RESET, out);
-    fputs(": ", out);
-    if (use_colors)
-        fputs(JSON_NUMBER_COLOR, out);
-    fprintf(out, "%d", line);
-    if (use_colors)
-        fputs(JSON_RESET, out);
-    fputs(",\n", out);
-
-    fputs("    ", out);
-    if (use_colors)
-        fputs(JSON_KEY_COLOR, out);
-    fputs("\"column\"", out);
-    if (use_colors)
-        fputs(JSON_RESET, out);
-    fputs(": ", out);
-    if (use_colors)
-        fputs(JSON_NUMBER_COLOR, out);
-    fprintf(out, "%d", col);
-    if (use_colors)
-        fputs(JSON_RESET, out);
-    fputs(",\n", out);
-
-    fputs("    ", out);
-    if (use_colors)
-        fputs(JSON_KEY_COLOR, out);
-    fputs("\"span_length\"", out);
-    if (use_colors)
-        fputs(JSON_RESET, out);
-    fputs(": ", out);
-    if (use_colors)
-        fputs(JSON_NUMBER_COLOR, out);
-    fprintf(out, "%d", span_len);
-    if (use_colors)
-        fputs(JSON_RESET, out);
-    fputs("\n  ", out);
-
-    if (use_colors)
-        fputs(JSON_BRACKET_COLOR, out);
-    fputs("}", out);
-    if (use_colors)
-        fputs(JSON_RESET, out);
-
-    /* Notes */
-    if (notes_count > 0)
-    {
-        fputs(",\n  ", out);
-        if (use_colors)
-            fputs(JSON_KEY_COLOR, out);
-        fputs("\"notes\"", out);
-        if (use_colors)
-            fputs(JSON_RESET, out);
-        fputs(": ", out);
-        if (use_colors)
-            fputs(JSON_BRACKET_COLOR, out);
-        fputs("[\n", out);
-        if (use_colors)
-            fputs(JSON_RESET, out);
-
-        for (size_t i = 0; i < notes_count; i++)
-        {
-            fputs("    ", out);
-            if (use_colors)
-                fputs(JSON_BRACKET_COLOR, out);
-            fputs("{\n", out);
-            if (use_colors)
-                fputs(JSON_RESET, out);
-
-            fputs("      ", out);
-            if (use_colors)
-                fputs(JSON_KEY_COLOR, out);
-            fputs("\"kind\"", out);
-            if (use_colors)
-                fputs(JSON_RESET, out);
-            fputs(": ", out);
-            json_escape_string(out, notes[i].kind, use_colors);
-            fputs(",\n", out);
-
-            fputs("      ", out);
-            if (use_colors)
-                fputs(JSON_KEY_COLOR, out);
-            fputs("\"message\"", out);
-            if (use_colors)
-                fputs(JSON_RESET, out);
-            fputs(": ", out);
-            json_escape_string(out, notes[i].message, use_colors);
-            fputs("\n    ", out);
-
-            if (use_colors)
-                fputs(JSON_BRACKET_COLOR, out);
-            fputs("}", out);
-            if (use_colors)
-                fputs(JSON_RESET, out);
-
-            if (i + 1 < notes_count)
-                fputs(",", out);
-            fputs("\n", out);
-        }
-
-        fputs("  ", out);
-        if (use_colors)
-            fputs(JSON_BRACKET_COLOR, out);
-        fputs("]", out);
-        if (use_colors)
-            fputs(JSON_RESET, out);
-    }
+    char storage[APEP_RBUF_STACK];
+    apep_rbuf_t rb;
+    apep_rbuf_init(&rb, storage, sizeof(storage));
 
-    fputs("\n", out);
-    if (use_colors)
-        fputs(JSON_BRACKET_COLOR, out);
-    fputs("}\n", out);
-    if (use_colors)
-        fputs(JSON_RESET, out);
+    apep_render_json_diagnostic(&rb, &caps, APEP_FORMAT_PRETTY, sev, code, message, file, line, col, span_len,
+                                notes, notes_count);
+    apep_rbuf_write(&rb, out);
+    apep_rbuf_free(&rb);
 }
@@ -0,0 +1,405 @@
+#include "../include/apep/apep_limit.h"
+#include "apep_internal.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/* ----------------------------
+Limiter state
+Each distinct message owns one slot of an open-addressed table, claimed
+with a compare-and-swap on its 64-bit hash and never released until
+apep_limiter_reset(). The rate is a GCRA bucket: a single "theoretical
+arrival time" advanced by one interval per admitted message, so admitting
+is one CAS on one word.
+---------------------------- */
+
+#define APEP_LIMITER_PROBES 16
+#define APEP_LIMITER_TAG_MAX 23
+
+typedef struct apep_limit_rate
+{
+    unsigned long long interval;  /* ns between messages, 0 = unlimited */
+    unsigned long long tolerance; /* ns a message may arrive early (burst) */
+} apep_limit_rate_t;
+
+typedef struct apep_limit_entry
+{
+    volatile unsigned long long key; /* 0 = free */
+    volatile unsigned long long tat; /* theoretical arrival time, ns */
+    volatile unsigned long long suppressed;
+    volatile unsigned long long first_suppressed; /* ns, valid while suppressed > 0 */
+    volatile long ready;                          /* fields below are set */
+    apep_limit_rate_t rate;
+    apep_level_t level;
+    char tag[APEP_LIMITER_TAG_MAX + 1];
+    char text[APEP_LIMITER_TEXT_MAX + 1];
+} apep_limit_entry_t;
+
+typedef struct apep_limit_tag_rule
+{
+    char tag[APEP_LIMITER_TAG_MAX + 1];
+    apep_limit_rate_t rate;
+} apep_limit_tag_rule_t;
+
+struct apep_limiter
+{
+    apep_limit_entry_t *entries;
+    size_t mask;
+    unsigned long long epoch; /* clock at creation; times are relative to it */
+    volatile unsigned long long suppressed;
+
+    apep_limit_rate_t levels[APEP_LVL_CRITICAL + 1];
+    apep_limit_tag_rule_t tags[APEP_LIMITER_MAX_TAGS];
+    size_t tag_count;
+};
+
+static unsigned long long apep_limit_clock(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (unsigned long long)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    /* Tick-resolution time is plenty for message rates and costs a few ns
+       instead of a full clock read */
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+#endif
+}
+
+/* Nanoseconds since the limiter was created, never 0 */
+static unsigned long long apep_limit_now(const apep_limiter_t *lim)
+{
+    return apep_limit_clock() - lim->epoch + 1;
+}
+
+static int apep_limit_rate_make(apep_limit_rate_t *rate, double per_second, unsigned burst)
+{
+    if (per_second != per_second)
+        return -1;
+    if (per_second <= 0)
+    {
+        rate->interval = 0;
+        rate->tolerance = 0;
+        return 0;
+    }
+
+    double interval = 1e9 / per_second;
+    if (interval < 1)
+        interval = 1;
+    if (interval > 1e18)
+        interval = 1e18;
+    rate->interval = (unsigned long long)interval;
+    rate->tolerance = rate->interval * (unsigned long long)(burst > 1 ? burst - 1 : 0);
+    return 0;
+}
+
+/* FNV-1a over the level, the tag and the template */
+static unsigned long long apep_limit_hash(apep_level_t lvl, const char *tag, const char *key)
+{
+    unsigned long long h = 1469598103934665603ull;
+    h = (h ^ (unsigned char)lvl) * 1099511628211ull;
+    for (const unsigned char *p = (const unsigned char *)(tag ? tag : ""); *p; p++)
+        h = (h ^ *p) * 1099511628211ull;
+    h = (h ^ 0xFFu) * 1099511628211ull;
+    for (const unsigned char *p = (const unsigned char *)(key ? key : ""); *p; p++)
+        h = (h ^ *p) * 1099511628211ull;
+    return h ? h : 1;
+}
+
+static const apep_limit_rate_t *apep_limit_rate_for(const apep_limiter_t *lim, apep_level_t lvl, const char *tag)
+{
+    if (tag && tag[0])
+    {
+        for (size_t i = 0; i < lim->tag_count; i++)
+        {
+            if (strcmp(lim->tags[i].tag, tag) == 0)
+                return &lim->tags[i].rate;
+        }
+    }
+    return &lim->levels[lvl];
+}
+
+static void apep_limit_copy(char *dst, size_t cap, const char *src)
+{
+    size_t n = src ? strlen(src) : 0;
+    if (n >= cap)
+        n = cap - 1;
+    if (n)
+        memcpy(dst, src, n);
+    dst[n] = '\0';
+}
+
+/* ----------------------------
+Creation & configuration
+---------------------------- */
+
+apep_limiter_t *apep_limiter_create(size_t slots)
+{
+    size_t cap = 1;
+    if (slots == 0)
+        slots = 1024;
+    while (cap < slots)
+        cap <<= 1;
+
+    apep_limiter_t *lim = (apep_limiter_t *)calloc(1, sizeof(*lim));
+    if (!lim)
+        return NULL;
+    lim->entries = (apep_limit_entry_t *)calloc(cap, sizeof(*lim->entries));
+    if (!lim->entries)
+    {
+        free(lim);
+        return NULL;
+    }
+    lim->mask = cap - 1;
+    lim->epoch = apep_limit_clock();
+    return lim;
+}
+
+void apep_limiter_destroy(apep_limiter_t *lim)
+{
+    if (!lim)
+        return;
+    free(lim->entries);
+    free(lim);
+}
+
+int apep_limiter_set_level(apep_limiter_t *lim, apep_level_t lvl, double per_second, unsigned burst)
+{
+    if (!lim || (int)lvl < 0 || lvl > APEP_LVL_CRITICAL)
+        return -1;
+    return apep_limit_rate_make(&lim->levels[lvl], per_second, burst);
+}
+
+int apep_limiter_set_tag(apep_limiter_t *lim, const char *tag, double per_second, unsigned burst)
+{
+    if (!lim || !tag || !tag[0] || strlen(tag) > APEP_LIMITER_TAG_MAX)
+        return -1;
+
+    apep_limit_rate_t rate;
+    if (apep_limit_rate_make(&rate, per_second, burst) != 0)
+        return -1;
+
+    for (size_t i = 0; i < lim->tag_count; i++)
+    {
+        if (strcmp(lim->tags[i].tag, tag) == 0)
+        {
+            lim->tags[i].rate = rate;
+            return 0;
+        }
+    }
+    if (lim->tag_count == APEP_LIMITER_MAX_TAGS)
+        return -1;
+
+    apep_limit_copy(lim->tags[lim->tag_count].tag, sizeof(lim->tags[0].tag), tag);
+    lim->tags[lim->tag_count].rate = rate;
+    lim->tag_count++;
+    return 0;
+}
+
+void apep_limiter_reset(apep_limiter_t *lim)
+{
+    if (!lim)
+        return;
+    memset(lim->entries, 0, (lim->mask + 1) * sizeof(*lim->entries));
+}
+
+unsigned long long apep_limiter_suppressed(const apep_limiter_t *lim)
+{
+    return lim ? APEP_LOAD_ACQUIRE(&lim->suppressed) : 0;
+}
+
+/* ----------------------------
+Admission
+---------------------------- */
+
+/* Find or claim the slot for h; NULL if the probe window is full or the
+   slot is still being filled in by the thread that claimed it. With
+   fmt_args, message is a format expanded only when claiming. */
+static apep_limit_entry_t *apep_limit_lookup(
+    apep_limiter_t *lim,
+    unsigned long long h,
+    const apep_limit_rate_t *rate,
+    apep_level_t lvl,
+    const char *tag,
+    const char *message,
+    va_list *fmt_args)
+{
+    for (size_t i = 0; i < APEP_LIMITER_PROBES; i++)
+    {
+        apep_limit_entry_t *e = &lim->entries[(h + i) & lim->mask];
+        unsigned long long k = APEP_LOAD_ACQUIRE(&e->key);
+
+        if (k == 0)
+        {
+            unsigned long long expected = 0;
+            while (!APEP_CAS64(&e->key, &expected, h) && expected == 0)
+                ;
+            if (expected == 0)
+            {
+                e->rate = *rate;
+                e->level = lvl;
+                apep_limit_copy(e->tag, sizeof(e->tag), tag);
+                if (fmt_args)
+                {
+                    if (vsnprintf(e->text, sizeof(e->text), message, *fmt_args) < 0)
+                        e->text[0] = '\0';
+                }
+                else
+                {
+                    apep_limit_copy(e->text, sizeof(e->text), message);
+                }
+                APEP_STORE_RELEASE(&e->ready, 1L);
+                return e;
+            }
+            k = expected;
+        }
+        if (k == h)
+            return APEP_LOAD_ACQUIRE(&e->ready) ? e : NULL;
+    }
+    return NULL;
+}
+
+/* Take the pending repeat count of e; 0 if none. The count is swapped
+   out whole, so concurrent takers never report the same repeats, and the
+   window start is cleared with it; the suppressor that takes the count
+   from 0 to 1 sets it again. A taker that runs between that increment
+   and the store reports a window of 0 s. */
+static unsigned long long apep_limit_take(apep_limiter_t *lim, apep_limit_entry_t *e, double *seconds)
+{
+    if (APEP_LOAD_ACQUIRE(&e->suppressed) == 0)
+        return 0;
+
+    unsigned long long n = APEP_EXCHANGE64(&e->suppressed, 0);
+    if (n == 0)
+        return 0;
+
+    unsigned long long first = APEP_EXCHANGE64(&e->first_suppressed, 0);
+    if (seconds)
+    {
+        unsigned long long now = apep_limit_now(lim);
+        *seconds = (first && now > first) ? (double)(now - first) / 1e9 : 0.0;
+    }
+    return n;
+}
+
+static int apep_limit_admit(
+    apep_limiter_t *lim,
+    apep_level_t lvl,
+    const char *tag,
+    const char *key,
+    const char *message,
+    va_list *fmt_args,
+    unsigned long long *repeated,
+    double *seconds)
+{
+    if (repeated)
+        *repeated = 0;
+    if (!lim || (int)lvl < 0 || lvl > APEP_LVL_CRITICAL)
+        return 1;
+
+    /* Nothing to hash when no rate can apply */
+    if (lim->tag_count == 0 && lim->levels[lvl].interval == 0)
+        return 1;
+
+    const apep_limit_rate_t *rate = apep_limit_rate_for(lim, lvl, tag);
+    unsigned long long h = apep_limit_hash(lvl, tag, key);
+    apep_limit_entry_t *e = apep_limit_lookup(lim, h, rate, lvl, tag, message ? message : key, fmt_args);
+    if (!e || e->rate.interval == 0)
+        return 1;
+
+    unsigned long long now = apep_limit_now(lim);
+    unsigned long long tat = APEP_LOAD_ACQUIRE(&e->tat);
+    for (;;)
+    {
+        if (tat > now && tat - now > e->rate.tolerance)
+        {
+            if (APEP_FETCH_ADD64(&e->suppressed, 1) == 0)
+                APEP_STORE_RELEASE(&e->first_suppressed, now);
+            APEP_FETCH_ADD64(&lim->suppressed, 1);
+            return 0;
+        }
+        unsigned long long next = (tat > now ? tat : now) + e->rate.interval;
+        if (APEP_CAS64(&e->tat, &tat, next))
+            break;
+    }
+
+    double secs = 0.0;
+    unsigned long long n = apep_limit_take(lim, e, &secs);
+    if (repeated)
+        *repeated = n;
+    if (seconds)
+        *seconds = secs;
+    return 1;
+}
+
+int apep_limiter_admit(
+    apep_limiter_t *lim,
+    apep_level_t lvl,
+    const char *tag,
+    const char *key,
+    const char *message,
+    unsigned long long *repeated,
+    double *seconds)
+{
+    return apep_limit_admit(lim, lvl, tag, key, message, NULL, repeated, seconds);
+}
+
+int apep_limiter_admit_vfmt(
+    apep_limiter_t *lim,
+    apep_level_t lvl,
+    const char *tag,
+    const char *fmt,
+    va_list args,
+    unsigned long long *repeated,
+    double *seconds)
+{
+    va_list copy;
+    va_copy(copy, args);
+    int ok = apep_limit_admit(lim, lvl, tag, fmt, fmt, &copy, repeated, seconds);
+    va_end(copy);
+    return ok;
+}
+
+int apep_limiter_check(
+    apep_limiter_t *lim,
+    apep_level_t lvl,
+    const char *tag,
+    const char *key,
+    unsigned long long *repeated,
+    double *seconds)
+{
+    return apep_limiter_admit(lim, lvl, tag, key, key, repeated, seconds);
+}
+
+void apep_limiter_flush(apep_limiter_t *lim, const apep_options_t *opt)
+{
+    if (!lim)
+        return;
+
+    for (size_t i = 0; i <= lim->mask; i++)
+    {
+        apep_limit_entry_t *e = &lim->entries[i];
+        if (!APEP_LOAD_ACQUIRE(&e->ready))
+            continue;
+
+        double secs = 0.0;
+        unsigned long long n = apep_limit_take(lim, e, &secs);
+        if (n)
+            apep_emit_message_repeated(opt, e->level, e->tag, e->text, n, secs);
+    }
+}
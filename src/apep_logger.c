@@ -0,0 +1,225 @@
+#include "../include/apep/apep_logger.h"
+#include "apep_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* ----------------------------
+Logger registry
+Loggers are created under a spin lock and never move or die before
+apep_logger_shutdown(), so handles can be used without locking. A level
+change bumps g_logger_generation and marks every cache stale; a reader
+that recomputes its effective level re-checks the generation so a result
+computed from the old configuration is never kept.
+---------------------------- */
+
+struct apep_logger
+{
+    apep_logger_head_t head; /* first: read inline by APEP_LOGGER_ENABLED() */
+    struct apep_logger *parent;
+    struct apep_logger *next; /* registry list */
+    volatile int level;       /* own level, -1 = inherit */
+    const apep_options_t *volatile opt;
+    char name[];
+};
+
+static apep_logger_t *g_loggers; /* root first */
+static volatile long g_logger_lock;
+static volatile unsigned long long g_logger_generation;
+
+/* Caller holds g_logger_lock */
+static apep_logger_t *apep_logger_new(const char *name, size_t len, apep_logger_t *parent)
+{
+    apep_logger_t *lg = (apep_logger_t *)malloc(sizeof(*lg) + len + 1);
+    if (!lg)
+        return NULL;
+
+    lg->head.cached_level = -1;
+    lg->parent = parent;
+    lg->level = parent ? -1 : (int)APEP_LVL_INFO;
+    lg->opt = NULL;
+    memcpy(lg->name, name, len);
+    lg->name[len] = '\0';
+
+    /* Append so the root stays first */
+    apep_logger_t **link = &g_loggers;
+    while (*link)
+        link = &(*link)->next;
+    lg->next = NULL;
+    *link = lg;
+    return lg;
+}
+
+/* Caller holds g_logger_lock */
+static apep_logger_t *apep_logger_find(const char *name, size_t len)
+{
+    for (apep_logger_t *lg = g_loggers; lg; lg = lg->next)
+    {
+        if (strncmp(lg->name, name, len) == 0 && lg->name[len] == '\0')
+            return lg;
+    }
+    return NULL;
+}
+
+apep_logger_t *apep_logger_get(const char *name)
+{
+    if (!name)
+        name = "";
+
+    apep_spin_lock(&g_logger_lock);
+
+    apep_logger_t *lg = g_loggers ? g_loggers : apep_logger_new("", 0, NULL);
+
+    /* Walk "a", "a.b", "a.b.c", creating what is missing */
+    size_t len = strlen(name);
+    for (size_t end = 0; lg && end < len;)
+    {
+        const char *dot = (const char *)memchr(name + end, '.', len - end);
+        end = dot ? (size_t)(dot - name) : len;
+
+        apep_logger_t *child = apep_logger_find(name, end);
+        lg = child ? child : apep_logger_new(name, end, lg);
+        if (dot)
+            end++;
+    }
+
+    apep_spin_unlock(&g_logger_lock);
+    return lg;
+}
+
+apep_logger_t *apep_logger_root(void)
+{
+    return apep_logger_get("");
+}
+
+const char *apep_logger_name(const apep_logger_t *lg)
+{
+    return lg ? lg->name : "";
+}
+
+/* ----------------------------
+Levels
+---------------------------- */
+
+/* Caller holds g_logger_lock */
+static void apep_logger_invalidate(void)
+{
+    APEP_FETCH_ADD64(&g_logger_generation, 1);
+    APEP_FENCE();
+    for (apep_logger_t *lg = g_loggers; lg; lg = lg->next)
+        APEP_STORE_RELEASE(&lg->head.cached_level, -1);
+}
+
+void apep_logger_set_level(apep_logger_t *lg, apep_level_t lvl)
+{
+    if (!lg || (int)lvl < 0 || lvl > APEP_LOGGER_OFF)
+        return;
+
+    apep_spin_lock(&g_logger_lock);
+    APEP_STORE_RELEASE(&lg->level, (int)lvl);
+    apep_logger_invalidate();
+    apep_spin_unlock(&g_logger_lock);
+}
+
+void apep_logger_unset_level(apep_logger_t *lg)
+{
+    if (!lg || !lg->parent)
+        return;
+
+    apep_spin_lock(&g_logger_lock);
+    APEP_STORE_RELEASE(&lg->level, -1);
+    apep_logger_invalidate();
+    apep_spin_unlock(&g_logger_lock);
+}
+
+/* Recompute and cache the effective level */
+static int apep_logger_refresh(apep_logger_t *lg)
+{
+    for (;;)
+    {
+        unsigned long long gen = APEP_LOAD_ACQUIRE(&g_logger_generation);
+
+        int lvl = (int)APEP_LVL_INFO;
+        for (const apep_logger_t *p = lg; p; p = p->parent)
+        {
+            int own = APEP_LOAD_ACQUIRE(&p->level);
+            if (own >= 0)
+            {
+                lvl = own;
+                break;
+            }
+        }
+
+        APEP_STORE_RELEASE(&lg->head.cached_level, lvl);
+        APEP_FENCE();
+        if (APEP_LOAD_ACQUIRE(&g_logger_generation) == gen)
+            return lvl;
+    }
+}
+
+apep_level_t apep_logger_effective_level(apep_logger_t *lg)
+{
+    if (!lg)
+        return APEP_LOGGER_OFF;
+
+    int cached = APEP_LOAD_ACQUIRE(&lg->head.cached_level);
+    return (apep_level_t)(cached >= 0 ? cached : apep_logger_refresh(lg));
+}
+
+int apep_logger_enabled(apep_logger_t *lg, apep_level_t lvl)
+{
+    if (!lg)
+        return 0;
+    return (int)lvl >= (int)apep_logger_effective_level(lg) && (int)lvl >= APEP_MIN_LEVEL_NOW();
+}
+
+void apep_logger_set_options(apep_logger_t *lg, const apep_options_t *opt)
+{
+    if (lg)
+        APEP_STORE_RELEASE(&lg->opt, opt);
+}
+
+/* ----------------------------
+Printing
+---------------------------- */
+
+void apep_logger_vlog(apep_logger_t *lg, apep_level_t lvl, const char *fmt, va_list args)
+{
+    if (!apep_logger_enabled(lg, lvl) || lvl > APEP_LVL_CRITICAL)
+        return;
+
+    const apep_options_t *opt = NULL;
+    for (const apep_logger_t *p = lg; p && !opt; p = p->parent)
+        opt = APEP_LOAD_ACQUIRE(&p->opt);
+
+    const apep_options_t *o = opt ? opt : apep_global_options_acquire();
+
+    apep_print_message_vfmt(o, lvl, lg->name, fmt, args);
+
+    if (!opt)
+        apep_global_options_release();
+}
+
+void apep_logger_log(apep_logger_t *lg, apep_level_t lvl, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    apep_logger_vlog(lg, lvl, fmt, args);
+    va_end(args);
+}
+
+void apep_logger_shutdown(void)
+{
+    apep_spin_lock(&g_logger_lock);
+    apep_logger_t *lg = g_loggers;
+    g_loggers = NULL;
+    APEP_FETCH_ADD64(&g_logger_generation, 1);
+    apep_spin_unlock(&g_logger_lock);
+
+    while (lg)
+    {
+        apep_logger_t *next = lg->next;
+        free(lg);
+        lg = next;
+    }
+}
@@ -5,8 +5,9 @@
 #include <string.h>
 #include <stdlib.h>
 
-void apep_print_text_diagnostic_multi(
-    const apep_options_t *opt_in,
+static void apep_render_multi(
+    apep_rbuf_t *out,
+    const apep_caps_t *caps,
     apep_severity_t sev,
     const char *code,
     const char *message,
@@ -16,43 +17,33 @@ void apep_print_text_diagnostic_multi(
     const apep_note_t *notes,
     size_t notes_count)
 {
-    if (!src || !spans || spans_count == 0)
-        return;
-
-    apep_options_t def;
-    const apep_options_t *opt = opt_in;
-    if (!opt)
-    {
-        apep_options_default(&def);
-        opt = &def;
-    }
-    FILE *out = opt->out ? opt->out : stderr;
-    apep_caps_t caps = apep_detect_caps(out, opt);
-
     /* Print header */
-    apep_color_begin(out, &caps, APEP_CR_SEV_ERROR + sev);
-    fputs(apep_severity_name(sev), out);
-    apep_color_end(out, &caps);
+    apep_color_begin(out, caps, APEP_CR_SEV_ERROR + sev);
+    apep_rbuf_puts(out, apep_severity_name(sev));
+    apep_color_end(out, caps);
 
     if (code && code[0])
     {
-        fputc('[', out);
-        apep_color_begin(out, &caps, APEP_CR_LABEL);
-        fputs(code, out);
-        apep_color_end(out, &caps);
-        fputc(']', out);
+        apep_rbuf_putc(out, '[');
+        apep_color_begin(out, caps, APEP_CR_LABEL);
+        apep_rbuf_puts(out, code);
+        apep_color_end(out, caps);
+        apep_rbuf_putc(out, ']');
     }
 
-    fputs(": ", out);
+    apep_rbuf_puts(out, ": ");
     if (message)
-        fputs(message, out);
-    fputc('\n', out);
+        apep_rbuf_puts(out, message);
+    apep_rbuf_putc(out, '\n');
 
     /* Print location (use first span) */
-    fprintf(out, "  -> %s:%d:%d\n",
-            src->name ? src->name : "<input>",
-            spans[0].loc.line,
-            spans[0].loc.col);
+    apep_rbuf_puts(out, "  -> ");
+    apep_rbuf_puts(out, src->name ? src->name : "<input>");
+    apep_rbuf_putc(out, ':');
+    apep_rbuf_int(out, spans[0].loc.line, 0);
+    apep_rbuf_putc(out, ':');
+    apep_rbuf_int(out, spans[0].loc.col, 0);
+    apep_rbuf_putc(out, '\n');
 
     /* Get all affected lines */
     int min_line = spans[0].loc.line;
@@ -75,10 +66,12 @@ void apep_print_text_diagnostic_multi(
         if (!src->get_line(src->user, line_no, &line_ptr, &line_len))
             continue;
 
-        fprintf(out, "      |\n");
-        fprintf(out, " %4d | ", line_no);
-        fwrite(line_ptr, 1, line_len, out);
-        fputc('\n', out);
+        apep_rbuf_puts(out, "      |\n");
+        apep_rbuf_putc(out, ' ');
+        apep_rbuf_int(out, line_no, 4);
+        apep_rbuf_puts(out, " | ");
+        apep_rbuf_ref(out, line_ptr, line_len);
+        apep_rbuf_putc(out, '\n');
 
         /* Print carets for all spans on this line */
         for (size_t i = 0; i < spans_count; i++)
@@ -86,46 +79,65 @@ void apep_print_text_diagnostic_multi(
             if (spans[i].loc.line != line_no)
                 continue;
 
-            fprintf(out, "      | ");
+            apep_rbuf_puts(out, "      | ");
 
             /* Spaces before caret */
-            for (int j = 1; j < spans[i].loc.col; j++)
-                fputc(' ', out);
+            if (spans[i].loc.col > 1)
+                apep_rbuf_repeat(out, ' ', (size_t)(spans[i].loc.col - 1));
 
             /* Caret(s) */
-            apep_color_begin(out, &caps, APEP_CR_CARET);
-            for (int j = 0; j < spans[i].length; j++)
-                fputc('^', out);
-            apep_color_end(out, &caps);
+            apep_color_begin(out, caps, APEP_CR_CARET);
+            if (spans[i].length > 0)
+                apep_rbuf_repeat(out, '^', (size_t)spans[i].length);
+            apep_color_end(out, caps);
 
             /* Label if present */
             if (spans[i].label)
             {
-                fputc(' ', out);
-                apep_color_begin(out, &caps, APEP_CR_DIM);
-                fputs(spans[i].label, out);
-                apep_color_end(out, &caps);
+                apep_rbuf_putc(out, ' ');
+                apep_color_begin(out, caps, APEP_CR_DIM);
+                apep_rbuf_puts(out, spans[i].label);
+                apep_color_end(out, caps);
             }
-            fputc('\n', out);
+            apep_rbuf_putc(out, '\n');
         }
     }
 
     /* Print notes */
     if (notes && notes_count > 0)
     {
-        fprintf(out, "      |\n");
+        apep_rbuf_puts(out, "      |\n");
         for (size_t i = 0; i < notes_count; i++)
         {
-            fputs("  = ", out);
-            apep_color_begin(out, &caps, APEP_CR_LABEL);
-            fputs(notes[i].kind ? notes[i].kind : "note", out);
-            apep_color_end(out, &caps);
-            fputs(": ", out);
+            apep_rbuf_puts(out, "  = ");
+            apep_color_begin(out, caps, APEP_CR_LABEL);
+            apep_rbuf_puts(out, notes[i].kind ? notes[i].kind : "note");
+            apep_color_end(out, caps);
+            apep_rbuf_puts(out, ": ");
             if (notes[i].message)
-                fputs(notes[i].message, out);
-            fputc('\n', out);
+                apep_rbuf_puts(out, notes[i].message);
+            apep_rbuf_putc(out, '\n');
         }
     }
 
-    fputc('\n', out);
+    apep_rbuf_putc(out, '\n');
+}
+
+void apep_print_text_diagnostic_multi(
+    const apep_options_t *opt,
+    apep_severity_t sev,
+    const char *code,
+    const char *message,
+    const apep_text_source_t *src,
+    const apep_text_span_t *spans,
+    size_t spans_count,
+    const apep_note_t *notes,
+    size_t notes_count)
+{
+    if (!src || !spans || spans_count == 0)
+        return;
+
+    apep_emit_t em;
+    for (apep_emit_begin(&em, opt, APEP_ROUTE_KEY_SEVERITY(sev), apep_text_source_is_stable(src)); apep_emit_next(&em);)
+        apep_render_multi(&em.rb, &em.caps, sev, code, message, src, spans, spans_count, notes, notes_count);
 }
@@ -52,11 +52,13 @@ void apep_perf_end(apep_perf_timer_t *timer, const apep_options_t *opt)
     double end_time = get_time_ms();
     double elapsed = end_time - timer->start_time;
 
-    FILE *out = (opt && opt->out) ? opt->out : stderr;
-
-    fprintf(out, "[PERF] %s: %.3fms\n",
-            timer->label ? timer->label : "unnamed",
-            elapsed);
+    apep_emit_t em;
+    for (apep_emit_begin(&em, opt, APEP_ROUTE_KEY_LEVEL(APEP_LVL_DEBUG), 0); apep_emit_next(&em);)
+    {
+        apep_rbuf_printf(&em.rb, "[PERF] %s: %.3fms\n",
+                         timer->label ? timer->label : "unnamed",
+                         elapsed);
+    }
 
     free(timer->label);
     free(timer);
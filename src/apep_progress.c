@@ -43,38 +43,49 @@ void apep_progress_update(apep_progress_t *prog, size_t current)
 
     prog->current = current;
 
+    char storage[256];
+    apep_rbuf_t rb;
+    apep_rbuf_init(&rb, storage, sizeof(storage));
+
     if (!prog->is_tty)
     {
         /* Non-TTY: just print occasional updates */
         if (current % (prog->total / 10 + 1) == 0 || current == prog->total)
         {
-            fprintf(prog->out, "[%s] %lu/%lu (%.0f%%)\n",
-                    prog->label ? prog->label : "Progress",
-                    (unsigned long)current, (unsigned long)prog->total,
-                    100.0 * current / prog->total);
+            apep_rbuf_printf(&rb, "[%s] %lu/%lu (%.0f%%)\n",
+                             prog->label ? prog->label : "Progress",
+                             (unsigned long)current, (unsigned long)prog->total,
+                             100.0 * current / prog->total);
+            apep_rbuf_write(&rb, prog->out);
         }
+        apep_rbuf_free(&rb);
         return;
     }
 
-    /* TTY: animated progress bar */
-    fprintf(prog->out, "\r[%s] ", prog->label ? prog->label : "Progress");
+    /* TTY: animated progress bar, redrawn with one write */
+    apep_rbuf_puts(&rb, "\r[");
+    apep_rbuf_puts(&rb, prog->label ? prog->label : "Progress");
+    apep_rbuf_puts(&rb, "] ");
 
     int filled = (int)((double)current / prog->total * prog->width);
-    fputc('[', prog->out);
-    for (int i = 0; i < prog->width; i++)
+    if (filled < 0)
+        filled = 0;
+    if (filled > prog->width)
+        filled = prog->width;
+    apep_rbuf_putc(&rb, '[');
+    apep_rbuf_repeat(&rb, '=', (size_t)filled);
+    if (filled < prog->width)
     {
-        if (i < filled)
-            fputc('=', prog->out);
-        else if (i == filled)
-            fputc('>', prog->out);
-        else
-            fputc(' ', prog->out);
+        apep_rbuf_putc(&rb, '>');
+        apep_rbuf_repeat(&rb, ' ', (size_t)(prog->width - filled - 1));
     }
-    fputc(']', prog->out);
+    apep_rbuf_putc(&rb, ']');
 
-    fprintf(prog->out, " %lu/%lu (%.0f%%)", (unsigned long)current, (unsigned long)prog->total,
-            100.0 * current / prog->total);
+    apep_rbuf_printf(&rb, " %lu/%lu (%.0f%%)", (unsigned long)current, (unsigned long)prog->total,
+                     100.0 * current / prog->total);
 
+    apep_rbuf_write(&rb, prog->out);
+    apep_rbuf_free(&rb);
     fflush(prog->out);
 }
 
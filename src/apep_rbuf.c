@@ -0,0 +1,623 @@
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* fwrite_unlocked */
+#endif
+
+#include "../include/apep/apep.h"
+#include "apep_internal.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#define APEP_RBUF_FILENO _fileno
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define APEP_RBUF_FILENO fileno
+#endif
+
+/* Fragments shorter than this are cheaper to copy than to reference */
+#define APEP_RBUF_REF_MIN 64
+
+/* iovecs handed to one writev(2) call */
+#define APEP_RBUF_IOV_BATCH 64
+
+/* Largest block kept as a thread's scratch area */
+#define APEP_RBUF_SCRATCH_MAX (1024 * 1024)
+
+struct apep_rbuf_ref
+{
+    size_t at; /* owned-byte offset the fragment is spliced in at */
+    const char *ptr;
+    size_t len;
+};
+
+/* ----------------------------
+Growable render buffer
+---------------------------- */
+
+void apep_rbuf_init(apep_rbuf_t *rb, char *storage, size_t storage_size)
+{
+    if (!rb)
+        return;
+
+    rb->data = storage;
+    rb->len = 0;
+    rb->cap = storage ? storage_size : 0;
+    rb->heap = 0;
+    rb->failed = 0;
+    rb->ref_mode = 0;
+    rb->refs = NULL;
+    rb->ref_count = 0;
+    rb->ref_cap = 0;
+    rb->ref_bytes = 0;
+}
+
+void apep_rbuf_free(apep_rbuf_t *rb)
+{
+    if (!rb)
+        return;
+
+    if (rb->heap)
+        free(rb->data);
+    free(rb->refs);
+    rb->data = NULL;
+    rb->len = 0;
+    rb->cap = 0;
+    rb->heap = 0;
+    rb->refs = NULL;
+    rb->ref_count = 0;
+    rb->ref_cap = 0;
+    rb->ref_bytes = 0;
+}
+
+void apep_rbuf_reset(apep_rbuf_t *rb)
+{
+    if (!rb)
+        return;
+    rb->len = 0;
+    rb->failed = 0;
+    rb->ref_count = 0;
+    rb->ref_bytes = 0;
+}
+
+int apep_rbuf_reserve(apep_rbuf_t *rb, size_t extra)
+{
+    if (!rb || rb->failed)
+        return -1;
+
+    /* Keep one spare byte so apep_rbuf_cstr() never has to grow */
+    size_t need = rb->len + extra + 1;
+    if (need <= rb->cap)
+        return 0;
+
+    size_t new_cap = rb->cap ? rb->cap : 256;
+    while (new_cap < need)
+        new_cap *= 2;
+
+    char *grown;
+    if (rb->heap)
+    {
+        grown = (char *)realloc(rb->data, new_cap);
+    }
+    else
+    {
+        /* Move off caller-provided storage */
+        grown = (char *)malloc(new_cap);
+        if (grown && rb->len)
+            memcpy(grown, rb->data, rb->len);
+    }
+
+    if (!grown)
+    {
+        rb->failed = 1;
+        return -1;
+    }
+
+    rb->data = grown;
+    rb->cap = new_cap;
+    rb->heap = 1;
+    return 0;
+}
+
+void apep_rbuf_append(apep_rbuf_t *rb, const char *s, size_t n)
+{
+    if (!s || n == 0 || apep_rbuf_reserve(rb, n) != 0)
+        return;
+    memcpy(rb->data + rb->len, s, n);
+    rb->len += n;
+}
+
+void apep_rbuf_puts(apep_rbuf_t *rb, const char *s)
+{
+    if (s)
+        apep_rbuf_append(rb, s, strlen(s));
+}
+
+void apep_rbuf_putc(apep_rbuf_t *rb, char c)
+{
+    if (apep_rbuf_reserve(rb, 1) != 0)
+        return;
+    rb->data[rb->len++] = c;
+}
+
+void apep_rbuf_repeat(apep_rbuf_t *rb, char c, size_t n)
+{
+    if (n == 0 || apep_rbuf_reserve(rb, n) != 0)
+        return;
+    memset(rb->data + rb->len, c, n);
+    rb->len += n;
+}
+
+void apep_rbuf_ref(apep_rbuf_t *rb, const char *s, size_t n)
+{
+    if (!rb || !s || n == 0)
+        return;
+
+    if (!rb->ref_mode || n < APEP_RBUF_REF_MIN || rb->failed)
+    {
+        apep_rbuf_append(rb, s, n);
+        return;
+    }
+
+    if (rb->ref_count == rb->ref_cap)
+    {
+        size_t new_cap = rb->ref_cap ? rb->ref_cap * 2 : 8;
+        struct apep_rbuf_ref *grown = (struct apep_rbuf_ref *)realloc(rb->refs, new_cap * sizeof(*grown));
+        if (!grown)
+        {
+            /* Copying still works; only the zero-copy path is lost */
+            apep_rbuf_append(rb, s, n);
+            return;
+        }
+        rb->refs = grown;
+        rb->ref_cap = new_cap;
+    }
+
+    rb->refs[rb->ref_count].at = rb->len;
+    rb->refs[rb->ref_count].ptr = s;
+    rb->refs[rb->ref_count].len = n;
+    rb->ref_count++;
+    rb->ref_bytes += n;
+}
+
+size_t apep_rbuf_size(const apep_rbuf_t *rb)
+{
+    return rb ? rb->len + rb->ref_bytes : 0;
+}
+
+size_t apep_rbuf_pieces(const apep_rbuf_t *rb)
+{
+    return rb ? 2 * rb->ref_count + 1 : 0;
+}
+
+/* Piece i of the output: even pieces are owned bytes between references,
+   odd pieces are the references themselves. There are 2*ref_count+1. */
+size_t apep_rbuf_piece(const apep_rbuf_t *rb, size_t i, const char **p)
+{
+    size_t k = i / 2;
+    if (i & 1)
+    {
+        *p = rb->refs[k].ptr;
+        return rb->refs[k].len;
+    }
+
+    size_t from = k ? rb->refs[k - 1].at : 0;
+    size_t to = (k < rb->ref_count) ? rb->refs[k].at : rb->len;
+    *p = rb->data + from;
+    return to - from;
+}
+
+/* Copy referenced fragments into owned storage */
+static int apep_rbuf_flatten(apep_rbuf_t *rb)
+{
+    if (rb->ref_count == 0)
+        return 0;
+
+    size_t total = rb->len + rb->ref_bytes;
+    char *flat = (char *)malloc(total + 1);
+    if (!flat)
+    {
+        rb->failed = 1;
+        return -1;
+    }
+
+    size_t pos = 0;
+    for (size_t i = 0; i < 2 * rb->ref_count + 1; i++)
+    {
+        const char *p;
+        size_t n = apep_rbuf_piece(rb, i, &p);
+        if (n)
+            memcpy(flat + pos, p, n);
+        pos += n;
+    }
+
+    if (rb->heap)
+        free(rb->data);
+    rb->data = flat;
+    rb->len = total;
+    rb->cap = total + 1;
+    rb->heap = 1;
+    rb->ref_count = 0;
+    rb->ref_bytes = 0;
+    return 0;
+}
+
+void apep_rbuf_pad(apep_rbuf_t *rb, const char *s, size_t n, int width)
+{
+    /* printf-like: width > 0 right-aligns, width < 0 left-aligns */
+    size_t field = (size_t)(width < 0 ? -width : width);
+    size_t fill = field > n ? field - n : 0;
+
+    if (width > 0)
+        apep_rbuf_repeat(rb, ' ', fill);
+    apep_rbuf_append(rb, s, n);
+    if (width < 0)
+        apep_rbuf_repeat(rb, ' ', fill);
+}
+
+void apep_rbuf_uint(apep_rbuf_t *rb, unsigned long long v, int width)
+{
+    char digits[24];
+    size_t n = 0;
+    do
+    {
+        digits[sizeof(digits) - 1 - n++] = (char)('0' + (v % 10));
+        v /= 10;
+    } while (v);
+
+    apep_rbuf_pad(rb, digits + sizeof(digits) - n, n, width);
+}
+
+void apep_rbuf_int(apep_rbuf_t *rb, long long v, int width)
+{
+    char digits[24];
+    size_t n = 0;
+    int negative = v < 0;
+    /* Negate in unsigned space so LLONG_MIN is safe */
+    unsigned long long u = negative ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    do
+    {
+        digits[sizeof(digits) - 1 - n++] = (char)('0' + (u % 10));
+        u /= 10;
+    } while (u);
+    if (negative)
+        digits[sizeof(digits) - 1 - n++] = '-';
+
+    apep_rbuf_pad(rb, digits + sizeof(digits) - n, n, width);
+}
+
+void apep_rbuf_hex(apep_rbuf_t *rb, unsigned long long v, int min_digits, int upper)
+{
+    static const char lower_digits[] = "0123456789abcdef";
+    static const char upper_digits[] = "0123456789ABCDEF";
+    const char *set = upper ? upper_digits : lower_digits;
+
+    char digits[16];
+    size_t n = 0;
+    do
+    {
+        digits[sizeof(digits) - 1 - n++] = set[v & 0xF];
+        v >>= 4;
+    } while (v);
+
+    if (min_digits > 0 && (size_t)min_digits > n)
+        apep_rbuf_repeat(rb, '0', (size_t)min_digits - n);
+    apep_rbuf_append(rb, digits + sizeof(digits) - n, n);
+}
+
+int apep_rbuf_vprintf(apep_rbuf_t *rb, const char *fmt, va_list args)
+{
+    if (!rb || !fmt || rb->failed)
+        return -1;
+
+    va_list copy;
+    va_copy(copy, args);
+    size_t room = rb->cap > rb->len ? rb->cap - rb->len : 0;
+    int n = vsnprintf(room ? rb->data + rb->len : NULL, room, fmt, copy);
+    va_end(copy);
+
+    if (n < 0)
+        return -1;
+
+    if ((size_t)n >= room)
+    {
+        /* Did not fit: grow once to the exact size and format again */
+        if (apep_rbuf_reserve(rb, (size_t)n) != 0)
+            return -1;
+        vsnprintf(rb->data + rb->len, rb->cap - rb->len, fmt, args);
+    }
+
+    rb->len += (size_t)n;
+    return n;
+}
+
+int apep_rbuf_printf(apep_rbuf_t *rb, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = apep_rbuf_vprintf(rb, fmt, args);
+    va_end(args);
+    return n;
+}
+
+const char *apep_rbuf_cstr(apep_rbuf_t *rb)
+{
+    if (!rb)
+        return "";
+    if (apep_rbuf_flatten(rb) != 0)
+        return "";
+    if (rb->len >= rb->cap && apep_rbuf_reserve(rb, 0) != 0)
+        return "";
+    rb->data[rb->len] = '\0';
+    return rb->data;
+}
+
+/* ----------------------------
+Thread scratch area
+The largest heap block a thread's render buffers grew into (up to
+APEP_RBUF_SCRATCH_MAX) is kept and lent to the next buffer, so rendering
+long records allocates only until the thread has seen its largest one.
+---------------------------- */
+
+typedef struct apep_rbuf_scratch
+{
+    char *data;
+    size_t cap;
+    const apep_rbuf_t *owner; /* buffer currently lent the area, if any */
+} apep_rbuf_scratch_t;
+
+static APEP_THREAD_LOCAL apep_rbuf_scratch_t t_scratch;
+
+/* Free a thread's scratch area when it exits */
+#if defined(_WIN32)
+static DWORD g_scratch_fls = FLS_OUT_OF_INDEXES;
+static INIT_ONCE g_scratch_fls_once = INIT_ONCE_STATIC_INIT;
+
+static void WINAPI apep_rbuf_scratch_exit(void *p)
+{
+    free(((apep_rbuf_scratch_t *)p)->data);
+}
+
+static BOOL CALLBACK apep_rbuf_scratch_fls_init(PINIT_ONCE once, PVOID param, PVOID *ctx)
+{
+    (void)once;
+    (void)param;
+    (void)ctx;
+    g_scratch_fls = FlsAlloc(apep_rbuf_scratch_exit);
+    return TRUE;
+}
+
+static void apep_rbuf_scratch_watch_thread(apep_rbuf_scratch_t *sc)
+{
+    InitOnceExecuteOnce(&g_scratch_fls_once, apep_rbuf_scratch_fls_init, NULL, NULL);
+    if (g_scratch_fls != FLS_OUT_OF_INDEXES)
+        FlsSetValue(g_scratch_fls, sc);
+}
+#else
+static pthread_key_t g_scratch_key;
+static pthread_once_t g_scratch_key_once = PTHREAD_ONCE_INIT;
+
+static void apep_rbuf_scratch_exit(void *p)
+{
+    free(((apep_rbuf_scratch_t *)p)->data);
+}
+
+static void apep_rbuf_scratch_key_init(void)
+{
+    pthread_key_create(&g_scratch_key, apep_rbuf_scratch_exit);
+}
+
+static void apep_rbuf_scratch_watch_thread(apep_rbuf_scratch_t *sc)
+{
+    pthread_once(&g_scratch_key_once, apep_rbuf_scratch_key_init);
+    pthread_setspecific(g_scratch_key, sc);
+}
+#endif
+
+void apep_rbuf_init_scratch(apep_rbuf_t *rb, char *storage, size_t storage_size)
+{
+    apep_rbuf_scratch_t *sc = &t_scratch;
+
+    if (sc->owner)
+    {
+        /* Nested rendering on this thread: the area is taken */
+        apep_rbuf_init(rb, storage, storage_size);
+        return;
+    }
+
+    sc->owner = rb;
+    if (sc->cap > storage_size)
+        apep_rbuf_init(rb, sc->data, sc->cap);
+    else
+        apep_rbuf_init(rb, storage, storage_size);
+}
+
+void apep_rbuf_free_scratch(apep_rbuf_t *rb)
+{
+    apep_rbuf_scratch_t *sc = &t_scratch;
+
+    if (sc->owner == rb)
+    {
+        sc->owner = NULL;
+
+        /* Keep a larger block the buffer grew into */
+        if (rb->heap && rb->cap > sc->cap && rb->cap <= APEP_RBUF_SCRATCH_MAX)
+        {
+            if (!sc->data)
+                apep_rbuf_scratch_watch_thread(sc);
+            free(sc->data);
+            sc->data = rb->data;
+            sc->cap = rb->cap;
+            rb->heap = 0;
+        }
+    }
+    apep_rbuf_free(rb);
+}
+
+/* ----------------------------
+Emission
+---------------------------- */
+
+#if defined(_WIN32)
+/* Console handles need UTF-16 to display UTF-8 output correctly */
+static int apep_rbuf_write_console(const apep_rbuf_t *rb, FILE *out)
+{
+    HANDLE h = NULL;
+    if (out == stdout)
+        h = GetStdHandle(STD_OUTPUT_HANDLE);
+    else if (out == stderr)
+        h = GetStdHandle(STD_ERROR_HANDLE);
+
+    DWORD mode = 0;
+    if (!h || h == INVALID_HANDLE_VALUE || !GetConsoleMode(h, &mode))
+        return -1;
+
+    int wlen = MultiByteToWideChar(CP_UTF8, 0, rb->data, (int)rb->len, NULL, 0);
+    if (wlen <= 0)
+        return -1;
+
+    WCHAR *wbuf = (WCHAR *)malloc(sizeof(WCHAR) * (size_t)wlen);
+    if (!wbuf)
+        return -1;
+
+    MultiByteToWideChar(CP_UTF8, 0, rb->data, (int)rb->len, wbuf, wlen);
+    APEP_LOCK_STREAM(out);
+    fflush(out); /* keep ordering with anything already buffered */
+    DWORD written = 0;
+    WriteConsoleW(h, wbuf, (DWORD)wlen, &written, NULL);
+    APEP_UNLOCK_STREAM(out);
+    free(wbuf);
+    return 0;
+}
+#endif
+
+int apep_rbuf_write(const apep_rbuf_t *rb, FILE *out)
+{
+    if (!rb || !out)
+        return -1;
+    if (apep_rbuf_size(rb) == 0)
+        return 0;
+
+#if defined(_WIN32)
+    if (rb->ref_count == 0 && apep_rbuf_write_console(rb, out) == 0)
+        return 0;
+#endif
+
+    /* One lock scope per diagnostic, never torn by other threads */
+    int rc = 0;
+    APEP_LOCK_STREAM(out);
+    for (size_t i = 0; i < 2 * rb->ref_count + 1; i++)
+    {
+        const char *p;
+        size_t n = apep_rbuf_piece(rb, i, &p);
+        if (n && APEP_FWRITE_UNLOCKED(p, n, out) != n)
+        {
+            rc = -1;
+            break;
+        }
+    }
+    APEP_UNLOCK_STREAM(out);
+
+    return rc;
+}
+
+#if defined(_WIN32)
+int apep_rbuf_write_fd(const apep_rbuf_t *rb, int fd)
+{
+    if (!rb || fd < 0)
+        return -1;
+
+    for (size_t i = 0; i < 2 * rb->ref_count + 1; i++)
+    {
+        const char *p;
+        size_t left = apep_rbuf_piece(rb, i, &p);
+        while (left > 0)
+        {
+            int n = _write(fd, p, (unsigned int)left);
+            if (n <= 0)
+                return -1;
+            p += n;
+            left -= (size_t)n;
+        }
+    }
+    return 0;
+}
+#else
+int apep_rbuf_write_fd(const apep_rbuf_t *rb, int fd)
+{
+    if (!rb || fd < 0)
+        return -1;
+
+    size_t pieces = 2 * rb->ref_count + 1;
+    size_t i = 0;    /* first piece not fully written */
+    size_t skip = 0; /* bytes of piece i already written */
+
+    while (i < pieces)
+    {
+        struct iovec iov[APEP_RBUF_IOV_BATCH];
+        int cnt = 0;
+        for (size_t j = i; j < pieces && cnt < APEP_RBUF_IOV_BATCH; j++)
+        {
+            const char *p;
+            size_t n = apep_rbuf_piece(rb, j, &p);
+            if (j == i)
+            {
+                p += skip;
+                n -= skip;
+            }
+            if (n == 0)
+                continue;
+            iov[cnt].iov_base = (void *)p;
+            iov[cnt].iov_len = n;
+            cnt++;
+        }
+        if (cnt == 0)
+            break;
+
+        ssize_t w = writev(fd, iov, cnt);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+
+        /* Advance past what was written, including partial pieces */
+        size_t done = (size_t)w;
+        while (i < pieces)
+        {
+            const char *p;
+            size_t rem = apep_rbuf_piece(rb, i, &p) - skip;
+            if (done < rem)
+            {
+                skip += done;
+                break;
+            }
+            done -= rem;
+            skip = 0;
+            i++;
+        }
+    }
+    return 0;
+}
+#endif
+
+int apep_rbuf_emit(const apep_rbuf_t *rb, const apep_options_t *opt)
+{
+    FILE *out = (opt && opt->out) ? opt->out : stderr;
+    int fd = (opt && opt->zero_copy) ? APEP_RBUF_FILENO(out) : -1;
+
+    if (fd < 0)
+        return apep_rbuf_write(rb, out);
+
+    /* Bypass stdio: drain what it holds, then one writev under the lock */
+    APEP_LOCK_STREAM(out);
+    fflush(out);
+    int rc = apep_rbuf_write_fd(rb, fd);
+    APEP_UNLOCK_STREAM(out);
+    return rc;
+}
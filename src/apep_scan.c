@@ -0,0 +1,510 @@
+#include "apep_internal.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define APEP_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/* ----------------------------
+Portable fallback (SWAR, 8 bytes per step)
+---------------------------- */
+
+#define APEP_ONES 0x0101010101010101ULL
+#define APEP_HIGHS 0x8080808080808080ULL
+
+/* Eight bytes with p[0] in the least significant byte on every target, so
+   ctz / 8 of a hit mask is the offset of the first hit */
+static uint64_t apep_load64(const char *p)
+{
+#if defined(_MSC_VER) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return __builtin_bswap64(v);
+#else
+    const unsigned char *u = (const unsigned char *)p;
+    uint64_t v = 0;
+    for (int k = 7; k >= 0; k--)
+        v = (v << 8) | u[k];
+    return v;
+#endif
+}
+
+/* Exact per-byte equality mask: high bit set in every byte of v equal to c */
+static uint64_t apep_swar_eq(uint64_t v, uint64_t splat)
+{
+    uint64_t x = v ^ splat;
+    return ~(((x & ~APEP_HIGHS) + ~APEP_HIGHS) | x | ~APEP_HIGHS) & APEP_HIGHS;
+}
+
+static const char *apep_swar_find_any(const char *p, size_t n, const unsigned char *set, size_t set_len)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t v = apep_load64(p + i);
+        uint64_t hit = 0;
+        for (size_t k = 0; k < set_len; k++)
+            hit |= apep_swar_eq(v, APEP_ONES * set[k]);
+        if (hit)
+            break;
+    }
+    for (; i < n; i++)
+    {
+        for (size_t k = 0; k < set_len; k++)
+        {
+            if ((unsigned char)p[i] == set[k])
+                return p + i;
+        }
+    }
+    return NULL;
+}
+
+static const char *apep_swar_find(const char *p, size_t n, unsigned char c)
+{
+    return apep_swar_find_any(p, n, &c, 1);
+}
+
+/* Bytes a JSON string must escape: '"', '\\' and controls below 0x20 */
+static int apep_json_special(unsigned char c)
+{
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+static const char *apep_swar_find_json(const char *p, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t v = apep_load64(p + i);
+        /* (v - 0x20) & ~v flags every byte below 0x20; later bytes of the
+           word may be flagged too, but the tail loop finds the first */
+        uint64_t hit = apep_swar_eq(v, APEP_ONES * '"') | apep_swar_eq(v, APEP_ONES * '\\') |
+                       ((v - APEP_ONES * 0x20) & ~v & APEP_HIGHS);
+        if (hit)
+            break;
+    }
+    for (; i < n; i++)
+    {
+        if (apep_json_special((unsigned char)p[i]))
+            return p + i;
+    }
+    return NULL;
+}
+
+static size_t apep_popcount64(uint64_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t)__builtin_popcountll(v);
+#else
+    size_t count = 0;
+    while (v)
+    {
+        v &= v - 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+static size_t apep_ctz64(uint64_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t)__builtin_ctzll(v);
+#else
+    size_t n = 0;
+    while (!(v & 1))
+    {
+        v >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+static const char *apep_swar_nth(const char *p, size_t n, unsigned char c, size_t k, size_t *found)
+{
+    uint64_t splat = APEP_ONES * c;
+    size_t seen = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        size_t hits = apep_popcount64(apep_swar_eq(apep_load64(p + i), splat));
+        if (seen + hits >= k)
+            break;
+        seen += hits;
+    }
+    for (; i < n; i++)
+    {
+        if ((unsigned char)p[i] == c && ++seen == k)
+        {
+            *found = k;
+            return p + i;
+        }
+    }
+    *found = seen;
+    return NULL;
+}
+
+static size_t apep_swar_collect(const char *p, size_t n, unsigned char c, size_t *out, size_t max, size_t base)
+{
+    uint64_t splat = APEP_ONES * c;
+    size_t got = 0;
+    size_t i = 0;
+    for (; i + 8 <= n && got < max; i += 8)
+    {
+        uint64_t mask = apep_swar_eq(apep_load64(p + i), splat);
+        while (mask && got < max)
+        {
+            /* apep_load64() order: lowest set high bit is the first hit */
+            out[got++] = base + i + apep_ctz64(mask) / 8;
+            mask &= mask - 1;
+        }
+    }
+    for (; i < n && got < max; i++)
+    {
+        if ((unsigned char)p[i] == c)
+            out[got++] = base + i;
+    }
+    return got;
+}
+
+/* ----------------------------
+x86 SSE2 / AVX2 paths
+---------------------------- */
+
+#ifdef APEP_SCAN_X86
+
+static unsigned apep_ctz32(uint32_t v)
+{
+    return (unsigned)__builtin_ctz(v);
+}
+
+__attribute__((target("sse2"))) static __m128i apep_sse2_any_mask(__m128i v, const __m128i *needles, size_t set_len)
+{
+    __m128i hit = _mm_cmpeq_epi8(v, needles[0]);
+    for (size_t k = 1; k < set_len; k++)
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, needles[k]));
+    return hit;
+}
+
+__attribute__((target("sse2"))) static const char *apep_sse2_find_any(const char *p, size_t n, const unsigned char *set, size_t set_len)
+{
+    __m128i needles[APEP_SCAN_MAX_SET];
+    for (size_t k = 0; k < set_len; k++)
+        needles[k] = _mm_set1_epi8((char)set[k]);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(p + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(apep_sse2_any_mask(v, needles, set_len));
+        if (mask)
+            return p + i + apep_ctz32(mask);
+    }
+    return apep_swar_find_any(p + i, n - i, set, set_len);
+}
+
+__attribute__((target("sse2"))) static const char *apep_sse2_find(const char *p, size_t n, unsigned char c)
+{
+    return apep_sse2_find_any(p, n, &c, 1);
+}
+
+__attribute__((target("sse2"))) static const char *apep_sse2_nth(const char *p, size_t n, unsigned char c, size_t k, size_t *found)
+{
+    __m128i needle = _mm_set1_epi8((char)c);
+    size_t seen = 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(p + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        size_t hits = (size_t)__builtin_popcount(mask);
+        if (seen + hits >= k)
+        {
+            /* Drop the hits before the one we want */
+            for (size_t skip = k - seen - 1; skip > 0; skip--)
+                mask &= mask - 1;
+            *found = k;
+            return p + i + apep_ctz32(mask);
+        }
+        seen += hits;
+    }
+
+    size_t tail_found = 0;
+    const char *r = apep_swar_nth(p + i, n - i, c, k - seen, &tail_found);
+    *found = seen + tail_found;
+    return r;
+}
+
+/* Unsigned v <= 0x1F is min(v, 0x1F) == v */
+__attribute__((target("sse2"))) static const char *apep_sse2_find_json(const char *p, size_t n)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(p + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                   _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(hit);
+        if (mask)
+            return p + i + apep_ctz32(mask);
+    }
+    return apep_swar_find_json(p + i, n - i);
+}
+
+__attribute__((target("avx2"))) static const char *apep_avx2_find_json(const char *p, size_t n)
+{
+    size_t i = 0;
+
+    /* Short strings (most keys and messages) stay off the 256-bit unit */
+    if (n >= 32)
+    {
+        const __m256i quote = _mm256_set1_epi8('"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i control = _mm256_set1_epi8(0x1F);
+
+        for (; i + 32 <= n; i += 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(p + i));
+            __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+                                          _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+            if (mask)
+                return p + i + apep_ctz32(mask);
+        }
+
+        /* The compiler does not always clear the upper halves before the
+           tail call, and code after it would pay an SSE/AVX transition */
+        _mm256_zeroupper();
+    }
+
+    if (i + 16 <= n)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(p + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                                                _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+                                   _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1F)), v));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(hit);
+        if (mask)
+            return p + i + apep_ctz32(mask);
+        i += 16;
+    }
+    return apep_swar_find_json(p + i, n - i);
+}
+
+__attribute__((target("avx2"))) static const char *apep_avx2_find_any(const char *p, size_t n, const unsigned char *set, size_t set_len)
+{
+    __m256i needles[APEP_SCAN_MAX_SET];
+    for (size_t k = 0; k < set_len; k++)
+        needles[k] = _mm256_set1_epi8((char)set[k]);
+
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(p + i));
+        __m256i hit = _mm256_cmpeq_epi8(v, needles[0]);
+        for (size_t k = 1; k < set_len; k++)
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, needles[k]));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+        if (mask)
+            return p + i + apep_ctz32(mask);
+    }
+    return apep_swar_find_any(p + i, n - i, set, set_len);
+}
+
+__attribute__((target("avx2"))) static const char *apep_avx2_find(const char *p, size_t n, unsigned char c)
+{
+    return apep_avx2_find_any(p, n, &c, 1);
+}
+
+__attribute__((target("avx2"))) static const char *apep_avx2_nth(const char *p, size_t n, unsigned char c, size_t k, size_t *found)
+{
+    __m256i needle = _mm256_set1_epi8((char)c);
+    size_t seen = 0;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(p + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+        size_t hits = (size_t)__builtin_popcount(mask);
+        if (seen + hits >= k)
+        {
+            for (size_t skip = k - seen - 1; skip > 0; skip--)
+                mask &= mask - 1;
+            *found = k;
+            return p + i + apep_ctz32(mask);
+        }
+        seen += hits;
+    }
+
+    size_t tail_found = 0;
+    const char *r = apep_swar_nth(p + i, n - i, c, k - seen, &tail_found);
+    *found = seen + tail_found;
+    return r;
+}
+
+__attribute__((target("sse2"))) static size_t apep_sse2_collect(const char *p, size_t n, unsigned char c, size_t *out, size_t max, size_t base)
+{
+    __m128i needle = _mm_set1_epi8((char)c);
+    size_t got = 0;
+    size_t i = 0;
+    for (; i + 16 <= n && got < max; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(p + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        while (mask && got < max)
+        {
+            out[got++] = base + i + apep_ctz32(mask);
+            mask &= mask - 1;
+        }
+    }
+    for (; i < n && got < max; i++)
+    {
+        if ((unsigned char)p[i] == c)
+            out[got++] = base + i;
+    }
+    return got;
+}
+
+__attribute__((target("avx2"))) static size_t apep_avx2_collect(const char *p, size_t n, unsigned char c, size_t *out, size_t max, size_t base)
+{
+    __m256i needle = _mm256_set1_epi8((char)c);
+    size_t got = 0;
+    size_t i = 0;
+    for (; i + 32 <= n && got < max; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(p + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+        while (mask && got < max)
+        {
+            out[got++] = base + i + apep_ctz32(mask);
+            mask &= mask - 1;
+        }
+    }
+    for (; i < n && got < max; i++)
+    {
+        if ((unsigned char)p[i] == c)
+            out[got++] = base + i;
+    }
+    return got;
+}
+
+#endif /* APEP_SCAN_X86 */
+
+/* ----------------------------
+Runtime dispatch
+---------------------------- */
+
+typedef struct apep_scan_impl
+{
+    const char *(*find)(const char *p, size_t n, unsigned char c);
+    const char *(*find_any)(const char *p, size_t n, const unsigned char *set, size_t set_len);
+    const char *(*nth)(const char *p, size_t n, unsigned char c, size_t k, size_t *found);
+    size_t (*collect)(const char *p, size_t n, unsigned char c, size_t *out, size_t max, size_t base);
+    const char *(*find_json)(const char *p, size_t n);
+    const char *name;
+} apep_scan_impl_t;
+
+static const apep_scan_impl_t apep_scan_portable = {
+    apep_swar_find, apep_swar_find_any, apep_swar_nth, apep_swar_collect, apep_swar_find_json, "portable"};
+
+#ifdef APEP_SCAN_X86
+static const apep_scan_impl_t apep_scan_sse2 = {
+    apep_sse2_find, apep_sse2_find_any, apep_sse2_nth, apep_sse2_collect, apep_sse2_find_json, "sse2"};
+static const apep_scan_impl_t apep_scan_avx2 = {
+    apep_avx2_find, apep_avx2_find_any, apep_avx2_nth, apep_avx2_collect, apep_avx2_find_json, "avx2"};
+#endif
+
+/* Read by every scan; apep_scan_select() replaces it (meant for start-up
+   and benchmarks, before other threads scan) */
+static const apep_scan_impl_t *volatile g_scan_impl = NULL;
+
+static const apep_scan_impl_t *apep_scan_resolve(apep_scan_isa_t isa)
+{
+#ifdef APEP_SCAN_X86
+    __builtin_cpu_init();
+    int has_sse2 = __builtin_cpu_supports("sse2");
+    int has_avx2 = has_sse2 && __builtin_cpu_supports("avx2");
+
+    if ((isa == APEP_SCAN_ISA_BEST || isa == APEP_SCAN_ISA_AVX2) && has_avx2)
+        return &apep_scan_avx2;
+    if ((isa == APEP_SCAN_ISA_BEST || isa == APEP_SCAN_ISA_SSE2 || isa == APEP_SCAN_ISA_AVX2) && has_sse2)
+        return &apep_scan_sse2;
+#else
+    (void)isa;
+#endif
+    return &apep_scan_portable;
+}
+
+static const apep_scan_impl_t *apep_scan_impl(void)
+{
+    /* Racing first calls resolve and publish the same table */
+    const apep_scan_impl_t *impl = APEP_LOAD_ACQUIRE(&g_scan_impl);
+    if (!impl)
+    {
+        impl = apep_scan_resolve(APEP_SCAN_ISA_BEST);
+        APEP_STORE_RELEASE(&g_scan_impl, impl);
+    }
+    return impl;
+}
+
+const char *apep_scan_select(apep_scan_isa_t isa)
+{
+    const apep_scan_impl_t *impl = apep_scan_resolve(isa);
+    APEP_STORE_RELEASE(&g_scan_impl, impl);
+    return impl->name;
+}
+
+const char *apep_scan_byte(const char *p, size_t n, char c)
+{
+    if (!p || n == 0)
+        return NULL;
+    return apep_scan_impl()->find(p, n, (unsigned char)c);
+}
+
+const char *apep_scan_any(const char *p, size_t n, const char *set)
+{
+    if (!p || n == 0 || !set || !set[0])
+        return NULL;
+
+    size_t set_len = strlen(set);
+    if (set_len > APEP_SCAN_MAX_SET)
+        set_len = APEP_SCAN_MAX_SET;
+    return apep_scan_impl()->find_any(p, n, (const unsigned char *)set, set_len);
+}
+
+const char *apep_scan_nth(const char *p, size_t n, char c, size_t k, size_t *found)
+{
+    size_t dummy = 0;
+    if (!found)
+        found = &dummy;
+    *found = 0;
+    if (!p || n == 0 || k == 0)
+        return NULL;
+    return apep_scan_impl()->nth(p, n, (unsigned char)c, k, found);
+}
+
+size_t apep_scan_collect(const char *p, size_t n, char c, size_t *out, size_t max, size_t base)
+{
+    if (!p || n == 0 || !out || max == 0)
+        return 0;
+    return apep_scan_impl()->collect(p, n, (unsigned char)c, out, max, base);
+}
+
+const char *apep_scan_json(const char *p, size_t n)
+{
+    if (!p || n == 0)
+        return NULL;
+    return apep_scan_impl()->find_json(p, n);
+}
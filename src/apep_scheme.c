@@ -6,57 +6,71 @@
 static apep_color_scheme_t current_scheme = APEP_SCHEME_DEFAULT;
 static apep_custom_colors_t custom_colors = {0};
 
-/* Color scheme definitions */
+/* Bumped on every scheme change so resolved palettes know to rebuild */
+static volatile unsigned scheme_generation = 0;
+
+/* Color scheme definitions.
+   Level colors left NULL follow the severity colors (see role_from_scheme). */
 static const struct
 {
-    const char *error;
-    const char *warning;
-    const char *note;
-    const char *highlight;
-    const char *caret;
-    const char *label;
-    const char *dim;
+    apep_custom_colors_t base;
+    const char *trace;
+    const char *debug;
+    const char *info;
+    const char *lvl_warn;
+    const char *lvl_error;
+    const char *critical;
 } color_schemes[] = {
     [APEP_SCHEME_DEFAULT] = {
-        .error = "\x1b[1;31m",        /* bold red */
-        .warning = "\x1b[33m",        /* yellow */
-        .note = "\x1b[34m",           /* blue */
-        .highlight = "\x1b[1;33;41m", /* bold yellow on red */
-        .caret = "\x1b[1;31m",        /* bold red */
-        .label = "\x1b[1m",           /* bold */
-        .dim = "\x1b[2m"              /* dim */
-    },
-    [APEP_SCHEME_DARK] = {
-        .error = "\x1b[1;91m", /* bold bright red */
-        .warning = "\x1b[93m", /* bright yellow */
-        .note = "\x1b[96m",    /* bright cyan */
-        .highlight = "\x1b[1;93;41m",
-        .caret = "\x1b[1;91m",
-        .label = "\x1b[1;97m",  /* bold bright white */
-        .dim = "\x1b[38;5;240m" /* gray */
-    },
-    [APEP_SCHEME_LIGHT] = {
-        .error = "\x1b[31m",         /* red (not bold) */
-        .warning = "\x1b[38;5;130m", /* orange */
-        .note = "\x1b[34m",          /* blue */
-        .highlight = "\x1b[33;41m",
-        .caret = "\x1b[31m",
-        .label = "\x1b[1;30m", /* bold black */
-        .dim = "\x1b[90m"      /* bright black */
+        .base = {
+            .error = "\x1b[1;31m",        /* bold red */
+            .warning = "\x1b[33m",        /* yellow */
+            .note = "\x1b[34m",           /* blue */
+            .highlight = "\x1b[1;33;41m", /* bold yellow on red */
+            .caret = "\x1b[1;31m",        /* bold red */
+            .label = "\x1b[1m",           /* bold */
+            .dim = "\x1b[2m"              /* dim */
+        },
+        .trace = "\x1b[2m",      /* dim */
+        .debug = "\x1b[36m",     /* cyan */
+        .info = "\x1b[32m",      /* green */
+        .lvl_warn = "\x1b[33m",  /* yellow */
+        .lvl_error = "\x1b[31m", /* red */
+        .critical = "\x1b[1;31m" /* bold red */
     },
-    [APEP_SCHEME_COLORBLIND] = {.error = "\x1b[1;35m",        /* bold magenta */
-                                .warning = "\x1b[36m",        /* cyan */
-                                .note = "\x1b[34m",           /* blue */
-                                .highlight = "\x1b[1;36;45m", /* cyan on magenta */
-                                .caret = "\x1b[1;35m",
-                                .label = "\x1b[1m",
-                                .dim = "\x1b[2m"}};
+    [APEP_SCHEME_DARK] = {.base = {
+                              .error = "\x1b[1;91m", /* bold bright red */
+                              .warning = "\x1b[93m", /* bright yellow */
+                              .note = "\x1b[96m",    /* bright cyan */
+                              .highlight = "\x1b[1;93;41m",
+                              .caret = "\x1b[1;91m",
+                              .label = "\x1b[1;97m",  /* bold bright white */
+                              .dim = "\x1b[38;5;240m" /* gray */
+                          }},
+    [APEP_SCHEME_LIGHT] = {.base = {
+                               .error = "\x1b[31m",         /* red (not bold) */
+                               .warning = "\x1b[38;5;130m", /* orange */
+                               .note = "\x1b[34m",          /* blue */
+                               .highlight = "\x1b[33;41m",
+                               .caret = "\x1b[31m",
+                               .label = "\x1b[1;30m", /* bold black */
+                               .dim = "\x1b[90m"      /* bright black */
+                           }},
+    [APEP_SCHEME_COLORBLIND] = {.base = {
+                                    .error = "\x1b[1;35m",        /* bold magenta */
+                                    .warning = "\x1b[36m",        /* cyan */
+                                    .note = "\x1b[34m",           /* blue */
+                                    .highlight = "\x1b[1;36;45m", /* cyan on magenta */
+                                    .caret = "\x1b[1;35m",
+                                    .label = "\x1b[1m",
+                                    .dim = "\x1b[2m"}}};
 
 void apep_set_color_scheme(apep_color_scheme_t scheme)
 {
     if (scheme >= APEP_SCHEME_DEFAULT && scheme <= APEP_SCHEME_CUSTOM)
     {
         current_scheme = scheme;
+        APEP_STORE_RELEASE(&scheme_generation, scheme_generation + 1);
     }
 }
 
@@ -66,6 +80,7 @@ void apep_set_custom_colors(const apep_custom_colors_t *colors)
     {
         custom_colors = *colors;
         current_scheme = APEP_SCHEME_CUSTOM;
+        APEP_STORE_RELEASE(&scheme_generation, scheme_generation + 1);
     }
 }
 
@@ -74,18 +89,49 @@ apep_color_scheme_t apep_get_color_scheme(void)
     return current_scheme;
 }
 
-/* Get color code for role based on current scheme */
-const char *apep_get_color_for_role(apep_color_role_t role)
+unsigned apep_scheme_generation(void)
+{
+    return APEP_LOAD_ACQUIRE(&scheme_generation);
+}
+
+/* Look a role up in one scheme; NULL if the scheme leaves it unset */
+static const char *role_from_scheme(apep_color_scheme_t scheme, apep_color_role_t role)
 {
     const apep_custom_colors_t *colors;
+    const char *level = NULL;
 
-    if (current_scheme == APEP_SCHEME_CUSTOM)
+    if (scheme == APEP_SCHEME_CUSTOM)
     {
         colors = &custom_colors;
     }
     else
     {
-        colors = (const apep_custom_colors_t *)&color_schemes[current_scheme];
+        colors = &color_schemes[scheme].base;
+        switch (role)
+        {
+        case APEP_CR_LVL_TRACE:
+            level = color_schemes[scheme].trace;
+            break;
+        case APEP_CR_LVL_DEBUG:
+            level = color_schemes[scheme].debug;
+            break;
+        case APEP_CR_LVL_INFO:
+            level = color_schemes[scheme].info;
+            break;
+        case APEP_CR_LVL_WARN:
+            level = color_schemes[scheme].lvl_warn;
+            break;
+        case APEP_CR_LVL_ERROR:
+            level = color_schemes[scheme].lvl_error;
+            break;
+        case APEP_CR_LVL_CRITICAL:
+            level = color_schemes[scheme].critical;
+            break;
+        default:
+            break;
+        }
+        if (level)
+            return level;
     }
 
     switch (role)
@@ -111,6 +157,34 @@ const char *apep_get_color_for_role(apep_color_role_t role)
     case APEP_CR_LVL_DEBUG:
         return colors->dim;
     default:
+        return NULL;
+    }
+}
+
+/* Get color code for role based on current scheme */
+const char *apep_get_color_for_role(apep_color_role_t role)
+{
+    /* JSON syntax colors are not part of the schemes */
+    switch (role)
+    {
+    case APEP_CR_JSON_KEY:
+        return "\x1b[36m"; /* cyan */
+    case APEP_CR_JSON_STRING:
+        return "\x1b[32m"; /* green */
+    case APEP_CR_JSON_NUMBER:
+        return "\x1b[33m"; /* yellow */
+    case APEP_CR_JSON_PUNCT:
+        return "\x1b[1;37m"; /* bold white */
+    case APEP_CR_RESET:
         return "\x1b[0m";
+    default:
+        break;
     }
+
+    const char *code = role_from_scheme(current_scheme, role);
+
+    /* Unset custom colors fall back to the default scheme */
+    if (!code)
+        code = role_from_scheme(APEP_SCHEME_DEFAULT, role);
+    return code ? code : "\x1b[0m";
 }
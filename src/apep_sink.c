@@ -0,0 +1,681 @@
+#include "../include/apep/apep_sink.h"
+#include "apep_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#define APEP_SINK_CLOSE _close
+#define APEP_SINK_FILENO _fileno
+#define apep_sink_yield() SwitchToThread()
+#else
+#include <sched.h>
+#include <unistd.h>
+#define APEP_SINK_CLOSE close
+#define APEP_SINK_FILENO fileno
+#define apep_sink_yield() sched_yield()
+#endif
+
+/* ----------------------------
+Record lock
+Held only around copying one record (or one writev for fd sinks), and
+by apep_set_global_options() around publishing a snapshot.
+---------------------------- */
+
+void apep_spin_lock(volatile long *l)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    while (__atomic_exchange_n(l, 1L, __ATOMIC_ACQUIRE))
+        apep_sink_yield();
+#elif defined(_MSC_VER)
+    while (_InterlockedExchange(l, 1L))
+        apep_sink_yield();
+#else
+    (void)l;
+#endif
+}
+
+void apep_spin_unlock(volatile long *l)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(l, 0L, __ATOMIC_RELEASE);
+#elif defined(_MSC_VER)
+    _InterlockedExchange(l, 0L);
+#else
+    (void)l;
+#endif
+}
+
+/* Append every piece of record to out */
+static void apep_sink_copy_record(apep_rbuf_t *out, const apep_rbuf_t *record)
+{
+    size_t pieces = apep_rbuf_pieces(record);
+    for (size_t i = 0; i < pieces; i++)
+    {
+        const char *p;
+        size_t n = apep_rbuf_piece(record, i, &p);
+        apep_rbuf_append(out, p, n);
+    }
+}
+
+/* ----------------------------
+Generic interface
+---------------------------- */
+
+int apep_sink_write_rbuf(apep_sink_t *sink, const apep_rbuf_t *record)
+{
+    if (!sink || !sink->vt || !sink->vt->write || !record)
+        return -1;
+    return sink->vt->write(sink, record);
+}
+
+int apep_sink_write(apep_sink_t *sink, const char *data, size_t len)
+{
+    if (!data)
+        return -1;
+
+    /* A read-only view; nothing is appended to it */
+    apep_rbuf_t view;
+    apep_rbuf_init(&view, (char *)data, len);
+    view.len = len;
+    return apep_sink_write_rbuf(sink, &view);
+}
+
+int apep_sink_flush(apep_sink_t *sink)
+{
+    if (!sink || !sink->vt)
+        return -1;
+    return sink->vt->flush ? sink->vt->flush(sink) : 0;
+}
+
+void apep_sink_destroy(apep_sink_t *sink)
+{
+    if (sink && sink->vt && sink->vt->destroy)
+        sink->vt->destroy(sink);
+}
+
+/* ----------------------------
+FILE sink
+---------------------------- */
+
+typedef struct apep_file_sink
+{
+    apep_sink_t base;
+    FILE *out;
+    int owns;
+} apep_file_sink_t;
+
+static int apep_file_sink_write(apep_sink_t *sink, const apep_rbuf_t *record)
+{
+    return apep_rbuf_write(record, ((apep_file_sink_t *)sink)->out);
+}
+
+static int apep_file_sink_flush(apep_sink_t *sink)
+{
+    return fflush(((apep_file_sink_t *)sink)->out) == 0 ? 0 : -1;
+}
+
+static void apep_file_sink_destroy(apep_sink_t *sink)
+{
+    apep_file_sink_t *fs = (apep_file_sink_t *)sink;
+    if (fs->owns)
+        fclose(fs->out);
+    else
+        fflush(fs->out);
+    free(fs);
+}
+
+static const apep_sink_vtable_t apep_file_sink_vt = {
+    apep_file_sink_write, apep_file_sink_flush, apep_file_sink_destroy};
+
+apep_sink_t *apep_sink_file_create(FILE *out, int close_on_destroy)
+{
+    if (!out)
+        return NULL;
+
+    apep_file_sink_t *fs = (apep_file_sink_t *)calloc(1, sizeof(*fs));
+    if (!fs)
+        return NULL;
+
+    fs->base.vt = &apep_file_sink_vt;
+    fs->base.fd = APEP_SINK_FILENO(out);
+    fs->out = out;
+    fs->owns = close_on_destroy;
+    return &fs->base;
+}
+
+/* ----------------------------
+Raw fd sink
+---------------------------- */
+
+typedef struct apep_fd_sink
+{
+    apep_sink_t base;
+    volatile long lock;
+    int owns;
+} apep_fd_sink_t;
+
+static int apep_fd_sink_write(apep_sink_t *sink, const apep_rbuf_t *record)
+{
+    apep_fd_sink_t *fs = (apep_fd_sink_t *)sink;
+
+    /* writev may return short; keep the rest of the record contiguous */
+    apep_spin_lock(&fs->lock);
+    int rc = apep_rbuf_write_fd(record, fs->base.fd);
+    apep_spin_unlock(&fs->lock);
+    return rc;
+}
+
+static void apep_fd_sink_destroy(apep_sink_t *sink)
+{
+    apep_fd_sink_t *fs = (apep_fd_sink_t *)sink;
+    if (fs->owns)
+        APEP_SINK_CLOSE(fs->base.fd);
+    free(fs);
+}
+
+static const apep_sink_vtable_t apep_fd_sink_vt = {
+    apep_fd_sink_write, NULL, apep_fd_sink_destroy};
+
+apep_sink_t *apep_sink_fd_create(int fd, int close_on_destroy)
+{
+    if (fd < 0)
+        return NULL;
+
+    apep_fd_sink_t *fs = (apep_fd_sink_t *)calloc(1, sizeof(*fs));
+    if (!fs)
+        return NULL;
+
+    fs->base.vt = &apep_fd_sink_vt;
+    fs->base.fd = fd;
+    fs->owns = close_on_destroy;
+    return &fs->base;
+}
+
+/* ----------------------------
+Memory sink
+---------------------------- */
+
+typedef struct apep_memory_sink
+{
+    apep_sink_t base;
+    volatile long lock;
+    apep_rbuf_t buf;
+} apep_memory_sink_t;
+
+static int apep_memory_sink_write(apep_sink_t *sink, const apep_rbuf_t *record)
+{
+    apep_memory_sink_t *ms = (apep_memory_sink_t *)sink;
+
+    apep_spin_lock(&ms->lock);
+    apep_sink_copy_record(&ms->buf, record);
+    int rc = ms->buf.failed ? -1 : 0;
+    apep_spin_unlock(&ms->lock);
+    return rc;
+}
+
+static void apep_memory_sink_destroy(apep_sink_t *sink)
+{
+    apep_memory_sink_t *ms = (apep_memory_sink_t *)sink;
+    apep_rbuf_free(&ms->buf);
+    free(ms);
+}
+
+static const apep_sink_vtable_t apep_memory_sink_vt = {
+    apep_memory_sink_write, NULL, apep_memory_sink_destroy};
+
+apep_sink_t *apep_sink_memory_create(void)
+{
+    apep_memory_sink_t *ms = (apep_memory_sink_t *)calloc(1, sizeof(*ms));
+    if (!ms)
+        return NULL;
+
+    ms->base.vt = &apep_memory_sink_vt;
+    ms->base.fd = -1;
+    apep_rbuf_init(&ms->buf, NULL, 0);
+    return &ms->base;
+}
+
+const char *apep_sink_memory_data(apep_sink_t *sink, size_t *len)
+{
+    if (!sink || sink->vt != &apep_memory_sink_vt)
+    {
+        if (len)
+            *len = 0;
+        return "";
+    }
+
+    apep_memory_sink_t *ms = (apep_memory_sink_t *)sink;
+    apep_spin_lock(&ms->lock);
+    const char *data = apep_rbuf_cstr(&ms->buf);
+    if (len)
+        *len = ms->buf.len;
+    apep_spin_unlock(&ms->lock);
+    return data;
+}
+
+void apep_sink_memory_clear(apep_sink_t *sink)
+{
+    if (!sink || sink->vt != &apep_memory_sink_vt)
+        return;
+
+    apep_memory_sink_t *ms = (apep_memory_sink_t *)sink;
+    apep_spin_lock(&ms->lock);
+    apep_rbuf_reset(&ms->buf);
+    apep_spin_unlock(&ms->lock);
+}
+
+/* ----------------------------
+Ring sink
+Records are stored back to back as a 4-byte length followed by the
+bytes, wrapping at the end of the ring.
+---------------------------- */
+
+#define APEP_RING_HDR 4
+
+typedef struct apep_ring_sink
+{
+    apep_sink_t base;
+    volatile long lock;
+    unsigned char *data;
+    size_t cap;
+    size_t head; /* offset of the oldest record */
+    size_t used;
+    size_t count;
+    unsigned long long dropped;
+} apep_ring_sink_t;
+
+static size_t apep_ring_put(apep_ring_sink_t *rs, size_t pos, const void *src, size_t n)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    size_t first = rs->cap - pos < n ? rs->cap - pos : n;
+    memcpy(rs->data + pos, s, first);
+    if (n > first)
+        memcpy(rs->data, s + first, n - first);
+    return (pos + n) % rs->cap;
+}
+
+static size_t apep_ring_record_len(const apep_ring_sink_t *rs, size_t pos)
+{
+    size_t len = 0;
+    for (int i = 0; i < APEP_RING_HDR; i++)
+        len |= (size_t)rs->data[(pos + (size_t)i) % rs->cap] << (8 * i);
+    return len;
+}
+
+static int apep_ring_sink_write(apep_sink_t *sink, const apep_rbuf_t *record)
+{
+    apep_ring_sink_t *rs = (apep_ring_sink_t *)sink;
+    size_t len = apep_rbuf_size(record);
+    size_t need = APEP_RING_HDR + len;
+
+    apep_spin_lock(&rs->lock);
+
+    if (need > rs->cap || len > 0xFFFFFFFFu)
+    {
+        rs->dropped++;
+        apep_spin_unlock(&rs->lock);
+        return 0;
+    }
+
+    /* Evict the oldest records until this one fits */
+    while (rs->cap - rs->used < need)
+    {
+        size_t old = APEP_RING_HDR + apep_ring_record_len(rs, rs->head);
+        rs->head = (rs->head + old) % rs->cap;
+        rs->used -= old;
+        rs->count--;
+        rs->dropped++;
+    }
+
+    unsigned char hdr[APEP_RING_HDR];
+    for (int i = 0; i < APEP_RING_HDR; i++)
+        hdr[i] = (unsigned char)(len >> (8 * i));
+
+    size_t pos = apep_ring_put(rs, (rs->head + rs->used) % rs->cap, hdr, APEP_RING_HDR);
+    size_t pieces = apep_rbuf_pieces(record);
+    for (size_t i = 0; i < pieces; i++)
+    {
+        const char *p;
+        size_t n = apep_rbuf_piece(record, i, &p);
+        if (n)
+            pos = apep_ring_put(rs, pos, p, n);
+    }
+    rs->used += need;
+    rs->count++;
+
+    apep_spin_unlock(&rs->lock);
+    return 0;
+}
+
+static void apep_ring_sink_destroy(apep_sink_t *sink)
+{
+    apep_ring_sink_t *rs = (apep_ring_sink_t *)sink;
+    free(rs->data);
+    free(rs);
+}
+
+static const apep_sink_vtable_t apep_ring_sink_vt = {
+    apep_ring_sink_write, NULL, apep_ring_sink_destroy};
+
+apep_sink_t *apep_sink_ring_create(size_t capacity)
+{
+    if (capacity <= APEP_RING_HDR)
+        return NULL;
+
+    apep_ring_sink_t *rs = (apep_ring_sink_t *)calloc(1, sizeof(*rs));
+    if (!rs)
+        return NULL;
+
+    rs->data = (unsigned char *)malloc(capacity);
+    if (!rs->data)
+    {
+        free(rs);
+        return NULL;
+    }
+
+    rs->base.vt = &apep_ring_sink_vt;
+    rs->base.fd = -1;
+    rs->cap = capacity;
+    return &rs->base;
+}
+
+size_t apep_sink_ring_copy(apep_sink_t *sink, apep_rbuf_t *out)
+{
+    if (!sink || sink->vt != &apep_ring_sink_vt || !out)
+        return 0;
+
+    apep_ring_sink_t *rs = (apep_ring_sink_t *)sink;
+    apep_spin_lock(&rs->lock);
+
+    size_t pos = rs->head;
+    for (size_t r = 0; r < rs->count; r++)
+    {
+        size_t len = apep_ring_record_len(rs, pos);
+        pos = (pos + APEP_RING_HDR) % rs->cap;
+
+        size_t first = rs->cap - pos < len ? rs->cap - pos : len;
+        apep_rbuf_append(out, (const char *)rs->data + pos, first);
+        apep_rbuf_append(out, (const char *)rs->data, len - first);
+        pos = (pos + len) % rs->cap;
+    }
+    size_t count = rs->count;
+
+    apep_spin_unlock(&rs->lock);
+    return count;
+}
+
+unsigned long long apep_sink_ring_dropped(apep_sink_t *sink)
+{
+    if (!sink || sink->vt != &apep_ring_sink_vt)
+        return 0;
+
+    apep_ring_sink_t *rs = (apep_ring_sink_t *)sink;
+    apep_spin_lock(&rs->lock);
+    unsigned long long dropped = rs->dropped;
+    apep_spin_unlock(&rs->lock);
+    return dropped;
+}
+
+/* ----------------------------
+Callback sink
+---------------------------- */
+
+typedef struct apep_callback_sink
+{
+    apep_sink_t base;
+    apep_sink_callback_fn fn;
+    void *user;
+} apep_callback_sink_t;
+
+static int apep_callback_sink_write(apep_sink_t *sink, const apep_rbuf_t *record)
+{
+    apep_callback_sink_t *cs = (apep_callback_sink_t *)sink;
+
+    if (record->ref_count == 0)
+        return cs->fn(cs->user, record->data, record->len);
+
+    /* The callback wants contiguous bytes: stitch the references in */
+    char storage[APEP_RBUF_STACK];
+    apep_rbuf_t flat;
+    apep_rbuf_init(&flat, storage, sizeof(storage));
+    apep_sink_copy_record(&flat, record);
+
+    int rc = flat.failed ? -1 : cs->fn(cs->user, flat.data, flat.len);
+    apep_rbuf_free(&flat);
+    return rc;
+}
+
+static void apep_callback_sink_destroy(apep_sink_t *sink)
+{
+    free(sink);
+}
+
+static const apep_sink_vtable_t apep_callback_sink_vt = {
+    apep_callback_sink_write, NULL, apep_callback_sink_destroy};
+
+apep_sink_t *apep_sink_callback_create(apep_sink_callback_fn fn, void *user)
+{
+    if (!fn)
+        return NULL;
+
+    apep_callback_sink_t *cs = (apep_callback_sink_t *)calloc(1, sizeof(*cs));
+    if (!cs)
+        return NULL;
+
+    cs->base.vt = &apep_callback_sink_vt;
+    cs->base.fd = -1;
+    cs->fn = fn;
+    cs->user = user;
+    return &cs->base;
+}
+
+/* ----------------------------
+Router
+One NULL-terminated sink list per level/severity key, so routing a
+record is a single table index.
+---------------------------- */
+
+struct apep_router
+{
+    apep_sink_t *table[APEP_ROUTE_KEYS][APEP_ROUTER_MAX_SINKS + 1];
+    signed char format[APEP_ROUTE_KEYS][APEP_ROUTER_MAX_SINKS + 1]; /* -1 = opt->format */
+    unsigned char count[APEP_ROUTE_KEYS];
+};
+
+apep_router_t *apep_router_create(void)
+{
+    return (apep_router_t *)calloc(1, sizeof(apep_router_t));
+}
+
+void apep_router_destroy(apep_router_t *router)
+{
+    free(router);
+}
+
+static int apep_router_add_impl(apep_router_t *router, unsigned mask, apep_sink_t *sink, int format)
+{
+    if (!router || !sink)
+        return -1;
+
+    int rc = 0;
+    for (int key = 0; key < APEP_ROUTE_KEYS; key++)
+    {
+        if (!(mask & (1u << key)))
+            continue;
+
+        int present = 0;
+        for (int i = 0; i < router->count[key]; i++)
+        {
+            if (router->table[key][i] == sink)
+            {
+                present = 1;
+                if (format >= 0)
+                    router->format[key][i] = (signed char)format;
+            }
+        }
+        if (present)
+            continue;
+
+        if (router->count[key] == APEP_ROUTER_MAX_SINKS)
+        {
+            rc = -1;
+            continue;
+        }
+        router->format[key][router->count[key]] = (signed char)format;
+        router->table[key][router->count[key]++] = sink;
+    }
+    return rc;
+}
+
+int apep_router_add(apep_router_t *router, unsigned mask, apep_sink_t *sink)
+{
+    return apep_router_add_impl(router, mask, sink, -1);
+}
+
+int apep_router_add_format(apep_router_t *router, unsigned mask, apep_sink_t *sink, apep_output_format_t format)
+{
+    if ((int)format < APEP_FORMAT_PRETTY || format > APEP_FORMAT_LOGFMT)
+        return -1;
+    return apep_router_add_impl(router, mask, sink, (int)format);
+}
+
+void apep_router_clear(apep_router_t *router)
+{
+    if (router)
+        memset(router, 0, sizeof(*router));
+}
+
+int apep_router_flush(apep_router_t *router)
+{
+    if (!router)
+        return -1;
+
+    apep_sink_t *seen[APEP_ROUTE_KEYS * APEP_ROUTER_MAX_SINKS];
+    size_t seen_count = 0;
+    int rc = 0;
+
+    for (int key = 0; key < APEP_ROUTE_KEYS; key++)
+    {
+        for (int i = 0; i < router->count[key]; i++)
+        {
+            apep_sink_t *sink = router->table[key][i];
+            size_t j = 0;
+            while (j < seen_count && seen[j] != sink)
+                j++;
+            if (j < seen_count)
+                continue;
+
+            seen[seen_count++] = sink;
+            if (apep_sink_flush(sink) != 0)
+                rc = -1;
+        }
+    }
+    return rc;
+}
+
+/* ----------------------------
+Emission
+---------------------------- */
+
+static int apep_caps_equal(const apep_caps_t *a, const apep_caps_t *b)
+{
+    return a->is_tty == b->is_tty && a->color == b->color && a->unicode == b->unicode &&
+           a->width == b->width && a->color_depth == b->color_depth;
+}
+
+void apep_emit_begin(apep_emit_t *em, const apep_options_t *opt, int route_key, int by_ref)
+{
+    em->opt = opt;
+    em->sinks = NULL;
+    em->pending = 0;
+    em->current = 0;
+    em->by_ref = by_ref;
+    em->state = 0;
+    em->format = opt ? opt->format : APEP_FORMAT_PRETTY;
+    em->formats = NULL;
+    apep_rbuf_init_scratch(&em->rb, em->storage, sizeof(em->storage));
+
+    const apep_router_t *router = opt ? opt->router : NULL;
+    if (router && route_key >= 0 && route_key < APEP_ROUTE_KEYS)
+    {
+        em->sinks = router->table[route_key];
+        em->formats = router->format[route_key];
+        em->pending = (1u << router->count[route_key]) - 1u;
+    }
+    else if (router)
+    {
+        em->sinks = router->table[0] + APEP_ROUTER_MAX_SINKS; /* empty list */
+    }
+}
+
+static apep_output_format_t apep_emit_format(const apep_emit_t *em, int i)
+{
+    return em->formats[i] >= 0 ? (apep_output_format_t)em->formats[i]
+                               : (em->opt ? em->opt->format : APEP_FORMAT_PRETTY);
+}
+
+int apep_emit_next(apep_emit_t *em)
+{
+    if (em->state == 2)
+        return 0;
+
+    /* Deliver what was just rendered */
+    if (em->state == 1)
+    {
+        if (!em->sinks)
+        {
+            apep_rbuf_emit(&em->rb, em->opt);
+        }
+        else
+        {
+            for (int i = 0; i < APEP_ROUTER_MAX_SINKS; i++)
+            {
+                if (em->current & (1u << i))
+                    apep_sink_write_rbuf(em->sinks[i], &em->rb);
+            }
+        }
+        em->pending &= ~em->current;
+        em->current = 0;
+        apep_rbuf_reset(&em->rb);
+    }
+
+    if (!em->sinks && em->state == 0)
+    {
+        FILE *out = (em->opt && em->opt->out) ? em->opt->out : stderr;
+        em->caps = apep_detect_caps(out, em->opt);
+        em->rb.ref_mode = em->by_ref && em->opt && em->opt->zero_copy;
+        em->state = 1;
+        return 1;
+    }
+
+    if (!em->sinks || !em->pending)
+    {
+        em->state = 2;
+        apep_rbuf_free_scratch(&em->rb);
+        return 0;
+    }
+
+    /* Next rendering: the first pending sink and all that look alike */
+    int first = 0;
+    while (!(em->pending & (1u << first)))
+        first++;
+    em->caps = apep_detect_caps_fd(em->sinks[first]->fd, em->opt);
+    em->format = apep_emit_format(em, first);
+    em->current = 1u << first;
+
+    for (int i = first + 1; i < APEP_ROUTER_MAX_SINKS; i++)
+    {
+        if (!(em->pending & (1u << i)) || apep_emit_format(em, i) != em->format)
+            continue;
+        apep_caps_t caps = apep_detect_caps_fd(em->sinks[i]->fd, em->opt);
+        if (apep_caps_equal(&caps, &em->caps))
+            em->current |= 1u << i;
+    }
+
+    em->rb.ref_mode = em->by_ref;
+    em->state = 1;
+    return 1;
+}
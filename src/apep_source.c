@@ -0,0 +1,832 @@
+#include "../include/apep/apep.h"
+#include "apep_internal.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* ----------------------------
+Indexed text source
+---------------------------- */
+
+/* Backing state for indexed sources.
+   starts[i] holds the byte offset of line i*stride+1 (a checkpoint). With
+   stride 1 every line is recorded; larger strides trade a bounded rescan of
+   at most stride-1 lines for 1/stride of the memory. The index is filled
+   lazily: only as far as the furthest line (or offset) requested so far. */
+typedef struct apep_indexed_source
+{
+    const char *data;
+    size_t size;
+    int measured; /* 0 until size is known (NUL-terminated input) */
+
+    size_t *starts;
+    size_t count; /* checkpoints recorded */
+    size_t cap;
+    size_t stride;
+    size_t lines_seen; /* line starts discovered so far */
+    size_t scan_pos;   /* bytes consumed by the indexer */
+    int complete;      /* 1 once the whole input has been indexed */
+
+    /* File-backed sources own their mapping and name */
+    void *map_base;
+    size_t map_len;
+    char *owned_name;
+
+    int refs; /* handed-out sources plus the cache entry, if any */
+
+    /* While a cache holds the source its resident cost is kept counted in
+       *charge_total (the cache's total) */
+    size_t *charge_total;
+    size_t charged;
+} apep_indexed_source_t;
+
+/* Resident cost: the measured input plus the line index */
+static size_t apep_indexed_bytes(const apep_indexed_source_t *s)
+{
+    return (s->measured ? s->size : 0) + s->cap * sizeof(size_t);
+}
+
+/* Bring the holding cache's total up to date after the cost changed */
+static void apep_indexed_recharge(apep_indexed_source_t *s)
+{
+    if (!s->charge_total)
+        return;
+    size_t bytes = apep_indexed_bytes(s);
+    *s->charge_total = *s->charge_total - s->charged + bytes;
+    s->charged = bytes;
+}
+
+static int apep_get_line_indexed(void *user, int line_no_1based, const char **line_ptr, size_t *line_len);
+
+static apep_indexed_source_t *apep_indexed_from(const apep_text_source_t *src)
+{
+    if (!src || src->get_line != apep_get_line_indexed || !src->user)
+        return NULL;
+    return (apep_indexed_source_t *)src->user;
+}
+
+static void apep_indexed_bind(apep_text_source_t *src, apep_indexed_source_t *s, const char *name)
+{
+    src->name = name;
+    src->get_line = apep_get_line_indexed;
+    src->user = s;
+}
+
+static int apep_index_push(apep_indexed_source_t *s, size_t start)
+{
+    if (s->count == s->cap)
+    {
+        size_t new_cap = s->cap ? s->cap * 2 : 256;
+        size_t *grown = (size_t *)realloc(s->starts, new_cap * sizeof(size_t));
+        if (!grown)
+            return -1;
+        s->starts = grown;
+        s->cap = new_cap;
+        apep_indexed_recharge(s);
+    }
+    s->starts[s->count++] = start;
+    return 0;
+}
+
+/* Upper bound on newlines collected per kernel call, so offset-driven scans
+   overshoot the requested position by a bounded amount */
+#define APEP_INDEX_BATCH 4096
+
+/* Full-index fast path: collect newline positions straight into the index */
+static int apep_index_scan_full(apep_indexed_source_t *s, size_t want_lines, size_t want_offset)
+{
+    while (!s->complete && s->lines_seen < want_lines && s->scan_pos <= want_offset)
+    {
+        if (s->count == s->cap)
+        {
+            /* Grow by pushing a placeholder, then take it back */
+            if (apep_index_push(s, 0) != 0)
+                return -1;
+            s->count--;
+        }
+
+        size_t room = s->cap - s->count;
+        if (room > APEP_INDEX_BATCH)
+            room = APEP_INDEX_BATCH;
+        if (room > want_lines - s->lines_seen)
+            room = want_lines - s->lines_seen;
+
+        size_t *dst = s->starts + s->count;
+        size_t got = apep_scan_collect(s->data + s->scan_pos, s->size - s->scan_pos, '\n',
+                                       dst, room, s->scan_pos);
+
+        /* Newline positions -> start of the following line */
+        for (size_t i = 0; i < got; i++)
+            dst[i]++;
+
+        if (got > 0 && dst[got - 1] >= s->size)
+        {
+            /* A trailing '\n' does not open another line */
+            got--;
+            s->complete = 1;
+        }
+        else if (got < room)
+        {
+            s->complete = 1;
+        }
+
+        s->count += got;
+        s->lines_seen += got;
+        s->scan_pos = s->complete ? s->size : s->starts[s->count - 1];
+    }
+
+    return 0;
+}
+
+/* Extend the index until at least want_lines line starts have been seen, or
+   until the scan has moved past want_offset, or the input is exhausted. */
+static int apep_index_scan(apep_indexed_source_t *s, size_t want_lines, size_t want_offset)
+{
+    if (!s->measured)
+    {
+        s->size = strlen(s->data);
+        s->measured = 1;
+        apep_indexed_recharge(s);
+    }
+
+    if (s->lines_seen == 0 && !s->complete)
+    {
+        /* An empty input has no lines at all */
+        if (s->size == 0)
+        {
+            s->complete = 1;
+            return 0;
+        }
+        if (apep_index_push(s, 0) != 0)
+            return -1;
+        s->lines_seen = 1;
+    }
+
+    if (s->stride == 1)
+        return apep_index_scan_full(s, want_lines, want_offset);
+
+    while (!s->complete && s->lines_seen < want_lines && s->scan_pos <= want_offset)
+    {
+        /* Jump straight to the next checkpoint line (or the requested line,
+           whichever comes first): the newlines in between only need counting */
+        size_t to_checkpoint = (s->stride - s->lines_seen % s->stride) % s->stride + 1;
+        size_t k = want_lines - s->lines_seen;
+        if (k > to_checkpoint)
+            k = to_checkpoint;
+
+        const char *base = s->data + s->scan_pos;
+        size_t avail = s->size - s->scan_pos;
+        size_t found = 0;
+        const char *nl = (k == 1) ? apep_scan_byte(base, avail, '\n')
+                                  : apep_scan_nth(base, avail, '\n', k, &found);
+        if (!nl)
+        {
+            /* Every newline found opens a line, except one ending the input */
+            if (found > 0 && s->data[s->size - 1] == '\n')
+                found--;
+            s->lines_seen += found;
+            s->scan_pos = s->size;
+            s->complete = 1;
+            break;
+        }
+
+        size_t next = (size_t)(nl - s->data) + 1;
+
+        /* A trailing '\n' does not open another line */
+        if (next >= s->size)
+        {
+            s->lines_seen += k - 1;
+            s->scan_pos = next;
+            s->complete = 1;
+            break;
+        }
+
+        size_t line_idx = s->lines_seen + k - 1;
+        if (line_idx % s->stride == 0 && apep_index_push(s, next) != 0)
+            return -1;
+        s->scan_pos = next;
+        s->lines_seen = line_idx + 1;
+    }
+
+    return 0;
+}
+
+/* Byte offset of line idx+1, which must already have been seen by the scan.
+   Rescans forward from the nearest checkpoint (at most stride-1 lines). */
+static size_t apep_index_line_start(const apep_indexed_source_t *s, size_t idx)
+{
+    size_t pos = s->starts[idx / s->stride];
+    size_t skip = idx % s->stride;
+    if (skip > 0)
+    {
+        const char *nl = apep_scan_nth(s->data + pos, s->size - pos, '\n', skip, NULL);
+        pos = (size_t)(nl - s->data) + 1;
+    }
+    return pos;
+}
+
+static void apep_index_reset(apep_indexed_source_t *s)
+{
+    free(s->starts);
+    s->starts = NULL;
+    s->count = 0;
+    s->cap = 0;
+    s->lines_seen = 0;
+    s->scan_pos = 0;
+    s->complete = 0;
+    apep_indexed_recharge(s);
+}
+
+static int apep_get_line_indexed(
+    void *user,
+    int line_no_1based,
+    const char **line_ptr,
+    size_t *line_len)
+{
+    if (!user || !line_ptr || !line_len)
+        return 0;
+    if (line_no_1based <= 0)
+        return 0;
+
+    apep_indexed_source_t *s = (apep_indexed_source_t *)user;
+    size_t idx = (size_t)line_no_1based - 1;
+
+    /* Index one line past the target so its end is known without rescanning */
+    apep_index_scan(s, idx + 2, (size_t)-1);
+    if (idx >= s->lines_seen)
+        return 0;
+
+    const char *start = s->data + apep_index_line_start(s, idx);
+    const char *end;
+    if (s->stride == 1 && idx + 1 < s->count)
+    {
+        end = s->data + s->starts[idx + 1] - 1; /* the '\n' */
+    }
+    else
+    {
+        size_t remaining = s->size - (size_t)(start - s->data);
+        end = apep_scan_byte(start, remaining, '\n');
+        if (!end)
+            end = start + remaining;
+    }
+
+    /* trim CR if present */
+    if (end > start && end[-1] == '\r')
+        end--;
+
+    *line_ptr = start;
+    *line_len = (size_t)(end - start);
+    return 1;
+}
+
+apep_text_source_t apep_text_source_from_string_indexed(const char *name, const char *text)
+{
+    apep_indexed_source_t *s = (apep_indexed_source_t *)calloc(1, sizeof(apep_indexed_source_t));
+    if (!s)
+    {
+        /* Degrade to the unindexed string source rather than failing */
+        return apep_text_source_from_string(name, text);
+    }
+
+    s->data = text ? text : "";
+    s->stride = 1;
+    s->refs = 1;
+
+    apep_text_source_t src;
+    apep_indexed_bind(&src, s, name ? name : "<input>");
+    return src;
+}
+
+/* ----------------------------
+Memory-mapped file source
+---------------------------- */
+
+static int apep_map_file(const char *path, void **base, size_t *len)
+{
+    *base = NULL;
+    *len = 0;
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return -1;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || (unsigned long long)size.QuadPart > (size_t)-1)
+    {
+        CloseHandle(file);
+        return -1;
+    }
+
+    if (size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return 0;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return -1;
+
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping); /* the view keeps the mapping alive */
+    if (!view)
+        return -1;
+
+    *base = view;
+    *len = (size_t)size.QuadPart;
+    return 0;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if ((unsigned long long)st.st_size > (size_t)-1)
+    {
+        close(fd);
+        errno = EFBIG;
+        return -1;
+    }
+
+    /* mmap() rejects zero-length mappings; an empty file simply has no lines */
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    void *view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping keeps the file referenced */
+    if (view == MAP_FAILED)
+        return -1;
+
+    *base = view;
+    *len = (size_t)st.st_size;
+    return 0;
+#endif
+}
+
+static void apep_unmap_file(void *base, size_t len)
+{
+    if (!base)
+        return;
+#if defined(_WIN32)
+    (void)len;
+    UnmapViewOfFile(base);
+#else
+    munmap(base, len);
+#endif
+}
+
+static char *apep_strdup_owned(const char *str)
+{
+    size_t len = strlen(str);
+    char *copy = (char *)malloc(len + 1);
+    if (copy)
+        memcpy(copy, str, len + 1);
+    return copy;
+}
+
+static apep_indexed_source_t *apep_indexed_open_file(const char *path)
+{
+    apep_indexed_source_t *s = (apep_indexed_source_t *)calloc(1, sizeof(apep_indexed_source_t));
+    if (!s)
+        return NULL;
+
+    s->owned_name = apep_strdup_owned(path);
+    if (!s->owned_name)
+    {
+        free(s);
+        return NULL;
+    }
+
+    if (apep_map_file(path, &s->map_base, &s->map_len) != 0)
+    {
+        int saved = errno;
+        free(s->owned_name);
+        free(s);
+        errno = saved;
+        return NULL;
+    }
+
+    /* Lines are handed out straight from the mapping (not NUL-terminated) */
+    s->data = s->map_base ? (const char *)s->map_base : "";
+    s->size = s->map_len;
+    s->measured = 1;
+    s->stride = 1;
+    s->refs = 1;
+    return s;
+}
+
+static void apep_indexed_release(apep_indexed_source_t *s)
+{
+    if (!s || --s->refs > 0)
+        return;
+
+    apep_unmap_file(s->map_base, s->map_len);
+    free(s->owned_name);
+    free(s->starts);
+    free(s);
+}
+
+int apep_text_source_from_file(apep_text_source_t *src, const char *path)
+{
+    if (!src || !path)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    apep_indexed_source_t *s = apep_indexed_open_file(path);
+    if (!s)
+        return -1;
+
+    apep_indexed_bind(src, s, s->owned_name);
+    return 0;
+}
+
+void apep_text_source_destroy(apep_text_source_t *src)
+{
+    apep_indexed_source_t *s = apep_indexed_from(src);
+    if (!s)
+        return;
+
+    apep_indexed_release(s);
+    src->user = NULL;
+    src->get_line = NULL;
+}
+
+int apep_text_source_line_offset(const apep_text_source_t *src, int line_no_1based, size_t *offset)
+{
+    apep_indexed_source_t *s = apep_indexed_from(src);
+    if (!s || !offset || line_no_1based <= 0)
+        return 0;
+
+    size_t idx = (size_t)line_no_1based - 1;
+    apep_index_scan(s, idx + 1, (size_t)-1);
+    if (idx >= s->lines_seen)
+        return 0;
+
+    *offset = apep_index_line_start(s, idx);
+    return 1;
+}
+
+int apep_text_source_offset_to_loc(const apep_text_source_t *src, size_t offset, apep_loc_t *loc)
+{
+    apep_indexed_source_t *s = apep_indexed_from(src);
+    if (!s || !loc)
+        return 0;
+
+    apep_index_scan(s, (size_t)-1, offset);
+    if (offset > s->size)
+        return 0;
+
+    if (s->count == 0)
+    {
+        /* Empty input: the only valid position is 1:1 */
+        loc->line = 1;
+        loc->col = 1;
+        return 1;
+    }
+
+    /* Largest checkpoint <= offset */
+    size_t lo = 0;
+    size_t hi = s->count;
+    while (hi - lo > 1)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (s->starts[mid] <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    /* Walk the remaining (at most stride-1) lines up to offset */
+    size_t line_idx = lo * s->stride;
+    size_t start = s->starts[lo];
+    for (;;)
+    {
+        const char *nl = apep_scan_byte(s->data + start, offset - start, '\n');
+        if (!nl)
+            break;
+        start = (size_t)(nl - s->data) + 1;
+        line_idx++;
+    }
+
+    /* Positions that do not fit the int fields are not reported */
+    if (line_idx >= (size_t)INT_MAX || offset - start >= (size_t)INT_MAX)
+        return 0;
+    loc->line = (int)(line_idx + 1);
+    loc->col = (int)(offset - start + 1);
+    return 1;
+}
+
+int apep_text_source_is_stable(const apep_text_source_t *src)
+{
+    return apep_indexed_from(src) != NULL || apep_text_source_is_plain_string(src);
+}
+
+int apep_text_source_line_count(const apep_text_source_t *src)
+{
+    apep_indexed_source_t *s = apep_indexed_from(src);
+    if (!s)
+        return -1;
+
+    apep_index_scan(s, (size_t)-1, (size_t)-1);
+    return s->lines_seen > (size_t)INT_MAX ? INT_MAX : (int)s->lines_seen;
+}
+
+int apep_text_source_set_index_stride(apep_text_source_t *src, int stride)
+{
+    apep_indexed_source_t *s = apep_indexed_from(src);
+    if (!s || stride <= 0)
+        return -1;
+
+    if ((size_t)stride != s->stride)
+    {
+        apep_index_reset(s);
+        s->stride = (size_t)stride;
+    }
+    return 0;
+}
+
+/* ----------------------------
+Shared source cache
+---------------------------- */
+
+#define APEP_SOURCE_CACHE_BUCKETS 256
+
+typedef struct apep_cache_entry
+{
+    char *key;
+    apep_indexed_source_t *src;
+    struct apep_cache_entry *hash_next;
+    struct apep_cache_entry *lru_prev; /* towards most recently used */
+    struct apep_cache_entry *lru_next; /* towards least recently used */
+} apep_cache_entry_t;
+
+struct apep_source_cache
+{
+    size_t byte_budget; /* 0 = unlimited */
+    size_t entries;
+    size_t total_bytes; /* resident cost of all entries, kept by the sources */
+    apep_cache_entry_t *buckets[APEP_SOURCE_CACHE_BUCKETS];
+    apep_cache_entry_t *lru_head; /* most recently used */
+    apep_cache_entry_t *lru_tail; /* least recently used */
+};
+
+static unsigned int apep_cache_hash(const char *key)
+{
+    unsigned int hash = 5381;
+    int c;
+
+    while ((c = (unsigned char)*key++))
+    {
+        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+    }
+
+    return hash % APEP_SOURCE_CACHE_BUCKETS;
+}
+
+static void apep_cache_lru_unlink(apep_source_cache_t *cache, apep_cache_entry_t *e)
+{
+    if (e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        cache->lru_head = e->lru_next;
+
+    if (e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        cache->lru_tail = e->lru_prev;
+
+    e->lru_prev = NULL;
+    e->lru_next = NULL;
+}
+
+static void apep_cache_lru_push_front(apep_source_cache_t *cache, apep_cache_entry_t *e)
+{
+    e->lru_prev = NULL;
+    e->lru_next = cache->lru_head;
+    if (cache->lru_head)
+        cache->lru_head->lru_prev = e;
+    cache->lru_head = e;
+    if (!cache->lru_tail)
+        cache->lru_tail = e;
+}
+
+static apep_cache_entry_t *apep_cache_find(apep_source_cache_t *cache, const char *key)
+{
+    apep_cache_entry_t *e = cache->buckets[apep_cache_hash(key)];
+    while (e)
+    {
+        if (strcmp(e->key, key) == 0)
+            return e;
+        e = e->hash_next;
+    }
+    return NULL;
+}
+
+static void apep_cache_remove(apep_source_cache_t *cache, apep_cache_entry_t *e)
+{
+    apep_cache_entry_t **link = &cache->buckets[apep_cache_hash(e->key)];
+    while (*link && *link != e)
+        link = &(*link)->hash_next;
+    if (*link)
+        *link = e->hash_next;
+
+    apep_cache_lru_unlink(cache, e);
+    cache->entries--;
+    cache->total_bytes -= e->src->charged;
+    e->src->charge_total = NULL;
+    e->src->charged = 0;
+
+    /* Sources still handed out keep their own reference */
+    apep_indexed_release(e->src);
+    free(e->key);
+    free(e);
+}
+
+/* Drop least recently used entries until the budget is met, always keeping
+   the entry that was just used */
+static void apep_cache_evict(apep_source_cache_t *cache, const apep_cache_entry_t *keep)
+{
+    if (cache->byte_budget == 0)
+        return;
+
+    while (cache->total_bytes > cache->byte_budget && cache->lru_tail && cache->lru_tail != keep)
+        apep_cache_remove(cache, cache->lru_tail);
+}
+
+static apep_cache_entry_t *apep_cache_insert(apep_source_cache_t *cache, const char *key, apep_indexed_source_t *s)
+{
+    apep_cache_entry_t *e = (apep_cache_entry_t *)calloc(1, sizeof(apep_cache_entry_t));
+    if (!e)
+        return NULL;
+
+    e->key = apep_strdup_owned(key);
+    if (!e->key)
+    {
+        free(e);
+        return NULL;
+    }
+
+    unsigned int idx = apep_cache_hash(key);
+    e->src = s;
+    e->hash_next = cache->buckets[idx];
+    cache->buckets[idx] = e;
+    apep_cache_lru_push_front(cache, e);
+    cache->entries++;
+    s->charge_total = &cache->total_bytes;
+    s->charged = 0;
+    apep_indexed_recharge(s);
+    return e;
+}
+
+/* Hand out a new reference to a cached entry and mark it most recently used */
+static void apep_cache_hand_out(apep_source_cache_t *cache, apep_cache_entry_t *e, apep_text_source_t *src)
+{
+    apep_cache_lru_unlink(cache, e);
+    apep_cache_lru_push_front(cache, e);
+
+    e->src->refs++;
+    apep_indexed_bind(src, e->src, e->src->owned_name);
+
+    apep_cache_evict(cache, e);
+}
+
+apep_source_cache_t *apep_source_cache_create(size_t byte_budget)
+{
+    apep_source_cache_t *cache = (apep_source_cache_t *)calloc(1, sizeof(apep_source_cache_t));
+    if (!cache)
+        return NULL;
+
+    cache->byte_budget = byte_budget;
+    return cache;
+}
+
+void apep_source_cache_destroy(apep_source_cache_t *cache)
+{
+    if (!cache)
+        return;
+
+    apep_source_cache_clear(cache);
+    free(cache);
+}
+
+void apep_source_cache_clear(apep_source_cache_t *cache)
+{
+    if (!cache)
+        return;
+
+    while (cache->lru_head)
+        apep_cache_remove(cache, cache->lru_head);
+}
+
+int apep_source_cache_open_file(apep_source_cache_t *cache, const char *path, apep_text_source_t *src)
+{
+    if (!cache)
+        return apep_text_source_from_file(src, path);
+    if (!src || !path)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    apep_cache_entry_t *e = apep_cache_find(cache, path);
+    if (!e)
+    {
+        apep_indexed_source_t *s = apep_indexed_open_file(path);
+        if (!s)
+            return -1;
+
+        e = apep_cache_insert(cache, path, s);
+        if (!e)
+        {
+            /* Still usable, just not shared */
+            apep_indexed_bind(src, s, s->owned_name);
+            return 0;
+        }
+    }
+
+    apep_cache_hand_out(cache, e, src);
+    return 0;
+}
+
+int apep_source_cache_open_string(apep_source_cache_t *cache, const char *key, const char *text, apep_text_source_t *src)
+{
+    if (!src || !key)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!cache)
+    {
+        *src = apep_text_source_from_string_indexed(key, text);
+        return 0;
+    }
+
+    apep_cache_entry_t *e = apep_cache_find(cache, key);
+    if (!e)
+    {
+        apep_text_source_t fresh = apep_text_source_from_string_indexed(NULL, text);
+        apep_indexed_source_t *s = apep_indexed_from(&fresh);
+        if (!s)
+            return -1;
+
+        /* The name must outlive the entry: sources may be handed out past eviction */
+        s->owned_name = apep_strdup_owned(key);
+        if (!s->owned_name)
+        {
+            apep_indexed_release(s);
+            return -1;
+        }
+
+        e = apep_cache_insert(cache, key, s);
+        if (!e)
+        {
+            apep_indexed_release(s);
+            return -1;
+        }
+    }
+
+    apep_cache_hand_out(cache, e, src);
+    return 0;
+}
+
+void apep_source_cache_invalidate(apep_source_cache_t *cache, const char *key)
+{
+    if (!cache || !key)
+        return;
+
+    apep_cache_entry_t *e = apep_cache_find(cache, key);
+    if (e)
+        apep_cache_remove(cache, e);
+}
+
+void apep_source_cache_stats(const apep_source_cache_t *cache, size_t *entries, size_t *bytes)
+{
+    if (entries)
+        *entries = cache ? cache->entries : 0;
+    if (bytes)
+        *bytes = cache ? cache->total_bytes : 0;
+}
@@ -1,50 +1,238 @@
 #include "../include/apep/apep.h"
 #include "../include/apep/apep_helpers.h"
+#include "apep_internal.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-static apep_stack_frame_t stack[APEP_MAX_STACK_DEPTH];
-static int stack_depth = 0;
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/* ----------------------------
+Per-thread shadow stack
+The first chunk lives in thread-local storage, so shallow traces never
+allocate. Deeper chunks are linked on demand and one spare is kept when
+the stack shrinks, so oscillating across a chunk boundary does not
+allocate either.
+---------------------------- */
+
+typedef struct apep_stack_chunk
+{
+    struct apep_stack_chunk *prev;
+    struct apep_stack_chunk *next;
+    apep_stack_frame_t frames[APEP_MAX_STACK_DEPTH];
+} apep_stack_chunk_t;
+
+typedef struct apep_thread_stack
+{
+    apep_stack_chunk_t first;
+    apep_stack_chunk_t *top; /* chunk holding the innermost frame, NULL = first */
+    size_t top_used;         /* frames used in top */
+    size_t depth;
+    size_t overflow; /* pushes above the recorded frames that were not stored */
+} apep_thread_stack_t;
+
+static APEP_THREAD_LOCAL apep_thread_stack_t t_stack;
+
+static void apep_stack_free_chunks(apep_stack_chunk_t *c)
+{
+    while (c)
+    {
+        apep_stack_chunk_t *next = c->next;
+        free(c);
+        c = next;
+    }
+}
+
+/* Free a thread's heap chunks when it exits */
+#if defined(_WIN32)
+static DWORD g_stack_fls = FLS_OUT_OF_INDEXES;
+static INIT_ONCE g_stack_fls_once = INIT_ONCE_STATIC_INIT;
+
+static void WINAPI apep_stack_thread_exit(void *p)
+{
+    apep_stack_free_chunks(((apep_thread_stack_t *)p)->first.next);
+}
+
+static BOOL CALLBACK apep_stack_fls_init(PINIT_ONCE once, PVOID param, PVOID *ctx)
+{
+    (void)once;
+    (void)param;
+    (void)ctx;
+    g_stack_fls = FlsAlloc(apep_stack_thread_exit);
+    return TRUE;
+}
+
+static void apep_stack_watch_thread(apep_thread_stack_t *ts)
+{
+    InitOnceExecuteOnce(&g_stack_fls_once, apep_stack_fls_init, NULL, NULL);
+    if (g_stack_fls != FLS_OUT_OF_INDEXES)
+        FlsSetValue(g_stack_fls, ts);
+}
+#else
+static pthread_key_t g_stack_key;
+static pthread_once_t g_stack_key_once = PTHREAD_ONCE_INIT;
+
+static void apep_stack_thread_exit(void *p)
+{
+    apep_stack_free_chunks(((apep_thread_stack_t *)p)->first.next);
+}
+
+static void apep_stack_key_init(void)
+{
+    pthread_key_create(&g_stack_key, apep_stack_thread_exit);
+}
+
+static void apep_stack_watch_thread(apep_thread_stack_t *ts)
+{
+    pthread_once(&g_stack_key_once, apep_stack_key_init);
+    pthread_setspecific(g_stack_key, ts);
+}
+#endif
 
 void apep_stack_push(const char *func, const char *file, int line)
 {
-    if (stack_depth >= APEP_MAX_STACK_DEPTH)
+    apep_thread_stack_t *ts = &t_stack;
+
+    /* Once a frame is missing, everything above it is counted too, so
+       pops stay paired with pushes */
+    if (ts->overflow || ts->depth >= APEP_STACK_MAX_FRAMES)
+    {
+        ts->overflow++;
         return;
+    }
+
+    apep_stack_chunk_t *c = ts->top ? ts->top : &ts->first;
+    if (ts->top_used == APEP_MAX_STACK_DEPTH)
+    {
+        apep_stack_chunk_t *next = c->next;
+        if (!next)
+        {
+            next = (apep_stack_chunk_t *)malloc(sizeof(*next));
+            if (!next)
+            {
+                ts->overflow++;
+                return;
+            }
+            if (!ts->first.next)
+                apep_stack_watch_thread(ts);
+            next->prev = c;
+            next->next = NULL;
+            c->next = next;
+        }
+        c = next;
+        ts->top = c;
+        ts->top_used = 0;
+    }
 
-    stack[stack_depth].function = func;
-    stack[stack_depth].file = file;
-    stack[stack_depth].line = line;
-    stack_depth++;
+    apep_stack_frame_t *f = &c->frames[ts->top_used++];
+    f->function = func;
+    f->file = file;
+    f->line = line;
+    ts->depth++;
 }
 
 void apep_stack_pop(void)
 {
-    if (stack_depth > 0)
-        stack_depth--;
+    apep_thread_stack_t *ts = &t_stack;
+
+    if (ts->overflow)
+    {
+        ts->overflow--;
+        return;
+    }
+    if (ts->depth == 0)
+        return;
+
+    ts->depth--;
+    ts->top_used--;
+
+    apep_stack_chunk_t *c = ts->top ? ts->top : &ts->first;
+    if (ts->top_used == 0 && c != &ts->first)
+    {
+        /* Keep c as the spare, release anything beyond it */
+        apep_stack_free_chunks(c->next);
+        c->next = NULL;
+        ts->top = c->prev;
+        ts->top_used = APEP_MAX_STACK_DEPTH;
+    }
 }
 
-void apep_stack_print(const apep_options_t *opt)
+void apep_stack_scope_end(int *scope)
+{
+    (void)scope;
+    apep_stack_pop();
+}
+
+size_t apep_stack_depth(void)
+{
+    return t_stack.depth;
+}
+
+size_t apep_stack_overflow(void)
 {
-    FILE *out = opt && opt->out ? opt->out : stderr;
+    return t_stack.overflow;
+}
+
+void apep_stack_render(apep_rbuf_t *out)
+{
+    const apep_thread_stack_t *ts = &t_stack;
 
-    if (stack_depth == 0)
+    if (ts->depth == 0 && ts->overflow == 0)
     {
-        fprintf(out, "Stack trace: (empty)\n");
+        apep_rbuf_puts(out, "Stack trace: (empty)\n");
         return;
     }
 
-    fprintf(out, "Stack trace:\n");
-    for (int i = stack_depth - 1; i >= 0; i--)
+    apep_rbuf_puts(out, "Stack trace:\n");
+    if (ts->overflow)
+    {
+        apep_rbuf_puts(out, "  ... ");
+        apep_rbuf_uint(out, ts->overflow, 0);
+        apep_rbuf_puts(out, " innermost frames not recorded\n");
+    }
+
+    /* Innermost first */
+    const apep_stack_chunk_t *c = ts->top ? ts->top : &ts->first;
+    size_t used = ts->top_used;
+    for (size_t n = 0; n < ts->depth; n++)
     {
-        fprintf(out, "  #%d: %s() at %s:%d\n",
-                stack_depth - 1 - i,
-                stack[i].function ? stack[i].function : "???",
-                stack[i].file ? stack[i].file : "???",
-                stack[i].line);
+        if (used == 0)
+        {
+            c = c->prev;
+            used = APEP_MAX_STACK_DEPTH;
+        }
+        const apep_stack_frame_t *f = &c->frames[--used];
+
+        apep_rbuf_puts(out, "  #");
+        apep_rbuf_uint(out, n, 0);
+        apep_rbuf_puts(out, ": ");
+        apep_rbuf_puts(out, f->function ? f->function : "???");
+        apep_rbuf_puts(out, "() at ");
+        apep_rbuf_puts(out, f->file ? f->file : "???");
+        apep_rbuf_putc(out, ':');
+        apep_rbuf_int(out, f->line, 0);
+        apep_rbuf_putc(out, '\n');
     }
 }
 
+void apep_stack_print(const apep_options_t *opt)
+{
+    apep_emit_t em;
+    for (apep_emit_begin(&em, opt, APEP_ROUTE_KEY_LEVEL(APEP_LVL_DEBUG), 0); apep_emit_next(&em);)
+        apep_stack_render(&em.rb);
+}
+
 void apep_stack_clear(void)
 {
-    stack_depth = 0;
+    apep_thread_stack_t *ts = &t_stack;
+
+    /* Keep the chunks for reuse; they are freed when the thread exits */
+    ts->top = NULL;
+    ts->top_used = 0;
+    ts->depth = 0;
+    ts->overflow = 0;
 }
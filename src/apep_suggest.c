@@ -4,6 +4,54 @@
 #include <stdio.h>
 #include <string.h>
 
+static void apep_render_suggestion(
+    apep_rbuf_t *out,
+    const apep_caps_t *caps,
+    const apep_text_source_t *src,
+    const apep_suggestion_t *suggestion)
+{
+    apep_rbuf_puts(out, "\n  ");
+    apep_color_begin(out, caps, APEP_CR_LABEL);
+    apep_rbuf_puts(out, suggestion->label ? suggestion->label : "help");
+    apep_color_end(out, caps);
+    apep_rbuf_puts(out, ": ");
+
+    if (suggestion->code)
+    {
+        apep_rbuf_puts(out, "try this instead:\n");
+
+        /* Get the line from source */
+        const char *line_ptr;
+        size_t line_len;
+        if (src->get_line(src->user, suggestion->loc.line, &line_ptr, &line_len))
+        {
+            /* Show original with X mark */
+            apep_rbuf_puts(out, "      | ");
+            if (apep_text_source_is_stable(src))
+                apep_rbuf_ref(out, line_ptr, line_len);
+            else
+                apep_rbuf_append(out, line_ptr, line_len);
+            apep_rbuf_putc(out, '\n');
+
+            /* Show suggestion with checkmark */
+            apep_rbuf_puts(out, "      | ");
+            apep_color_begin(out, caps, APEP_CR_LVL_INFO);
+            apep_rbuf_puts(out, suggestion->code);
+            apep_color_end(out, caps);
+            apep_rbuf_putc(out, '\n');
+        }
+        else
+        {
+            apep_rbuf_puts(out, "      | ");
+            apep_color_begin(out, caps, APEP_CR_LVL_INFO);
+            apep_rbuf_puts(out, suggestion->code);
+            apep_color_end(out, caps);
+            apep_rbuf_putc(out, '\n');
+        }
+    }
+    apep_rbuf_putc(out, '\n');
+}
+
 void apep_print_text_diagnostic_with_suggestion(
     const apep_options_t *opt_in,
     apep_severity_t sev,
@@ -16,13 +64,6 @@ void apep_print_text_diagnostic_with_suggestion(
     size_t notes_count,
     const apep_suggestion_t *suggestion)
 {
-    /* First print the normal diagnostic */
-    apep_print_text_diagnostic(opt_in, sev, code, message, src, loc, span_len_cols, notes, notes_count);
-
-    /* Then add the suggestion */
-    if (!suggestion)
-        return;
-
     apep_options_t def;
     const apep_options_t *opt = opt_in;
     if (!opt)
@@ -30,44 +71,13 @@ void apep_print_text_diagnostic_with_suggestion(
         apep_options_default(&def);
         opt = &def;
     }
-    FILE *out = opt->out ? opt->out : stderr;
-    apep_caps_t caps = apep_detect_caps(out, opt);
-
-    fprintf(out, "\n  ");
-    apep_color_begin(out, &caps, APEP_CR_LABEL);
-    fputs(suggestion->label ? suggestion->label : "help", out);
-    apep_color_end(out, &caps);
-    fputs(": ", out);
 
-    if (suggestion->code)
+    /* The diagnostic and its suggestion leave in one write */
+    apep_emit_t em;
+    for (apep_emit_begin(&em, opt, APEP_ROUTE_KEY_SEVERITY(sev), apep_text_source_is_stable(src)); apep_emit_next(&em);)
     {
-        fputs("try this instead:\n", out);
-
-        /* Get the line from source */
-        const char *line_ptr;
-        size_t line_len;
-        if (src->get_line(src->user, suggestion->loc.line, &line_ptr, &line_len))
-        {
-            /* Show original with X mark */
-            fprintf(out, "      | ");
-            fwrite(line_ptr, 1, line_len, out);
-            fputc('\n', out);
-
-            /* Show suggestion with checkmark */
-            fprintf(out, "      | ");
-            apep_color_begin(out, &caps, APEP_CR_LVL_INFO);
-            fputs(suggestion->code, out);
-            apep_color_end(out, &caps);
-            fputc('\n', out);
-        }
-        else
-        {
-            fprintf(out, "      | ");
-            apep_color_begin(out, &caps, APEP_CR_LVL_INFO);
-            fputs(suggestion->code, out);
-            apep_color_end(out, &caps);
-            fputc('\n', out);
-        }
+        apep_render_text_caps(&em.rb, opt, &em.caps, sev, code, message, src, loc, span_len_cols, notes, notes_count);
+        if (suggestion)
+            apep_render_suggestion(&em.rb, &em.caps, src, suggestion);
     }
-    fputc('\n', out);
 }
@@ -1,7 +1,9 @@
 #include "../include/apep/apep.h"
+#include "../include/apep/apep_helpers.h"
 #include "../include/apep/apep_i18n.h"
 #include "apep_internal.h"
 
+#include <stdarg.h>
 #include <string.h>
 
 /* clamp helpers */
@@ -14,40 +16,49 @@ static int apep_clamp_int(int v, int lo, int hi)
     return v;
 }
 
-static void apep_print_notes(FILE *out, const apep_caps_t *caps, const apep_note_t *notes, size_t notes_count)
+static void apep_render_notes(apep_rbuf_t *out, const apep_caps_t *caps, const apep_note_t *notes, size_t notes_count)
 {
     for (size_t i = 0; i < notes_count; i++)
     {
         const char *k = (notes[i].kind && notes[i].kind[0]) ? notes[i].kind : _("note");
         const char *m = notes[i].message ? notes[i].message : "";
 
-        fputs("  = ", out);
+        apep_rbuf_puts(out, "  = ");
 
         apep_color_begin(out, caps, APEP_CR_LABEL);
-        fputs(k, out);
+        apep_rbuf_puts(out, k);
         apep_color_end(out, caps);
 
-        fputs(": ", out);
-        fputs(m, out);
-        fputc('\n', out);
+        apep_rbuf_puts(out, ": ");
+        apep_rbuf_puts(out, m);
+        apep_rbuf_putc(out, '\n');
     }
 }
 
-static void apep_print_gutter_line(FILE *out, int line_no, const char *bar, const char *line, size_t len)
+static void apep_render_gutter_line(apep_rbuf_t *out, int line_no, const char *bar, const char *line, size_t len, int by_ref)
 {
     /* Right-align line numbers to 4 columns (good enough for v1) */
-    fprintf(out, " %4d %s ", line_no, bar);
-    fwrite(line, 1, len, out);
-    fputc('\n', out);
+    apep_rbuf_putc(out, ' ');
+    apep_rbuf_int(out, line_no, 4);
+    apep_rbuf_putc(out, ' ');
+    apep_rbuf_puts(out, bar);
+    apep_rbuf_putc(out, ' ');
+    if (by_ref)
+        apep_rbuf_ref(out, line, len);
+    else
+        apep_rbuf_append(out, line, len);
+    apep_rbuf_putc(out, '\n');
 }
 
-static void apep_print_gutter_empty(FILE *out, const char *bar)
+static void apep_render_gutter_empty(apep_rbuf_t *out, const char *bar)
 {
-    fprintf(out, "      %s\n", bar);
+    apep_rbuf_repeat(out, ' ', 6);
+    apep_rbuf_puts(out, bar);
+    apep_rbuf_putc(out, '\n');
 }
 
-static void apep_print_caret_line(
-    FILE *out,
+static void apep_render_caret_line(
+    apep_rbuf_t *out,
     const apep_caps_t *caps,
     const char *bar,
     int col_1based,
@@ -56,31 +67,24 @@ static void apep_print_caret_line(
     /* Render: spaces then ^ or ^^^^ */
     int col = (col_1based <= 0) ? 1 : col_1based;
 
-    fprintf(out, "      %s ", bar);
+    apep_rbuf_repeat(out, ' ', 6);
+    apep_rbuf_puts(out, bar);
+    apep_rbuf_putc(out, ' ');
 
     /* spaces before caret */
-    for (int i = 1; i < col; i++)
-        fputc(' ', out);
+    apep_rbuf_repeat(out, ' ', (size_t)(col - 1));
 
     /* Color the caret for better visibility */
     apep_color_begin(out, caps, APEP_CR_CARET);
-
-    if (span_len_cols <= 1)
-    {
-        fputc('^', out);
-    }
-    else
-    {
-        for (int i = 0; i < span_len_cols; i++)
-            fputc('^', out);
-    }
-
+    apep_rbuf_repeat(out, '^', span_len_cols <= 1 ? 1 : (size_t)span_len_cols);
     apep_color_end(out, caps);
-    fputc('\n', out);
+    apep_rbuf_putc(out, '\n');
 }
 
-void apep_print_text_diagnostic(
-    const apep_options_t *opt_in,
+void apep_render_text_caps(
+    apep_rbuf_t *out,
+    const apep_options_t *opt,
+    const apep_caps_t *caps,
     apep_severity_t sev,
     const char *code,
     const char *message,
@@ -90,57 +94,53 @@ void apep_print_text_diagnostic(
     const apep_note_t *notes,
     size_t notes_count)
 {
-    apep_options_t def;
-    const apep_options_t *opt = opt_in;
-    if (!opt)
-    {
-        apep_options_default(&def);
-        opt = &def;
-    }
-
-    FILE *out = opt->out ? opt->out : stderr;
-
-    /* Detect output capabilities and choose ASCII/Unicode framing */
-    apep_caps_t caps = apep_detect_caps(out, opt);
-
-    const char *bar = caps.unicode ? "│" : "|";
-    const char *arrow = caps.unicode ? "→" : "->";
+    /* Choose ASCII/Unicode framing for the destination */
+    const char *bar = caps->unicode ? "│" : "|";
+    const char *arrow = caps->unicode ? "→" : "->";
 
     /* Header line */
     apep_color_role_t role =
         (sev == APEP_SEV_ERROR) ? APEP_CR_SEV_ERROR : (sev == APEP_SEV_WARN) ? APEP_CR_SEV_WARN
                                                                              : APEP_CR_SEV_NOTE;
 
-    apep_color_begin(out, &caps, role);
-    fputs(apep_severity_name(sev), out);
-    apep_color_end(out, &caps);
+    apep_color_begin(out, caps, role);
+    apep_rbuf_puts(out, apep_severity_name(sev));
+    apep_color_end(out, caps);
 
     if (code && code[0])
     {
-        fputc('[', out);
-        apep_color_begin(out, &caps, APEP_CR_LABEL);
-        fputs(code, out);
-        apep_color_end(out, &caps);
-        fputc(']', out);
+        apep_rbuf_putc(out, '[');
+        apep_color_begin(out, caps, APEP_CR_LABEL);
+        apep_rbuf_puts(out, code);
+        apep_color_end(out, caps);
+        apep_rbuf_putc(out, ']');
     }
 
-    fputs(": ", out);
-    fputs(message ? message : "", out);
-    fputc('\n', out);
+    apep_rbuf_puts(out, ": ");
+    apep_rbuf_puts(out, message ? message : "");
+    apep_rbuf_putc(out, '\n');
 
     /* Location line */
     const char *name = (src && src->name && src->name[0]) ? src->name : _("<input>");
     int line = (loc.line <= 0) ? 1 : loc.line;
     int col = (loc.col <= 0) ? 1 : loc.col;
 
-    apep_color_begin(out, &caps, APEP_CR_DIM);
-    fprintf(out, "  %s %s:%d:%d\n", arrow, name, line, col);
-    apep_color_end(out, &caps);
+    apep_color_begin(out, caps, APEP_CR_DIM);
+    apep_rbuf_puts(out, "  ");
+    apep_rbuf_puts(out, arrow);
+    apep_rbuf_putc(out, ' ');
+    apep_rbuf_puts(out, name);
+    apep_rbuf_putc(out, ':');
+    apep_rbuf_int(out, line, 0);
+    apep_rbuf_putc(out, ':');
+    apep_rbuf_int(out, col, 0);
+    apep_rbuf_putc(out, '\n');
+    apep_color_end(out, caps);
 
     /* If we have no source, only print notes and return */
     if (!src || !src->get_line)
     {
-        apep_print_notes(out, &caps, notes, notes_count);
+        apep_render_notes(out, caps, notes, notes_count);
 
         return;
     }
@@ -151,13 +151,16 @@ void apep_print_text_diagnostic(
     if (ctx > 10)
         ctx = 10; /* keep v1 sane */
 
+    /* Lines of built-in sources outlive the render and can be referenced */
+    int by_ref = apep_text_source_is_stable(src);
+
     int from = line - ctx;
     int to = line + ctx;
     if (from < 1)
         from = 1;
 
     /* Print separator gutter line */
-    apep_print_gutter_empty(out, bar);
+    apep_render_gutter_empty(out, bar);
 
     /* Print context lines that exist */
     for (int ln = from; ln <= to; ln++)
@@ -182,7 +185,7 @@ void apep_print_text_diagnostic(
             col = apep_clamp_int(col, 1, (max_col < 1 ? 1 : max_col));
         }
 
-        apep_print_gutter_line(out, ln, bar, line_ptr, line_len);
+        apep_render_gutter_line(out, ln, bar, line_ptr, line_len, by_ref);
 
         if (ln == line)
         {
@@ -192,22 +195,77 @@ void apep_print_text_diagnostic(
             if (span > 200)
                 span = 200; /* avoid silly output */
 
-            apep_print_caret_line(out, &caps, bar, col, span);
+            apep_render_caret_line(out, caps, bar, col, span);
         }
     }
 
     /* Notes */
-    apep_print_notes(out, &caps, notes, notes_count);
+    apep_render_notes(out, caps, notes, notes_count);
 }
-void apep_print_message(
-    const apep_options_t *opt,
-    apep_level_t lvl,
-    const char *tag,
-    const char *message)
+
+void apep_render_text_diagnostic(
+    apep_rbuf_t *out,
+    const apep_options_t *opt_in,
+    apep_severity_t sev,
+    const char *code,
+    const char *message,
+    const apep_text_source_t *src,
+    apep_loc_t loc,
+    int span_len_cols,
+    const apep_note_t *notes,
+    size_t notes_count)
+{
+    apep_options_t def;
+    const apep_options_t *opt = opt_in;
+    if (!opt)
+    {
+        apep_options_default(&def);
+        opt = &def;
+    }
+
+    apep_caps_t caps = apep_detect_caps(opt->out ? opt->out : stderr, opt);
+    apep_render_text_caps(out, opt, &caps, sev, code, message, src, loc, span_len_cols, notes, notes_count);
+}
+
+void apep_print_text_diagnostic(
+    const apep_options_t *opt_in,
+    apep_severity_t sev,
+    const char *code,
+    const char *message,
+    const apep_text_source_t *src,
+    apep_loc_t loc,
+    int span_len_cols,
+    const apep_note_t *notes,
+    size_t notes_count)
 {
-    FILE *out = (opt && opt->out) ? opt->out : stderr;
+    apep_options_t def;
+    const apep_options_t *opt = opt_in;
+    if (!opt)
+    {
+        apep_options_default(&def);
+        opt = &def;
+    }
 
-    apep_caps_t caps = apep_detect_caps(out, opt);
+    apep_emit_t em;
+    for (apep_emit_begin(&em, opt, APEP_ROUTE_KEY_SEVERITY(sev), apep_text_source_is_stable(src)); apep_emit_next(&em);)
+        apep_render_text_caps(&em.rb, opt, &em.caps, sev, code, message, src, loc, span_len_cols, notes, notes_count);
+}
+
+/* "[stamp ]level[tag]: " */
+void apep_render_message_head(
+    apep_rbuf_t *out,
+    const apep_caps_t *caps,
+    const apep_stamp_t *stamp,
+    apep_level_t lvl,
+    const char *tag)
+{
+    if (stamp)
+    {
+        apep_color_begin(out, caps, APEP_CR_DIM);
+        apep_rbuf_append(out, stamp->text, stamp->len);
+        apep_color_end(out, caps);
+        apep_rbuf_putc(out, ' ');
+    }
 
     /* Map level -> color role */
     apep_color_role_t role = APEP_CR_LVL_INFO;
@@ -237,20 +295,211 @@ void apep_print_message(
     }
 
     /* Header: level[tag]: */
-    apep_color_begin(out, &caps, role);
-    fputs(apep_level_name(lvl), out);
-    apep_color_end(out, &caps);
+    apep_color_begin(out, caps, role);
+    apep_rbuf_puts(out, apep_level_name(lvl));
+    apep_color_end(out, caps);
 
     if (tag && tag[0])
     {
-        fputc('[', out);
-        apep_color_begin(out, &caps, APEP_CR_LABEL);
-        fputs(tag, out);
-        apep_color_end(out, &caps);
-        fputc(']', out);
+        apep_rbuf_putc(out, '[');
+        apep_color_begin(out, caps, APEP_CR_LABEL);
+        apep_rbuf_puts(out, tag);
+        apep_color_end(out, caps);
+        apep_rbuf_putc(out, ']');
+    }
+
+    apep_rbuf_puts(out, ": ");
+}
+
+void apep_render_message(
+    apep_rbuf_t *out,
+    const apep_options_t *opt,
+    apep_level_t lvl,
+    const char *tag,
+    const char *message)
+{
+    apep_caps_t caps = apep_detect_caps((opt && opt->out) ? opt->out : stderr, opt);
+    apep_stamp_t st;
+    const apep_stamp_t *stamp = apep_stamp_now(&st, opt);
+    apep_render_record(out, &caps, opt ? opt->format : APEP_FORMAT_PRETTY, stamp, lvl, tag, message, NULL, 0);
+}
+
+static void apep_emit_message_stamped(
+    const apep_options_t *opt,
+    const apep_stamp_t *stamp,
+    apep_level_t lvl,
+    const char *tag,
+    const char *message,
+    unsigned long long repeated,
+    double seconds)
+{
+    char stack[APEP_RBUF_STACK];
+    apep_rbuf_t text;
+    apep_rbuf_init(&text, stack, sizeof(stack));
+
+    apep_rbuf_puts(&text, message ? message : "");
+    if (repeated)
+    {
+        apep_rbuf_puts(&text, " (");
+        apep_rbuf_printf(&text, _("repeated %lu times in %.1f s"), (unsigned long)repeated, seconds);
+        apep_rbuf_putc(&text, ')');
+    }
+
+    apep_emit_t em;
+    for (apep_emit_begin(&em, opt, APEP_ROUTE_KEY_LEVEL(lvl), 0); apep_emit_next(&em);)
+        apep_render_record(&em.rb, &em.caps, em.format, stamp, lvl, tag, apep_rbuf_cstr(&text), NULL, 0);
+
+    apep_rbuf_free(&text);
+}
+
+void apep_emit_message_repeated(
+    const apep_options_t *opt,
+    apep_level_t lvl,
+    const char *tag,
+    const char *message,
+    unsigned long long repeated,
+    double seconds)
+{
+    apep_stamp_t st;
+    apep_emit_message_stamped(opt, apep_stamp_now(&st, opt), lvl, tag, message, repeated, seconds);
+}
+
+static void apep_print_message_stamped(
+    const apep_options_t *opt,
+    const apep_stamp_t *stamp,
+    apep_level_t lvl,
+    const char *tag,
+    const char *key,
+    const char *message)
+{
+    unsigned long long repeated = 0;
+    double seconds = 0.0;
+    if (opt && opt->limiter &&
+        !apep_limiter_admit(opt->limiter, lvl, tag, key, message, &repeated, &seconds))
+        return;
+
+    if (repeated)
+    {
+        apep_emit_message_stamped(opt, stamp, lvl, tag, message, repeated, seconds);
+        return;
+    }
+
+    apep_emit_t em;
+    for (apep_emit_begin(&em, opt, APEP_ROUTE_KEY_LEVEL(lvl), 0); apep_emit_next(&em);)
+        apep_render_record(&em.rb, &em.caps, em.format, stamp, lvl, tag, message, NULL, 0);
+}
+
+void apep_print_message_keyed(
+    const apep_options_t *opt,
+    apep_level_t lvl,
+    const char *tag,
+    const char *key,
+    const char *message)
+{
+    if ((int)lvl < APEP_MIN_LEVEL_NOW())
+        return;
+
+    apep_stamp_t st;
+    apep_print_message_stamped(opt, apep_stamp_now(&st, opt), lvl, tag, key, message);
+}
+
+void apep_print_message_at(
+    const apep_options_t *opt,
+    apep_level_t lvl,
+    const char *tag,
+    const char *key,
+    const char *message,
+    long long real_ms)
+{
+    if ((int)lvl < APEP_MIN_LEVEL_NOW())
+        return;
+
+    apep_stamp_t st;
+    const apep_stamp_t *stamp = opt ? apep_stamp_at(&st, opt->timestamp, real_ms) : NULL;
+    apep_print_message_stamped(opt, stamp, lvl, tag, key, message);
+}
+
+void apep_print_message(
+    const apep_options_t *opt,
+    apep_level_t lvl,
+    const char *tag,
+    const char *message)
+{
+    apep_print_message_keyed(opt, lvl, tag, message, message);
+}
+
+void apep_print_message_vfmt(
+    const apep_options_t *opt,
+    apep_level_t lvl,
+    const char *tag,
+    const char *fmt,
+    va_list args)
+{
+    if ((int)lvl < APEP_MIN_LEVEL_NOW())
+        return;
+
+    if (!fmt)
+        fmt = "";
+
+    /* Decide on the format string first so suppressed repeats are never
+       formatted; the limiter formats its own copy of a message it has not
+       seen before */
+    if (opt && opt->limiter)
+    {
+        unsigned long long repeated = 0;
+        double seconds = 0.0;
+        if (!apep_limiter_admit_vfmt(opt->limiter, lvl, tag, fmt, args, &repeated, &seconds))
+            return;
+
+        if (repeated)
+        {
+            char stack[APEP_RBUF_STACK];
+            apep_rbuf_t text;
+            apep_rbuf_init(&text, stack, sizeof(stack));
+            apep_rbuf_vprintf(&text, fmt, args);
+            apep_emit_message_repeated(opt, lvl, tag, apep_rbuf_cstr(&text), repeated, seconds);
+            apep_rbuf_free(&text);
+            return;
+        }
+    }
+
+    /* Pretty renderings format in place; logfmt and JSON need the text
+       first to quote it, formatted once for all of them */
+    char stack[APEP_RBUF_STACK];
+    apep_rbuf_t text;
+    int have_text = 0;
+
+    apep_stamp_t st;
+    const apep_stamp_t *stamp = apep_stamp_now(&st, opt);
+
+    apep_emit_t em;
+    for (apep_emit_begin(&em, opt, APEP_ROUTE_KEY_LEVEL(lvl), 0); apep_emit_next(&em);)
+    {
+        va_list copy;
+        if (em.format != APEP_FORMAT_PRETTY)
+        {
+            if (!have_text)
+            {
+                apep_rbuf_init(&text, stack, sizeof(stack));
+                va_copy(copy, args);
+                apep_rbuf_vprintf(&text, fmt, copy);
+                va_end(copy);
+                have_text = 1;
+            }
+            apep_render_record(&em.rb, &em.caps, em.format, stamp, lvl, tag, apep_rbuf_cstr(&text), NULL, 0);
+            continue;
+        }
+
+        apep_render_message_head(&em.rb, &em.caps, stamp, lvl, tag);
+
+        /* Each rendering consumes its own copy of the arguments */
+        va_copy(copy, args);
+        apep_rbuf_vprintf(&em.rb, fmt, copy);
+        va_end(copy);
+
+        apep_rbuf_putc(&em.rb, '\n');
     }
 
-    fputs(": ", out);
-    fputs(message ? message : "", out);
-    fputc('\n', out);
+    if (have_text)
+        apep_rbuf_free(&text);
 }
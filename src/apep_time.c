@@ -0,0 +1,266 @@
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* gmtime_r, localtime_r, CLOCK_*_COARSE */
+#endif
+
+#include "apep_internal.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/* ----------------------------
+Clocks
+The coarse clocks are read from the vDSO without a syscall; their
+resolution is the scheduler tick (1-4 ms on Linux), which is what a
+millisecond timestamp needs.
+---------------------------- */
+
+long long apep_clock_real_ms(void)
+{
+#ifdef _WIN32
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    unsigned long long t = ((unsigned long long)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return (long long)((t - 116444736000000000ull) / 10000ull);
+#else
+    struct timespec ts;
+#ifdef CLOCK_REALTIME_COARSE
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+static long long apep_clock_mono_ms(void)
+{
+#ifdef _WIN32
+    return (long long)GetTickCount64();
+#else
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+/* Monotonic timestamps count from the first one taken (stored + 1 so 0
+   means unset) */
+static volatile unsigned long long g_mono_base;
+
+static long long apep_mono_offset_ms(long long mono_ms)
+{
+    unsigned long long base = APEP_LOAD_ACQUIRE(&g_mono_base);
+    if (base == 0)
+    {
+        unsigned long long expected = 0;
+        unsigned long long mine = (unsigned long long)mono_ms + 1;
+        while (!APEP_CAS64(&g_mono_base, &expected, mine) && expected == 0)
+            ;
+        base = expected ? expected : mine;
+    }
+    long long offset = mono_ms - (long long)(base - 1);
+    return offset > 0 ? offset : 0;
+}
+
+/* ----------------------------
+Wall-clock formatting
+Each thread keeps the "YYYY-MM-DDTHH:MM:SS" text and zone suffix of the
+last second it formatted per mode, so within a second only the
+milliseconds are written.
+---------------------------- */
+
+typedef struct apep_stamp_cache
+{
+    long long sec; /* second the text is for, + 1 (0 = empty) */
+    char prefix[24];
+    char zone[8]; /* "Z" or "+hh:mm" */
+    size_t prefix_len;
+    size_t zone_len;
+} apep_stamp_cache_t;
+
+static APEP_THREAD_LOCAL apep_stamp_cache_t t_stamp_cache[2]; /* UTC, local */
+
+/* Days since 1970-01-01 of a proleptic Gregorian date */
+static long long apep_days_from_civil(long long y, int m, int d)
+{
+    y -= m <= 2;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    long long yoe = y - era * 400;
+    long long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static long long apep_tm_seconds(const struct tm *tm)
+{
+    return apep_days_from_civil((long long)tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday) * 86400 +
+           tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+}
+
+static void apep_stamp_cache_fill(apep_stamp_cache_t *c, long long sec, int local)
+{
+    time_t t = (time_t)sec;
+    struct tm tm;
+    int ok;
+#ifdef _WIN32
+    ok = (local ? localtime_s(&tm, &t) : gmtime_s(&tm, &t)) == 0;
+#else
+    ok = (local ? localtime_r(&t, &tm) : gmtime_r(&t, &tm)) != NULL;
+#endif
+    if (!ok)
+        memset(&tm, 0, sizeof(tm));
+
+    /* Times outside years 0000-9999 (real_ms is caller-supplied through
+       apep_print_message_at) are pinned to the nearest end, so the text
+       stays 19 bytes and the whole stamp within APEP_STAMP_MAX */
+    struct tm shown = tm;
+    if (tm.tm_year + 1900 > 9999)
+    {
+        memset(&shown, 0, sizeof(shown));
+        shown.tm_year = 9999 - 1900;
+        shown.tm_mon = 11;
+        shown.tm_mday = 31;
+        shown.tm_hour = 23;
+        shown.tm_min = 59;
+        shown.tm_sec = 59;
+    }
+    else if (tm.tm_year + 1900 < 0)
+    {
+        memset(&shown, 0, sizeof(shown));
+        shown.tm_year = -1900;
+        shown.tm_mday = 1;
+    }
+
+    int n = snprintf(c->prefix, sizeof(c->prefix), "%04d-%02d-%02dT%02d:%02d:%02d",
+                     shown.tm_year + 1900, shown.tm_mon + 1, shown.tm_mday, shown.tm_hour, shown.tm_min, shown.tm_sec);
+    c->prefix_len = (n > 0 && (size_t)n < sizeof(c->prefix)) ? (size_t)n : 0;
+
+    if (!local)
+    {
+        memcpy(c->zone, "Z", 2);
+        c->zone_len = 1;
+    }
+    else
+    {
+        /* UTC offset as the difference of the local and UTC readings */
+        long long offset = ok ? (apep_tm_seconds(&tm) - sec) / 60 : 0;
+        char sign = offset < 0 ? '-' : '+';
+        if (offset < 0)
+            offset = -offset;
+        n = snprintf(c->zone, sizeof(c->zone), "%c%02d:%02d", sign, (int)(offset / 60 % 100), (int)(offset % 60));
+        c->zone_len = (n > 0 && (size_t)n < sizeof(c->zone)) ? (size_t)n : 0;
+    }
+    c->sec = sec + 1;
+}
+
+static size_t apep_stamp_wall(char *buf, long long real_ms, int local)
+{
+    long long sec = real_ms >= 0 ? real_ms / 1000 : (real_ms - 999) / 1000;
+    int ms = (int)(real_ms - sec * 1000);
+
+    apep_stamp_cache_t *c = &t_stamp_cache[local];
+    if (c->sec != sec + 1)
+        apep_stamp_cache_fill(c, sec, local);
+
+    size_t len = c->prefix_len;
+    memcpy(buf, c->prefix, len);
+    buf[len++] = '.';
+    buf[len++] = (char)('0' + ms / 100);
+    buf[len++] = (char)('0' + ms / 10 % 10);
+    buf[len++] = (char)('0' + ms % 10);
+    memcpy(buf + len, c->zone, c->zone_len);
+    len += c->zone_len;
+    buf[len] = '\0';
+    return len;
+}
+
+/* "seconds.mmm" */
+static size_t apep_stamp_offset(char *buf, long long ms)
+{
+    char digits[24];
+    size_t n = 0;
+    long long sec = ms / 1000;
+    do
+    {
+        digits[n++] = (char)('0' + sec % 10);
+        sec /= 10;
+    } while (sec);
+
+    size_t len = 0;
+    while (n)
+        buf[len++] = digits[--n];
+    buf[len++] = '.';
+    buf[len++] = (char)('0' + ms / 100 % 10);
+    buf[len++] = (char)('0' + ms / 10 % 10);
+    buf[len++] = (char)('0' + ms % 10);
+    buf[len] = '\0';
+    return len;
+}
+
+const apep_stamp_t *apep_stamp_at(apep_stamp_t *st, apep_timestamp_mode_t mode, long long real_ms)
+{
+    st->mode = mode;
+    switch (mode)
+    {
+    case APEP_TIMESTAMP_UTC:
+        st->len = apep_stamp_wall(st->text, real_ms, 0);
+        return st;
+    case APEP_TIMESTAMP_LOCAL:
+        st->len = apep_stamp_wall(st->text, real_ms, 1);
+        return st;
+    case APEP_TIMESTAMP_MONOTONIC:
+    {
+        /* Both clocks are read to place real_ms on the monotonic scale */
+        long long mono = apep_clock_mono_ms() - (apep_clock_real_ms() - real_ms);
+        st->len = apep_stamp_offset(st->text, apep_mono_offset_ms(mono));
+        return st;
+    }
+    case APEP_TIMESTAMP_NONE:
+    default:
+        st->len = 0;
+        st->text[0] = '\0';
+        return NULL;
+    }
+}
+
+const apep_stamp_t *apep_stamp_now(apep_stamp_t *st, const apep_options_t *opt)
+{
+    apep_timestamp_mode_t mode = opt ? opt->timestamp : APEP_TIMESTAMP_NONE;
+    if (mode == APEP_TIMESTAMP_NONE)
+        return NULL;
+
+    if (mode == APEP_TIMESTAMP_MONOTONIC)
+    {
+        st->mode = mode;
+        st->len = apep_stamp_offset(st->text, apep_mono_offset_ms(apep_clock_mono_ms()));
+        return st;
+    }
+    return apep_stamp_at(st, mode, apep_clock_real_ms());
+}
+
+size_t apep_format_timestamp(char *buf, size_t size, apep_timestamp_mode_t mode)
+{
+    if (!buf || size == 0)
+        return 0;
+
+    apep_options_t opt;
+    apep_options_default(&opt);
+    opt.timestamp = mode;
+
+    apep_stamp_t st;
+    size_t len = apep_stamp_now(&st, &opt) ? st.len : 0;
+    if (len >= size)
+        len = size - 1;
+    memcpy(buf, st.text, len);
+    buf[len] = '\0';
+    return len;
+}
@@ -1,5 +1,6 @@
 #include "../include/apep/apep.h"
 #include "../include/apep/apep_i18n.h"
+#include "apep_internal.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -40,12 +41,23 @@ void apep_options_default(apep_options_t *opt)
     /* hard overrides (default: off) */
     opt->force_no_color = 0;
     opt->force_ascii = 0;
+
+    opt->zero_copy = 0;
+
+    opt->router = NULL;
+    opt->limiter = NULL;
+
+    opt->format = APEP_FORMAT_PRETTY;
+    opt->timestamp = APEP_TIMESTAMP_NONE;
 }
 
 /* ----------------------------
 Text source from string
 ---------------------------- */
 
+/* Bytes measured (strnlen) and scanned per step */
+#define APEP_STRING_SCAN_CHUNK 4096
+
 static int apep_get_line_from_string(
     void *user,
     int line_no_1based,
@@ -57,25 +69,24 @@ static int apep_get_line_from_string(
     if (line_no_1based <= 0)
         return 0;
 
-    const char *text = (const char *)user;
-
-    int current = 1;
-    const char *p = text;
-    const char *line_start = p;
-
-    while (*p && current < line_no_1based)
+    /* The text is walked in chunks bounded by the NUL, so a lookup reads
+       no further than the end of the requested line */
+    const char *line_start = (const char *)user;
+    size_t need = (size_t)line_no_1based - 1;
+    while (need)
     {
-        if (*p == '\n')
+        size_t len = strnlen(line_start, APEP_STRING_SCAN_CHUNK);
+        size_t found = 0;
+        const char *nl = apep_scan_nth(line_start, len, '\n', need, &found);
+        if (nl)
         {
-            current++;
-            line_start = p + 1;
+            line_start = nl + 1;
+            break;
         }
-        p++;
-    }
-
-    if (current != line_no_1based)
-    {
-        return 0;
+        if (len < APEP_STRING_SCAN_CHUNK)
+            return 0;
+        need -= found;
+        line_start += len;
     }
 
     /* If we reached the end of string and line_start points to null terminator,
@@ -87,8 +98,17 @@ static int apep_get_line_from_string(
 
     /* find end of line (exclude '\n' and optional '\r') */
     const char *end = line_start;
-    while (*end && *end != '\n')
-        end++;
+    for (;;)
+    {
+        size_t len = strnlen(end, APEP_STRING_SCAN_CHUNK);
+        const char *nl = apep_scan_byte(end, len, '\n');
+        if (nl || len < APEP_STRING_SCAN_CHUNK)
+        {
+            end = nl ? nl : end + len;
+            break;
+        }
+        end += len;
+    }
 
     /* trim CR if present */
     const char *trimmed_end = end;
@@ -128,4 +148,9 @@ const char *apep_level_name(apep_level_t lvl)
     default:
         return _("Information");
     }
-}
\ No newline at end of file
+}
+
+int apep_text_source_is_plain_string(const apep_text_source_t *src)
+{
+    return src && src->get_line == apep_get_line_from_string;
+}
@@ -0,0 +1,199 @@
+/**
+ * Async sink tests
+ *
+ * - fork() while the writer thread is blocked inside its target: the
+ *   child must be able to write and flush through the same sinks
+ *   without deadlock.
+ * - apep_sink_flush() while another thread keeps evicting under
+ *   DROP_OLDEST must not return before the record the writer was in the
+ *   middle of has been written.
+ *
+ * Exits 0 on success. A hang is reported by alarm() as a failure.
+ */
+
+#include "apep/apep_sink.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FORKS 100
+#define FLUSHES 5
+
+static int failures = 0;
+
+#define CHECK(cond, msg)                                  \
+    do                                                    \
+    {                                                     \
+        if (!(cond))                                      \
+        {                                                 \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, \
+                    __LINE__, msg);                       \
+            failures++;                                   \
+        }                                                 \
+    } while (0)
+
+static void pause_us(long us)
+{
+    struct timespec ts = {us / 1000000L, (us % 1000000L) * 1000L};
+    nanosleep(&ts, NULL);
+}
+
+/* ----------------------------
+fork() while writing
+---------------------------- */
+
+static char big_record[4096];
+
+static void flood(apep_sink_t *sink, int n)
+{
+    for (int i = 0; i < n; i++)
+        apep_sink_write(sink, big_record, sizeof(big_record));
+}
+
+/* Drains a pipe slowly so writers block inside writev/fwrite */
+static void *slow_reader(void *arg)
+{
+    int fd = *(int *)arg;
+    char buf[8192];
+    while (read(fd, buf, sizeof(buf)) > 0)
+        pause_us(50);
+    return NULL;
+}
+
+static void test_fork_while_writing(void)
+{
+    int p1[2], p2[2];
+    CHECK(pipe(p1) == 0 && pipe(p2) == 0, "pipe");
+    memset(big_record, 'x', sizeof(big_record));
+    big_record[sizeof(big_record) - 1] = '\n';
+
+    pthread_t r1, r2;
+    pthread_create(&r1, NULL, slow_reader, &p1[0]);
+    pthread_create(&r2, NULL, slow_reader, &p2[0]);
+
+    /* One target per lock kind: fd sink spin lock, stdio stream lock */
+    FILE *f = fdopen(p2[1], "w");
+    apep_sink_t *fd_target = apep_sink_fd_create(p1[1], 1);
+    apep_sink_t *file_target = apep_sink_file_create(f, 1);
+    apep_sink_t *a = apep_sink_async_create(fd_target, NULL);
+    apep_sink_t *b = apep_sink_async_create(file_target, NULL);
+    CHECK(f && a && b, "create sinks");
+    if (!f || !a || !b)
+        return;
+
+    for (int i = 0; i < FORKS && !failures; i++)
+    {
+        flood(a, 64);
+        flood(b, 64);
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            alarm(10);
+            flood(a, 4);
+            flood(b, 4);
+            int rc = apep_sink_flush(a) | apep_sink_flush(b);
+            _exit(rc == 0 ? 0 : 1);
+        }
+        CHECK(pid > 0, "fork");
+        if (pid < 0)
+            break;
+
+        int status = 0;
+        waitpid(pid, &status, 0);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+              "child deadlocked or failed writing through inherited sinks");
+    }
+
+    apep_sink_destroy(a);
+    apep_sink_destroy(b);
+    apep_sink_destroy(fd_target);
+    apep_sink_destroy(file_target);
+    pthread_join(r1, NULL);
+    pthread_join(r2, NULL);
+    close(p1[0]);
+    close(p2[0]);
+}
+
+/* ----------------------------
+Flush under DROP_OLDEST eviction
+A slow record is written while a second thread queues a burst of fast
+records that evicts everything behind it, pushing the queue past the
+flush target.
+---------------------------- */
+
+static volatile unsigned long started;  /* slow record the target is in */
+static volatile unsigned long finished; /* last slow record completed */
+
+static int slow_write(void *user, const char *data, size_t len)
+{
+    (void)user;
+    (void)len;
+    if (data[0] != 'S')
+        return 0;
+    unsigned long id = strtoul(data + 1, NULL, 10);
+    __atomic_store_n(&started, id, __ATOMIC_SEQ_CST);
+    pause_us(150000); /* longer than the flush waiter's poll period */
+    __atomic_store_n(&finished, id, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+static void *burst(void *arg)
+{
+    apep_sink_t *sink = (apep_sink_t *)arg;
+    pause_us(10000); /* let the flush start waiting */
+    for (int i = 0; i < 64; i++)
+        apep_sink_write(sink, "F\n", 2);
+    return NULL;
+}
+
+static void test_flush_under_eviction(void)
+{
+    apep_sink_t *target = apep_sink_callback_create(slow_write, NULL);
+    apep_async_config_t cfg;
+    apep_async_config_default(&cfg);
+    cfg.capacity = 8;
+    cfg.overflow = APEP_OVERFLOW_DROP_OLDEST;
+    apep_sink_t *as = apep_sink_async_create(target, &cfg);
+    CHECK(target && as, "create async sink");
+    if (!target || !as)
+        return;
+
+    for (unsigned long id = 1; id <= FLUSHES; id++)
+    {
+        char rec[32];
+        int n = snprintf(rec, sizeof(rec), "S%lu\n", id);
+        apep_sink_write(as, rec, (size_t)n);
+        while (__atomic_load_n(&started, __ATOMIC_SEQ_CST) != id)
+            pause_us(100);
+
+        pthread_t t;
+        pthread_create(&t, NULL, burst, as);
+        apep_sink_flush(as);
+        CHECK(__atomic_load_n(&finished, __ATOMIC_SEQ_CST) == id,
+              "flush returned while an earlier record was being written");
+        pthread_join(t, NULL);
+        apep_sink_flush(as);
+    }
+    CHECK(apep_sink_async_dropped(as) > 0, "no records were evicted");
+
+    apep_sink_destroy(as);
+    apep_sink_destroy(target);
+}
+
+int main(void)
+{
+    alarm(120);
+    test_fork_while_writing();
+    test_flush_under_eviction();
+    if (failures)
+        return 1;
+    printf("async tests passed\n");
+    return 0;
+}
@@ -0,0 +1,56 @@
+/**
+ * apep_decode - print a binary log written by apep_binlog
+ *
+ * Formats every record of a file produced with apep_binlog_config_t.file
+ * and prints it through the usual message path (colors follow the
+ * terminal, as for any apep output).
+ *
+ * Usage: apep_decode [-t] file
+ *        -t  prefix each message with seconds since logging started
+ *
+ * The file must come from a build with the same byte order and type
+ * sizes as the decoder.
+ */
+
+#include "../include/apep/apep.h"
+#include "../include/apep/apep_binlog.h"
+
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char **argv)
+{
+    unsigned flags = 0;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-t") == 0)
+            flags |= APEP_BINLOG_REPLAY_TIME;
+        else if (!path)
+            path = argv[i];
+        else
+            path = NULL, i = argc;
+    }
+    if (!path)
+    {
+        fprintf(stderr, "usage: %s [-t] file\n", argv[0]);
+        return 2;
+    }
+
+    FILE *in = fopen(path, "rb");
+    if (!in)
+    {
+        perror(path);
+        return 1;
+    }
+
+    long n = apep_binlog_replay(in, NULL, flags);
+    fclose(in);
+    if (n < 0)
+    {
+        fprintf(stderr, "%s: not a binary log from a compatible writer\n", path);
+        return 1;
+    }
+    return 0;
+}